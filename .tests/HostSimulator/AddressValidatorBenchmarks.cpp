@@ -0,0 +1,129 @@
+#include <ProfilerAddressRegions.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+	Measures the cost of classifying one stack slot by the sampling profiler (see SYSPROGS_PROFILER_ADDRESS_REGIONS) with different amounts
+	of code regions. The slots hold a mix of code addresses, addresses just outside the regions, stack addresses and small integers, roughly
+	resembling a real stack. The linear scan is shown for comparison.
+
+	The cycle counts are measured on the development machine, so they only give a rough estimate of the on-target cost.
+*/
+
+enum
+{
+	kSlotCount = 1 << 20,
+	kIterations = 16,
+	kRegionStride = 0x100000,
+	kRegionSize = 0x40000,
+};
+
+static const uintptr_t kFirstRegion = 0x08000000, kStackStart = 0x20000000, kStackEnd = 0x20020000;
+
+static unsigned long long ReadCycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static const void *MakeAddress(uintptr_t value)
+{
+	return (const void *)value;
+}
+
+static int FindRegionLinearly(const ProfilerAddressRegion *pRegions, unsigned count, const void *pAddr)
+{
+	for (unsigned i = 0; i < count; i++)
+		if (pAddr >= pRegions[i].Start && pAddr < pRegions[i].End)
+			return 1;
+	return 0;
+}
+
+//Mirrors GetNextStackEntry() from SamplingProfiler.cpp: a slot is reported if it looks like a saved FP or a code address.
+template <class _Lookup> static void RunBenchmark(const char *pName, const std::vector<const void *> &slots, unsigned regionCount, _Lookup lookup)
+{
+	const void *pStackEnd = MakeAddress(kStackEnd);
+	unsigned reported = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long startCycles = ReadCycleCounter();
+	for (int iteration = 0; iteration < kIterations; iteration++)
+	{
+		const void *pSlotAddress = MakeAddress(kStackStart);
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			const void *value = slots[i];
+			if (value > pSlotAddress && value < pStackEnd)
+				reported++;
+			else if (lookup(value))
+				reported++;
+		}
+	}
+	unsigned long long cycles = ReadCycleCounter() - startCycles;
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	double total = (double)slots.size() * kIterations;
+	printf("%-16s %2u regions: %6.2f ns/slot %6.2f cycles/slot (%u%% reported)\n", pName, regionCount, ns / total, cycles / total, (unsigned)(reported * 100.0 / total));
+}
+
+int main()
+{
+	for (unsigned regionCount = 1; regionCount <= 32; regionCount *= 2)
+	{
+		std::vector<ProfilerAddressRegion> regions(regionCount);
+		for (unsigned i = 0; i < regionCount; i++)
+		{
+			regions[i].Start = MakeAddress(kFirstRegion + i * kRegionStride);
+			regions[i].End = MakeAddress(kFirstRegion + i * kRegionStride + kRegionSize);
+		}
+
+		srand(regionCount);
+		std::vector<const void *> slots(kSlotCount);
+		for (size_t i = 0; i < slots.size(); i++)
+		{
+			uintptr_t region = kFirstRegion + (rand() % regionCount) * kRegionStride;
+			switch (rand() % 4)
+			{
+			case 0: //Return address
+				slots[i] = MakeAddress((region + rand() % kRegionSize) | 1);
+				break;
+			case 1: //Pointer to constant data following the code
+				slots[i] = MakeAddress(region + kRegionSize + rand() % (kRegionStride - kRegionSize));
+				break;
+			case 2: //Pointer to a variable
+				slots[i] = MakeAddress(kStackStart + (rand() % (kStackEnd - kStackStart)));
+				break;
+			default:
+				slots[i] = MakeAddress(rand() % 1000);
+				break;
+			}
+		}
+
+		const ProfilerAddressRegion *pRegions = regions.data();
+		if (regionCount == 1)
+		{
+			RunBenchmark("Single range", slots, regionCount, [pRegions](const void *pAddr) {
+				return pAddr >= pRegions->Start && pAddr < pRegions->End;
+			});
+		}
+
+		RunBenchmark("Linear scan", slots, regionCount, [pRegions, regionCount](const void *pAddr) {
+			return FindRegionLinearly(pRegions, regionCount, pAddr) != 0;
+		});
+
+		RunBenchmark("Binary search", slots, regionCount, [pRegions, regionCount](const void *pAddr) {
+			return FindProfilerAddressRegion(pRegions, regionCount, pAddr) != 0;
+		});
+	}
+
+	return 0;
+}
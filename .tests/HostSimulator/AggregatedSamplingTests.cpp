@@ -0,0 +1,171 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <AggregatedSampleDecoder.h>
+#include <FastSemihosting.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <map>
+#include <vector>
+
+/*
+	This file is built with SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE=4096 and SAMPLING_PROFILER_AGGREGATION_FLUSH_INTERVAL=1000,
+	with and without SYSPROGS_PROFILER_ADDRESS_REGIONS. The table only has room for ~13 stacks, so the tests with more distinct stacks
+	exercise the eviction.
+*/
+
+static char s_SimulatedCode[256];
+
+TEST_GROUP(AggregatedSamplingTests)
+{
+	SimulatedDebugger &Debugger;
+	AggregatedSampleDecoder Decoder;
+	std::vector<AggregatedSampleDecoder::Stack> Stacks;
+	void *m_Stack[64];
+
+	TEST_GROUP_AggregatedSamplingTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+
+		//Every 4th slot looks like a return address, the rest of the stack does not point to the code
+		for (int i = 0; i < 64; i++)
+			m_Stack[i] = (i % 4) ? (void *)(uintptr_t)(0x1000 + i) : (void *)(s_SimulatedCode + i);
+		Debugger.SetSampledMemory(m_Stack, m_Stack + 64, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+		//The table is kept between the tests, so the stacks counted by the previous ones are discarded here.
+		CHECK(SysprogsProfiler_FlushAggregatedSamples());
+		Debugger.Poll();
+		Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream).clear();
+	}
+
+	~TEST_GROUP_AggregatedSamplingTests()
+	{
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+
+	void Sample(unsigned pcOffset, unsigned lrOffset, unsigned depth)
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + pcOffset, m_Stack + depth, m_Stack + depth, s_SimulatedCode + lrOffset);
+	}
+
+	//Decodes the data received so far and returns the total hit count per PC.
+	std::map<unsigned, unsigned> ReceiveCounts()
+	{
+		Debugger.Poll();
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream);
+		CHECK(Decoder.Feed(data.data(), data.size(), Stacks));
+		data.clear();
+
+		std::map<unsigned, unsigned> counts;
+		for (size_t i = 0; i < Stacks.size(); i++)
+			counts[Stacks[i].PC] += Stacks[i].Count;
+		return counts;
+	}
+
+	static unsigned PCKey(unsigned pcOffset)
+	{
+		return (unsigned)(uintptr_t)(s_SimulatedCode + pcOffset);
+	}
+};
+
+TEST(AggregatedSamplingTests, RepeatedStacksAreCounted)
+{
+	const int kSamples = 900;
+	for (int i = 0; i < kSamples; i++)
+		Sample((i % 3) ? 2 : 6, 4, 0);
+
+	//No data is sent before the table is flushed.
+	CHECK(ReceiveCounts().empty());
+
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	std::map<unsigned, unsigned> counts = ReceiveCounts();
+	CHECK_EQUAL(2, Stacks.size());
+	CHECK_EQUAL(kSamples * 2 / 3, counts[PCKey(2)]);
+	CHECK_EQUAL(kSamples / 3, counts[PCKey(6)]);
+
+	//The stack entries are reported relative to SP (see the stack layout above), up to SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH of them.
+	const AggregatedSampleDecoder::Stack &stack = Stacks[0];
+	CHECK_EQUAL(16, stack.Entries.size());
+	for (size_t i = 0; i < stack.Entries.size(); i++)
+	{
+		CHECK_EQUAL(i * 4, stack.Entries[i].Index);
+		CHECK_EQUAL((unsigned)(uintptr_t)(s_SimulatedCode + i * 4), stack.Entries[i].Value);
+		CHECK(!stack.Entries[i].IsSavedFP);
+	}
+}
+
+TEST(AggregatedSamplingTests, TableIsFlushedPeriodically)
+{
+	//The periodic flush sends 2 slots per sample, so the table is sent within a few samples after SAMPLING_PROFILER_AGGREGATION_FLUSH_INTERVAL.
+	for (int i = 0; i < 1100; i++)
+		Sample(2 + (i % 4) * 2, 4, i % 4);
+
+	std::map<unsigned, unsigned> counts = ReceiveCounts();
+	unsigned total = 0;
+	for (auto it = counts.begin(); it != counts.end(); ++it)
+		total += it->second;
+
+	CHECK(total >= 1000 && total <= 1100);
+}
+
+TEST(AggregatedSamplingTests, EvictionPreservesTotalCounts)
+{
+	//300 distinct stacks do not fit into the table, so the least used ones are sent to the debugger to make room for the new ones.
+	const int kSamples = 30000;
+	std::map<unsigned, unsigned> expected;
+	for (int i = 0; i < kSamples; i++)
+	{
+		unsigned stackIndex = (i * 7919) % 300;
+		unsigned pcOffset = 2 * (stackIndex % 100);
+		Sample(pcOffset, 4, stackIndex / 100);
+		expected[PCKey(pcOffset)]++;
+
+		//Almost every sample evicts a slot here, so the debugger needs to read the buffer more often than with regular sampling.
+		if (!(i % 16))
+			Debugger.Poll();
+	}
+
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	CHECK(ReceiveCounts() == expected);
+}
+
+TEST(AggregatedSamplingTests, BandwidthDependsOnDistinctStacks)
+{
+	const int kSamples = 20000;
+	for (int i = 0; i < kSamples; i++)
+	{
+		Sample((i & 1) ? 2 : 6, 4, 0);
+		if (!(i % 256))
+			Debugger.Poll();
+	}
+
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	Debugger.Poll();
+
+	//Each flush sends 2 records of ~70 bytes, instead of ~70 bytes per sample.
+	CHECK(Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream).size() < 200 * (kSamples / 1000 + 1));
+	CHECK_EQUAL(0, Debugger.GetChannelData(pdcSamplingProfilerStream).size());
+}
+
+TEST(AggregatedSamplingTests, AllCodeRegionsAreRecognized)
+{
+	//Slot 2 points to a function copied to RAM, outside of the main code region
+	static char ramFunctions[64];
+	m_Stack[2] = ramFunctions + 8;
+
+	Sample(2, 4, 0);
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	ReceiveCounts();
+	CHECK_EQUAL(1, Stacks.size());
+	CHECK_EQUAL(4, Stacks[0].Entries[1].Index);
+
+	Stacks.clear();
+	Debugger.AddSampledCodeRegion(ramFunctions, ramFunctions + sizeof(ramFunctions));
+	Sample(2, 4, 0);
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	ReceiveCounts();
+	CHECK_EQUAL(1, Stacks.size());
+	CHECK_EQUAL(2, Stacks[0].Entries[1].Index);
+	CHECK_EQUAL((unsigned)(uintptr_t)(ramFunctions + 8), Stacks[0].Entries[1].Value);
+}
@@ -0,0 +1,52 @@
+#include "AutoRateSimulation.h"
+#include <stdio.h>
+
+/*
+	Compares the auto-rate controller from SamplingRateController.h with the previous algorithm on several simulated debugger links.
+	Each simulation starts at 100 Hz and runs for 30 seconds; the drop ratio and the mean rate are computed for the last 20 seconds.
+*/
+
+int main()
+{
+	static const AutoRateSimulation::Link links[] = {
+		{4096, 40000, 0.005, 24, 56},
+		{16384, 40000, 0.02, 24, 56},
+		{4096, 400000, 0.002, 24, 56},
+		{32768, 1000000, 0.001, 24, 56},
+		{16384, 40000, 0.05, 8, 100},
+		{4096, 40000, 0.05, 8, 100}, //Each debugger read frees half of the buffer
+		{1024, 10000, 0.01, 16, 64},
+		{4096, 40000, 0.0002, 24, 56}, //The debugger reads the buffer almost continuously
+	};
+
+	printf("Buffer   Bandwidth   Poll  Sustainable | Controller  Converged  Mean rate  Dropped\n");
+	for (const AutoRateSimulation::Link &link : links)
+	{
+		AutoRateSimulation simulation(link);
+		PIDRateController controller;
+		LegacyRateController legacyController;
+		AutoRateSimulation::Result results[] = {simulation.Run(controller, 100, 30, 10, 0.75, 1.25), simulation.Run(legacyController, 100, 30, 10, 0.75, 1.25)};
+		static const char *names[] = {"PID", "Legacy"};
+
+		for (int i = 0; i < 2; i++)
+		{
+			char converged[32];
+			if (results[i].TimeToConverge < 0)
+				snprintf(converged, sizeof(converged), "never");
+			else
+				snprintf(converged, sizeof(converged), "%.2f s", results[i].TimeToConverge);
+
+			printf("%6d %8d/s %4.1fms %8.0f/s   | %-10s %10s %8.0f/s %7.3f%%\n",
+				   link.BufferSize,
+				   link.BytesPerSecond,
+				   link.PollInterval * 1000,
+				   simulation.GetSustainableRate(),
+				   names[i],
+				   converged,
+				   results[i].MeanRate,
+				   results[i].DropRatio * 100);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <SamplingRateController.h>
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+/*
+	Simulates the sampling profiler sending samples via a buffer that is read by the debugger with a limited bandwidth, and lets either
+	the current rate controller (SamplingRateController.h) or the previous one (fixed 1024-sample cycles with x4/x2/+200 steps) select
+	the sampling rate. Everything runs in virtual time, so the simulation is deterministic and takes milliseconds.
+*/
+class AutoRateSimulation
+{
+public:
+	struct Link
+	{
+		int BufferSize;			//Bytes
+		int BytesPerSecond;		//Debugger read bandwidth
+		double PollInterval;	//Seconds between the debugger reads
+		int MinSampleSize, MaxSampleSize;
+	};
+
+	struct Result
+	{
+		double TimeToConverge; //Seconds until the rate (averaged over kConvergenceWindow) stays within [minShare, maxShare] of the sustainable rate, or -1 if it never does
+		double DropRatio;	   //Dropped samples / all samples after the warm-up
+		double MeanRate;	   //After the warm-up
+		int RateChangesAfterWarmup;
+		std::vector<int> RatePerSecond;
+	};
+
+	static constexpr double kConvergenceWindow = 0.5;
+
+	AutoRateSimulation(const Link &link)
+		: m_Link(link)
+	{
+	}
+
+	double GetSustainableRate() const
+	{
+		return m_Link.BytesPerSecond * 2.0 / (m_Link.MinSampleSize + m_Link.MaxSampleSize);
+	}
+
+	//Runs the simulation for the specified time and computes the statistics for the part after warmupTime.
+	template <class _Controller> Result Run(_Controller &controller, int initialRate, double duration, double warmupTime, double minShare = 0.5, double maxShare = 1.1)
+	{
+		Result result = {};
+		double time = 0, nextPoll = m_Link.PollInterval, usedBytes = 0;
+		double lastOutOfRange = 0, windowEnd = kConvergenceWindow;
+		int samplesInWindow = 0;
+		int rate = initialRate, lastRate = initialRate;
+		uint64_t samplesAfterWarmup = 0, droppedAfterWarmup = 0;
+		uint32_t random = 0x2545F491;
+		double sustainableRate = GetSustainableRate();
+
+		while (time < duration)
+		{
+			time += 1.0 / rate;
+			while (nextPoll <= time)
+			{
+				usedBytes -= std::min(usedBytes, m_Link.BytesPerSecond * m_Link.PollInterval);
+				nextPoll += m_Link.PollInterval;
+			}
+
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			int size = m_Link.MinSampleSize + random % (m_Link.MaxSampleSize - m_Link.MinSampleSize + 1);
+
+			int availability = -1;
+			if (usedBytes + size <= m_Link.BufferSize)
+			{
+				usedBytes += size;
+				availability = (int)((m_Link.BufferSize - usedBytes) * (1 << kSamplingRateControllerAvailabilityExp) / m_Link.BufferSize);
+			}
+
+			if (time >= warmupTime)
+			{
+				samplesAfterWarmup++;
+				if (availability < 0)
+					droppedAfterWarmup++;
+			}
+
+			rate = controller.CountSample(rate, availability);
+			if (rate != lastRate)
+			{
+				if (time >= warmupTime)
+					result.RateChangesAfterWarmup++;
+				lastRate = rate;
+			}
+
+			if (time >= windowEnd)
+			{
+				double windowRate = samplesInWindow / kConvergenceWindow;
+				if (windowRate < sustainableRate * minShare || windowRate > sustainableRate * maxShare)
+					lastOutOfRange = windowEnd;
+				windowEnd += kConvergenceWindow;
+				samplesInWindow = 0;
+			}
+			samplesInWindow++;
+
+			if ((size_t)time >= result.RatePerSecond.size())
+				result.RatePerSecond.push_back(rate);
+		}
+
+		result.TimeToConverge = (lastOutOfRange >= duration - 1) ? -1 : lastOutOfRange;
+		result.DropRatio = samplesAfterWarmup ? (double)droppedAfterWarmup / samplesAfterWarmup : 0;
+		result.MeanRate = samplesAfterWarmup / (duration - warmupTime);
+		return result;
+	}
+
+private:
+	Link m_Link;
+};
+
+//The controller used by SamplingProfiler.cpp.
+struct PIDRateController
+{
+	SamplingRateController State;
+
+	PIDRateController()
+	{
+		SamplingRateController_Reset(&State);
+	}
+
+	int CountSample(int rate, int availability)
+	{
+		if (availability < 0)
+			SamplingRateController_CountDroppedSample(&State);
+		else
+			SamplingRateController_CountSample(&State, availability);
+		if (State.Samples >= SamplingRateController_GetSamplesPerUpdate(&State, rate))
+			return SamplingRateController_Update(&State, rate);
+		return rate;
+	}
+};
+
+//The controller used by the previous versions of SamplingProfiler.cpp.
+struct LegacyRateController
+{
+	enum
+	{
+		kSamplesPerCycle = 1024,
+		kUsageExp = 4,
+	};
+
+	int PacketsDropped = 0, PacketsInCycle = 0, AvailabilitySum = 0;
+
+	int CountSample(int rate, int availability)
+	{
+		int newRate = rate;
+		if (++PacketsInCycle >= kSamplesPerCycle)
+		{
+			int scaledNewRate = 0;
+			if (PacketsDropped)
+				scaledNewRate = rate * (kSamplesPerCycle - PacketsDropped) / kSamplesPerCycle;
+			else if ((AvailabilitySum / kSamplesPerCycle) > (1 << kUsageExp) * 1 / 4)
+			{
+				if ((AvailabilitySum / kSamplesPerCycle) > (1 << kUsageExp) * 7 / 8)
+					scaledNewRate = rate * 4;
+				else if ((AvailabilitySum / kSamplesPerCycle) > (1 << kUsageExp) * 3 / 4)
+					scaledNewRate = rate * 2;
+				else
+					scaledNewRate = rate + 200;
+			}
+
+			if (scaledNewRate > 100 && scaledNewRate < 100000)
+				newRate = scaledNewRate;
+
+			PacketsDropped = PacketsInCycle = AvailabilitySum = 0;
+		}
+
+		if (availability < 0)
+			PacketsDropped++;
+		else
+			AvailabilitySum += availability >> (kSamplingRateControllerAvailabilityExp - kUsageExp);
+		return newRate;
+	}
+};
@@ -0,0 +1,102 @@
+#include "HostTestFramework.h"
+#include "AutoRateSimulation.h"
+#include <math.h>
+
+/*
+	Runs the rate controller from SamplingRateController.h against simulated debugger links (see AutoRateSimulation.h) and compares it
+	with the previous auto-rate algorithm. The links cover different buffer sizes, bandwidths and debugger polling intervals.
+*/
+TEST_GROUP(AutoRateTests)
+{
+	static const AutoRateSimulation::Link *GetLinks(int *pCount)
+	{
+		static const AutoRateSimulation::Link links[] = {
+			{4096, 40000, 0.005, 24, 56},	  //Typical fast semihosting setup
+			{16384, 40000, 0.02, 24, 56},	  //Large buffer, slow polling
+			{4096, 400000, 0.002, 24, 56},	  //Fast probe
+			{32768, 1000000, 0.001, 24, 56},  //Very fast probe
+			{16384, 40000, 0.05, 8, 100},	  //Slow polling, highly variable samples
+		};
+		*pCount = sizeof(links) / sizeof(links[0]);
+		return links;
+	}
+
+	//Amount of updates needed to reach the sustainable rate from initialRate by doubling the rate, plus some time to settle.
+	static double GetConvergenceBound(double sustainableRate, int initialRate)
+	{
+		double updates = ceil(log2(sustainableRate / initialRate)) + 8;
+		return updates / SAMPLING_PROFILER_AUTORATE_UPDATES_PER_SECOND * 2; //Low rates use SAMPLING_PROFILER_AUTORATE_MIN_SAMPLES_PER_UPDATE
+	}
+};
+
+TEST(AutoRateTests, RateConvergesWithinBoundedTime)
+{
+	int count;
+	const AutoRateSimulation::Link *pLinks = GetLinks(&count);
+	for (int i = 0; i < count; i++)
+	{
+		AutoRateSimulation simulation(pLinks[i]);
+		PIDRateController controller;
+		AutoRateSimulation::Result result = simulation.Run(controller, 100, 30, 10, 0.75, 1.25);
+
+		CHECK(result.TimeToConverge >= 0);
+		CHECK(result.TimeToConverge < GetConvergenceBound(simulation.GetSustainableRate(), 100));
+		CHECK(result.MeanRate > simulation.GetSustainableRate() * 0.9);
+	}
+}
+
+TEST(AutoRateTests, RateDecreasesQuickly)
+{
+	//Starting far above the sustainable rate fills the buffer immediately, and the rate is reduced up to 4x per update.
+	int count;
+	const AutoRateSimulation::Link *pLinks = GetLinks(&count);
+	AutoRateSimulation simulation(pLinks[0]);
+	PIDRateController controller;
+	AutoRateSimulation::Result result = simulation.Run(controller, 50000, 30, 10, 0.75, 1.25);
+
+	CHECK(result.TimeToConverge >= 0);
+	CHECK(result.TimeToConverge < 2);
+	CHECK(result.DropRatio < 0.001);
+}
+
+TEST(AutoRateTests, FewerDropsAndFasterConvergenceThanLegacyAlgorithm)
+{
+	int count;
+	const AutoRateSimulation::Link *pLinks = GetLinks(&count);
+	for (int i = 0; i < count; i++)
+	{
+		AutoRateSimulation simulation(pLinks[i]);
+		PIDRateController controller;
+		LegacyRateController legacyController;
+		AutoRateSimulation::Result result = simulation.Run(controller, 100, 30, 10, 0.75, 1.25);
+		AutoRateSimulation::Result legacyResult = simulation.Run(legacyController, 100, 30, 10, 0.75, 1.25);
+
+		CHECK(result.DropRatio < 0.002);
+		CHECK(result.DropRatio < legacyResult.DropRatio);
+
+		//The legacy algorithm needs 1024 samples (10 seconds at 100 Hz) before the first adjustment.
+		CHECK(legacyResult.TimeToConverge < 0 || legacyResult.TimeToConverge > 10);
+		CHECK(result.TimeToConverge < legacyResult.TimeToConverge || legacyResult.TimeToConverge < 0);
+	}
+}
+
+TEST(AutoRateTests, UnknownBufferUsageOnlyReactsToDrops)
+{
+	SamplingRateController controller;
+	SamplingRateController_Reset(&controller);
+
+	for (int i = 0; i < 16; i++)
+		SamplingRateController_CountSample(&controller, -1);
+	CHECK_EQUAL(-1, SamplingRateController_GetOccupancy(&controller));
+	CHECK_EQUAL(1000, SamplingRateController_Update(&controller, 1000));
+
+	//Half of the samples dropped: the rate goes to 7/8 of the delivered rate.
+	for (int i = 0; i < 16; i++)
+	{
+		if (i & 1)
+			SamplingRateController_CountDroppedSample(&controller);
+		else
+			SamplingRateController_CountSample(&controller, -1);
+	}
+	CHECK_EQUAL(437, SamplingRateController_Update(&controller, 1000));
+}
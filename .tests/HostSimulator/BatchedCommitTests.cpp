@@ -0,0 +1,107 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_COMMIT_THRESHOLD=kThreshold.
+enum
+{
+	kThreshold = 256
+};
+
+TEST_GROUP(BatchedCommitTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_BatchedCommitTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	template <class _Function> void RunWithDebugger(_Function function)
+	{
+		std::atomic<bool> done(false);
+		std::thread reader([&]() {
+			while (!done)
+				if (!Debugger.Poll())
+					std::this_thread::yield();
+		});
+
+		function();
+		done = true;
+		reader.join();
+		Debugger.Poll();
+	}
+};
+
+TEST(BatchedCommitTests, SmallRecordsArePublishedAfterThreshold)
+{
+	unsigned char record[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	unsigned written = 2; //Channel switch record
+	while (written < kThreshold)
+	{
+		CHECK_EQUAL(0, Debugger.Poll());
+		CHECK_EQUAL(sizeof(record), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, record, 4, record + 4, sizeof(record) - 4));
+		written += sizeof(record);
+	}
+
+	CHECK_EQUAL(written, Debugger.Poll());
+	CHECK_EQUAL(written - 2, Debugger.GetChannelData(pdcRealTimeAnalysisStream).size());
+}
+
+TEST(BatchedCommitTests, FlushPublishesPendingData)
+{
+	unsigned char record[10] = {0};
+	CHECK_EQUAL(sizeof(record), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, record, 4, record + 4, sizeof(record) - 4));
+	CHECK_EQUAL(0, Debugger.Poll());
+
+	FlushFastSemihostingBuffer();
+	CHECK_EQUAL(sizeof(record) + 2, Debugger.Poll());
+}
+
+TEST(BatchedCommitTests, LineBreakPublishesTextOutput)
+{
+	CHECK_EQUAL(3, WriteToFastSemihostingChannel(1, "abc", 3, 1));
+	CHECK_EQUAL(0, Debugger.Poll());
+
+	CHECK_EQUAL(4, WriteToFastSemihostingChannel(1, "def\n", 4, 1));
+	CHECK_EQUAL(7 + 2, Debugger.Poll());
+	CHECK(Debugger.GetChannelData(1) == std::vector<unsigned char>({'a', 'b', 'c', 'd', 'e', 'f', '\n'}));
+}
+
+TEST(BatchedCommitTests, BlockingWritesLargerThanBufferComplete)
+{
+	//The writer waiting for the buffer space must publish the pending data, or the debugger would never free it up.
+	std::vector<unsigned char> data(Debugger.GetBufferSize() * 3 + 17);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)('A' + i % 26);
+
+	RunWithDebugger([&]() {
+		CHECK_EQUAL(data.size(), WriteToFastSemihostingChannel(2, data.data(), (int)data.size(), 1));
+		FlushFastSemihostingBuffer();
+	});
+
+	CHECK(Debugger.GetChannelData(2) == data);
+}
+
+TEST(BatchedCommitTests, DebuggerReadsLargerPortions)
+{
+	unsigned char record[12] = {0};
+	RunWithDebugger([&]() {
+		for (unsigned i = 0; i < 10000; i++)
+		{
+			record[0] = (unsigned char)i;
+			while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, record, 4, record + 4, sizeof(record) - 4))
+				std::this_thread::yield();
+		}
+		FlushFastSemihostingBuffer();
+	});
+
+	CHECK_EQUAL(10000 * sizeof(record), Debugger.GetChannelData(pdcRealTimeAnalysisStream).size());
+	CHECK(Debugger.GetTotalBytesRead() / Debugger.GetDataPollCount() >= kThreshold / 2);
+}
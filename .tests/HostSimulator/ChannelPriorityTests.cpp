@@ -0,0 +1,91 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_CHANNEL_PRIORITIES=1, FAST_SEMIHOSTING_DROP_STATISTICS=1 and FAST_SEMIHOSTING_BLOCKING_MODE=0.
+//The default watermarks are 50% for the text channels and 75% for the non-prioritized binary channels.
+
+TEST_GROUP(ChannelPriorityTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_ChannelPriorityTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	static std::vector<unsigned char> MakeData(size_t size)
+	{
+		std::vector<unsigned char> data(size);
+		for (size_t i = 0; i < size; i++)
+			data[i] = (unsigned char)(i * 7);
+		return data;
+	}
+};
+
+TEST(ChannelPriorityTests, TextChannelsStopAtWatermark)
+{
+	unsigned size = Debugger.GetBufferSize();
+	std::vector<unsigned char> data = MakeData(size);
+	int done = WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1);
+	CHECK(done > 0);
+	CHECK(done <= (int)size / 2);
+
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(1) == std::vector<unsigned char>(data.begin(), data.begin() + done));
+}
+
+TEST(ChannelPriorityTests, HighPriorityChannelsUseHeadroom)
+{
+	unsigned size = Debugger.GetBufferSize();
+	std::vector<unsigned char> text = MakeData(size), packet = MakeData(size / 8);
+	WriteToFastSemihostingChannel(1, text.data(), (int)text.size(), 1);
+
+	//The text channel has filled its share, but the remaining space is still available to the more important channels.
+	CHECK_EQUAL(0, WriteToFastSemihostingChannel(2, "x", 1, 1));
+	CHECK_EQUAL(packet.size(), SysprogsProfiler_WriteData(pdcSamplingProfilerStream, 0, 0, packet.data(), (unsigned)packet.size()));
+	CHECK_EQUAL(0, SysprogsProfiler_WriteData(pdcSamplingProfilerStream, 0, 0, text.data(), size / 4));
+	CHECK_EQUAL(packet.size(), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, 0, 0, packet.data(), (unsigned)packet.size()));
+	CHECK_EQUAL(packet.size(), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, 0, 0, packet.data(), (unsigned)packet.size()));
+
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream) == packet);
+	CHECK_EQUAL(packet.size() * 2, Debugger.GetChannelData(pdcRealTimeAnalysisStream).size());
+}
+
+TEST(ChannelPriorityTests, DropsAreReportedPerChannel)
+{
+	CHECK(Debugger.HasDropStatistics());
+
+	//The counters are never reset by the target, so we only check how they change.
+	unsigned writes1 = Debugger.GetDroppedWriteCount(1), bytes1 = Debugger.GetDroppedByteCount(1);
+	unsigned writes3 = Debugger.GetDroppedWriteCount(3), bytes3 = Debugger.GetDroppedByteCount(3);
+	unsigned profilerBytes = Debugger.GetDroppedByteCount(pdcSamplingProfilerStream);
+
+	unsigned size = Debugger.GetBufferSize();
+	std::vector<unsigned char> data = MakeData(size);
+	int done = WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1);
+	CHECK_EQUAL(0, WriteToFastSemihostingChannel(3, "hello", 5, 1));
+	CHECK_EQUAL(0, SysprogsProfiler_WriteData(pdcSamplingProfilerStream, 0, 0, data.data(), size));
+
+	CHECK_EQUAL(writes1 + 1, Debugger.GetDroppedWriteCount(1));
+	CHECK_EQUAL(bytes1 + size - done, Debugger.GetDroppedByteCount(1));
+	CHECK_EQUAL(writes3 + 1, Debugger.GetDroppedWriteCount(3));
+	CHECK_EQUAL(bytes3 + 5, Debugger.GetDroppedByteCount(3));
+	CHECK_EQUAL(profilerBytes + size, Debugger.GetDroppedByteCount(pdcSamplingProfilerStream));
+	CHECK_EQUAL(0, Debugger.GetDroppedWriteCount(pdcRealTimeAnalysisStream));
+}
+
+TEST(ChannelPriorityTests, BufferAvailabilityAccountsForWatermark)
+{
+	CHECK_EQUAL(192, SysprogsProfiler_GetBufferAvailability(8));
+
+	unsigned size = Debugger.GetBufferSize();
+	std::vector<unsigned char> data = MakeData(size / 2);
+	SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, 0, 0, data.data(), (unsigned)data.size());
+	CHECK(SysprogsProfiler_GetBufferAvailability(8) <= 64);
+}
@@ -0,0 +1,72 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_COMPRESSED_CHANNELS=1,0x44.
+
+TEST_GROUP(CompressedChannelTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_CompressedChannelTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+};
+
+TEST(CompressedChannelTests, TextOutputIsCompressed)
+{
+	std::string expected;
+	unsigned transferred = 0;
+	for (int i = 0; i < 100; i++)
+	{
+		char line[64];
+		int size = snprintf(line, sizeof(line), "Iteration %d: temperature = %d.%d C\n", i, 20 + i % 3, i % 10);
+		CHECK_EQUAL(size, WriteToFastSemihostingChannel(1, line, size, 1));
+		expected.append(line, size);
+		transferred += Debugger.Poll();
+	}
+
+	std::vector<unsigned char> &output = Debugger.GetChannelData(1);
+	CHECK(std::string(output.begin(), output.end()) == expected);
+	CHECK(transferred < expected.size() / 2);
+}
+
+TEST(CompressedChannelTests, LargeWritesAreSplitIntoBlocks)
+{
+	std::vector<unsigned char> data(Debugger.GetBufferSize() / 2);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)(i / 16);
+
+	CHECK_EQUAL(data.size(), WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1));
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(1) == data);
+}
+
+TEST(CompressedChannelTests, ProfilerRecordsAreCompressed)
+{
+	std::vector<unsigned char> expected;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		unsigned header[2] = {0x1234, i / 4}, payload[4] = {i & ~3U, 0, 0, 1};
+		CHECK_EQUAL(sizeof(header) + sizeof(payload), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, header, sizeof(header), payload, sizeof(payload)));
+		expected.insert(expected.end(), (unsigned char *)header, (unsigned char *)(header + 2));
+		expected.insert(expected.end(), (unsigned char *)payload, (unsigned char *)(payload + 4));
+	}
+
+	CHECK(Debugger.Poll() < expected.size() / 2);
+	CHECK(Debugger.GetChannelData(pdcRealTimeAnalysisStream) == expected);
+}
+
+TEST(CompressedChannelTests, OtherChannelsAreNotCompressed)
+{
+	CHECK_EQUAL(5, WriteToFastSemihostingChannel(2, "hello", 5, 1));
+	CHECK_EQUAL(5 + 2, Debugger.Poll());
+	CHECK(Debugger.GetChannelData(2) == std::vector<unsigned char>({'h', 'e', 'l', 'l', 'o'}));
+}
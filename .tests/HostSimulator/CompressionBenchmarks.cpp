@@ -0,0 +1,164 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <StreamCompressor.h>
+#include <StreamDecompressor.h>
+#include <SysprogsProfilerInterface.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+	Measures the compression ratio and speed of StreamCompressor on synthetic corpora resembling the typical semihosting traffic.
+	The cycle counts are measured on the development machine, so they only give a rough estimate of the on-target cost.
+	This executable is built with FAST_SEMIHOSTING_COMPRESSED_CHANNELS=1,0x44, so the end-to-end numbers include the framework overhead.
+*/
+
+static std::vector<unsigned char> MakePrintfCorpus(size_t size)
+{
+	std::vector<unsigned char> corpus;
+	srand(1);
+	for (unsigned i = 0; corpus.size() < size; i++)
+	{
+		char line[128];
+		int length;
+		switch (rand() % 3)
+		{
+		case 0:
+			length = snprintf(line, sizeof(line), "[%8u] ADC channel %d: %d mV\n", i * 10, rand() % 4, 3000 + rand() % 300);
+			break;
+		case 1:
+			length = snprintf(line, sizeof(line), "[%8u] Received packet #%u, %d bytes, status OK\n", i * 10, i, 64 + rand() % 64);
+			break;
+		default:
+			length = snprintf(line, sizeof(line), "[%8u] Task 'worker%d' woke up after %d ms\n", i * 10, rand() % 3, rand() % 100);
+			break;
+		}
+		corpus.insert(corpus.end(), line, line + length);
+	}
+	return corpus;
+}
+
+//Real-time watch records: a fixed header followed by a few slowly changing 32-bit values.
+static std::vector<unsigned char> MakeRealTimeWatchCorpus(size_t size)
+{
+	std::vector<unsigned char> corpus;
+	unsigned values[4] = {1000, 0x20001234, 0, 42};
+	srand(2);
+	while (corpus.size() < size)
+	{
+		unsigned record[6] = {0x0101, 0x20000F00u + (rand() % 4) * 4, values[0], values[1], values[2], values[3]};
+		values[0] += rand() % 3;
+		values[2]++;
+		corpus.insert(corpus.end(), (unsigned char *)record, (unsigned char *)(record + 6));
+	}
+	return corpus;
+}
+
+static std::vector<unsigned char> MakeRandomCorpus(size_t size)
+{
+	std::vector<unsigned char> corpus(size);
+	srand(3);
+	for (size_t i = 0; i < size; i++)
+		corpus[i] = (unsigned char)rand();
+	return corpus;
+}
+
+static unsigned long long ReadCycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+template <unsigned _Window, unsigned _BlockSize> static void BenchmarkCompressor(const char *pCorpusName, const std::vector<unsigned char> &corpus, unsigned writeSize)
+{
+	typedef StreamCompressor<_Window, _BlockSize> Compressor;
+	static Compressor compressor;
+	compressor.Reset();
+	std::vector<unsigned char> block(Compressor::kMaxCompressedSize), compressed;
+
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long startCycles = ReadCycleCounter();
+	for (size_t offset = 0; offset < corpus.size(); offset += writeSize)
+	{
+		unsigned todo = (unsigned)std::min<size_t>(writeSize, corpus.size() - offset);
+		compressor.AppendInput(&corpus[offset], todo);
+		unsigned size = compressor.Compress(block.data());
+		compressor.AcceptInput();
+		compressed.insert(compressed.end(), block.begin(), block.begin() + size);
+	}
+	unsigned long long cycles = ReadCycleCounter() - startCycles;
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	StreamDecompressor decompressor;
+	std::vector<unsigned char> output;
+	if (!decompressor.Feed(compressed.data(), compressed.size(), output) || output != corpus)
+	{
+		printf("%s: decompressed data does not match the corpus\n", pCorpusName);
+		exit(1);
+	}
+
+	printf("%-16s window=%-5u writes of %-4u bytes: ratio %5.1f%%, %6.2f ns/byte, %6.2f cycles/byte\n",
+		   pCorpusName,
+		   _Window,
+		   writeSize,
+		   100.0 * compressed.size() / corpus.size(),
+		   ns / corpus.size(),
+		   (double)cycles / corpus.size());
+}
+
+static void BenchmarkChannel(const char *pCorpusName, const std::vector<unsigned char> &corpus, unsigned char channel, unsigned writeSize)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	InitializeFastSemihosting();
+
+	unsigned long long transferred = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t offset = 0; offset < corpus.size(); offset += writeSize)
+	{
+		unsigned todo = (unsigned)std::min<size_t>(writeSize, corpus.size() - offset);
+		if (channel < 0x40)
+			WriteToFastSemihostingChannel(channel, &corpus[offset], todo, 1);
+		else
+			SysprogsProfiler_WriteData((ProfilerDataChannel)channel, &corpus[offset], 0, &corpus[offset], todo);
+
+		transferred += debugger.Poll();
+	}
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	bool match = debugger.GetChannelData(channel) == corpus;
+	printf("%-16s channel 0x%02x, writes of %-4u bytes: transferred %5.1f%%, %6.2f ns/byte%s\n",
+		   pCorpusName,
+		   channel,
+		   writeSize,
+		   100.0 * transferred / corpus.size(),
+		   ns / corpus.size(),
+		   match ? "" : " (MISMATCH)");
+}
+
+int main()
+{
+	const size_t kCorpusSize = 1024 * 1024;
+	std::vector<unsigned char> printfCorpus = MakePrintfCorpus(kCorpusSize), watchCorpus = MakeRealTimeWatchCorpus(kCorpusSize), randomCorpus = MakeRandomCorpus(kCorpusSize);
+
+	BenchmarkCompressor<256, 256>("printf", printfCorpus, 64);
+	BenchmarkCompressor<1024, 256>("printf", printfCorpus, 64);
+	BenchmarkCompressor<4096, 256>("printf", printfCorpus, 64);
+	BenchmarkCompressor<1024, 256>("printf", printfCorpus, 256);
+	BenchmarkCompressor<256, 256>("real-time watch", watchCorpus, 24);
+	BenchmarkCompressor<1024, 256>("real-time watch", watchCorpus, 24);
+	BenchmarkCompressor<1024, 256>("random", randomCorpus, 256);
+
+	BenchmarkChannel("printf", printfCorpus, 1, 64);
+	BenchmarkChannel("printf", printfCorpus, 2, 64); //Not compressed
+	BenchmarkChannel("real-time watch", watchCorpus, pdcRealTimeAnalysisStream, 24);
+	return 0;
+}
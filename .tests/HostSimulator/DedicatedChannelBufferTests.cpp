@@ -0,0 +1,105 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS=1 and the default FAST_SEMIHOSTING_DEDICATED_CHANNELS.
+
+TEST_GROUP(DedicatedChannelBufferTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_DedicatedChannelBufferTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+};
+
+static std::vector<unsigned char> MakePattern(unsigned size, unsigned char seed)
+{
+	std::vector<unsigned char> data(size);
+	for (unsigned i = 0; i < size; i++)
+		data[i] = (unsigned char)(seed + i * 7);
+	return data;
+}
+
+TEST(DedicatedChannelBufferTests, DedicatedRingsAreAnnounced)
+{
+	CHECK_EQUAL(4, Debugger.GetRingCount());
+}
+
+TEST(DedicatedChannelBufferTests, DedicatedChannelsDoNotUseSwitchRecords)
+{
+	std::vector<unsigned char> text = MakePattern(10, 1), sample = MakePattern(20, 2), expectedText, expectedSamples;
+	for (int i = 0; i < 50; i++)
+	{
+		CHECK_EQUAL(text.size(), WriteToFastSemihostingChannel(1, text.data(), (int)text.size(), 1));
+		CHECK_EQUAL(sample.size(), SysprogsProfiler_WriteData(pdcSamplingProfilerStream, sample.data(), 5, sample.data() + 5, (unsigned)sample.size() - 5));
+		expectedText.insert(expectedText.end(), text.begin(), text.end());
+		expectedSamples.insert(expectedSamples.end(), sample.begin(), sample.end());
+	}
+
+	//The only switch record is the initial switch from channel 0 to channel 1 in the shared ring.
+	CHECK_EQUAL(expectedText.size() + expectedSamples.size() + 2, Debugger.Poll());
+	CHECK(Debugger.GetChannelData(1) == expectedText);
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream) == expectedSamples);
+}
+
+TEST(DedicatedChannelBufferTests, PrintfFloodDoesNotStarveProfilerStream)
+{
+	//Fill the shared ring completely, as a burst of printf() output would do. The variable-size reservation leaves space for the 2 switch records of its padding.
+	FastSemihostingReservation reservation;
+	unsigned size = ReserveVariableSizeFastSemihostingBuffer(0, 1, 0x10000, &reservation);
+	CHECK_EQUAL(Debugger.GetBufferSize() - 10, size);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, size);
+	CHECK_EQUAL(10, ReserveFastSemihostingBuffer(0, 10, &reservation));
+	CommitFastSemihostingBuffer(&reservation);
+	size += 10;
+	CHECK_EQUAL(0, ReserveFastSemihostingBuffer(0, 1, &reservation));
+
+	CHECK_EQUAL(1 << 8, SysprogsProfiler_GetBufferAvailability(8));
+	std::vector<unsigned char> sample = MakePattern(64, 3);
+	CHECK_EQUAL(sample.size(), SysprogsProfiler_WriteData(pdcSamplingProfilerStream, sample.data(), 16, sample.data() + 16, (unsigned)sample.size() - 16));
+
+	Debugger.Poll();
+	CHECK_EQUAL(size, Debugger.GetChannelData(0).size());
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream) == sample);
+}
+
+TEST(DedicatedChannelBufferTests, VariableSizeReservationOnlyBlocksItsOwnRing)
+{
+	//Dedicated rings cannot contain padding, so other writers of the channel have to wait until the reservation is committed.
+	FastSemihostingReservation reservation, otherReservation;
+	CHECK_EQUAL(100, ReserveVariableSizeFastSemihostingBuffer(pdcSamplingProfilerStream, 1, 100, &reservation));
+	CHECK_EQUAL(0, ReserveFastSemihostingBuffer(pdcSamplingProfilerStream, 1, &otherReservation));
+	CHECK_EQUAL(0, WriteToFastSemihostingChannel(pdcSamplingProfilerStream, "x", 1, 1));
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(1, "y", 1, 1));
+
+	CopyToFastSemihostingReservation(&reservation, 0, "abc", 3);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 3);
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(pdcSamplingProfilerStream, "!", 1, 1));
+
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream) == std::vector<unsigned char>({'a', 'b', 'c', '!'}));
+	CHECK(Debugger.GetChannelData(1) == std::vector<unsigned char>({'y'}));
+}
+
+TEST(DedicatedChannelBufferTests, LegacyDebuggerFallsBackToSharedBuffer)
+{
+	Debugger.Reset();
+	Debugger.SetLegacyMode(true);
+	InitializeFastSemihosting();
+	CHECK_EQUAL(1, Debugger.GetRingCount());
+
+	std::vector<unsigned char> text = MakePattern(10, 4), sample = MakePattern(20, 5);
+	CHECK_EQUAL(text.size(), WriteToFastSemihostingChannel(1, text.data(), (int)text.size(), 1));
+	CHECK_EQUAL(sample.size(), SysprogsProfiler_WriteData(pdcSamplingProfilerStream, sample.data(), 5, sample.data() + 5, (unsigned)sample.size() - 5));
+
+	//Both channels share the same ring, so each of them is preceded by a switch record.
+	CHECK_EQUAL(text.size() + sample.size() + 4, Debugger.Poll());
+	CHECK(Debugger.GetChannelData(1) == text);
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream) == sample);
+}
@@ -0,0 +1,148 @@
+#include "HostSimulator.h"
+#include <DeferredLogRenderer.h>
+#include <FastSemihosting.h>
+#include <SysprogsLog.h>
+#include <SysprogsProfilerInterface.h>
+#include <atomic>
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include <thread>
+
+/*
+	Compares SysprogsLog() with the regular printf() route (formatting the message on the target and passing the text to _write()).
+	The simulated debugger drains the buffer from a separate thread and counts the received bytes. The last column shows how long
+	it takes DeferredLogRenderer to render one message on the host.
+
+	The CPU time is measured on the development machine, so it only approximates the ratio on the target: glibc's vsnprintf() is
+	faster than newlib's one (especially for floating-point values), while the host build of SysprogsLog() looks up the format string
+	token in a map (see SysprogsHostSimulator_MapAddress()) instead of using its address directly.
+*/
+
+enum
+{
+	kMessageCount = 200000,
+	kTextChannel = 1, //printf() writes to stdout
+};
+
+typedef void (*LogFunction)(const char *pFormat, ...);
+
+//Equivalent of printf() with FAST_SEMIHOSTING_STDIO_DRIVER=1 and FAST_SEMIHOSTING_BLOCKING_MODE=1.
+static void LogViaWrite(const char *pFormat, ...)
+{
+	char buffer[128];
+	va_list args;
+	va_start(args, pFormat);
+	int size = vsnprintf(buffer, sizeof(buffer), pFormat, args);
+	va_end(args);
+
+	if (size > (int)sizeof(buffer) - 1)
+		size = sizeof(buffer) - 1;
+	WriteToFastSemihostingChannel(kTextChannel, buffer, size, 1);
+}
+
+class SimulatedLogRenderer : public DeferredLogRenderer
+{
+protected:
+	virtual const char *ResolveFormatString(unsigned address)
+	{
+		return (const char *)SimulatedDebugger::Instance().GetResourceManager().ResolveAddress(address);
+	}
+};
+
+struct BenchmarkResult
+{
+	double NanosecondsPerMessage;
+	double BytesPerMessage;
+	std::vector<unsigned char> Data; //Data received from the first messages
+};
+
+template <class _Function> static BenchmarkResult RunBenchmark(unsigned char channel, LogFunction log, _Function function)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	InitializeFastSemihosting();
+
+	BenchmarkResult result;
+	std::atomic<bool> done(false);
+	unsigned long long received = 0;
+	std::thread reader([&]() {
+		for (;;)
+		{
+			bool last = done;
+			if (!debugger.Poll())
+				std::this_thread::yield();
+
+			std::vector<unsigned char> &data = debugger.GetChannelData(channel);
+			if (result.Data.size() < 4096)
+				result.Data.insert(result.Data.end(), data.begin(), data.end());
+			received += data.size();
+			data.clear();
+
+			if (last)
+				break;
+		}
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < kMessageCount; i++)
+		function(log, i);
+
+	auto end = std::chrono::steady_clock::now();
+	FlushFastSemihostingBuffer();
+	done = true;
+	reader.join();
+
+	result.NanosecondsPerMessage = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / kMessageCount;
+	result.BytesPerMessage = (double)received / kMessageCount;
+	return result;
+}
+
+template <class _Function> static void CompareRoutes(const char *pName, _Function function)
+{
+	BenchmarkResult text = RunBenchmark(kTextChannel, LogViaWrite, function);
+	BenchmarkResult deferred = RunBenchmark(pdcDeferredLogStream, SysprogsLog, function);
+
+	SimulatedLogRenderer renderer;
+	std::string output;
+	auto start = std::chrono::steady_clock::now();
+	renderer.Feed(deferred.Data.data(), deferred.Data.size(), output);
+	auto end = std::chrono::steady_clock::now();
+
+	unsigned renderedMessages = 0;
+	for (size_t i = 0; i < output.size(); i++)
+		renderedMessages += output[i] == '\n';
+
+	printf("%-24s %8.1f ns %6.1f bytes | %8.1f ns %6.1f bytes | %6.1fx %5.1fx | %8.1f ns\n",
+		   pName,
+		   text.NanosecondsPerMessage,
+		   text.BytesPerMessage,
+		   deferred.NanosecondsPerMessage,
+		   deferred.BytesPerMessage,
+		   text.NanosecondsPerMessage / deferred.NanosecondsPerMessage,
+		   text.BytesPerMessage / deferred.BytesPerMessage,
+		   renderedMessages ? (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / renderedMessages : 0.0);
+}
+
+int main()
+{
+	printf("%-24s %23s | %23s | %13s | %s\n", "", "printf() -> _write()", "SysprogsLog()", "speedup/size", "rendering");
+
+	CompareRoutes("Constant string", [](LogFunction log, unsigned) {
+		log("Heartbeat\n");
+	});
+
+	CompareRoutes("Integers and a string", [](LogFunction log, unsigned i) {
+		log("ADC channel %d: %u mV (%s)\n", i % 8, 3000 + i % 512, (i & 1) ? "ok" : "low");
+	});
+
+	CompareRoutes("Thread statistics", [](LogFunction log, unsigned i) {
+		log("[%08x] thread %s: stack %u/%u bytes, CPU load %u.%02u%%\n", i, "NetworkTask", 1024 + i % 64, 4096, i % 100, i % 97);
+	});
+
+	CompareRoutes("Floating-point values", [](LogFunction log, unsigned i) {
+		log("x=%.3f y=%.3f z=%.3f\n", i * 0.001, i * 0.5, -1.25);
+	});
+
+	return 0;
+}
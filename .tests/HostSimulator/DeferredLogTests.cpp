@@ -0,0 +1,184 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <DeferredLogRenderer.h>
+#include <FastSemihosting.h>
+#include <SmallNumberCoder.h>
+#include <SysprogsLog.h>
+#include <SysprogsProfilerInterface.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#pragma GCC diagnostic ignored "-Wformat-security"
+
+//The host build of SysprogsLog.cpp passes the format strings as tokens (see SysprogsHostSimulator_MapAddress()) instead of the addresses.
+class SimulatedLogRenderer : public DeferredLogRenderer
+{
+protected:
+	virtual const char *ResolveFormatString(unsigned address)
+	{
+		return (const char *)SimulatedDebugger::Instance().GetResourceManager().ResolveAddress(address);
+	}
+};
+
+TEST_GROUP(DeferredLogTests)
+{
+	SimulatedDebugger &Debugger;
+	SimulatedLogRenderer Renderer;
+
+	TEST_GROUP_DeferredLogTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	std::string Render()
+	{
+		Debugger.Poll();
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcDeferredLogStream);
+		std::string output;
+		CHECK(Renderer.Feed(data.data(), data.size(), output));
+		data.clear();
+		return output;
+	}
+
+	template <class... _Args> void CheckRenderedLikeSnprintf(const char *pFormat, _Args... args)
+	{
+		char expected[256];
+		snprintf(expected, sizeof(expected), pFormat, args...);
+		SysprogsLog(pFormat, args...);
+		CHECK(Render() == expected);
+	}
+};
+
+TEST(DeferredLogTests, BasicConversionsAreRendered)
+{
+	CheckRenderedLikeSnprintf("a=%d b=%u c=%x d=%X s=%s c=%c 100%%\n", -5, 300u, 0xDEADBEEF, 0x1234, "text", 'Z');
+	CheckRenderedLikeSnprintf("%i %o %d\n", 0x7FFFFFFF, 8, (int)0x80000000);
+	CheckRenderedLikeSnprintf("no arguments\n");
+}
+
+TEST(DeferredLogTests, WidthsPrecisionsAndLengthsAreRendered)
+{
+	CheckRenderedLikeSnprintf("[%08.3f|%-6s|%*d|%.*s|%-*d]\n", 3.14159, "ab", 5, 42, 3, "abcdef", -4, 7);
+	CheckRenderedLikeSnprintf("%lld %llx %ld %zu %hhu %hd\n", -1234567890123LL, 0x123456789ABCULL, 100000L, (size_t)17, 0x1FF, 0x12345);
+	CheckRenderedLikeSnprintf("%e %g %.2Lf %+d % d %#o\n", 1.5e-10, 0.25, (long double)2.5, 3, 4, 8);
+	CheckRenderedLikeSnprintf("%.10s|%5.2s|\n", "short", "longer");
+}
+
+TEST(DeferredLogTests, PointersAndNullStringsAreRendered)
+{
+	int variable;
+	SysprogsLog("%p %s\n", &variable, (const char *)0);
+
+	char expected[64];
+	snprintf(expected, sizeof(expected), "%#llx (null)\n", (unsigned long long)(uintptr_t)&variable);
+	CHECK(Render() == expected);
+}
+
+TEST(DeferredLogTests, MessagesAreSmallerThanText)
+{
+	SysprogsLog("ADC channel %d: %u mV (%s)\n", 3, 3297, "ok");
+	Debugger.Poll();
+	std::vector<unsigned char> data = Debugger.GetChannelData(pdcDeferredLogStream);
+	std::string output;
+
+	//1 byte for the size, up to 2 for the format string token, 1 + 4 for the integers and 1 + 2 for the string.
+	CHECK(data.size() <= 11);
+	CHECK(data.size() * 2 < strlen("ADC channel 3: 3297 mV (ok)\n"));
+	CHECK(Renderer.Feed(data.data(), data.size(), output) && output == "ADC channel 3: 3297 mV (ok)\n");
+}
+
+TEST(DeferredLogTests, LongMessagesAreTruncated)
+{
+	std::string longString(100, 'x');
+	SysprogsLog("[%s]\n", longString.c_str());
+	CHECK(Render() == "[" + std::string(32, 'x') + "]\n");
+
+	//The second string is truncated to the remaining space of the 64-byte record, and the rest of the arguments are dropped.
+	SysprogsLog("%s %s %s %d\n", longString.c_str(), longString.c_str(), longString.c_str(), 1);
+	std::string output = Render(), prefix = std::string(32, 'x') + " xxxxxxxxxxxxxxxxxxxx", suffix = " ...\n";
+	CHECK(output.size() > prefix.size() + suffix.size() && output.size() < 2 * 33 + suffix.size());
+	CHECK(output.compare(0, prefix.size(), prefix) == 0);
+	CHECK(output.compare(output.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+TEST(DeferredLogTests, MessagesDoNotWaitForInterruptedReservation)
+{
+	//The messages below are logged like from an interrupt handler running while the reservation is open. Nothing after it can be published
+	//before it is committed, so the messages that do not fit into the buffer are dropped instead of waiting for the debugger forever.
+	FastSemihostingReservation reservation;
+	CHECK_EQUAL(100, ReserveFastSemihostingBuffer(1, 100, &reservation));
+
+	Debugger.StartPollingThread();
+	for (int i = 0; i < 2000; i++)
+		SysprogsLog("message %d\n", i);
+	Debugger.StopPollingThread();
+
+	CommitFastSemihostingBuffer(&reservation);
+	std::string output = Render();
+	CHECK(output.compare(0, 20, "message 0\nmessage 1\n") == 0);
+	CHECK(output.find("message 1999\n") == std::string::npos);
+}
+
+TEST(DeferredLogTests, UnsupportedConversionsStopRendering)
+{
+	int count;
+	SysprogsLog("before %d %n after %d\n", 1, &count, 2);
+	CHECK(Render() == "before 1 ...\n");
+}
+
+TEST(DeferredLogTests, FormatStringsAreLoadedFromELFFile)
+{
+	//Minimal ELF file with 2 program headers: a loadable segment holding the format strings at 0x08001000 and a non-loadable one.
+	static const char formats[] = "x=%d\n\0y=%s\n";
+	std::vector<unsigned char> elf(0x34 + 2 * 0x20);
+	const unsigned char identification[] = {0x7F, 'E', 'L', 'F', 1, 1, 1};
+	memcpy(elf.data(), identification, sizeof(identification));
+	unsigned programHeaderOffset = 0x34, dataOffset = (unsigned)elf.size(), formatAddress = 0x08001000;
+	memcpy(&elf[0x1C], &programHeaderOffset, 4);
+	elf[0x2A] = 0x20;
+	elf[0x2C] = 2;
+	elf[0x34] = 1;
+	memcpy(&elf[0x34 + 4], &dataOffset, 4);
+	memcpy(&elf[0x34 + 8], &formatAddress, 4);
+	elf[0x34 + 16] = sizeof(formats);
+	elf[0x54] = 4;
+	elf.insert(elf.end(), formats, formats + sizeof(formats));
+
+	std::string fileName = "DeferredLogTest.elf";
+	FILE *pFile = fopen(fileName.c_str(), "wb");
+	CHECK(pFile != 0);
+	fwrite(elf.data(), 1, elf.size(), pFile);
+	fclose(pFile);
+
+	DeferredLogRenderer renderer;
+	CHECK(renderer.LoadELFFile(fileName.c_str()));
+	remove(fileName.c_str());
+
+	char records[64];
+	SmallNumberCoder coder(records, sizeof(records), 0, 0);
+	CHECK(coder.WriteBytes("\x07", 1));
+	CHECK(coder.WriteTinySIntWithFlag((int)formatAddress, false));
+	CHECK(coder.WriteTinySIntWithFlag(42, false));
+
+	CHECK(coder.WriteBytes("\x05", 1));
+	CHECK(coder.WriteTinySIntWithFlag(0x12345678, false)); //Unknown address
+
+	CHECK(coder.WriteBytes("\x08", 1));
+	CHECK(coder.WriteTinySIntWithFlag((int)formatAddress + 6, false));
+	CHECK(coder.WriteTinySIntWithFlag(2, false));
+	CHECK(coder.WriteBytes("ok", 2));
+
+	//Feeding the data byte by byte should not make any difference, and the unknown format string should not affect the other messages.
+	std::string output;
+	bool allRendered = true;
+	for (int i = 0; i < coder.GetOffset(); i++)
+		allRendered &= renderer.Feed((const unsigned char *)records + i, 1, output);
+
+	CHECK(!allRendered);
+	CHECK(output == "x=42\ny=ok\n");
+}
@@ -0,0 +1,196 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <TestResourceManager.h>
+#include <sched.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_CORE_COUNT=2 and SAMPLING_PROFILER_CORE_COUNT=2, with and without FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS.
+
+enum
+{
+	kRecordCount = 20000,
+	kTextChannel = 1,
+};
+
+#if FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+static const unsigned kRingsPerCore = 4;
+#else
+static const unsigned kRingsPerCore = 1;
+#endif
+
+struct SequencedRecord
+{
+	unsigned Core;
+	unsigned Sequence;
+};
+
+//Acts as the code running on one core: writes numbered records to a regular channel and to a profiler stream.
+static void ProduceRecords(unsigned core)
+{
+	SysprogsHostSimulator_SetCoreID(core);
+	for (unsigned i = 0; i < kRecordCount; i++)
+	{
+		SequencedRecord record = {core, i};
+		CHECK_EQUAL(sizeof(record), WriteToFastSemihostingChannel(kTextChannel, &record, sizeof(record), 1));
+
+		record.Sequence = ~i;
+		while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, &record, sizeof(record), 0, 0))
+			sched_yield();
+	}
+
+	FlushFastSemihostingBuffer();
+}
+
+//Checks that the stream contains kRecordCount records from the specified core in the original order.
+static void CheckSequence(const std::vector<unsigned char> &stream, unsigned core, bool inverted)
+{
+	CHECK_EQUAL(kRecordCount * sizeof(SequencedRecord), stream.size());
+	for (unsigned i = 0; i < kRecordCount; i++)
+	{
+		SequencedRecord record;
+		memcpy(&record, &stream[i * sizeof(record)], sizeof(record));
+		CHECK_EQUAL(core, record.Core);
+		CHECK_EQUAL(inverted ? ~i : i, record.Sequence);
+	}
+}
+
+TEST_GROUP(DualCoreTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_DualCoreTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	~TEST_GROUP_DualCoreTests()
+	{
+		Debugger.StopPollingThread();
+		SysprogsHostSimulator_SetCoreID(0);
+	}
+};
+
+TEST(DualCoreTests, EachCoreHasItsOwnRings)
+{
+	CHECK_EQUAL(2 * kRingsPerCore, Debugger.GetRingCount());
+
+	SysprogsHostSimulator_SetCoreID(1);
+	CHECK_EQUAL(5, WriteToFastSemihostingChannel(kTextChannel, "core1", 5, 1));
+	SysprogsHostSimulator_SetCoreID(0);
+	CHECK_EQUAL(5, WriteToFastSemihostingChannel(kTextChannel, "core0", 5, 1));
+
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(kTextChannel, 0) == std::vector<unsigned char>({'c', 'o', 'r', 'e', '0'}));
+	CHECK(Debugger.GetChannelData(kTextChannel, 1) == std::vector<unsigned char>({'c', 'o', 'r', 'e', '1'}));
+}
+
+TEST(DualCoreTests, ConcurrentProducersKeepTheirOrder)
+{
+	Debugger.StartPollingThread();
+	std::thread core0(ProduceRecords, 0), core1(ProduceRecords, 1);
+	core0.join();
+	core1.join();
+	Debugger.StopPollingThread();
+
+	for (unsigned core = 0; core < 2; core++)
+	{
+		CheckSequence(Debugger.GetChannelData(kTextChannel, core), core, false);
+		CheckSequence(Debugger.GetChannelData(pdcRealTimeAnalysisStream, core), core, true);
+	}
+}
+
+TEST(DualCoreTests, LegacyDebuggerReceivesBothCoresViaSharedRing)
+{
+	//Older debuggers only know the buffer of core 0, so both cores fall back to it (serialized by the same lock-free reservation as before).
+	Debugger.Reset();
+	Debugger.SetLegacyMode(true);
+	InitializeFastSemihosting();
+	CHECK_EQUAL(1, Debugger.GetRingCount());
+
+	std::thread core1([]() {
+		SysprogsHostSimulator_SetCoreID(1);
+		CHECK_EQUAL(3, WriteToFastSemihostingChannel(kTextChannel, "abc", 3, 1));
+	});
+	core1.join();
+
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(kTextChannel, 0) == std::vector<unsigned char>({'a', 'b', 'c'}));
+	CHECK(Debugger.GetChannelData(kTextChannel, 1).empty());
+}
+
+TEST(DualCoreTests, BlockingRequestsAreHandledOnSecondCore)
+{
+	Debugger.StartPollingThread();
+	unsigned long long time = 0;
+	std::thread core1([&time]() {
+		SysprogsHostSimulator_SetCoreID(1);
+		time = TRMGetHostSystemTime();
+	});
+	core1.join();
+
+	CHECK(time > 0x01D0000000000000ULL); //After 2014
+	CHECK_EQUAL(1, Debugger.GetResourceManager().GetBlockingRequestCount());
+}
+
+static char s_SimulatedCode[256];
+
+//Samples a simulated stack where every 4th slot looks like a return address. Different seeds produce different call stacks.
+static void TakeSamples(void **pStack, unsigned core, unsigned seed, int count)
+{
+	SysprogsHostSimulator_SetCoreID(core);
+	for (int i = 0; i < count; i++)
+	{
+		unsigned depth = (seed + i * 3) % 8;
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2 * ((seed + i) % 64), pStack + depth, pStack + depth, s_SimulatedCode + 4 * (seed % 16));
+	}
+	SysprogsHostSimulator_SetCoreID(0);
+}
+
+TEST(DualCoreTests, SamplesAreEncodedPerCore)
+{
+	void *stack[64];
+	for (int i = 0; i < 64; i++)
+		stack[i] = (i % 4) ? (void *)(uintptr_t)(0x1000 + i) : (void *)(s_SimulatedCode + i);
+	Debugger.SetSampledMemory(stack, stack + 64, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+	//Each core has its own delta-encoding state, so interleaving the samples of 2 cores should not affect the encoding. Both cores start
+	//from the initial state (no other test in this file samples core 1 first), so the same samples should produce the same stream.
+	for (int i = 0; i < 10; i++)
+	{
+		TakeSamples(stack, i & 1, i, 5);
+		TakeSamples(stack, !(i & 1), i, 5);
+		Debugger.Poll();
+	}
+
+	std::vector<unsigned char> &core0 = Debugger.GetChannelData(pdcSamplingProfilerStream, 0), &core1 = Debugger.GetChannelData(pdcSamplingProfilerStream, 1);
+	CHECK(!core0.empty());
+	CHECK(core0 == core1);
+	Debugger.SetSampledMemory(0, 0, 0, 0);
+}
+
+TEST(DualCoreTests, SecondCoreIsNotSampledWithLegacyDebugger)
+{
+	//The delta-encoded samples of 2 cores cannot be told apart in a single stream, so only core 0 is reported.
+	Debugger.Reset();
+	Debugger.SetLegacyMode(true);
+	InitializeFastSemihosting();
+	CHECK_EQUAL(1, SysprogsProfiler_GetReportedCoreCount());
+
+	void *stack[64] = {s_SimulatedCode + 8};
+	Debugger.SetSampledMemory(stack, stack + 64, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+	TakeSamples(stack, 1, 0, 5);
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream, 0).empty());
+
+	TakeSamples(stack, 0, 0, 5);
+	Debugger.Poll();
+	CHECK(!Debugger.GetChannelData(pdcSamplingProfilerStream, 0).empty());
+	Debugger.SetSampledMemory(0, 0, 0, 0);
+}
@@ -0,0 +1,79 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+/*
+	Measures the per-record cost of sending profiler records via the fast semihosting buffer.
+	The simulated debugger drains the buffer from a separate thread, so the numbers include the waiting time
+	if the writer is faster than the reader. The amount of bytes read per poll shows how well the updates are batched
+	(see FAST_SEMIHOSTING_COMMIT_THRESHOLD).
+*/
+
+enum
+{
+	kRecordCount = 1000000,
+};
+
+struct BenchmarkRecord
+{
+	unsigned Header[3];
+	unsigned Payload[4];
+};
+
+template <class _Function> static void RunBenchmark(const char *pName, _Function function)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	InitializeFastSemihosting();
+
+	std::atomic<bool> done(false);
+	std::thread reader([&]() {
+		while (!done)
+		{
+			if (!debugger.Poll())
+				std::this_thread::yield();
+			debugger.GetChannelData(pdcRealTimeAnalysisStream).clear();
+		}
+	});
+
+	BenchmarkRecord record = {{1, 2, 3}, {4, 5, 6, 7}};
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < kRecordCount; i++)
+	{
+		record.Header[1] = i;
+		function(record);
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	FlushFastSemihostingBuffer();
+	done = true;
+	reader.join();
+
+	double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	printf("%-40s %8.1f ns/record %8.1f bytes/poll\n", pName, ns / kRecordCount, (double)debugger.GetTotalBytesRead() / debugger.GetDataPollCount());
+}
+
+int main()
+{
+	RunBenchmark("2 x WriteToFastSemihostingChannel()", [](const BenchmarkRecord &record) {
+		WriteToFastSemihostingChannel(pdcRealTimeAnalysisStream, record.Header, sizeof(record.Header), 1);
+		WriteToFastSemihostingChannel(pdcRealTimeAnalysisStream, record.Payload, sizeof(record.Payload), 1);
+	});
+
+	RunBenchmark("SysprogsProfiler_WriteData()", [](const BenchmarkRecord &record) {
+		while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, record.Header, sizeof(record.Header), record.Payload, sizeof(record.Payload)))
+			std::this_thread::yield();
+	});
+
+	RunBenchmark("SysprogsProfiler_WriteDataV(), 3 segments", [](const BenchmarkRecord &record) {
+		ProfilerDataSegment segments[] = {{record.Header, sizeof(record.Header)}, {record.Payload, 8}, {record.Payload + 2, 8}};
+		while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, 3))
+			std::this_thread::yield();
+	});
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <FastSemihostingDecoder.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/*
+	Measures the throughput of FastSemihostingDecoder. The buffer snapshots are produced by the real WriteToFastSemihostingChannel()
+	and captured in advance, so the numbers only include the decoding and the copying into the per-channel streams.
+*/
+
+enum
+{
+	kSnapshotCount = 256,
+	kIterations = 50,
+};
+
+//Nearly fills the shared buffer with writes of the specified size, cycling through channelCount channels, and captures a copy of it after each round.
+static std::vector<std::vector<unsigned char>> CaptureSnapshots(unsigned writeSize, unsigned channelCount)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	InitializeFastSemihosting();
+
+	SimulatedFastSemihostingState *pState = debugger.GetSharedBufferState();
+	unsigned imageSize = 12 + debugger.GetBufferSize();
+	std::vector<unsigned char> data(writeSize, 0x55);
+	std::vector<std::vector<unsigned char>> snapshots;
+	unsigned channel = 0;
+
+	for (int i = 0; i < kSnapshotCount; i++)
+	{
+		//The writers would wait for the debugger if the buffer was full, so we stop before that (5 bytes is the largest switch record).
+		for (unsigned used = 0; used + writeSize + 5 <= debugger.GetBufferSize(); used += writeSize + 5)
+		{
+			WriteToFastSemihostingChannel(channel, data.data(), writeSize, 1);
+			channel = (channel + 1) % channelCount;
+		}
+
+		snapshots.push_back(std::vector<unsigned char>((const unsigned char *)pState, (const unsigned char *)pState + imageSize));
+		pState->ReadOffset = pState->WriteOffset & 0x7FFFFFFF;
+	}
+
+	return snapshots;
+}
+
+static void RunBenchmark(const char *pName, unsigned writeSize, unsigned channelCount)
+{
+	std::vector<std::vector<unsigned char>> images = CaptureSnapshots(writeSize, channelCount);
+	std::vector<unsigned char> channels[FastSemihostingDecoder::kChannelCount];
+	unsigned long long totalBytes = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int iteration = 0; iteration < kIterations; iteration++)
+	{
+		FastSemihostingDecoder decoder;
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			FastSemihostingSnapshot snapshot;
+			FastSemihostingSnapshot::FromMemoryImage(images[i].data(), images[i].size(), snapshot);
+			if (!decoder.Decode(snapshot, channels))
+			{
+				printf("%s: malformed snapshot\n", pName);
+				return;
+			}
+
+			totalBytes += (snapshot.WriteOffset - snapshot.ReadOffset) & 0x7FFFFFFF;
+			for (unsigned ch = 0; ch < channelCount; ch++)
+				channels[ch].clear();
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	printf("%-40s %8.1f MB/s\n", pName, totalBytes / seconds / 1e6);
+}
+
+int main()
+{
+	RunBenchmark("1 channel, 64-byte writes", 64, 1);
+	RunBenchmark("4 channels, 64-byte writes", 64, 4);
+	RunBenchmark("4 channels, 8-byte writes", 8, 4);
+	RunBenchmark("4 channels, 1000-byte writes", 1000, 4);
+	return 0;
+}
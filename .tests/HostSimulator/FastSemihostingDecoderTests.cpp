@@ -0,0 +1,120 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <FastSemihostingDecoder.h>
+#include <vector>
+
+/*
+	These tests capture the shared buffer directly (without SimulatedDebugger::Poll()) and decode it with FastSemihostingDecoder,
+	acting as a standalone tool reading the target memory.
+*/
+
+TEST_GROUP(FastSemihostingDecoderTests)
+{
+	SimulatedDebugger &Debugger;
+	unsigned m_Seed;
+
+	TEST_GROUP_FastSemihostingDecoderTests()
+		: Debugger(SimulatedDebugger::Instance()), m_Seed(12345)
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	unsigned Random(unsigned range)
+	{
+		m_Seed = m_Seed * 1103515245 + 12345;
+		return (m_Seed >> 8) % range;
+	}
+
+	FastSemihostingSnapshot CaptureSharedBuffer()
+	{
+		SimulatedFastSemihostingState *pState = Debugger.GetSharedBufferState();
+		FastSemihostingSnapshot snapshot = {pState->ReadOffset, pState->WriteOffset, pState->LastKnownSwitchOffset, (const unsigned char *)pState->Data, Debugger.GetBufferSize()};
+		return snapshot;
+	}
+};
+
+TEST(FastSemihostingDecoderTests, RandomWriteSequencesRoundTrip)
+{
+	//Each round fills up to the entire buffer with random writes, then decodes and consumes it, so the later rounds cover the wrap-around.
+	FastSemihostingDecoder decoder;
+	std::vector<unsigned char> expected[FastSemihostingDecoder::kChannelCount], decoded[FastSemihostingDecoder::kChannelCount];
+	std::vector<unsigned char> data;
+
+	for (int round = 0; round < 300; round++)
+	{
+		//The writers would wait for the debugger if the buffer was full, so each round stops before that (5 bytes is the largest switch record).
+		unsigned writeCount = 1 + Random(40), used = 0;
+		for (unsigned i = 0; i < writeCount; i++)
+		{
+			//Mostly use a few channels, so that both adjacent writes to the same channel and large deltas (4-byte records) occur.
+			//The last channel is reserved for padding.
+			unsigned char channel = Random(4) ? (unsigned char)Random(3) : (unsigned char)Random(FastSemihostingDecoder::kPaddingChannel);
+			data.resize(1 + Random(Random(8) ? 64 : 600));
+			if (used + data.size() + 5 > Debugger.GetBufferSize())
+				break;
+			used += (unsigned)data.size() + 5;
+			for (size_t j = 0; j < data.size(); j++)
+				data[j] = (unsigned char)Random(256);
+
+			CHECK_EQUAL(data.size(), WriteToFastSemihostingChannel(channel, data.data(), (int)data.size(), 1));
+			expected[channel].insert(expected[channel].end(), data.begin(), data.end());
+		}
+
+		FastSemihostingSnapshot snapshot = CaptureSharedBuffer();
+		CHECK(decoder.Decode(snapshot, decoded));
+		Debugger.GetSharedBufferState()->ReadOffset = snapshot.WriteOffset & 0x7FFFFFFF;
+	}
+
+	for (int i = 0; i < FastSemihostingDecoder::kChannelCount; i++)
+		CHECK(expected[i] == decoded[i]);
+}
+
+TEST(FastSemihostingDecoderTests, LongSwitchRecordsAreDecoded)
+{
+	//The target only uses 5-byte records after 8 MB of data, so we build the buffer by hand. The decoder only relies on the bit patterns,
+	//so a 5-byte record with a small delta is still valid: [1] [1] [4-byte record: delta 300, ch 5] [3] [5-byte record: delta 1, ch 6] [4]
+	unsigned char buffer[64] = {0};
+	unsigned offset = 0x7FFFFFF8; //The data wraps around the 31-bit offset range
+	unsigned char contents[] = {0x11, 0x22, 0x2C, 0x01, 0x80, 0x05, 0x33, 0x02, 0x00, 0x00, 0x00, 0x06, 0x44};
+	for (unsigned i = 0; i < sizeof(contents); i++)
+		buffer[(offset + i) % sizeof(buffer)] = contents[i];
+
+	FastSemihostingSnapshot snapshot = {offset, (offset + (unsigned)sizeof(contents)) & 0x7FFFFFFF, (offset + 12) & 0x7FFFFFFF, buffer, sizeof(buffer)};
+	FastSemihostingDecoder decoder(1);
+	std::vector<FastSemihostingDecoder::Segment> segments;
+
+	//The buffer initially has delta = 2, pointing into the middle of the first record. The decoder then reads garbage that eventually points before the read offset.
+	CHECK(!decoder.Decode(snapshot, segments));
+	CHECK_EQUAL(0, segments.size());
+	CHECK_EQUAL(1, decoder.GetCurrentChannel());
+
+	//The first record points 300 bytes back (before the read offset), so the data before it belongs to the current channel.
+	buffer[(offset + 7) % sizeof(buffer)] = 0x01;
+	CHECK(decoder.Decode(snapshot, segments));
+	CHECK_EQUAL(3, segments.size());
+	CHECK_EQUAL(1, segments[0].Channel);
+	CHECK_EQUAL(2, (segments[0].End - segments[0].Start) & 0x7FFFFFFF);
+	CHECK_EQUAL(5, segments[1].Channel);
+	CHECK_EQUAL(6, segments[2].Channel);
+	CHECK_EQUAL(6, decoder.GetCurrentChannel());
+
+	std::vector<unsigned char> output;
+	for (size_t i = 0; i < segments.size(); i++)
+		FastSemihostingDecoder::AppendSegment(snapshot, segments[i], output);
+	CHECK(output == std::vector<unsigned char>({0x11, 0x22, 0x33, 0x44}));
+}
+
+TEST(FastSemihostingDecoderTests, MemoryImageIsParsed)
+{
+	unsigned char image[12 + 8] = {4, 0, 0, 0, 6, 0, 0, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 'h', 'i', 0, 0};
+	FastSemihostingSnapshot snapshot;
+	CHECK(FastSemihostingSnapshot::FromMemoryImage(image, sizeof(image), snapshot));
+	CHECK_EQUAL(8, snapshot.Size);
+
+	std::vector<unsigned char> channels[FastSemihostingDecoder::kChannelCount];
+	FastSemihostingDecoder decoder;
+	CHECK(decoder.Decode(snapshot, channels));
+	CHECK(channels[0] == std::vector<unsigned char>({'h', 'i'}));
+}
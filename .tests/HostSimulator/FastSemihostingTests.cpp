@@ -0,0 +1,291 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_GROUP(FastSemihostingTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_FastSemihostingTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	//Polls the buffer from a background thread while the specified function runs, then collects the remaining data.
+	template <class _Function> void RunWithDebugger(_Function function)
+	{
+		std::atomic<bool> done(false);
+		std::thread reader([&]() {
+			while (!done)
+				if (!Debugger.Poll())
+					std::this_thread::yield();
+		});
+
+		function();
+		done = true;
+		reader.join();
+		Debugger.Poll();
+	}
+};
+
+static void FillRecord(std::vector<unsigned char> &record, unsigned char thread, unsigned sequence)
+{
+	unsigned payloadSize = (sequence * 7 + thread) % 61;
+	record.resize(6 + payloadSize);
+	record[0] = thread;
+	record[1] = sequence;
+	record[2] = sequence >> 8;
+	record[3] = sequence >> 16;
+	record[4] = sequence >> 24;
+	record[5] = payloadSize;
+	for (unsigned i = 0; i < payloadSize; i++)
+		record[6 + i] = (unsigned char)(sequence + i * 13);
+}
+
+TEST(FastSemihostingTests, ChannelSwitchEncodings)
+{
+	//Switch records use 2, 4 or 5 bytes depending on the amount of data since the previous switch.
+	static const unsigned sizes[] = {10, 300, 0x00800000 + 100, 1, 17};
+	std::vector<unsigned char> data(0x00800000 + 100);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)(i * 31);
+
+	RunWithDebugger([&]() {
+		for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			CHECK_EQUAL(sizes[i], WriteToFastSemihostingChannel(i + 1, data.data(), sizes[i], 1));
+	});
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		std::vector<unsigned char> &received = Debugger.GetChannelData(i + 1);
+		CHECK_EQUAL(sizes[i], received.size());
+		CHECK(!memcmp(received.data(), data.data(), sizes[i]));
+	}
+}
+
+TEST(FastSemihostingTests, ReservationWrapsAroundBufferEnd)
+{
+	unsigned bufferSize = Debugger.GetBufferSize();
+	std::vector<unsigned char> filler(bufferSize - 10, 0x55);
+	CHECK_EQUAL(filler.size(), WriteToFastSemihostingChannel(0, filler.data(), filler.size(), 1));
+
+	//The buffer is almost full, so the reservation must fail until the debugger reads the data.
+	FastSemihostingReservation reservation;
+	CHECK_EQUAL(0, ReserveFastSemihostingBuffer(0, 32, &reservation));
+	Debugger.Poll();
+
+	unsigned char record[32];
+	for (unsigned i = 0; i < sizeof(record); i++)
+		record[i] = i;
+
+	CHECK_EQUAL(sizeof(record), ReserveFastSemihostingBuffer(0, sizeof(record), &reservation));
+	CHECK_EQUAL(10, reservation.FirstSegmentSize);
+	CHECK_EQUAL(22, reservation.SecondSegmentSize);
+	CopyToFastSemihostingReservation(&reservation, 0, record, 5);
+	CopyToFastSemihostingReservation(&reservation, 5, record + 5, sizeof(record) - 5);
+
+	//Uncommitted data must not be visible to the debugger.
+	CHECK_EQUAL(0, Debugger.Poll());
+	CommitFastSemihostingBuffer(&reservation);
+	CHECK_EQUAL(sizeof(record), Debugger.Poll());
+
+	std::vector<unsigned char> &received = Debugger.GetChannelData(0);
+	CHECK_EQUAL(filler.size() + sizeof(record), received.size());
+	CHECK(!memcmp(received.data() + filler.size(), record, sizeof(record)));
+}
+
+TEST(FastSemihostingTests, ConcurrentWritersOnDifferentChannels)
+{
+	enum
+	{
+		kThreadCount = 8,
+		kRecordsPerThread = 20000,
+	};
+
+	RunWithDebugger([&]() {
+		std::vector<std::thread> writers;
+		for (int t = 0; t < kThreadCount; t++)
+			writers.push_back(std::thread([t]() {
+				std::vector<unsigned char> record;
+				for (unsigned seq = 0; seq < kRecordsPerThread; seq++)
+				{
+					FillRecord(record, t, seq);
+					if (seq & 1)
+						WriteToFastSemihostingChannel(t + 1, record.data(), record.size(), 1);
+					else
+					{
+						FastSemihostingReservation reservation;
+						while (!ReserveFastSemihostingBuffer(t + 1, record.size(), &reservation))
+							std::this_thread::yield();
+
+						CopyToFastSemihostingReservation(&reservation, 0, record.data(), record.size());
+						CommitFastSemihostingBuffer(&reservation);
+					}
+				}
+			}));
+
+		for (size_t i = 0; i < writers.size(); i++)
+			writers[i].join();
+	});
+
+	CHECK_EQUAL(0, Debugger.GetChannelData(0).size());
+	for (int t = 0; t < kThreadCount; t++)
+	{
+		std::vector<unsigned char> expected, record;
+		for (unsigned seq = 0; seq < kRecordsPerThread; seq++)
+		{
+			FillRecord(record, t, seq);
+			expected.insert(expected.end(), record.begin(), record.end());
+		}
+
+		std::vector<unsigned char> &received = Debugger.GetChannelData(t + 1);
+		CHECK_EQUAL(expected.size(), received.size());
+		CHECK(expected == received);
+	}
+}
+
+TEST(FastSemihostingTests, VariableSizeReservationReturnsUnusedSpace)
+{
+	//The entire buffer except the 2-byte channel switch record and the 10 bytes needed for the padding gets reserved.
+	FastSemihostingReservation reservation;
+	CHECK_EQUAL(Debugger.GetBufferSize() - 2 - 10, ReserveVariableSizeFastSemihostingBuffer(2, 16, 100000, &reservation));
+	CopyToFastSemihostingReservation(&reservation, 0, "hello", 5);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 5);
+
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(3, "x", 1, 1));
+	CHECK_EQUAL(10, ReserveVariableSizeFastSemihostingBuffer(2, 1, 10, &reservation));
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 0);
+	CHECK_EQUAL(3, WriteToFastSemihostingChannel(3, "yz!", 3, 1));
+
+	//Without concurrent writers, the unused space is returned to the buffer and no padding is written (only the switch records to channels 2, 3, 2, 3).
+	CHECK_EQUAL((2 + 5) + (2 + 1) + 2 + (2 + 3), Debugger.Poll());
+	CHECK(Debugger.GetChannelData(2) == std::vector<unsigned char>({'h', 'e', 'l', 'l', 'o'}));
+	CHECK(Debugger.GetChannelData(3) == std::vector<unsigned char>({'x', 'y', 'z', '!'}));
+}
+
+TEST(FastSemihostingTests, VariableSizeReservationDoesNotBlockOtherWriters)
+{
+	FastSemihostingReservation reservation, otherReservation;
+	CHECK_EQUAL(100, ReserveVariableSizeFastSemihostingBuffer(2, 16, 100, &reservation));
+
+	//Other writers (including another variable-size reservation) can use the buffer while the reservation is open.
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(3, "x", 1, 1));
+	CHECK_EQUAL(2, ReserveFastSemihostingBuffer(2, 2, &otherReservation));
+	CopyToFastSemihostingReservation(&otherReservation, 0, "yz", 2);
+	CommitFastSemihostingBuffer(&otherReservation);
+	CHECK_EQUAL(50, ReserveVariableSizeFastSemihostingBuffer(4, 1, 50, &otherReservation));
+	CopyToFastSemihostingReservation(&otherReservation, 0, "abc", 3);
+	CommitVariableSizeFastSemihostingBuffer(&otherReservation, 3);
+
+	//Only the switch record preceding the first reservation becomes visible before it is committed.
+	CHECK_EQUAL(2, Debugger.Poll());
+	CopyToFastSemihostingReservation(&reservation, 0, "hello", 5);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 5);
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(3, "!", 1, 1));
+
+	//The unused space of the first reservation has been turned into padding, while the last one was returned to the buffer.
+	CHECK_EQUAL((100 + 10) + (2 + 1) + (2 + 2) + (2 + 3) + (2 + 1), Debugger.Poll());
+	CHECK(Debugger.GetChannelData(2) == std::vector<unsigned char>({'h', 'e', 'l', 'l', 'o', 'y', 'z'}));
+	CHECK(Debugger.GetChannelData(3) == std::vector<unsigned char>({'x', '!'}));
+	CHECK(Debugger.GetChannelData(4) == std::vector<unsigned char>({'a', 'b', 'c'}));
+	CHECK_EQUAL(0, Debugger.GetChannelData(0x7F).size());
+}
+
+TEST(FastSemihostingTests, BlockingWriterDoesNotWaitForInterruptedReservation)
+{
+	//The write below acts like an interrupt handler running while the reservation is open. Nothing after the reservation can be published
+	//before it is committed, so the writer has to give up once the buffer is full instead of waiting for the debugger forever.
+	FastSemihostingReservation reservation;
+	CHECK_EQUAL(100, ReserveFastSemihostingBuffer(2, 100, &reservation));
+
+	std::vector<unsigned char> data(8192);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)(i * 7);
+
+	int written = 0;
+	RunWithDebugger([&]() { written = WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1); });
+	CHECK(written > 0);
+	CHECK(written < (int)Debugger.GetBufferSize());
+
+	std::vector<unsigned char> payload(100, 'x');
+	CopyToFastSemihostingReservation(&reservation, 0, payload.data(), payload.size());
+	CommitFastSemihostingBuffer(&reservation);
+	Debugger.Poll();
+	CHECK(Debugger.GetChannelData(2) == payload);
+	CHECK(Debugger.GetChannelData(1) == std::vector<unsigned char>(data.begin(), data.begin() + written));
+}
+
+TEST(FastSemihostingTests, VariableSizeReservationsFromConcurrentWriters)
+{
+	enum
+	{
+		kThreadCount = 4,
+		kRecordsPerThread = 20000,
+	};
+
+	RunWithDebugger([&]() {
+		std::vector<std::thread> writers;
+		for (int t = 0; t < kThreadCount; t++)
+			writers.push_back(std::thread([t]() {
+				std::vector<unsigned char> record;
+				for (unsigned seq = 0; seq < kRecordsPerThread; seq++)
+				{
+					FillRecord(record, t, seq);
+					FastSemihostingReservation reservation;
+					if (seq & 1)
+					{
+						while (!ReserveVariableSizeFastSemihostingBuffer(t + 1, record.size(), record.size() + 64, &reservation))
+							std::this_thread::yield();
+
+						CopyToFastSemihostingReservation(&reservation, 0, record.data(), record.size());
+						CommitVariableSizeFastSemihostingBuffer(&reservation, record.size());
+					}
+					else
+					{
+						while (!ReserveFastSemihostingBuffer(t + 1, record.size(), &reservation))
+							std::this_thread::yield();
+
+						CopyToFastSemihostingReservation(&reservation, 0, record.data(), record.size());
+						CommitFastSemihostingBuffer(&reservation);
+					}
+				}
+			}));
+
+		for (size_t i = 0; i < writers.size(); i++)
+			writers[i].join();
+	});
+
+	for (int t = 0; t < kThreadCount; t++)
+	{
+		std::vector<unsigned char> expected, record;
+		for (unsigned seq = 0; seq < kRecordsPerThread; seq++)
+		{
+			FillRecord(record, t, seq);
+			expected.insert(expected.end(), record.begin(), record.end());
+		}
+
+		CHECK(expected == Debugger.GetChannelData(t + 1));
+	}
+}
+
+TEST(FastSemihostingTests, WriteDataVConcatenatesSegments)
+{
+	ProfilerDataSegment segments[] = {{"abc", 3}, {0, 0}, {"de", 2}, {"fgh", 3}};
+	CHECK_EQUAL(8, SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, 4));
+
+	//The record is written all-or-nothing.
+	std::vector<unsigned char> large(Debugger.GetBufferSize());
+	ProfilerDataSegment largeSegments[] = {{"x", 1}, {large.data(), (unsigned)large.size()}};
+	CHECK_EQUAL(0, SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, largeSegments, 2));
+
+	Debugger.Poll();
+	std::vector<unsigned char> &received = Debugger.GetChannelData(pdcRealTimeAnalysisStream);
+	CHECK_EQUAL(8, received.size());
+	CHECK(!memcmp(received.data(), "abcdefgh", 8));
+}
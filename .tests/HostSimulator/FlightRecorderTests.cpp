@@ -0,0 +1,178 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_BLOCKING_MODE=2 (overwrite the oldest records).
+
+TEST_GROUP(FlightRecorderTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_FlightRecorderTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+};
+
+//Each record contains its size, sequence number and a pattern derived from them, so that any corruption can be detected.
+static std::vector<unsigned char> MakeRecord(unsigned sequence)
+{
+	std::vector<unsigned char> record(5 + sequence % 40);
+	record[0] = (unsigned char)record.size();
+	memcpy(&record[1], &sequence, 4);
+	for (size_t i = 5; i < record.size(); i++)
+		record[i] = (unsigned char)(sequence * 3 + i);
+	return record;
+}
+
+//Parses the records produced by MakeRecord() and returns their sequence numbers, or an empty vector if the data is corrupt.
+static std::vector<unsigned> ParseRecords(const std::vector<unsigned char> &data)
+{
+	std::vector<unsigned> sequences;
+	for (size_t offset = 0; offset < data.size();)
+	{
+		unsigned sequence;
+		if (data.size() - offset < 5)
+			return std::vector<unsigned>();
+		memcpy(&sequence, &data[offset + 1], 4);
+		std::vector<unsigned char> expected = MakeRecord(sequence);
+		if (data.size() - offset < expected.size() || memcmp(&data[offset], expected.data(), expected.size()))
+			return std::vector<unsigned>();
+		sequences.push_back(sequence);
+		offset += expected.size();
+	}
+	return sequences;
+}
+
+TEST(FlightRecorderTests, BufferKeepsLatestRecords)
+{
+	const unsigned count = 2000;
+	for (unsigned i = 0; i < count; i++)
+	{
+		std::vector<unsigned char> record = MakeRecord(i);
+		CHECK_EQUAL(record.size(), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, record.data(), 5, record.data() + 5, (unsigned)record.size() - 5));
+	}
+
+	//The debugger reads the buffer only once, as it would do with a crash dump.
+	Debugger.Poll();
+	std::vector<unsigned> sequences = ParseRecords(Debugger.GetChannelData(pdcRealTimeAnalysisStream));
+	CHECK(sequences.size() > Debugger.GetBufferSize() / (4 + 5 + 40));
+	CHECK_EQUAL(count - 1, sequences.back());
+	for (size_t i = 1; i < sequences.size(); i++)
+		CHECK_EQUAL(sequences[i - 1] + 1, sequences[i]);
+
+	CHECK(Debugger.GetOverwrittenByteCount() > 0);
+	CHECK_EQUAL(0, Debugger.GetFramingErrorCount());
+}
+
+TEST(FlightRecorderTests, EvictionStartsAtRecordBoundary)
+{
+	//The debugger may stop reading in the middle of a record. The writers should still evict the records starting from a record boundary.
+	unsigned sequence = 0;
+	for (; sequence < 10; sequence++)
+	{
+		std::vector<unsigned char> record = MakeRecord(sequence);
+		CHECK_EQUAL(record.size(), WriteToFastSemihostingChannel(1, record.data(), (int)record.size(), 1));
+	}
+
+	SimulatedFastSemihostingState *pState = Debugger.GetSharedBufferState();
+	pState->ReadOffset = (pState->WriteOffset & 0x7FFFFFFF) - 3;
+
+	const unsigned count = 2000;
+	for (; sequence < count; sequence++)
+	{
+		std::vector<unsigned char> record = MakeRecord(sequence);
+		CHECK_EQUAL(record.size(), WriteToFastSemihostingChannel(1, record.data(), (int)record.size(), 1));
+	}
+
+	Debugger.Poll();
+	CHECK_EQUAL(0, Debugger.GetFramingErrorCount());
+	std::vector<unsigned> sequences = ParseRecords(Debugger.GetChannelData(1));
+	CHECK(!sequences.empty());
+	CHECK_EQUAL(count - 1, sequences.back());
+	for (size_t i = 1; i < sequences.size(); i++)
+		CHECK_EQUAL(sequences[i - 1] + 1, sequences[i]);
+}
+
+TEST(FlightRecorderTests, LargeWritesNeverBlock)
+{
+	std::vector<unsigned char> data(Debugger.GetBufferSize() * 3);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)(i * 7);
+
+	CHECK_EQUAL(data.size(), WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1));
+	Debugger.Poll();
+
+	//Only the last chunks fit into the buffer.
+	std::vector<unsigned char> &received = Debugger.GetChannelData(1);
+	CHECK(!received.empty());
+	CHECK(received.size() < Debugger.GetBufferSize());
+	CHECK(std::equal(received.begin(), received.end(), data.end() - received.size()));
+}
+
+TEST(FlightRecorderTests, VariableSizeReservationUpdatesRecordSize)
+{
+	FastSemihostingReservation reservation;
+	CHECK(ReserveVariableSizeFastSemihostingBuffer(2, 4, 100, &reservation) >= 4);
+	CopyToFastSemihostingReservation(&reservation, 0, "hello", 5);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 5);
+	CHECK_EQUAL(3, WriteToFastSemihostingChannel(3, "abc", 3, 1));
+
+	CHECK_EQUAL(4 + 5 + 4 + 3, Debugger.Poll());
+	CHECK(Debugger.GetChannelData(2) == std::vector<unsigned char>({'h', 'e', 'l', 'l', 'o'}));
+	CHECK(Debugger.GetChannelData(3) == std::vector<unsigned char>({'a', 'b', 'c'}));
+}
+
+TEST(FlightRecorderTests, VariableSizeReservationIsPaddedAfterConcurrentWrites)
+{
+	FastSemihostingReservation reservation;
+	CHECK_EQUAL(100, ReserveVariableSizeFastSemihostingBuffer(2, 4, 100, &reservation));
+	CHECK_EQUAL(3, WriteToFastSemihostingChannel(3, "abc", 3, 1));
+	CopyToFastSemihostingReservation(&reservation, 0, "hello", 5);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 5);
+
+	//The record is followed by a padding record covering the rest of the reservation.
+	CHECK_EQUAL(4 + 100 + 4 + 4 + 3, Debugger.Poll());
+	CHECK_EQUAL(0, Debugger.GetFramingErrorCount());
+	CHECK(Debugger.GetChannelData(2) == std::vector<unsigned char>({'h', 'e', 'l', 'l', 'o'}));
+	CHECK(Debugger.GetChannelData(3) == std::vector<unsigned char>({'a', 'b', 'c'}));
+}
+
+TEST(FlightRecorderTests, ReaderResynchronizesAfterOverwrites)
+{
+	const unsigned count = 200000;
+	std::atomic<bool> done(false);
+	std::thread reader([&]() {
+		while (!done)
+		{
+			Debugger.Poll();
+			std::this_thread::yield();
+		}
+	});
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		std::vector<unsigned char> record = MakeRecord(i);
+		WriteToFastSemihostingChannel((i & 1) ? 1 : 2, record.data(), (int)record.size(), 1);
+	}
+
+	done = true;
+	reader.join();
+	Debugger.Poll();
+
+	//Records may be missing, but the remaining ones should be intact and in order.
+	CHECK_EQUAL(0, Debugger.GetFramingErrorCount());
+	for (int channel = 1; channel <= 2; channel++)
+	{
+		std::vector<unsigned> sequences = ParseRecords(Debugger.GetChannelData(channel));
+		CHECK(!sequences.empty());
+		for (size_t i = 1; i < sequences.size(); i++)
+			CHECK(sequences[i] > sequences[i - 1]);
+	}
+}
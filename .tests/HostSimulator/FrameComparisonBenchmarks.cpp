@@ -0,0 +1,86 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+	Measures the time taken by SysprogsProfiler_ProcessSample() on recursive stacks of different depths, where only the innermost frames
+	change between the samples. Built as FrameComparisonBenchmarks (SAMPLING_PROFILER_COMPARE_FRAMES = 1) and FrameComparisonBenchmarks_Raw
+	(SAMPLING_PROFILER_COMPARE_FRAMES = 2).
+
+	The default mode decodes the whole previous sample and encodes the whole new one, so its time grows with the stack depth, while the
+	raw comparison only encodes the changed frames. Both modes produce the same output here, as SP does not change between the samples.
+*/
+
+extern "C" void SysprogsHostSimulator_ResetSamplingProfiler();
+
+enum
+{
+	kStackSize = 1024,
+	kSampleCount = 200000,
+	kSamplesPerBatch = 8, //The buffer is read between the batches, outside the measured time
+};
+
+static char s_SimulatedCode[256];
+static void *s_Stack[kStackSize];
+
+static void RunBenchmark(int depth, int changedFrames)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	InitializeFastSemihosting();
+	SysprogsHostSimulator_ResetSamplingProfiler();
+
+	//Each recursion level takes 4 slots, the innermost changedFrames return addresses alternate between 2 values.
+	for (int i = 0; i < kStackSize; i++)
+		s_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+	for (int level = 0; level < depth; level++)
+		s_Stack[kStackSize - level * 4 - 1] = s_SimulatedCode + 16;
+
+	void **SP = s_Stack + kStackSize - depth * 4;
+	debugger.SetSampledMemory(s_Stack, s_Stack + kStackSize, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+	std::chrono::nanoseconds total(0);
+	unsigned long long bytes = 0;
+	for (int i = 0; i < kSampleCount; i += kSamplesPerBatch)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int j = 0; j < kSamplesPerBatch; j++)
+		{
+			for (int frame = 0; frame < changedFrames; frame++)
+				SP[frame * 4 + 3] = s_SimulatedCode + ((i + j) & 1 ? 32 : 48) + frame * 2;
+			SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, SP, SP, s_SimulatedCode + 4);
+		}
+		total += std::chrono::steady_clock::now() - start;
+
+		debugger.Poll();
+		std::vector<unsigned char> &data = debugger.GetChannelData(pdcSamplingProfilerStream);
+		bytes += data.size();
+		data.clear();
+	}
+
+	debugger.SetSampledMemory(0, 0, 0, 0);
+	printf("%5d %8d %10.1f ns %8.1f bytes\n", depth, changedFrames, (double)total.count() / kSampleCount, (double)bytes / kSampleCount);
+}
+
+int main()
+{
+#if SAMPLING_PROFILER_COMPARE_FRAMES == 2
+	printf("SAMPLING_PROFILER_COMPARE_FRAMES = 2 (raw stack comparison)\n");
+#else
+	printf("SAMPLING_PROFILER_COMPARE_FRAMES = 1 (decoding the previous sample)\n");
+#endif
+
+	printf("Depth  Changed     Sample time    Sample size\n");
+	static const int depths[] = {8, 16, 32, 64};
+	for (int depth : depths)
+	{
+		RunBenchmark(depth, 1);
+		RunBenchmark(depth, 4);
+	}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SampleStreamDecoder.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+	Decodes the samples reported by SysprogsProfiler_ProcessSample() via SampleStreamDecoder and compares the reconstructed stacks with
+	the simulated one. The same tests are built with SAMPLING_PROFILER_COMPARE_FRAMES = 1 (HostSimulatorTests) and 2 (HostSimulatorTests_RawFrameComparison).
+*/
+
+extern "C" void SysprogsHostSimulator_ResetSamplingProfiler();
+
+static char s_SimulatedCode[256];
+
+/*
+	The default mode walks the decoded previous sample along with the new one, and misses some of the reused frames (e.g. after a call adds
+	a frame at the top of the stack, or when the values do not fit into 32 bits on a 64-bit host). The samples are still correct, just larger,
+	so the amount of reused frames is only checked for the raw comparison.
+*/
+#if SAMPLING_PROFILER_COMPARE_FRAMES == 2
+static const bool kFramesAreReused = true;
+#else
+static const bool kFramesAreReused = false;
+#endif
+
+TEST_GROUP(FrameComparisonTests)
+{
+	enum
+	{
+		kStackSize = 512,
+		kMaxEntriesPerSample = 128, //MAX_ENTRIES_PER_STACK_SNAPSHOT
+		kRecursionDepth = 64,
+	};
+
+	SimulatedDebugger &Debugger;
+	SampleStreamDecoder Decoder;
+	void *m_Stack[kStackSize];
+	uint32_t m_Random;
+
+	TEST_GROUP_FrameComparisonTests()
+		: Debugger(SimulatedDebugger::Instance()), Decoder(sizeof(void *)), m_Random(0x2545F491)
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+		SysprogsHostSimulator_ResetSamplingProfiler();
+		Debugger.SetSampledMemory(m_Stack, m_Stack + kStackSize, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+		for (int i = 0; i < kStackSize; i++)
+			m_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+	}
+
+	~TEST_GROUP_FrameComparisonTests()
+	{
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+
+	unsigned Random(unsigned range)
+	{
+		m_Random ^= m_Random << 13;
+		m_Random ^= m_Random >> 17;
+		m_Random ^= m_Random << 5;
+		return m_Random % range;
+	}
+
+	//Fills the stack from the specified slot with frames of 4-16 slots, each ending with a return address and some of them with a saved FP.
+	void BuildFrames(int firstSlot)
+	{
+		for (int i = firstSlot; i < kStackSize; i++)
+			m_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+
+		for (int slot = firstSlot + 1 + Random(4); slot < kStackSize - 8; slot += 4 + Random(13))
+		{
+			m_Stack[slot] = s_SimulatedCode + 2 * Random(sizeof(s_SimulatedCode) / 2);
+			if (Random(4) == 0)
+				m_Stack[slot - 1] = &m_Stack[slot + 2 + Random(4)];
+		}
+	}
+
+	//Reports a sample with the specified SP and checks that the debugger can reconstruct the same stack entries as the profiler found.
+	//Returns false if the sample was not sent, as the changed entries did not fit into MAX_STACK_SNAPSHOT_SIZE.
+	bool CheckSample(int spIndex, std::vector<SampleStreamDecoder::Sample> &samples)
+	{
+		void **SP = m_Stack + spIndex;
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, SP, SP, s_SimulatedCode + 4);
+		Debugger.Poll();
+
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcSamplingProfilerStream);
+		size_t oldCount = samples.size();
+		CHECK(Decoder.Feed(data.data(), data.size(), samples));
+		data.clear();
+		if (samples.size() == oldCount)
+			return false;
+		CHECK_EQUAL(oldCount + 1, samples.size());
+
+		//Mirrors GetNextStackEntry()
+		std::vector<SampleStreamDecoder::StackEntry> expected;
+		void **lastEntry = SP;
+		for (void **slot = SP; slot < m_Stack + kStackSize && expected.size() < kMaxEntriesPerSample && ((char *)slot - (char *)lastEntry) < 256; slot++)
+		{
+			void **potentialFP = (void **)*slot;
+			bool isSavedFP = potentialFP > slot && potentialFP < m_Stack + kStackSize;
+			if (!isSavedFP && (*slot < s_SimulatedCode || *slot >= s_SimulatedCode + sizeof(s_SimulatedCode)))
+				continue;
+
+			SampleStreamDecoder::StackEntry entry = {(unsigned)(uintptr_t)slot, (unsigned)(uintptr_t)*slot, isSavedFP};
+			expected.push_back(entry);
+			lastEntry = slot;
+		}
+
+		const SampleStreamDecoder::Sample &sample = samples.back();
+		CHECK_EQUAL((unsigned)(uintptr_t)SP, sample.SP);
+		CHECK_EQUAL(expected.size(), sample.Entries.size());
+		for (size_t i = 0; i < expected.size() && i < sample.Entries.size(); i++)
+		{
+			CHECK_EQUAL(expected[i].Address, sample.Entries[i].Address);
+			CHECK_EQUAL(expected[i].Value, sample.Entries[i].Value);
+			CHECK(expected[i].IsSavedFP == sample.Entries[i].IsSavedFP);
+		}
+		return true;
+	}
+};
+
+TEST(FrameComparisonTests, OnlyChangedFramesAreSent)
+{
+	std::vector<SampleStreamDecoder::Sample> samples;
+	BuildFrames(0);
+	CHECK(CheckSample(0, samples));
+	CHECK_EQUAL(0, samples.back().ReusedEntries);
+
+	CHECK(CheckSample(0, samples));
+	if (kFramesAreReused)
+		CHECK_EQUAL(samples.back().Entries.size(), samples.back().ReusedEntries);
+
+	//Replace the innermost frames. Everything below them is reused.
+	int changedSlots = 0;
+	while (changedSlots < 16 || m_Stack[changedSlots] < s_SimulatedCode || m_Stack[changedSlots] >= s_SimulatedCode + sizeof(s_SimulatedCode))
+		changedSlots++;
+	for (int i = 0; i <= changedSlots; i++)
+		m_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+	m_Stack[changedSlots - 4] = s_SimulatedCode + 5;
+	m_Stack[changedSlots] = s_SimulatedCode + 7; //BuildFrames() only uses even addresses
+
+	CHECK(CheckSample(0, samples));
+	if (kFramesAreReused)
+		CHECK_EQUAL(2, samples.back().Entries.size() - samples.back().ReusedEntries);
+}
+
+TEST(FrameComparisonTests, RandomStacksAreReconstructed)
+{
+	//Calls and returns at different depths, and changes of the outer frames.
+	std::vector<SampleStreamDecoder::Sample> samples;
+	BuildFrames(0);
+	int sp = kStackSize / 2, sentSamples = 0;
+	for (int i = 0; i < 2000; i++)
+	{
+		switch (Random(4))
+		{
+		case 0:
+			sp = Random(kStackSize - 16);
+			break;
+		case 1:
+			sp += Random(16);
+			break;
+		case 2:
+			sp -= Random(16);
+			break;
+		default:
+			BuildFrames(sp + Random(32));
+			break;
+		}
+
+		if (sp < 0)
+			sp = 0;
+		if (sp >= kStackSize - 16)
+			sp = kStackSize - 16;
+		sentSamples += CheckSample(sp, samples);
+	}
+
+	CHECK(sentSamples > 1800);
+}
+
+TEST(FrameComparisonTests, DeepRecursionIsReconstructed)
+{
+	//Each recursion level takes 4 slots and has the same return address. Recursing deeper only adds one new entry per level.
+	std::vector<SampleStreamDecoder::Sample> samples;
+	for (int i = kStackSize - 4 * kRecursionDepth + 3; i < kStackSize; i += 4)
+		m_Stack[i] = s_SimulatedCode + 16;
+
+	for (int depth = 1; depth <= kRecursionDepth; depth++)
+	{
+		CHECK(CheckSample(kStackSize - depth * 4, samples));
+		if (kFramesAreReused)
+			CHECK_EQUAL(depth - 1, samples.back().ReusedEntries);
+	}
+
+	for (int depth = kRecursionDepth; depth > 0; depth -= 3)
+		CHECK(CheckSample(kStackSize - depth * 4, samples));
+}
@@ -0,0 +1,448 @@
+#include "HostSimulator.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <chrono>
+#include <thread>
+
+static const unsigned SysprogsSemihostingReasonBase = 0x50535953; //'SYSP';
+
+enum
+{
+	kInitializeFastSemihosting,
+	kControlFastSemihostingPolling,
+	kInitializeFastSemihostingV2,
+	kInitializeFastSemihostingV3,
+	kConfigureFastSemihostingDoorbell,
+	kConfigureFastSemihostingStatistics,
+};
+
+enum
+{
+	kBlockingRequestFlag = 0x80000000,
+	kResourceManagementChannel = 0x46, //pdcResourceManagementStream
+	kFastSemihostingFlagFramedRecords = 1,
+	kRecordMarker = 0xFA,
+	kRecordHeaderSize = 4,
+	kPaddingChannel = 0x7F,
+};
+
+//Returns the later of 2 offsets, taking the wrapping into account. Offsets reported by the target use 31 bits.
+static unsigned LaterOffset(unsigned a, unsigned b)
+{
+	return ((int)((a - b) << 1) > 0) ? a : b;
+}
+
+SimulatedDebugger::SimulatedDebugger()
+	: m_Legacy(false), m_DataPollCount(0), m_TotalBytesRead(0), m_OverwrittenBytes(0), m_FramingErrors(0), m_pDropStatistics(0), m_DropStatisticsSlotCount(0),
+	  m_pWaitingWriters(0), m_DoorbellIRQ(0), m_DoorbellCount(0), m_EventPending(false), m_StopPolling(false), m_ProbePollLatency(0), m_ProbeBytesPerSecond(0),
+	  m_StackRegion()
+{
+}
+
+SimulatedDebugger &SimulatedDebugger::Instance()
+{
+	static SimulatedDebugger instance;
+	return instance;
+}
+
+void SimulatedDebugger::Reset()
+{
+	m_Rings.clear();
+	m_Legacy = false;
+	m_DataPollCount = 0;
+	m_TotalBytesRead = 0;
+	m_OverwrittenBytes = 0;
+	m_FramingErrors = 0;
+	m_pWaitingWriters = 0;
+	m_DoorbellCount = 0;
+	m_pDropStatistics = 0;
+	m_DropStatisticsSlotCount = 0;
+	m_ResourceManager.Reset();
+	m_ProbePollLatency = 0;
+	m_ProbeBytesPerSecond = 0;
+	for (int core = 0; core < kMaxCores; core++)
+	{
+		CoreStreams &streams = m_Cores[core];
+		for (int i = 0; i < kChannelCount; i++)
+		{
+			streams.Channels[i].clear();
+			streams.Decompressors[i].Reset();
+			streams.TimestampDecoders[i].Reset();
+			streams.TimestampedRecords[i].clear();
+		}
+	}
+}
+
+void SimulatedDebugger::OnSemihostingCall(void *r0, void *r1, void *r2, void *r3)
+{
+	bool framed = ((uintptr_t)r3 & kFastSemihostingFlagFramedRecords) != 0;
+	switch ((unsigned)(uintptr_t)r0 - SysprogsSemihostingReasonBase)
+	{
+	case kInitializeFastSemihostingV2:
+	{
+		Ring ring = {(SimulatedFastSemihostingState *)r1, ((SimulatedFastSemihostingState *)r1)->Data, (unsigned)(uintptr_t)r2, kSharedRingChannel, 0, 0, framed};
+		m_Rings.assign(1, ring);
+		break;
+	}
+	case kInitializeFastSemihostingV3:
+	{
+		if (m_Legacy)
+			break; //Older debuggers do not acknowledge the call, so the target falls back to kInitializeFastSemihostingV2.
+
+		SimulatedControlBlock *pControlBlock = (SimulatedControlBlock *)r1;
+		m_Rings.clear();
+		for (unsigned i = 0; i < pControlBlock->RingCount; i++)
+		{
+			const SimulatedRingDescriptor &descriptor = pControlBlock->Rings[i];
+			unsigned channel = descriptor.Channel & ((1 << kRingDescriptorCoreShift) - 1), core = descriptor.Channel >> kRingDescriptorCoreShift;
+			if (core >= kMaxCores)
+			{
+				fprintf(stderr, "Unexpected core number in ring descriptor: %u\n", core);
+				abort();
+			}
+
+			Ring ring = {descriptor.pHeader, descriptor.pData, descriptor.Size, channel, core, (unsigned char)(channel & 0x7F), framed};
+			if (channel == kSharedRingChannel)
+				ring.Decoder.Reset(0);
+			m_Rings.push_back(ring);
+		}
+
+		pControlBlock->HostAcknowledged = 1;
+		break;
+	}
+	case kControlFastSemihostingPolling:
+		break;
+	case kConfigureFastSemihostingDoorbell:
+		m_pWaitingWriters = (volatile unsigned *)r1;
+		m_DoorbellIRQ = (unsigned)(uintptr_t)r2;
+		break;
+	case kConfigureFastSemihostingStatistics:
+		m_pDropStatistics = (const SimulatedDropStatistics *)r1;
+		m_DropStatisticsSlotCount = (unsigned)(uintptr_t)r2 / sizeof(SimulatedDropStatistics);
+		break;
+	default:
+		fprintf(stderr, "Unexpected semihosting call: 0x%x\n", (unsigned)(uintptr_t)r0);
+		abort();
+	}
+}
+
+unsigned SimulatedDebugger::GetDroppedWriteCount(unsigned char channel) const
+{
+	for (unsigned i = 0; i < m_DropStatisticsSlotCount; i++)
+		if (m_pDropStatistics[i].Channel == (0x100U | channel))
+			return m_pDropStatistics[i].DroppedWrites;
+	return 0;
+}
+
+unsigned SimulatedDebugger::GetDroppedByteCount(unsigned char channel) const
+{
+	for (unsigned i = 0; i < m_DropStatisticsSlotCount; i++)
+		if (m_pDropStatistics[i].Channel == (0x100U | channel))
+			return m_pDropStatistics[i].DroppedBytes;
+	return 0;
+}
+
+void SimulatedDebugger::AppendData(const Ring &ring, unsigned char channel, unsigned start, unsigned end)
+{
+	if (channel & (StreamDecompressor::kCompressedChannelFlag | TimestampedRecordDecoder::kTimestampedChannelFlag))
+	{
+		m_EncodedData.clear();
+		for (unsigned offset = start; offset != end; offset++)
+			m_EncodedData.push_back(ReadByte(ring, offset));
+
+		AppendDecodedData(ring.Core, channel, m_EncodedData.data(), m_EncodedData.size());
+		return;
+	}
+
+	std::vector<unsigned char> &stream = m_Cores[ring.Core].Channels[channel & 0x7F];
+	for (unsigned offset = start; offset != end; offset++)
+		stream.push_back(ReadByte(ring, offset));
+}
+
+//Appends the data received via a channel to the stream of the original channel, decoding the compressed and timestamped data.
+void SimulatedDebugger::AppendDecodedData(unsigned core, unsigned char channel, const unsigned char *pData, size_t size)
+{
+	CoreStreams &streams = m_Cores[core];
+	channel &= 0x7F;
+	if (channel == kPaddingChannel)
+		return; //Unused end of a variable-size reservation
+	if (channel & StreamDecompressor::kCompressedChannelFlag)
+	{
+		if (!streams.Decompressors[channel].Feed(pData, size, streams.Channels[channel & ~StreamDecompressor::kCompressedChannelFlag]))
+		{
+			fprintf(stderr, "Malformed compressed data in channel 0x%x\n", channel);
+			abort();
+		}
+	}
+	else if (channel & TimestampedRecordDecoder::kTimestampedChannelFlag)
+	{
+		unsigned char originalChannel = channel & ~TimestampedRecordDecoder::kTimestampedChannelFlag;
+		if (!streams.TimestampDecoders[channel].Feed(pData, size, streams.Channels[originalChannel], streams.TimestampedRecords[originalChannel]))
+		{
+			fprintf(stderr, "Malformed timestamped records in channel 0x%x\n", channel);
+			abort();
+		}
+	}
+	else
+		streams.Channels[channel].insert(streams.Channels[channel].end(), pData, pData + size);
+}
+
+unsigned SimulatedDebugger::Poll()
+{
+	//The target sets the blocking request flag after writing the request data, so it has to be checked before reading the data.
+	//Each core sets it in its own shared ring.
+	m_BlockingRequestRings.clear();
+	for (size_t i = 0; i < m_Rings.size(); i++)
+		if (m_Rings[i].Channel == kSharedRingChannel && (__atomic_load_n(&m_Rings[i].pHeader->WriteOffset, __ATOMIC_ACQUIRE) & kBlockingRequestFlag))
+			m_BlockingRequestRings.push_back(i);
+
+	if (m_ProbePollLatency)
+		std::this_thread::sleep_for(std::chrono::microseconds(m_ProbePollLatency));
+
+	unsigned total = 0;
+	for (size_t i = 0; i < m_Rings.size(); i++)
+		total += PollRing(m_Rings[i]);
+
+	ProcessResourceRequests();
+
+	if (total)
+	{
+		m_DataPollCount++;
+		m_TotalBytesRead += total;
+
+		//A real debugger would set the pending bit of the doorbell IRQ via the NVIC->ISPR register here.
+		if (m_pWaitingWriters && *m_pWaitingWriters)
+		{
+			std::lock_guard<std::mutex> lock(m_EventMutex);
+			m_DoorbellCount++;
+			m_EventPending = true;
+			m_EventCondition.notify_all();
+		}
+	}
+	return total;
+}
+
+void SimulatedDebugger::ProcessResourceRequests()
+{
+	for (int core = 0; core < kMaxCores; core++)
+		m_ResourceManager.ProcessNonBlockingRequests(m_Cores[core].Channels[kResourceManagementChannel]);
+	m_ResourceManager.UpdateReadBursts();
+
+	for (size_t i = 0; i < m_BlockingRequestRings.size(); i++)
+	{
+		m_ResourceManager.ProcessBlockingRequest();
+
+		//The target may still be advancing WriteOffset from other threads, so the flag is cleared atomically.
+		volatile unsigned *pWriteOffset = &m_Rings[m_BlockingRequestRings[i]].pHeader->WriteOffset;
+		__atomic_fetch_and(pWriteOffset, ~(unsigned)kBlockingRequestFlag, __ATOMIC_RELEASE);
+	}
+}
+
+void SimulatedDebugger::SimulateProbeTransfer(unsigned size)
+{
+	if (m_ProbeBytesPerSecond && size)
+		std::this_thread::sleep_for(std::chrono::duration<double>(size / m_ProbeBytesPerSecond));
+}
+
+void SimulatedDebugger::AddSampledCodeRegion(const void *pCodeStart, const void *pCodeEnd)
+{
+	ProfilerAddressRegion region = {pCodeStart, pCodeEnd};
+	std::vector<ProfilerAddressRegion>::iterator it = m_CodeRegions.begin();
+	while (it != m_CodeRegions.end() && it->Start < pCodeStart)
+		++it;
+	m_CodeRegions.insert(it, region);
+}
+
+void SimulatedDebugger::StartPollingThread()
+{
+	m_StopPolling = false;
+	m_PollingThread = std::thread([this]() {
+		while (!m_StopPolling)
+		{
+			if (!Poll())
+				std::this_thread::yield();
+		}
+		Poll();
+	});
+}
+
+void SimulatedDebugger::StopPollingThread()
+{
+	m_StopPolling = true;
+	if (m_PollingThread.joinable())
+		m_PollingThread.join();
+}
+
+void SimulatedDebugger::WaitForEvent()
+{
+	//Without the doorbell, WFE would only return on the next periodic interrupt (e.g. SysTick).
+	std::unique_lock<std::mutex> lock(m_EventMutex);
+	m_EventCondition.wait_for(lock, std::chrono::milliseconds(1), [this]() { return m_EventPending; });
+	m_EventPending = false;
+}
+
+unsigned SimulatedDebugger::PollFramedRing(Ring &ring)
+{
+	unsigned readOffset = ring.pHeader->ReadOffset;
+	unsigned writeOffset = __atomic_load_n(&ring.pHeader->WriteOffset, __ATOMIC_ACQUIRE) & 0x7FFFFFFF;
+	unsigned start = LaterOffset(readOffset, __atomic_load_n(&ring.pHeader->LastKnownSwitchOffset, __ATOMIC_ACQUIRE));
+	m_OverwrittenBytes += start - readOffset;
+	if ((int)((writeOffset - start) << 1) <= 0)
+		return 0;
+
+	SimulateProbeTransfer(writeOffset - start);
+	std::vector<unsigned char> data;
+	for (unsigned offset = start; offset != writeOffset; offset++)
+		data.push_back(ReadByte(ring, offset));
+
+	//The target only reuses the space after moving LastKnownSwitchOffset past it, so anything before its new value may have been overwritten
+	//while we were copying it. The new value always points to a record header, so we can continue parsing from there.
+	unsigned validStart = LaterOffset(start, __atomic_load_n(&ring.pHeader->LastKnownSwitchOffset, __ATOMIC_ACQUIRE));
+	size_t position = validStart - start;
+	if (position)
+	{
+		if (position > data.size())
+			position = data.size();
+		m_OverwrittenBytes += position;
+	}
+
+	while (position < data.size())
+	{
+		size_t payloadSize = data.size() - position < kRecordHeaderSize ? 0 : data[position + 2] | (data[position + 3] << 8);
+		if (data.size() - position < kRecordHeaderSize || data[position] != kRecordMarker || data.size() - position - kRecordHeaderSize < payloadSize)
+		{
+			m_FramingErrors++;
+			break;
+		}
+
+		AppendDecodedData(ring.Core, data[position + 1], data.data() + position + kRecordHeaderSize, payloadSize);
+		position += kRecordHeaderSize + payloadSize;
+	}
+
+	__atomic_store_n(&ring.pHeader->ReadOffset, writeOffset, __ATOMIC_RELEASE);
+	return writeOffset - start;
+}
+
+unsigned SimulatedDebugger::PollRing(Ring &ring)
+{
+	if (ring.Framed)
+		return PollFramedRing(ring);
+
+	unsigned readOffset = ring.pHeader->ReadOffset;
+	unsigned writeOffset, lastSwitchEnd;
+	for (;;)
+	{
+		//WriteOffset is published after LastKnownSwitchOffset, so reading them in the opposite order guarantees that
+		//all switch records before WriteOffset are reachable from LastKnownSwitchOffset.
+		writeOffset = __atomic_load_n(&ring.pHeader->WriteOffset, __ATOMIC_ACQUIRE) & 0x7FFFFFFF;
+		lastSwitchEnd = __atomic_load_n(&ring.pHeader->LastKnownSwitchOffset, __ATOMIC_ACQUIRE);
+		if ((int)((lastSwitchEnd - writeOffset) << 1) <= 0)
+			break;
+	}
+
+	SimulateProbeTransfer(writeOffset - readOffset);
+	if (ring.Channel != kSharedRingChannel)
+	{
+		//Dedicated rings never contain channel switch records.
+		AppendData(ring, ring.Decoder.GetCurrentChannel(), readOffset, writeOffset);
+		__atomic_store_n(&ring.pHeader->ReadOffset, writeOffset, __ATOMIC_RELEASE);
+		return writeOffset - readOffset;
+	}
+
+	FastSemihostingSnapshot snapshot = {readOffset, writeOffset, lastSwitchEnd, (const unsigned char *)ring.pData, ring.Size};
+	m_Segments.clear();
+	if (!ring.Decoder.Decode(snapshot, m_Segments))
+	{
+		fprintf(stderr, "Malformed channel switch records at offset 0x%x\n", readOffset);
+		abort();
+	}
+
+	for (size_t i = 0; i < m_Segments.size(); i++)
+		AppendData(ring, m_Segments[i].Channel, m_Segments[i].Start, m_Segments[i].End);
+
+	__atomic_store_n(&ring.pHeader->ReadOffset, writeOffset, __ATOMIC_RELEASE);
+	return writeOffset - readOffset;
+}
+
+extern "C" void SysprogsHostSimulator_RunSemihostingCall(void *r0, void *r1, void *r2, void *r3)
+{
+	SimulatedDebugger::Instance().OnSemihostingCall(r0, r1, r2, r3);
+}
+
+extern "C" void SysprogsHostSimulator_Yield()
+{
+	sched_yield();
+}
+
+extern "C" void SysprogsHostSimulator_WaitForEvent()
+{
+	SimulatedDebugger::Instance().WaitForEvent();
+}
+
+extern "C" void SysprogsHostSimulator_Sleep()
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static thread_local unsigned s_CoreID;
+
+extern "C" void SysprogsHostSimulator_SetCoreID(unsigned core)
+{
+	s_CoreID = core;
+}
+
+extern "C" unsigned SysprogsHostSimulator_GetCoreID()
+{
+	return s_CoreID;
+}
+
+extern "C" unsigned SysprogsHostSimulator_MapAddress(const volatile void *p)
+{
+	return SimulatedDebugger::Instance().GetResourceManager().MapAddress(p);
+}
+
+//Emulates DWT->CYCCNT using the host clock (1 cycle = 1 ns).
+extern "C" unsigned SysprogsHostSimulator_GetCycleCount()
+{
+	return (unsigned)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+extern "C" unsigned SysprogsInstrumentingProfiler_QueryAndResetPerformanceCounter()
+{
+	static unsigned lastValue;
+	unsigned value = SysprogsHostSimulator_GetCycleCount();
+	unsigned result = value - lastValue;
+	lastValue = value;
+	return result;
+}
+
+//The sampling profiler relies on the target-specific memory layout (see SYSPROGS_PROFILER_USE_CUSTOM_ADDRESS_VALIDATORS).
+volatile int g_SamplingProfilerRate = 100;
+
+extern "C" int IsValidCodeAddress(void *pAddr)
+{
+	return SimulatedDebugger::Instance().IsValidCodeAddress(pAddr);
+}
+
+extern "C" int IsValidStackAddress(void **pStackSlot)
+{
+	return SimulatedDebugger::Instance().IsValidStackAddress(pStackSlot);
+}
+
+extern "C" void *SysprogsHostSimulator_GetEndOfStack()
+{
+	return SimulatedDebugger::Instance().GetEndOfStack();
+}
+
+//Used instead of the linker-generated tables with SYSPROGS_PROFILER_ADDRESS_REGIONS=1.
+extern "C" const ProfilerAddressRegion *SysprogsHostSimulator_GetCodeRegions(unsigned *pCount)
+{
+	return SimulatedDebugger::Instance().GetCodeRegions(pCount);
+}
+
+extern "C" const ProfilerAddressRegion *SysprogsHostSimulator_GetStackRegions(unsigned *pCount)
+{
+	return SimulatedDebugger::Instance().GetStackRegions(pCount);
+}
@@ -0,0 +1,299 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FastSemihostingDecoder.h"
+#include "ProfilerAddressRegions.h"
+#include "StreamDecompressor.h"
+#include "TimestampedRecordDecoder.h"
+#include "SimulatedResourceManager.h"
+
+/*
+	The host simulator plays the role of VisualGDB for the target-side framework built for the development machine:
+	it handles the semihosting calls and demultiplexes the fast semihosting buffer into per-channel streams via FastSemihostingDecoder.
+	Data received via compressed channels (see FAST_SEMIHOSTING_COMPRESSED_CHANNELS) is decompressed into the original channel.
+	Payloads of the timestamped channels (see FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS) are appended to the original channel as well,
+	and their timestamps can be queried via GetTimestampedRecords().
+	Requests sent by TestResourceManager.cpp are handled by SimulatedResourceManager.
+	With FAST_SEMIHOSTING_CORE_COUNT > 1, each core writes to its own rings. The streams received from each core are kept separately
+	(see the 'core' argument of GetChannelData()), and the producer threads select the simulated core via SysprogsHostSimulator_SetCoreID().
+
+	The tests can either call Poll() explicitly, or start a polling thread that acts like a debugger continuously attached to the target.
+	The latter is needed for the code that waits for the debugger, e.g. the Test Resource Manager calls.
+*/
+
+//Selects the core reported to the framework (FAST_SEMIHOSTING_GET_CORE_ID()) for the calling thread. Threads start on core 0.
+extern "C" void SysprogsHostSimulator_SetCoreID(unsigned core);
+
+struct SimulatedFastSemihostingState
+{
+	volatile unsigned ReadOffset;
+	volatile unsigned WriteOffset;
+	volatile unsigned LastKnownSwitchOffset;
+	char Data[1];
+};
+
+//Layout of the control block passed via kInitializeFastSemihostingV3.
+struct SimulatedRingDescriptor
+{
+	unsigned Channel; //Bits 8+ contain the core number
+	SimulatedFastSemihostingState *pHeader;
+	char *pData;
+	unsigned Size;
+};
+
+//Layout of the table passed via kConfigureFastSemihostingStatistics.
+struct SimulatedDropStatistics
+{
+	volatile unsigned Channel; //0x100 | channel, 0 for unused slots
+	volatile unsigned DroppedWrites;
+	volatile unsigned DroppedBytes;
+};
+
+struct SimulatedControlBlock
+{
+	volatile unsigned HostAcknowledged;
+	unsigned RingCount;
+	SimulatedRingDescriptor Rings[1];
+};
+
+class SimulatedDebugger
+{
+public:
+	enum
+	{
+		kChannelCount = 128,
+		kMaxCores = 2,
+	};
+
+	static SimulatedDebugger &Instance();
+
+	//Forgets all data received so far. The target side should be reinitialized via InitializeFastSemihosting() afterwards.
+	void Reset();
+
+	//Reads all data committed to the fast semihosting buffers, appends it to the per-channel streams and returns the amount of
+	//consumed bytes (including the channel switch records). Then handles the pending Test Resource Manager requests.
+	unsigned Poll();
+
+	//Makes Poll() take as long as reading the memory via a debug probe would: each call waits for pollLatencyMicroseconds (reading the header),
+	//and each ring waits for the transfer of the available data before updating ReadOffset. Reset() restores the default (no delays).
+	void SetProbeModel(unsigned pollLatencyMicroseconds, double bytesPerSecond)
+	{
+		m_ProbePollLatency = pollLatencyMicroseconds;
+		m_ProbeBytesPerSecond = bytesPerSecond;
+	}
+
+	//Starts a thread that calls Poll() until StopPollingThread() is called. Poll() should not be called by the tests in the meantime.
+	void StartPollingThread();
+	void StopPollingThread();
+
+	SimulatedResourceManager &GetResourceManager()
+	{
+		return m_ResourceManager;
+	}
+
+	//Defines the memory treated as the stack and the code by the sampling profiler's address validators.
+	//Samples reported via SysprogsProfiler_ProcessSample() should point to the simulated stack.
+	void SetSampledMemory(void **pStackStart, void **pStackEnd, const void *pCodeStart, const void *pCodeEnd)
+	{
+		m_StackRegion.Start = pStackStart;
+		m_StackRegion.End = pStackEnd;
+		m_CodeRegions.clear();
+		AddSampledCodeRegion(pCodeStart, pCodeEnd);
+	}
+
+	//Defines an additional code region (e.g. functions placed into RAM). The regions are kept sorted, as required by SYSPROGS_PROFILER_ADDRESS_REGIONS.
+	void AddSampledCodeRegion(const void *pCodeStart, const void *pCodeEnd);
+
+	bool IsValidStackAddress(void **pStackSlot) const
+	{
+		return FindProfilerAddressRegion(&m_StackRegion, 1, pStackSlot) != 0;
+	}
+
+	bool IsValidCodeAddress(void *pAddr) const
+	{
+		return FindProfilerAddressRegion(m_CodeRegions.data(), (unsigned)m_CodeRegions.size(), pAddr) != 0;
+	}
+
+	const ProfilerAddressRegion *GetCodeRegions(unsigned *pCount) const
+	{
+		*pCount = (unsigned)m_CodeRegions.size();
+		return m_CodeRegions.data();
+	}
+
+	const ProfilerAddressRegion *GetStackRegions(unsigned *pCount) const
+	{
+		*pCount = 1;
+		return &m_StackRegion;
+	}
+
+	void **GetEndOfStack() const
+	{
+		return (void **)m_StackRegion.End;
+	}
+
+	//Returns the amount of Poll() calls that found new data since the last Reset().
+	unsigned GetDataPollCount() const
+	{
+		return m_DataPollCount;
+	}
+
+	//Returns the amount of bytes read from the buffers since the last Reset(), including the channel switch records.
+	unsigned long long GetTotalBytesRead() const
+	{
+		return m_TotalBytesRead;
+	}
+
+	//Returns the amount of bytes overwritten by the target before they could be read (FAST_SEMIHOSTING_BLOCKING_MODE=2).
+	unsigned long long GetOverwrittenByteCount() const
+	{
+		return m_OverwrittenBytes;
+	}
+
+	//Returns the amount of times a malformed record header was encountered (FAST_SEMIHOSTING_BLOCKING_MODE=2).
+	unsigned GetFramingErrorCount() const
+	{
+		return m_FramingErrors;
+	}
+
+	//Returns the IRQ number configured via FAST_SEMIHOSTING_DOORBELL_IRQ, or -1 if the doorbell is not used.
+	int GetDoorbellIRQ() const
+	{
+		return m_pWaitingWriters ? (int)m_DoorbellIRQ : -1;
+	}
+
+	//Returns the amount of times the doorbell interrupt was triggered since the last Reset().
+	unsigned GetDoorbellCount() const
+	{
+		return m_DoorbellCount;
+	}
+
+	//Returns the amount of failed writes on the channel reported via FAST_SEMIHOSTING_DROP_STATISTICS.
+	unsigned GetDroppedWriteCount(unsigned char channel) const;
+
+	//Returns the amount of bytes discarded on the channel reported via FAST_SEMIHOSTING_DROP_STATISTICS.
+	unsigned GetDroppedByteCount(unsigned char channel) const;
+
+	//Returns true if the target has reported the drop statistics table.
+	bool HasDropStatistics() const
+	{
+		return m_pDropStatistics != 0;
+	}
+
+	//Emulates the WFE instruction: waits until the doorbell interrupt is triggered, or a simulated periodic interrupt occurs.
+	void WaitForEvent();
+
+	//Emulates an older debugger that ignores the kInitializeFastSemihostingV3 call. Reset() restores the default behavior.
+	void SetLegacyMode(bool legacy)
+	{
+		m_Legacy = legacy;
+	}
+
+	std::vector<unsigned char> &GetChannelData(unsigned char channel, unsigned core = 0)
+	{
+		return m_Cores[core].Channels[channel & 0x7F];
+	}
+
+	//Returns the records received via the timestamped version of the channel. Their offsets refer to GetChannelData(channel, core).
+	std::vector<TimestampedRecordDecoder::Record> &GetTimestampedRecords(unsigned char channel, unsigned core = 0)
+	{
+		return m_Cores[core].TimestampedRecords[channel & 0x7F];
+	}
+
+	//Returns the header of the shared buffer, so that the tests can capture it via FastSemihostingSnapshot.
+	SimulatedFastSemihostingState *GetSharedBufferState() const
+	{
+		return m_Rings.empty() ? 0 : m_Rings[0].pHeader;
+	}
+
+	//Returns the size of the shared buffer.
+	unsigned GetBufferSize() const
+	{
+		return m_Rings.empty() ? 0 : m_Rings[0].Size;
+	}
+
+	//Returns the amount of ring buffers of all cores (1 if neither dedicated channel buffers, nor multiple cores are used).
+	unsigned GetRingCount() const
+	{
+		return (unsigned)m_Rings.size();
+	}
+
+	bool IsInitialized() const
+	{
+		return !m_Rings.empty();
+	}
+
+	void OnSemihostingCall(void *r0, void *r1, void *r2, void *r3);
+
+private:
+	enum
+	{
+		kSharedRingChannel = 0xFF,
+		kRingDescriptorCoreShift = 8,
+	};
+
+	struct Ring
+	{
+		SimulatedFastSemihostingState *pHeader;
+		const char *pData;
+		unsigned Size;
+		unsigned Channel;				//kSharedRingChannel if the ring contains channel switch records
+		unsigned Core;
+		FastSemihostingDecoder Decoder;	//Dedicated rings only use its current channel
+		bool Framed;					//Records have headers and may be overwritten by the target
+	};
+
+	SimulatedDebugger();
+
+	unsigned char ReadByte(const Ring &ring, unsigned offset) const
+	{
+		return ring.pData[offset % ring.Size];
+	}
+
+	void AppendData(const Ring &ring, unsigned char channel, unsigned start, unsigned end);
+	void AppendDecodedData(unsigned core, unsigned char channel, const unsigned char *pData, size_t size);
+	unsigned PollRing(Ring &ring);
+	unsigned PollFramedRing(Ring &ring);
+	void ProcessResourceRequests();
+	void SimulateProbeTransfer(unsigned size);
+
+private:
+	std::vector<Ring> m_Rings;
+	std::vector<FastSemihostingDecoder::Segment> m_Segments;
+	std::vector<size_t> m_BlockingRequestRings;
+	bool m_Legacy;
+	unsigned m_DataPollCount;
+	unsigned long long m_TotalBytesRead;
+	unsigned long long m_OverwrittenBytes;
+	unsigned m_FramingErrors;
+
+	const SimulatedDropStatistics *m_pDropStatistics;
+	unsigned m_DropStatisticsSlotCount;
+
+	volatile unsigned *m_pWaitingWriters;
+	unsigned m_DoorbellIRQ, m_DoorbellCount;
+	std::mutex m_EventMutex;
+	std::condition_variable m_EventCondition;
+	bool m_EventPending;
+
+	//The decoders keep their state between the records, so each core needs its own ones.
+	struct CoreStreams
+	{
+		std::vector<unsigned char> Channels[kChannelCount];
+		StreamDecompressor Decompressors[kChannelCount];
+		TimestampedRecordDecoder TimestampDecoders[kChannelCount];
+		std::vector<TimestampedRecordDecoder::Record> TimestampedRecords[kChannelCount];
+	} m_Cores[kMaxCores];
+
+	std::vector<unsigned char> m_EncodedData;
+
+	SimulatedResourceManager m_ResourceManager;
+	std::thread m_PollingThread;
+	volatile bool m_StopPolling;
+	unsigned m_ProbePollLatency;
+	double m_ProbeBytesPerSecond;
+
+	ProfilerAddressRegion m_StackRegion;
+	std::vector<ProfilerAddressRegion> m_CodeRegions;
+};
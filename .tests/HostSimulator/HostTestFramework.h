@@ -0,0 +1,83 @@
+#pragma once
+#include <stdio.h>
+#include <string.h>
+
+/*
+	Minimal replacement for the TinyEmbeddedTest macros, so that the host-side tests look exactly like the on-target ones.
+*/
+
+struct HostTestFailure
+{
+	const char *File;
+	int Line;
+	char Message[256];
+};
+
+class HostTestRegistration
+{
+public:
+	typedef void (*TestFunction)();
+
+	const char *Group, *Name;
+	TestFunction Function;
+	HostTestRegistration *pNext;
+
+	static HostTestRegistration *&First()
+	{
+		static HostTestRegistration *pFirst;
+		return pFirst;
+	}
+
+	HostTestRegistration(const char *group, const char *name, TestFunction function)
+		: Group(group), Name(name), Function(function), pNext(0)
+	{
+		HostTestRegistration **ppLast = &First();
+		while (*ppLast)
+			ppLast = &(*ppLast)->pNext;
+		*ppLast = this;
+	}
+};
+
+#define TEST_GROUP(group) struct TEST_GROUP_##group
+
+#define TEST(group, name)                                                                                               \
+	struct TEST_##group##_##name : public TEST_GROUP_##group                                                            \
+	{                                                                                                                   \
+		void Run();                                                                                                     \
+		static void Invoke()                                                                                            \
+		{                                                                                                               \
+			TEST_##group##_##name test;                                                                                 \
+			test.Run();                                                                                                 \
+		}                                                                                                               \
+	};                                                                                                                  \
+	static HostTestRegistration s_Registration_##group##_##name(#group, #name, &TEST_##group##_##name::Invoke);          \
+	void TEST_##group##_##name::Run()
+
+#define FAIL(message)                                                             \
+	do                                                                            \
+	{                                                                             \
+		HostTestFailure failure = {__FILE__, __LINE__, ""};                       \
+		snprintf(failure.Message, sizeof(failure.Message), "%s", message);       \
+		throw failure;                                                            \
+	} while (0)
+
+#define CHECK(condition)                 \
+	do                                   \
+	{                                    \
+		if (!(condition))                \
+			FAIL("CHECK(" #condition ")"); \
+	} while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                                                             \
+	do                                                                                                                            \
+	{                                                                                                                             \
+		long long expectedValue = (long long)(expected), actualValue = (long long)(actual);                                       \
+		if (expectedValue != actualValue)                                                                                         \
+		{                                                                                                                         \
+			HostTestFailure failure = {__FILE__, __LINE__, ""};                                                                   \
+			snprintf(failure.Message, sizeof(failure.Message), "expected %lld, got %lld (" #actual ")", expectedValue, actualValue); \
+			throw failure;                                                                                                        \
+		}                                                                                                                         \
+	} while (0)
+
+int RunAllTests();
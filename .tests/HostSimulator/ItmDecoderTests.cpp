@@ -0,0 +1,188 @@
+#include "HostTestFramework.h"
+#include "ItmPacketGenerator.h"
+#include <ItmPacketDecoder.h>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+/*
+	Feeds the SWO streams produced by ItmPacketGenerator (i.e. what ProfilerDriver_ITM.cpp would send) into ItmPacketDecoder and checks
+	the resulting flat profile and exception events. The data is fed in random chunks, as the debugger may split it anywhere.
+*/
+TEST_GROUP(ItmDecoderTests)
+{
+	uint32_t m_Random;
+	ItmPacketGenerator Generator;
+	ItmPacketDecoder Decoder;
+
+	TEST_GROUP_ItmDecoderTests()
+		: m_Random(0x2545F491)
+	{
+	}
+
+	unsigned Random(unsigned range)
+	{
+		m_Random ^= m_Random << 13;
+		m_Random ^= m_Random >> 17;
+		m_Random ^= m_Random << 5;
+		return m_Random % range;
+	}
+
+	bool FeedInChunks(std::vector<ItmPacketDecoder::ExceptionEvent> *pEvents = nullptr)
+	{
+		bool result = true;
+		for (size_t offset = 0; offset < Generator.Data.size();)
+		{
+			size_t chunk = 1 + Random(16);
+			if (chunk > Generator.Data.size() - offset)
+				chunk = Generator.Data.size() - offset;
+			result &= Decoder.Feed(Generator.Data.data() + offset, chunk, pEvents);
+			offset += chunk;
+		}
+		return result;
+	}
+
+	std::map<unsigned, unsigned> GetFlatProfile()
+	{
+		std::vector<AggregatedSampleDecoder::Stack> stacks;
+		Decoder.TakeFlatProfile(stacks);
+
+		std::map<unsigned, unsigned> profile;
+		for (const auto &stack : stacks)
+		{
+			CHECK_EQUAL(0, stack.Entries.size());
+			CHECK_EQUAL(0, stack.SP);
+			profile[stack.PC] += stack.Count;
+		}
+		return profile;
+	}
+};
+
+TEST(ItmDecoderTests, FlatProfileMatchesGeneratedSamples)
+{
+	//PC samples mixed with the other packet types that can share the SWO stream.
+	std::map<unsigned, unsigned> expected;
+	unsigned sleepSamples = 0;
+	Generator.Sync();
+	for (int i = 0; i < 20000; i++)
+	{
+		switch (Random(10))
+		{
+		case 0:
+			Generator.Instrumentation(Random(32), m_Random, 1 << Random(3));
+			break;
+		case 1:
+			Generator.LocalTimestamp(Random(4) ? Random(7) + 1 : m_Random & 0x3FFFFFF);
+			break;
+		case 2:
+			Generator.GlobalTimestamp(m_Random);
+			break;
+		case 3:
+			Generator.StimulusPortPage(Random(8));
+			break;
+		case 4:
+			Generator.EventCounter((unsigned char)Random(64));
+			break;
+		case 5:
+			Generator.SleepSample();
+			sleepSamples++;
+			break;
+		default:
+		{
+			//Includes addresses with zero and 0x80 bytes
+			static const unsigned addresses[] = {0x08000100, 0x08000202, 0x08001000, 0x00000080, 0x20000000, 0x08800000, 0x0800ABCE};
+			unsigned pc = addresses[Random(sizeof(addresses) / sizeof(addresses[0]))];
+			Generator.PCSample(pc);
+			expected[pc]++;
+			break;
+		}
+		}
+	}
+
+	CHECK(FeedInChunks());
+	CHECK(GetFlatProfile() == expected);
+	CHECK_EQUAL(sleepSamples, Decoder.GetStatistics().SleepSamples);
+	CHECK_EQUAL(1, Decoder.GetStatistics().SyncPackets);
+	CHECK_EQUAL(0, Decoder.GetStatistics().MalformedPackets);
+
+	//The counts are cleared after they are reported.
+	CHECK(GetFlatProfile().empty());
+	Generator.Data.clear();
+	Generator.PCSample(0x08000100);
+	CHECK(FeedInChunks());
+	CHECK_EQUAL(1, GetFlatProfile()[0x08000100]);
+}
+
+TEST(ItmDecoderTests, ExceptionEventsAreTimestamped)
+{
+	//SysTick interrupted by IRQ5, then back to thread mode.
+	Generator.LocalTimestamp(100);
+	Generator.Exception(15, 1);
+	Generator.LocalTimestamp(3);
+	Generator.PCSample(0x08000200);
+	Generator.Exception(21, 1);
+	Generator.LocalTimestamp(1000000);
+	Generator.Exception(21, 2);
+	Generator.Exception(15, 3);
+	Generator.LocalTimestamp(5);
+	Generator.Exception(15, 2);
+	Generator.Exception(0, 3);
+
+	std::vector<ItmPacketDecoder::ExceptionEvent> events;
+	CHECK(FeedInChunks(&events));
+	CHECK_EQUAL(6, events.size());
+	CHECK_EQUAL(6, Decoder.GetStatistics().ExceptionEvents);
+
+	static const ItmPacketDecoder::ExceptionEvent expected[] = {
+		{15, ItmPacketDecoder::kExceptionEntered, 100},
+		{21, ItmPacketDecoder::kExceptionEntered, 103},
+		{21, ItmPacketDecoder::kExceptionExited, 1000103},
+		{15, ItmPacketDecoder::kExceptionReturned, 1000103},
+		{15, ItmPacketDecoder::kExceptionExited, 1000108},
+		{0, ItmPacketDecoder::kExceptionReturned, 1000108},
+	};
+
+	for (size_t i = 0; i < events.size() && i < sizeof(expected) / sizeof(expected[0]); i++)
+	{
+		CHECK_EQUAL(expected[i].Number, events[i].Number);
+		CHECK_EQUAL(expected[i].Function, events[i].Function);
+		CHECK_EQUAL(expected[i].Timestamp, events[i].Timestamp);
+	}
+
+	CHECK_EQUAL(1, GetFlatProfile()[0x08000200]);
+}
+
+TEST(ItmDecoderTests, DecoderResynchronizesAfterCorruption)
+{
+	Generator.PCSample(0x08000100);
+	Generator.Overflow();
+	Generator.PCSample(0x08000200);
+
+	//A reserved header, followed by the packets that are ignored until the next synchronization packet.
+	Generator.Data.push_back(0x04);
+	Generator.PCSample(0x08000300);
+	Generator.Exception(16, 1);
+	Generator.Sync();
+	Generator.PCSample(0x08000400);
+
+	//Lost bytes in the middle of a PC sample.
+	Generator.PCSample(0x08000500);
+	Generator.Data.resize(Generator.Data.size() - 2);
+	Generator.PCSample(0x08000600);
+	Generator.Sync();
+	Generator.PCSample(0x08000700);
+
+	std::vector<ItmPacketDecoder::ExceptionEvent> events;
+	CHECK(!FeedInChunks(&events));
+	CHECK_EQUAL(0, events.size());
+	CHECK_EQUAL(1, Decoder.GetStatistics().Overflows);
+	CHECK_EQUAL(2, Decoder.GetStatistics().SyncPackets);
+	CHECK(Decoder.GetStatistics().MalformedPackets > 0);
+
+	std::map<unsigned, unsigned> profile = GetFlatProfile();
+	CHECK_EQUAL(1, profile[0x08000100]);
+	CHECK_EQUAL(1, profile[0x08000200]);
+	CHECK_EQUAL(0, profile[0x08000300]);
+	CHECK_EQUAL(1, profile[0x08000400]);
+	CHECK_EQUAL(1, profile[0x08000700]);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+/*
+	Produces the ITM packets that a Cortex-M core configured by ProfilerDriver_ITM.cpp would send via SWO, so that ItmPacketDecoder can be
+	tested without a board. Besides the PC samples and exception trace, it can emit the other packet types that may appear in the same
+	stream (instrumentation, timestamps, extension, overflow and synchronization packets).
+*/
+class ItmPacketGenerator
+{
+public:
+	std::vector<unsigned char> Data;
+
+	void Sync()
+	{
+		Data.insert(Data.end(), 5, 0);
+		Data.push_back(0x80);
+	}
+
+	void Overflow()
+	{
+		Data.push_back(0x70);
+	}
+
+	void PCSample(uint32_t pc)
+	{
+		HardwarePacket(2, pc, 4);
+	}
+
+	void SleepSample()
+	{
+		HardwarePacket(2, 0, 1);
+	}
+
+	//function: 1 = entered, 2 = exited, 3 = returned
+	void Exception(unsigned number, unsigned function)
+	{
+		HardwarePacket(1, (number & 0x1FF) | (function << 12), 2);
+	}
+
+	void EventCounter(unsigned char flags)
+	{
+		HardwarePacket(0, flags, 1);
+	}
+
+	void Instrumentation(unsigned port, uint32_t value, int size)
+	{
+		Data.push_back((unsigned char)((port << 3) | (size == 4 ? 3 : size)));
+		AppendValue(value, size);
+	}
+
+	//Uses the single-byte format for deltas 1..6 and format 1 otherwise.
+	void LocalTimestamp(uint32_t delta)
+	{
+		if (delta > 0 && delta < 7)
+			Data.push_back((unsigned char)(delta << 4));
+		else
+		{
+			Data.push_back(0xC0);
+			AppendContinuationValue(delta);
+		}
+	}
+
+	void GlobalTimestamp(uint32_t value)
+	{
+		Data.push_back(0x94);
+		AppendContinuationValue(value & 0x3FFFFFF);
+	}
+
+	void StimulusPortPage(unsigned page)
+	{
+		Data.push_back((unsigned char)(0x08 | ((page & 7) << 4)));
+	}
+
+private:
+	void HardwarePacket(unsigned discriminator, uint32_t value, int size)
+	{
+		Data.push_back((unsigned char)((discriminator << 3) | 4 | (size == 4 ? 3 : size)));
+		AppendValue(value, size);
+	}
+
+	void AppendValue(uint32_t value, int size)
+	{
+		for (int i = 0; i < size; i++)
+			Data.push_back((unsigned char)(value >> (i * 8)));
+	}
+
+	void AppendContinuationValue(uint32_t value)
+	{
+		do
+		{
+			unsigned char byte = value & 0x7F;
+			value >>= 7;
+			Data.push_back(value ? (byte | 0x80) : byte);
+		} while (value);
+	}
+};
@@ -0,0 +1,138 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <ProfilerAddressRegions.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <vector>
+
+extern volatile int g_SamplingProfilerDroppedPacketRatio;
+extern volatile int g_SamplingProfilerBufferUsage;
+extern volatile int g_SamplingProfilerAutoRate;
+extern volatile int g_SamplingProfilerRate;
+
+/*
+	These tests run the host builds of SamplingProfiler.cpp and the real-time watch part of InstrumentingProfiler.cpp.
+	The sampling profiler scans a simulated stack instead of the real one (see SimulatedDebugger::SetSampledMemory()).
+*/
+
+static char s_SimulatedCode[256];
+
+TEST_GROUP(ProfilerTests)
+{
+	SimulatedDebugger &Debugger;
+	void *m_Stack[64];
+
+	TEST_GROUP_ProfilerTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+
+		//Every 4th slot looks like a return address, the rest of the stack does not point to the code
+		for (int i = 0; i < 64; i++)
+			m_Stack[i] = (i % 4) ? (void *)(uintptr_t)(0x1000 + i) : (void *)(s_SimulatedCode + i);
+		Debugger.SetSampledMemory(m_Stack, m_Stack + 64, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+	}
+
+	~TEST_GROUP_ProfilerTests()
+	{
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+};
+
+TEST(ProfilerTests, SamplesAreReported)
+{
+	SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+	SysprogsProfiler_ProcessSample(s_SimulatedCode + 6, m_Stack + 4, m_Stack + 4, s_SimulatedCode + 4);
+	CHECK(Debugger.Poll() > 0);
+
+	//The first sample contains 16 stack entries taking at least 1 byte each. The second one may reuse them (SAMPLING_PROFILER_COMPARE_FRAMES).
+	CHECK(Debugger.GetChannelData(pdcSamplingProfilerStream).size() > 16);
+}
+
+TEST(ProfilerTests, DroppedSamplesAreCounted)
+{
+	//Without a debugger reading the buffer, it eventually fills up and the samples get dropped instead of blocking the caller.
+	for (int i = 0; i < 4096; i++)
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + (i & 0x7E), m_Stack + (i & 7), m_Stack + (i & 7), s_SimulatedCode + 4);
+
+	CHECK(g_SamplingProfilerDroppedPacketRatio > 0);
+	CHECK(Debugger.Poll() > 0);
+
+	//Once the buffer is available again, no more samples are dropped. The ratio is updated every 1024 samples, and the cycle
+	//may have started before the buffer got drained, so we need 2 cycles to get a clean one.
+	for (int i = 0; i < 2048; i++)
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+		Debugger.Poll();
+	}
+
+	CHECK_EQUAL(0, g_SamplingProfilerDroppedPacketRatio);
+	CHECK(g_SamplingProfilerBufferUsage >= 0 && g_SamplingProfilerBufferUsage < 512);
+}
+
+TEST(ProfilerTests, AutoRateFollowsBufferUsage)
+{
+	//While the debugger keeps the buffer empty, the rate grows (see SamplingRateController.h).
+	g_SamplingProfilerAutoRate = 1000;
+	for (int i = 0; i < 256; i++)
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+		Debugger.Poll();
+	}
+
+	int increasedRate = g_SamplingProfilerAutoRate;
+	CHECK(increasedRate > 1000);
+	CHECK_EQUAL(increasedRate, g_SamplingProfilerRate);
+	CHECK_EQUAL(0, g_SamplingProfilerDroppedPacketRatio);
+
+	//Once the debugger stops reading the buffer, it fills up, and the rate goes down.
+	for (int i = 0; i < 4096; i++)
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + (i & 0x7E), m_Stack + (i & 7), m_Stack + (i & 7), s_SimulatedCode + 4);
+
+	CHECK(g_SamplingProfilerAutoRate < increasedRate);
+	CHECK(g_SamplingProfilerDroppedPacketRatio > 0);
+
+	g_SamplingProfilerAutoRate = 0;
+	g_SamplingProfilerRate = 100;
+}
+
+TEST(ProfilerTests, RealTimeWatchRecordsAreReported)
+{
+	static int variable;
+	SysprogsProfiler_ReportIntegralValue(&variable, 1234, 0);
+	SysprogsProfiler_ReportGenericEvent(&variable, "event");
+	Debugger.Poll();
+
+	//[type = rtpUnsignedValueChanged] [time delta] [resource] [value], followed by [length << 8 | rtpCustomEvent] [time delta] [resource] "event"
+	std::vector<unsigned char> &data = Debugger.GetChannelData(pdcRealTimeAnalysisStream);
+	CHECK_EQUAL(16 + 12 + 5, data.size());
+
+	unsigned words[7];
+	memcpy(words, data.data(), sizeof(words));
+	CHECK_EQUAL(10, words[0]);
+	CHECK_EQUAL((unsigned)(uintptr_t)&variable, words[2]);
+	CHECK_EQUAL(1234, words[3]);
+	CHECK_EQUAL(5 << 8 | 12, words[4]);
+	CHECK(!memcmp(data.data() + 28, "event", 5));
+}
+
+TEST(ProfilerTests, AddressRegionsAreFoundViaBinarySearch)
+{
+	static char memory[100];
+	const ProfilerAddressRegion regions[] = {{memory, memory + 10}, {memory + 10, memory + 20}, {memory + 30, memory + 40}, {memory + 50, memory + 51}, {memory + 60, memory + 90}};
+	const unsigned count = sizeof(regions) / sizeof(regions[0]);
+
+	for (int i = 0; i < 100; i++)
+	{
+		const ProfilerAddressRegion *pExpected = 0;
+		for (unsigned j = 0; j < count; j++)
+			if (memory + i >= regions[j].Start && memory + i < regions[j].End)
+				pExpected = &regions[j];
+
+		//Each prefix of the table is a valid table as well, covering the odd and even region counts
+		for (unsigned prefix = 0; prefix <= count; prefix++)
+			CHECK(FindProfilerAddressRegion(regions, prefix, memory + i) == ((pExpected && pExpected < regions + prefix) ? pExpected : 0));
+	}
+}
@@ -0,0 +1,103 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <TestResourceManager.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/*
+	Measures the round-trip latency of the blocking Test Resource Manager calls and the throughput of the burst transfers.
+	The simulated debugger polls from a separate thread, so the latency mostly reflects the thread switching overhead of the host,
+	while the relative numbers show how many blocking calls each transfer method needs.
+	TRMBeginReadFileCached() spins without yielding while waiting for the data, so on single-core hosts the cached reads
+	are limited by the scheduler time slices rather than by the protocol.
+*/
+
+enum
+{
+	kBlockingCallCount = 20000,
+	kFileSize = 16 * 1024 * 1024,
+	kChunkSize = 4096,
+};
+
+template <class _Function> static void RunBenchmark(const char *pName, unsigned long long bytes, _Function function)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	auto start = std::chrono::steady_clock::now();
+	function();
+	auto end = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	if (bytes)
+		printf("%-40s %8.1f MB/s %8u blocking calls\n", pName, bytes * 1000.0 / ns, debugger.GetResourceManager().GetBlockingRequestCount());
+	else
+		printf("%-40s %8.1f ns/call\n", pName, ns / kBlockingCallCount);
+
+	debugger.StopPollingThread();
+	debugger.Reset();
+	InitializeFastSemihosting();
+	debugger.StartPollingThread();
+}
+
+int main()
+{
+	char directory[] = "/tmp/TestResourcesXXXXXX";
+	if (!mkdtemp(directory))
+		return 1;
+
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	debugger.GetResourceManager().SetRootDirectory(directory);
+	InitializeFastSemihosting();
+	debugger.StartPollingThread();
+
+	std::vector<char> chunk(kChunkSize, 'x');
+	char workArea[kChunkSize];
+
+	RunBenchmark("TRMGetHostSystemTime()", 0, []() {
+		for (int i = 0; i < kBlockingCallCount; i++)
+			TRMGetHostSystemTime();
+	});
+
+	RunBenchmark("TRMWriteFile()", kFileSize, [&]() {
+		TRMFileHandle hFile = TRMCreateFile("bench.dat", sfmCreateOrTruncateWriteOnly);
+		for (int i = 0; i < kFileSize / kChunkSize; i++)
+			TRMWriteFile(hFile, chunk.data(), chunk.size());
+		TRMCloseFile(hFile);
+	});
+
+	RunBenchmark("TRMWriteFileCached()", kFileSize, [&]() {
+		TRMFileHandle hFile = TRMCreateFile("bench.dat", sfmCreateOrTruncateWriteOnly);
+		TRMWriteBurstHandle hBurst = TRMBeginWriteBurst(hFile);
+		for (int i = 0; i < kFileSize / kChunkSize; i++)
+			TRMWriteFileCached(hBurst, chunk.data(), chunk.size());
+		TRMEndWriteBurst(hBurst);
+		TRMCloseFile(hFile);
+	});
+
+	RunBenchmark("TRMReadFile()", kFileSize, [&]() {
+		TRMFileHandle hFile = TRMCreateFile("bench.dat", sfmOpenReadOnly);
+		while (TRMReadFile(hFile, chunk.data(), chunk.size()) > 0)
+		{
+		}
+		TRMCloseFile(hFile);
+	});
+
+	RunBenchmark("TRMReadFileCached()", kFileSize, [&]() {
+		TRMFileHandle hFile = TRMCreateFile("bench.dat", sfmOpenReadOnly);
+		TRMReadBurstHandle hBurst = TRMBeginReadBurst(hFile, workArea, sizeof(workArea));
+		while (TRMReadFileCached(hBurst, chunk.data(), chunk.size(), 1) > 0)
+		{
+		}
+		TRMEndReadBurst(hBurst);
+		TRMCloseFile(hFile);
+	});
+
+	debugger.StopPollingThread();
+	debugger.Reset();
+	if (system((std::string("rm -rf ") + directory).c_str()))
+		return 1;
+	return 0;
+}
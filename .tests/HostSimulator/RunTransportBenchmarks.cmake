@@ -0,0 +1,25 @@
+# Runs the transport benchmark executables passed via BENCHMARKS (comma-separated) and merges their JSON output into OUTPUT.
+# Set BENCHMARK_ARGS to pass extra arguments (e.g. --total-bytes=1048576) to each benchmark.
+
+string(REPLACE "," ";" benchmarks "${BENCHMARKS}")
+set(results)
+foreach(benchmark ${benchmarks})
+	if(benchmark)
+		message(STATUS "Running ${benchmark}")
+		separate_arguments(args UNIX_COMMAND "${BENCHMARK_ARGS}")
+		execute_process(COMMAND ${benchmark} ${args} OUTPUT_VARIABLE output RESULT_VARIABLE status)
+		if(NOT status EQUAL 0)
+			message(FATAL_ERROR "${benchmark} failed: ${status}")
+		endif()
+
+		string(STRIP "${output}" output)
+		if(results)
+			set(results "${results},\n${output}")
+		else()
+			set(results "${output}")
+		endif()
+	endif()
+endforeach()
+
+file(WRITE ${OUTPUT} "[\n${results}\n]\n")
+message(STATUS "Results saved to ${OUTPUT}")
@@ -0,0 +1,119 @@
+#include "HostTestFramework.h"
+#include <SamplingPeriodJitter.h>
+#include <stdint.h>
+
+/*
+	Simulates the sampling timer (see SAMPLING_PROFILER_PERIOD_JITTER) against a periodic workload in virtual time: the control loop ISR
+	starts every LoopPeriod ticks and runs for 10% of that time, so an unbiased profiler should attribute 10% of the samples to it.
+*/
+TEST_GROUP(SamplingJitterTests)
+{
+	enum
+	{
+		kSampleCount = 200000,
+		kSamplingPeriod = 10000, //1 kHz at 10 MHz
+	};
+
+	struct PhaseStatistics
+	{
+		unsigned SamplesInISR;
+		unsigned SamplesPerPhase[10]; //Phase of each sample relative to the control loop, in 10% steps
+	};
+
+	static PhaseStatistics SampleControlLoop(unsigned loopPeriod, unsigned jitterPercent, unsigned initialPhase)
+	{
+		PhaseStatistics stats = {};
+		SamplingPeriodGenerator generator = {};
+		SamplingPeriodGenerator_Init(&generator, kSamplingPeriod, jitterPercent, 0x2545F491);
+
+		uint64_t time = initialPhase;
+		for (int i = 0; i < kSampleCount; i++)
+		{
+			time += SamplingPeriodGenerator_Next(&generator);
+			unsigned phase = (unsigned)(time % loopPeriod);
+			if (phase < loopPeriod / 10)
+				stats.SamplesInISR++;
+			stats.SamplesPerPhase[phase * 10 / loopPeriod]++;
+		}
+		return stats;
+	}
+
+	//Checks that the share is within 0.5% from 10% (the standard deviation of a truly random sampler is ~0.07% here).
+	static bool IsTenPercent(unsigned count)
+	{
+		return count > kSampleCount * 95 / 1000 && count < kSampleCount * 105 / 1000;
+	}
+};
+
+TEST(SamplingJitterTests, JitteredPeriodsPreserveMeanRate)
+{
+	SamplingPeriodGenerator generator = {};
+	SamplingPeriodGenerator_Init(&generator, kSamplingPeriod, 20, 1);
+
+	uint64_t total = 0;
+	unsigned minPeriod = ~0U, maxPeriod = 0;
+	for (int i = 0; i < kSampleCount * 5; i++)
+	{
+		unsigned period = SamplingPeriodGenerator_Next(&generator);
+		total += period;
+		if (period < minPeriod)
+			minPeriod = period;
+		if (period > maxPeriod)
+			maxPeriod = period;
+	}
+
+	double mean = (double)total / (kSampleCount * 5);
+	CHECK(mean > kSamplingPeriod * 0.9995 && mean < kSamplingPeriod * 1.0005);
+	CHECK_EQUAL(kSamplingPeriod * 8 / 10, minPeriod);
+	CHECK_EQUAL(kSamplingPeriod * 12 / 10, maxPeriod);
+}
+
+TEST(SamplingJitterTests, ReinitializingKeepsTheSequence)
+{
+	SamplingPeriodGenerator first = {}, second = {};
+	SamplingPeriodGenerator_Init(&first, 1000, 10, 123);
+	SamplingPeriodGenerator_Init(&second, 1000, 10, 456);
+	CHECK(SamplingPeriodGenerator_Next(&first) != SamplingPeriodGenerator_Next(&second) || SamplingPeriodGenerator_Next(&first) != SamplingPeriodGenerator_Next(&second));
+
+	//A rate change must not restart the sequence, otherwise frequent rate changes (e.g. from the autorate logic) would repeat the same periods.
+	unsigned state = first.State;
+	SamplingPeriodGenerator_Init(&first, 2000, 10, 123);
+	CHECK_EQUAL(state, first.State);
+	CHECK_EQUAL(200, first.Spread);
+
+	//Without jitter, the period is exactly the requested one.
+	SamplingPeriodGenerator_Init(&first, 2000, 0, 123);
+	for (int i = 0; i < 100; i++)
+		CHECK_EQUAL(2000, SamplingPeriodGenerator_Next(&first));
+}
+
+TEST(SamplingJitterTests, FixedPeriodAliasesWithControlLoop)
+{
+	//This is the problem solved by the jitter: depending on the phase, the ISR gets either all samples or none of them.
+	for (unsigned loopPeriod = kSamplingPeriod / 10; loopPeriod <= kSamplingPeriod; loopPeriod *= 10)
+	{
+		CHECK_EQUAL(kSampleCount, SampleControlLoop(loopPeriod, 0, 0).SamplesInISR);
+		CHECK_EQUAL(0, SampleControlLoop(loopPeriod, 0, loopPeriod / 2).SamplesInISR);
+	}
+}
+
+TEST(SamplingJitterTests, JitteredSamplingAttributesControlLoopFairly)
+{
+	//1 kHz and 10 kHz control loops, sampled at 1 kHz with different jitter amounts and initial phases.
+	static const unsigned jitterValues[] = {5, 10, 25, 50};
+	for (unsigned loopPeriod = kSamplingPeriod / 10; loopPeriod <= kSamplingPeriod; loopPeriod *= 10)
+	{
+		for (unsigned jitter : jitterValues)
+		{
+			for (unsigned initialPhase = 0; initialPhase < loopPeriod; initialPhase += loopPeriod / 4)
+			{
+				PhaseStatistics stats = SampleControlLoop(loopPeriod, jitter, initialPhase);
+				CHECK(IsTenPercent(stats.SamplesInISR));
+
+				//Not only the ISR, but every part of the loop should get its share.
+				for (unsigned count : stats.SamplesPerPhase)
+					CHECK(IsTenPercent(count));
+			}
+		}
+	}
+}
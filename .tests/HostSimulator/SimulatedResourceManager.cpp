@@ -0,0 +1,410 @@
+#include "SimulatedResourceManager.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//Must match the definitions in TestResourceManager.cpp and TestResourceManager.h
+enum NonBlockingResourceRequest
+{
+	nbrrInitialize,
+	nbrrProcessWriteBurstData,
+};
+
+enum BlockingResourceRequest
+{
+	brrInvalid,
+	brrGetSystemTime,
+	brrCreateFile,
+	brrCloseFile,
+	brrReadFile,
+	brrWriteFile,
+	brrGetFileSize,
+	brrSeekFile,
+	brrDeleteFile,
+	brrTruncateFile,
+	brrCreateDirectory,
+	brrDeleteDirectory,
+
+	brrBeginCachedRead,
+	brrEndCachedRead,
+	brrBeginCachedWrite,
+	brrEndCachedWrite,
+
+	brrReadStdin,
+};
+
+enum
+{
+	sfmCreateOrTruncateWriteOnly,
+	sfmCreateOrAppendWriteOnly,
+	sfmOpenReadOnly,
+	sfmCreateOrOpenReadWrite,
+	sfmCreateOrTruncateReadWrite,
+};
+
+enum
+{
+	trmSuccess = 0,
+	trmUnknownError = -1,
+	trmInvalidArgument = -2,
+};
+
+enum
+{
+	kReadBurstGenerationFlag = 0x80000000,
+	kReadBurstEOFFlag = 0x40000000,
+	kReadBurstOffsetMask = 0x3FFFFFFF,
+};
+
+static unsigned ReadUInt32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static bool DeleteDirectoryRecursively(const std::string &path)
+{
+	DIR *pDir = opendir(path.c_str());
+	if (!pDir)
+		return false;
+
+	bool ok = true;
+	while (struct dirent *pEntry = readdir(pDir))
+	{
+		if (!strcmp(pEntry->d_name, ".") || !strcmp(pEntry->d_name, ".."))
+			continue;
+
+		std::string entryPath = path + "/" + pEntry->d_name;
+		struct stat st;
+		if (lstat(entryPath.c_str(), &st))
+			ok = false;
+		else if (S_ISDIR(st.st_mode))
+			ok = DeleteDirectoryRecursively(entryPath) && ok;
+		else
+			ok = !unlink(entryPath.c_str()) && ok;
+	}
+
+	closedir(pDir);
+	return !rmdir(path.c_str()) && ok;
+}
+
+SimulatedResourceManager::SimulatedResourceManager()
+	: m_RootDirectory("."), m_pStateExtension(0), m_NextHandle(1), m_BlockingRequestCount(0)
+{
+}
+
+SimulatedResourceManager::~SimulatedResourceManager()
+{
+	Reset();
+}
+
+void SimulatedResourceManager::Reset()
+{
+	for (std::map<unsigned, int>::iterator it = m_Files.begin(); it != m_Files.end(); ++it)
+		close(it->second);
+
+	m_Files.clear();
+	m_ReadBursts.clear();
+	m_BlockingRequestCount = 0;
+}
+
+unsigned SimulatedResourceManager::MapAddress(const volatile void *p)
+{
+	if (!p)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(m_AddressMutex);
+	std::map<const volatile void *, unsigned>::iterator it = m_AddressTokens.find(p);
+	if (it != m_AddressTokens.end())
+		return it->second;
+
+	m_Addresses.push_back(p);
+	unsigned token = (unsigned)m_Addresses.size();
+	m_AddressTokens[p] = token;
+	return token;
+}
+
+void *SimulatedResourceManager::ResolveAddress(unsigned token)
+{
+	std::lock_guard<std::mutex> lock(m_AddressMutex);
+	if (!token || token > m_Addresses.size())
+	{
+		fprintf(stderr, "Unknown target address token: 0x%x\n", token);
+		abort();
+	}
+
+	return (void *)m_Addresses[token - 1];
+}
+
+bool SimulatedResourceManager::TranslatePath(unsigned nameToken, unsigned length, std::string &path) const
+{
+	std::string name((const char *)const_cast<SimulatedResourceManager *>(this)->ResolveAddress(nameToken), length);
+	for (size_t i = 0; i < name.size(); i++)
+		if (name[i] == '\\')
+			name[i] = '/';
+
+	//Like VisualGDB, we only allow accessing the files inside the root directory.
+	if (name.empty() || name[0] == '/' || name == ".." || !name.compare(0, 3, "../") || name.find("/../") != std::string::npos ||
+		(name.size() >= 3 && !name.compare(name.size() - 3, 3, "/..")))
+		return false;
+
+	path = m_RootDirectory + "/" + name;
+	return true;
+}
+
+int SimulatedResourceManager::GetFile(unsigned handle) const
+{
+	std::map<unsigned, int>::const_iterator it = m_Files.find(handle);
+	return it == m_Files.end() ? -1 : it->second;
+}
+
+unsigned SimulatedResourceManager::CreateFile(unsigned nameToken, unsigned length, unsigned mode)
+{
+	static const int flags[] = {
+		O_WRONLY | O_CREAT | O_TRUNC,
+		O_WRONLY | O_CREAT | O_APPEND,
+		O_RDONLY,
+		O_RDWR | O_CREAT,
+		O_RDWR | O_CREAT | O_TRUNC,
+	};
+
+	std::string path;
+	if (mode >= sizeof(flags) / sizeof(flags[0]) || !TranslatePath(nameToken, length, path))
+		return 0;
+
+	int file = open(path.c_str(), flags[mode], 0644);
+	if (file < 0)
+		return 0;
+
+	unsigned handle = m_NextHandle++;
+	m_Files[handle] = file;
+	return handle;
+}
+
+void SimulatedResourceManager::ProcessNonBlockingRequests(std::vector<unsigned char> &stream)
+{
+	size_t position = 0;
+	while (stream.size() - position >= 4)
+	{
+		const unsigned char *pRequest = stream.data() + position;
+		unsigned available = (unsigned)(stream.size() - position);
+		unsigned request = ReadUInt32(pRequest);
+		if (request == nbrrInitialize)
+		{
+			if (available < 12)
+				break;
+
+			m_pStateExtension = (StateExtension *)ResolveAddress(ReadUInt32(pRequest + 8));
+			*(volatile bool *)ResolveAddress(ReadUInt32(pRequest + 4)) = true;
+			position += 12;
+		}
+		else if (request == nbrrProcessWriteBurstData)
+		{
+			if (available < 12 || available - 12 < ReadUInt32(pRequest + 8))
+				break;
+
+			unsigned size = ReadUInt32(pRequest + 8);
+			int file = GetFile(ReadUInt32(pRequest + 4));
+			if (file < 0 || write(file, pRequest + 12, size) != (ssize_t)size)
+				fprintf(stderr, "Failed to write burst data to handle %u\n", ReadUInt32(pRequest + 4));
+			position += 12 + size;
+		}
+		else
+		{
+			fprintf(stderr, "Unexpected resource manager request: %u\n", request);
+			abort();
+		}
+	}
+
+	stream.erase(stream.begin(), stream.begin() + position);
+}
+
+void SimulatedResourceManager::ProcessBlockingRequest()
+{
+	if (!m_pStateExtension)
+	{
+		fprintf(stderr, "Blocking request received before nbrrInitialize\n");
+		abort();
+	}
+
+	volatile unsigned *pArgs = m_pStateExtension->Arguments;
+	int file = -1;
+	switch (m_pStateExtension->Command)
+	{
+	case brrCloseFile:
+	case brrReadFile:
+	case brrWriteFile:
+	case brrGetFileSize:
+	case brrSeekFile:
+	case brrTruncateFile:
+	case brrBeginCachedRead:
+		file = GetFile(pArgs[0]);
+		break;
+	}
+
+	m_BlockingRequestCount++;
+	switch (m_pStateExtension->Command)
+	{
+	case brrGetSystemTime:
+	{
+		//Windows FILETIME: 100-nanosecond intervals since January 1, 1601
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		uint64_t time = (now.tv_sec + 11644473600ULL) * 10000000ULL + now.tv_nsec / 100;
+		pArgs[0] = (unsigned)time;
+		pArgs[1] = (unsigned)(time >> 32);
+		break;
+	}
+	case brrCreateFile:
+		pArgs[0] = CreateFile(pArgs[0], pArgs[1], pArgs[2]);
+		break;
+	case brrCloseFile:
+		if (file >= 0)
+		{
+			close(file);
+			m_Files.erase((unsigned)pArgs[0]);
+		}
+		break;
+	case brrReadFile:
+	case brrWriteFile:
+	{
+		char *pBuffer = (char *)ResolveAddress(pArgs[1]);
+		ssize_t done = -1;
+		if (file >= 0)
+		{
+			if (m_pStateExtension->Command == brrReadFile)
+				done = read(file, pBuffer, pArgs[2]);
+			else
+				done = write(file, pBuffer, pArgs[2]);
+		}
+		pArgs[0] = (unsigned)done;
+		break;
+	}
+	case brrGetFileSize:
+	case brrSeekFile:
+	{
+		int64_t result = -1;
+		struct stat st;
+		if (file < 0)
+			result = -1;
+		else if (m_pStateExtension->Command == brrGetFileSize)
+			result = fstat(file, &st) ? -1 : st.st_size;
+		else
+			result = lseek(file, *(const int64_t *)ResolveAddress(pArgs[2]), (int)pArgs[1]);
+
+		pArgs[0] = (unsigned)result;
+		pArgs[1] = (unsigned)((uint64_t)result >> 32);
+		break;
+	}
+	case brrTruncateFile:
+		if (file >= 0 && ftruncate(file, lseek(file, 0, SEEK_CUR)))
+			fprintf(stderr, "Failed to truncate handle %u\n", pArgs[0]);
+		break;
+	case brrDeleteFile:
+	case brrCreateDirectory:
+	case brrDeleteDirectory:
+	{
+		std::string path;
+		bool ok = TranslatePath(pArgs[0], pArgs[1], path);
+		if (ok && m_pStateExtension->Command == brrDeleteFile)
+			ok = !unlink(path.c_str());
+		else if (ok && m_pStateExtension->Command == brrCreateDirectory)
+			ok = !mkdir(path.c_str(), 0755);
+		else if (ok)
+			ok = pArgs[2] ? DeleteDirectoryRecursively(path) : !rmdir(path.c_str());
+
+		pArgs[0] = ok ? (unsigned)trmSuccess : (unsigned)trmUnknownError;
+		break;
+	}
+	case brrBeginCachedRead:
+	{
+		if (file < 0)
+		{
+			pArgs[0] = (unsigned)trmInvalidArgument;
+			break;
+		}
+
+		ReadBurst burst = {(ReadBurstWorkArea *)ResolveAddress(pArgs[1]), file};
+		m_ReadBursts.push_back(burst);
+		FillReadBurst(m_ReadBursts.back());
+		pArgs[0] = trmSuccess;
+		break;
+	}
+	case brrEndCachedRead:
+	{
+		ReadBurstWorkArea *pWorkArea = (ReadBurstWorkArea *)ResolveAddress(pArgs[0]);
+		pArgs[0] = (unsigned)trmInvalidArgument;
+		for (size_t i = 0; i < m_ReadBursts.size(); i++)
+			if (m_ReadBursts[i].pWorkArea == pWorkArea)
+			{
+				m_ReadBursts.erase(m_ReadBursts.begin() + i);
+				pArgs[0] = trmSuccess;
+				break;
+			}
+		break;
+	}
+	case brrBeginCachedWrite:
+		//The burst data only specifies the handle, so we use the file handle itself.
+		pArgs[0] = GetFile(pArgs[0]) < 0 ? 0 : pArgs[0];
+		break;
+	case brrEndCachedWrite:
+		//All data sent before this request has already been processed by ProcessNonBlockingRequests().
+		pArgs[0] = GetFile(pArgs[0]) < 0 ? (unsigned)trmInvalidArgument : (unsigned)trmSuccess;
+		break;
+	case brrReadStdin:
+		pArgs[0] = 0; //The simulator has no console input
+		break;
+	default:
+		fprintf(stderr, "Unexpected blocking resource manager request: %u\n", m_pStateExtension->Command);
+		abort();
+	}
+}
+
+void SimulatedResourceManager::UpdateReadBursts()
+{
+	for (size_t i = 0; i < m_ReadBursts.size(); i++)
+		FillReadBurst(m_ReadBursts[i]);
+}
+
+void SimulatedResourceManager::FillReadBurst(ReadBurst &burst)
+{
+	ReadBurstWorkArea *pWorkArea = burst.pWorkArea;
+	char *pData = (char *)(pWorkArea + 1);
+	unsigned writeOffsetWithFlags = pWorkArea->WriteOffsetWithFlags;
+	if (writeOffsetWithFlags & kReadBurstEOFFlag)
+		return;
+
+	for (;;)
+	{
+		//The target owns the data between the read and the write offset. If both offsets are equal, the generation flags tell
+		//whether the buffer is empty (same generation) or full (the writer has wrapped around once more than the reader).
+		unsigned readOffsetWithFlags = __atomic_load_n(&pWorkArea->ReadOffsetWithFlags, __ATOMIC_ACQUIRE);
+		unsigned readOffset = readOffsetWithFlags & kReadBurstOffsetMask, writeOffset = writeOffsetWithFlags & kReadBurstOffsetMask;
+		bool sameGeneration = !((readOffsetWithFlags ^ writeOffsetWithFlags) & kReadBurstGenerationFlag);
+		unsigned end = sameGeneration ? pWorkArea->BufferSize : readOffset;
+		if (end <= writeOffset)
+			return;
+
+		ssize_t done = read(burst.File, pData + writeOffset, end - writeOffset);
+		if (done <= 0)
+		{
+			__atomic_store_n(&pWorkArea->WriteOffsetWithFlags, writeOffsetWithFlags | kReadBurstEOFFlag, __ATOMIC_RELEASE);
+			return;
+		}
+
+		writeOffset += (unsigned)done;
+		if (writeOffset >= pWorkArea->BufferSize)
+		{
+			writeOffset = 0;
+			writeOffsetWithFlags ^= kReadBurstGenerationFlag;
+		}
+
+		writeOffsetWithFlags = (writeOffsetWithFlags & kReadBurstGenerationFlag) | writeOffset;
+		__atomic_store_n(&pWorkArea->WriteOffsetWithFlags, writeOffsetWithFlags, __ATOMIC_RELEASE);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	Host side of the Test Resource Manager (see TestResourceManager.cpp). Non-blocking requests arrive via the pdcResourceManagementStream
+	channel, while the blocking ones are placed into the state extension reported by nbrrInitialize and signaled via bit 31 of WriteOffset.
+	The files are accessed relative to the directory passed to SetRootDirectory(), like VisualGDB uses the TestResources directory.
+
+	The target passes the addresses as 32-bit values, so the host build of TestResourceManager.cpp reports its pointers
+	via SysprogsHostSimulator_MapAddress(), and the simulator translates the returned tokens back into pointers.
+*/
+class SimulatedResourceManager
+{
+public:
+	SimulatedResourceManager();
+	~SimulatedResourceManager();
+
+	void SetRootDirectory(const std::string &directory)
+	{
+		m_RootDirectory = directory;
+	}
+
+	//Closes all files opened by the target. The state reported via nbrrInitialize is kept, as the target only sends it once.
+	void Reset();
+
+	//Returns a 32-bit token that the target can pass instead of the pointer.
+	unsigned MapAddress(const volatile void *p);
+
+	//Translates a token returned by MapAddress() back into the pointer.
+	void *ResolveAddress(unsigned token);
+
+	//Handles the complete requests received via pdcResourceManagementStream and removes them from the stream.
+	void ProcessNonBlockingRequests(std::vector<unsigned char> &stream);
+
+	//Handles the request placed into the state extension. The caller should then clear bit 31 of WriteOffset.
+	void ProcessBlockingRequest();
+
+	//Copies the file contents into the work areas of the active read bursts.
+	void UpdateReadBursts();
+
+	//Returns the amount of blocking requests handled since the last Reset().
+	unsigned GetBlockingRequestCount() const
+	{
+		return m_BlockingRequestCount;
+	}
+
+private:
+	struct StateExtension
+	{
+		volatile unsigned Command;
+		volatile unsigned Arguments[3];
+	};
+
+	struct ReadBurstWorkArea
+	{
+		volatile unsigned ReadOffsetWithFlags;
+		volatile unsigned WriteOffsetWithFlags;
+		volatile unsigned BufferSize;
+	};
+
+	struct ReadBurst
+	{
+		ReadBurstWorkArea *pWorkArea;
+		int File;
+	};
+
+	bool TranslatePath(unsigned nameToken, unsigned length, std::string &path) const;
+	int GetFile(unsigned handle) const;
+	unsigned CreateFile(unsigned nameToken, unsigned length, unsigned mode);
+	void FillReadBurst(ReadBurst &burst);
+
+private:
+	std::string m_RootDirectory;
+	std::mutex m_AddressMutex;
+	std::map<const volatile void *, unsigned> m_AddressTokens;
+	std::vector<const volatile void *> m_Addresses;
+
+	StateExtension *m_pStateExtension;
+	std::map<unsigned, int> m_Files;
+	unsigned m_NextHandle;
+	std::vector<ReadBurst> m_ReadBursts;
+	unsigned m_BlockingRequestCount;
+};
@@ -0,0 +1,86 @@
+#include "HostTestFramework.h"
+#include <SmallNumberCoder.h>
+#include <vector>
+
+TEST_GROUP(SmallNumberCoderTests)
+{
+	//Encodes the same sequence of values into the specified coder.
+	static bool EncodeSequence(SmallNumberCoder &coder)
+	{
+		static int dummy[64];
+		for (int i = 0; i < 16; i++)
+		{
+			if (!coder.WriteTinySInt(i * 37 - 200))
+				return false;
+			if (!coder.WriteSmallUnsignedIntWithFlag(i * 12345, i & 1))
+				return false;
+			if (!coder.WritePackedUIntPair(i, i * 3))
+				return false;
+			if (!coder.WriteStackEntry(i, &dummy[i * 3], i & 1))
+				return false;
+		}
+		return true;
+	}
+};
+
+TEST(SmallNumberCoderTests, SplitBufferMatchesContiguousBuffer)
+{
+	char contiguous[512];
+	SmallNumberCoder reference(contiguous, sizeof(contiguous), 0, 0);
+	CHECK(EncodeSequence(reference));
+	int size = reference.GetOffset();
+
+	//Try every possible split point, so that each value gets split between the segments at least once.
+	for (int split = 0; split <= size; split++)
+	{
+		std::vector<char> first(split), second(sizeof(contiguous) - split);
+		SmallNumberCoder coder(first.data(), first.size(), second.data(), second.size(), 0, 0);
+		CHECK(EncodeSequence(coder));
+		CHECK_EQUAL(size, coder.GetOffset());
+		CHECK(!memcmp(first.data(), contiguous, split));
+		CHECK(!memcmp(second.data(), contiguous + split, size - split));
+	}
+}
+
+TEST(SmallNumberCoderTests, SplitBufferOverflow)
+{
+	char first[3], second[2];
+	SmallNumberCoder coder(first, sizeof(first), second, sizeof(second), 0, 0);
+	CHECK(coder.WriteSmallUnsignedInt(0x12345)); //4 bytes
+	CHECK(!coder.WriteSmallUnsignedInt(1));		 //2 more bytes do not fit
+	CHECK_EQUAL(4, coder.GetOffset());
+	CHECK_EQUAL(1, coder.RemainingSize());
+}
+
+TEST(SmallNumberCoderTests, FixedSizePairCanBeOverwritten)
+{
+	char buffer[8], second[8];
+	SmallNumberCoder coder(buffer, 2, second, sizeof(second), 0, 0);
+	CHECK(coder.WriteFixedSizeUIntPair(0, 0));
+	CHECK(coder.WriteTinySInt(5));
+	coder.SetOffset(0);
+	CHECK(coder.WriteFixedSizeUIntPair(1, 77));
+	CHECK_EQUAL(0xFE, (unsigned char)buffer[0]);
+	CHECK_EQUAL(1, buffer[1]);
+	CHECK_EQUAL(77, second[0]);
+	CHECK_EQUAL(10, second[1]);
+}
+
+TEST(SmallNumberCoderTests, MostlyEvenValuesRoundTrip)
+{
+	//Covers the 2-byte, 4-byte and 5-byte forms, including the addresses above 0x20000000 (e.g. SRAM) that need the last one.
+	const int values[] = {0, 2, -2, 0x7FFE, 0x12345678, -0x12345678, 0x20001234, (int)0xDEADBEEE, 0x7FFF0001, (int)0x80000000};
+	char buffer[64];
+	SmallNumberCoder coder(buffer, sizeof(buffer), 0, 0);
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+		CHECK(coder.WriteSmallMostLikelyEvenSInt(values[i]));
+
+	SmallNumberDecoder decoder(buffer, coder.GetOffset(), 0, 0);
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		int value;
+		CHECK(decoder.ReadSmallMostlyEvenSInt(&value));
+		CHECK_EQUAL(values[i], value);
+	}
+	CHECK_EQUAL(coder.GetOffset(), decoder.GetOffset());
+}
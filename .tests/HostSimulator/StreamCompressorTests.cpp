@@ -0,0 +1,116 @@
+#include "HostTestFramework.h"
+#include <StreamCompressor.h>
+#include <StreamDecompressor.h>
+#include <stdlib.h>
+#include <vector>
+
+typedef StreamCompressor<1024, 256> TestCompressor;
+
+static std::vector<unsigned char> CompressBlock(TestCompressor &compressor, const std::vector<unsigned char> &data, bool accept = true)
+{
+	std::vector<unsigned char> block(TestCompressor::kMaxCompressedSize);
+	CHECK(compressor.AppendInput(data.data(), (unsigned)data.size()));
+	block.resize(compressor.Compress(block.data()));
+	if (accept)
+		compressor.AcceptInput();
+	else
+		compressor.DiscardInput();
+	return block;
+}
+
+static std::vector<unsigned char> MakeText(unsigned size, unsigned seed)
+{
+	static const char *words[] = {"sample ", "value=", "thread ", "OK\n", "0x20001000 ", "counter ", "ms "};
+	std::vector<unsigned char> text;
+	srand(seed);
+	while (text.size() < size)
+	{
+		const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		text.insert(text.end(), word, word + strlen(word));
+		if (rand() % 3 == 0)
+			text.push_back('0' + rand() % 10);
+	}
+	text.resize(size);
+	return text;
+}
+
+TEST_GROUP(StreamCompressorTests)
+{
+	TestCompressor Compressor;
+	StreamDecompressor Decompressor;
+
+	TEST_GROUP_StreamCompressorTests()
+	{
+		Compressor.Reset();
+	}
+};
+
+TEST(StreamCompressorTests, RoundTripAcrossBlocks)
+{
+	std::vector<unsigned char> expected, output;
+	for (unsigned i = 0; i < 200; i++)
+	{
+		std::vector<unsigned char> data = MakeText(1 + (i * 37) % 256, i);
+		std::vector<unsigned char> block = CompressBlock(Compressor, data);
+		CHECK(Decompressor.Feed(block.data(), block.size(), output));
+		expected.insert(expected.end(), data.begin(), data.end());
+	}
+
+	CHECK(output == expected);
+}
+
+TEST(StreamCompressorTests, BlocksReferToPreviousBlocks)
+{
+	std::vector<unsigned char> data = MakeText(200, 1), output;
+	std::vector<unsigned char> first = CompressBlock(Compressor, data);
+	std::vector<unsigned char> second = CompressBlock(Compressor, data);
+	CHECK(second.size() < data.size() / 4);
+
+	//Blocks can be split arbitrarily between the reads.
+	std::vector<unsigned char> stream(first);
+	stream.insert(stream.end(), second.begin(), second.end());
+	for (size_t i = 0; i < stream.size(); i += 7)
+		CHECK(Decompressor.Feed(stream.data() + i, std::min<size_t>(7, stream.size() - i), output));
+
+	data.insert(data.end(), data.begin(), data.end());
+	CHECK(output == data);
+}
+
+TEST(StreamCompressorTests, DiscardedBlocksAreNotReferenced)
+{
+	std::vector<unsigned char> output;
+	std::vector<unsigned char> data = MakeText(256, 2);
+	CompressBlock(Compressor, data, false);
+
+	std::vector<unsigned char> block = CompressBlock(Compressor, data);
+	CHECK(Decompressor.Feed(block.data(), block.size(), output));
+	CHECK(output == data);
+}
+
+TEST(StreamCompressorTests, IncompressibleDataFitsIntoWorstCaseSize)
+{
+	std::vector<unsigned char> data(256), output, expected;
+	srand(3);
+	for (int iteration = 0; iteration < 20; iteration++)
+	{
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = (unsigned char)rand();
+
+		std::vector<unsigned char> block = CompressBlock(Compressor, data);
+		CHECK(block.size() <= TestCompressor::kMaxCompressedSize);
+		CHECK(Decompressor.Feed(block.data(), block.size(), output));
+		expected.insert(expected.end(), data.begin(), data.end());
+	}
+
+	CHECK(output == expected);
+}
+
+TEST(StreamCompressorTests, LongMatchesAndOverlappingCopies)
+{
+	std::vector<unsigned char> data(256, 'x'), output;
+	data[0] = 'a';
+	std::vector<unsigned char> block = CompressBlock(Compressor, data);
+	CHECK(block.size() < 16);
+	CHECK(Decompressor.Feed(block.data(), block.size(), output));
+	CHECK(output == data);
+}
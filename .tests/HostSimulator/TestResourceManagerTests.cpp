@@ -0,0 +1,121 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <TestResourceManager.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/*
+	The Test Resource Manager calls wait for the debugger, so these tests keep the simulated debugger polling from a background thread.
+*/
+
+TEST_GROUP(TestResourceManagerTests)
+{
+	SimulatedDebugger &Debugger;
+	std::string m_Directory;
+
+	TEST_GROUP_TestResourceManagerTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		char directory[] = "/tmp/TestResourcesXXXXXX";
+		if (!mkdtemp(directory))
+			FAIL("Cannot create a temporary directory");
+
+		m_Directory = directory;
+		Debugger.Reset();
+		Debugger.GetResourceManager().SetRootDirectory(m_Directory);
+		InitializeFastSemihosting();
+		Debugger.StartPollingThread();
+	}
+
+	~TEST_GROUP_TestResourceManagerTests()
+	{
+		Debugger.StopPollingThread();
+		Debugger.Reset();
+		if (system(("rm -rf " + m_Directory).c_str()))
+			fprintf(stderr, "Failed to delete %s\n", m_Directory.c_str());
+	}
+
+	static void FillData(std::vector<unsigned char> &data, size_t size)
+	{
+		data.resize(size);
+		for (size_t i = 0; i < size; i++)
+			data[i] = (unsigned char)(i * 7 + (i >> 8));
+	}
+};
+
+TEST(TestResourceManagerTests, FilesAreWrittenAndRead)
+{
+	std::vector<unsigned char> data, readBack(1000);
+	FillData(data, 1000);
+
+	TRMFileHandle hFile = TRMCreateFile("test.dat", sfmCreateOrTruncateWriteOnly);
+	CHECK(hFile != 0);
+	CHECK_EQUAL(data.size(), TRMWriteFile(hFile, data.data(), data.size()));
+	TRMCloseFile(hFile);
+
+	hFile = TRMCreateFile("test.dat", sfmOpenReadOnly);
+	CHECK(hFile != 0);
+	CHECK_EQUAL(data.size(), TRMGetFileSize(hFile));
+	CHECK_EQUAL(900, TRMSeekFile(hFile, SEEK_SET, 900));
+	CHECK_EQUAL(100, TRMReadFile(hFile, readBack.data(), readBack.size()));
+	CHECK(!memcmp(readBack.data(), data.data() + 900, 100));
+	CHECK_EQUAL(0, TRMReadFile(hFile, readBack.data(), readBack.size()));
+	TRMCloseFile(hFile);
+
+	CHECK(TRMGetHostSystemTime() > 0x01D0000000000000ULL); //After 2014
+	CHECK_EQUAL(trmSuccess, TRMDeleteFile("test.dat"));
+	CHECK(TRMCreateFile("test.dat", sfmOpenReadOnly) == 0);
+}
+
+TEST(TestResourceManagerTests, PathsOutsideRootAreRejected)
+{
+	CHECK(TRMCreateFile("../test.dat", sfmCreateOrTruncateWriteOnly) == 0);
+	CHECK(TRMCreateFile("/tmp/test.dat", sfmCreateOrTruncateWriteOnly) == 0);
+	CHECK(TRMCreateFile("dir\\..\\..\\test.dat", sfmCreateOrTruncateWriteOnly) == 0);
+
+	CHECK_EQUAL(trmSuccess, TRMCreateDirectory("dir"));
+	TRMFileHandle hFile = TRMCreateFile("dir\\test.dat", sfmCreateOrTruncateWriteOnly);
+	CHECK(hFile != 0);
+	TRMCloseFile(hFile);
+
+	CHECK(TRMDeleteDirectory("dir", 0) != trmSuccess);
+	CHECK_EQUAL(trmSuccess, TRMDeleteDirectory("dir", 1));
+}
+
+TEST(TestResourceManagerTests, BurstsTransferLargeFiles)
+{
+	//The data is larger than both the fast semihosting buffer and the read burst work area, so both wrap around multiple times.
+	std::vector<unsigned char> data, readBack;
+	FillData(data, 100000);
+
+	TRMFileHandle hFile = TRMCreateFile("burst.dat", sfmCreateOrTruncateWriteOnly);
+	TRMWriteBurstHandle hWriteBurst = TRMBeginWriteBurst(hFile);
+	CHECK(hWriteBurst != 0);
+	for (size_t offset = 0; offset < data.size(); offset += 777)
+	{
+		size_t todo = std::min<size_t>(777, data.size() - offset);
+		CHECK_EQUAL(todo, TRMWriteFileCached(hWriteBurst, data.data() + offset, todo));
+	}
+	CHECK_EQUAL(trmSuccess, TRMEndWriteBurst(hWriteBurst));
+	TRMCloseFile(hFile);
+
+	hFile = TRMCreateFile("burst.dat", sfmOpenReadOnly);
+	char workArea[1000];
+	TRMReadBurstHandle hReadBurst = TRMBeginReadBurst(hFile, workArea, sizeof(workArea));
+	CHECK(hReadBurst != 0);
+
+	unsigned char buffer[300];
+	for (;;)
+	{
+		ssize_t done = TRMReadFileCached(hReadBurst, buffer, sizeof(buffer), 0);
+		if (done <= 0)
+			break;
+		readBack.insert(readBack.end(), buffer, buffer + done);
+	}
+
+	CHECK_EQUAL(trmSuccess, TRMEndReadBurst(hReadBurst));
+	TRMCloseFile(hFile);
+	CHECK(readBack == data);
+}
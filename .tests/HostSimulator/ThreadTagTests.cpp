@@ -0,0 +1,149 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SampleStreamDecoder.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+	Reports thread switches via SysprogsProfiler_RTOSThreadSwitched() (as the RTOS hooks would) and checks that the samples decoded by
+	SampleStreamDecoder are attributed to the right threads, while the samples between the switches do not get any larger.
+	Built with SAMPLING_PROFILER_THREAD_TAGS = 1 and both SAMPLING_PROFILER_COMPARE_FRAMES modes.
+*/
+
+extern "C" void SysprogsHostSimulator_ResetSamplingProfiler();
+
+static char s_SimulatedCode[256];
+
+TEST_GROUP(ThreadTagTests)
+{
+	enum
+	{
+		kStackSize = 64,
+		kMaxThreads = 31, //SAMPLING_PROFILER_MAX_THREADS
+	};
+
+	SimulatedDebugger &Debugger;
+	SampleStreamDecoder Decoder;
+	std::vector<SampleStreamDecoder::Sample> Samples;
+	void *m_Stack[kStackSize];
+	int m_Threads[kMaxThreads + 2];
+
+	TEST_GROUP_ThreadTagTests()
+		: Debugger(SimulatedDebugger::Instance()), Decoder(sizeof(void *))
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+		SysprogsHostSimulator_ResetSamplingProfiler();
+		Debugger.SetSampledMemory(m_Stack, m_Stack + kStackSize, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+		for (int i = 0; i < kStackSize; i++)
+			m_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+		m_Stack[kStackSize - 1] = s_SimulatedCode + 16;
+	}
+
+	~TEST_GROUP_ThreadTagTests()
+	{
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+
+	static unsigned Handle(const void *pThread)
+	{
+		return (unsigned)(uintptr_t)pThread;
+	}
+
+	//Reports a sample and returns the size of its record.
+	size_t TakeSample()
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+		Debugger.Poll();
+
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcSamplingProfilerStream);
+		size_t size = data.size(), oldCount = Samples.size();
+		CHECK(Decoder.Feed(data.data(), data.size(), Samples));
+		CHECK_EQUAL(oldCount + 1, Samples.size());
+		data.clear();
+		return size;
+	}
+
+	const char *GetThreadName(const SampleStreamDecoder::Sample &sample)
+	{
+		CHECK(sample.ThreadIndex < Decoder.GetThreadTable().size());
+		return Decoder.GetThreadTable()[sample.ThreadIndex].Name.c_str();
+	}
+};
+
+TEST(ThreadTagTests, TagsAreOnlySentWhenThreadChanges)
+{
+	//The first sample sends the entire stack, the next ones only the (unchanged) frame counts.
+	TakeSample();
+	size_t untaggedSize = TakeSample();
+	CHECK_EQUAL(0, Samples.back().ThreadIndex);
+	CHECK_EQUAL(untaggedSize, TakeSample());
+
+	//The first sample of each thread carries its thread table entry, the next ones are the same size as before.
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[0], "main", 0);
+	size_t firstSampleSize = TakeSample();
+	CHECK(firstSampleSize > untaggedSize + 4);
+	CHECK_EQUAL(Handle(&m_Threads[0]), Samples.back().Thread);
+	CHECK(!strcmp(GetThreadName(Samples.back()), "main"));
+	CHECK_EQUAL(untaggedSize, TakeSample());
+	CHECK_EQUAL(Handle(&m_Threads[0]), Samples.back().Thread);
+
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[1], "a very long thread name", 0);
+	TakeSample();
+	CHECK_EQUAL(Handle(&m_Threads[1]), Samples.back().Thread);
+	CHECK(!strcmp(GetThreadName(Samples.back()), "a very long thre")); //SAMPLING_PROFILER_THREAD_NAME_LENGTH
+
+	//Switching back only sends the index.
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[0], "main", 0);
+	CHECK_EQUAL(untaggedSize + 2, TakeSample());
+	CHECK_EQUAL(Handle(&m_Threads[0]), Samples.back().Thread);
+
+	//Switching to the same thread sends nothing.
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[0], "main", 0);
+	CHECK_EQUAL(untaggedSize, TakeSample());
+	CHECK_EQUAL(Handle(&m_Threads[0]), Samples.back().Thread);
+	CHECK(Samples.back().ThreadIndex != Samples[5].ThreadIndex);
+}
+
+TEST(ThreadTagTests, DeletedThreadIndicesAreReused)
+{
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[0], "first", 0);
+	TakeSample();
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[1], "second", 0);
+	TakeSample();
+	unsigned firstIndex = Samples[0].ThreadIndex;
+
+	SysprogsProfiler_RTOSThreadDeleted(&m_Threads[0]);
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[2], "third", 0);
+	TakeSample();
+	CHECK_EQUAL(firstIndex, Samples.back().ThreadIndex);
+	CHECK_EQUAL(Handle(&m_Threads[2]), Samples.back().Thread);
+	CHECK(!strcmp(GetThreadName(Samples.back()), "third"));
+
+	//The earlier samples keep the thread they were decoded with.
+	CHECK_EQUAL(Handle(&m_Threads[0]), Samples[0].Thread);
+}
+
+TEST(ThreadTagTests, ThreadsBeyondTableSizeUseIndexZero)
+{
+	for (int i = 0; i < kMaxThreads; i++)
+	{
+		SysprogsProfiler_RTOSThreadSwitched(&m_Threads[i], "worker", 0);
+		TakeSample();
+		CHECK_EQUAL(i + 1, Samples.back().ThreadIndex);
+		CHECK_EQUAL(Handle(&m_Threads[i]), Samples.back().Thread);
+	}
+
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[kMaxThreads], "overflow", 0);
+	TakeSample();
+	CHECK_EQUAL(0, Samples.back().ThreadIndex);
+	CHECK_EQUAL(0, Samples.back().Thread);
+
+	SysprogsProfiler_RTOSThreadSwitched(&m_Threads[3], "worker", 0);
+	TakeSample();
+	CHECK_EQUAL(4, Samples.back().ThreadIndex);
+}
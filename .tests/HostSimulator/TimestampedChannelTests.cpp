@@ -0,0 +1,188 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SysprogsProfilerInterface.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS=0,0x41,0x44 and FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL=0x100000 (~1ms of the host clock),
+//with and without FAST_SEMIHOSTING_BLOCKING_MODE=2.
+
+extern "C" unsigned SysprogsHostSimulator_GetCycleCount();
+
+TEST_GROUP(TimestampedChannelTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_TimestampedChannelTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+	}
+
+	static void AppendToken(std::vector<unsigned char> &data, unsigned value)
+	{
+		for (; value >= 0x80; value >>= 7)
+			data.push_back((unsigned char)(value | 0x80));
+		data.push_back((unsigned char)value);
+	}
+
+	static void AppendSync(std::vector<unsigned char> &data, unsigned generation, unsigned base)
+	{
+		AppendToken(data, (generation << 1) | 1);
+		for (int i = 0; i < 4; i++)
+			data.push_back((unsigned char)(base >> (i * 8)));
+	}
+
+	static void AppendRecord(std::vector<unsigned char> &data, unsigned generation, unsigned delta, const char *pPayload)
+	{
+		AppendToken(data, (delta << 3) | (generation << 1));
+		size_t size = strlen(pPayload);
+		data.push_back((unsigned char)size);
+		data.push_back((unsigned char)(size >> 8));
+		data.insert(data.end(), pPayload, pPayload + size);
+	}
+};
+
+TEST(TimestampedChannelTests, TextRecordsAreTimestamped)
+{
+	unsigned before = SysprogsHostSimulator_GetCycleCount();
+	CHECK_EQUAL(5, WriteToFastSemihostingChannel(0, "hello", 5, 1));
+	unsigned after = SysprogsHostSimulator_GetCycleCount();
+	Debugger.Poll();
+
+	std::vector<unsigned char> &data = Debugger.GetChannelData(0);
+	CHECK(std::string(data.begin(), data.end()) == "hello");
+
+	std::vector<TimestampedRecordDecoder::Record> &records = Debugger.GetTimestampedRecords(0);
+	CHECK_EQUAL(1, records.size());
+	CHECK(records[0].HasTimestamp);
+	CHECK_EQUAL(0, records[0].Offset);
+	CHECK_EQUAL(5, records[0].Size);
+	CHECK((unsigned)records[0].Timestamp - before <= after - before);
+}
+
+TEST(TimestampedChannelTests, ChannelsShareTimebase)
+{
+	unsigned header = 0x1234;
+	CHECK_EQUAL(6, WriteToFastSemihostingChannel(0, "first\n", 6, 1));
+	CHECK_EQUAL(sizeof(header), SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, &header, sizeof(header), 0, 0));
+	CHECK_EQUAL(7, WriteToFastSemihostingChannel(0, "second\n", 7, 1));
+	CHECK_EQUAL(3, WriteToFastSemihostingChannel(2, "raw", 3, 1));
+	Debugger.Poll();
+
+	std::vector<TimestampedRecordDecoder::Record> &text = Debugger.GetTimestampedRecords(0), &events = Debugger.GetTimestampedRecords(pdcRealTimeAnalysisStream);
+	CHECK_EQUAL(2, text.size());
+	CHECK_EQUAL(1, events.size());
+	CHECK(text[0].HasTimestamp && events[0].HasTimestamp && text[1].HasTimestamp);
+	CHECK(text[0].Timestamp <= events[0].Timestamp);
+	CHECK(events[0].Timestamp <= text[1].Timestamp);
+	CHECK_EQUAL(sizeof(header), Debugger.GetChannelData(pdcRealTimeAnalysisStream).size());
+
+	//Channels not listed in FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS are sent as is.
+	CHECK(Debugger.GetTimestampedRecords(2).empty());
+	CHECK_EQUAL(3, Debugger.GetChannelData(2).size());
+}
+
+TEST(TimestampedChannelTests, FullTimestampsAreSentPeriodically)
+{
+	//The delta between the 2nd and 3rd records exceeds FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL, so the 3rd one starts a new generation.
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(0, "a", 1, 1));
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(0, "b", 1, 1));
+	Debugger.Poll();
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(3));
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(0, "c", 1, 1));
+	CHECK_EQUAL(1, WriteToFastSemihostingChannel(0, "d", 1, 1));
+	Debugger.Poll();
+
+	std::vector<TimestampedRecordDecoder::Record> &records = Debugger.GetTimestampedRecords(0);
+	CHECK_EQUAL(4, records.size());
+	for (size_t i = 0; i < records.size(); i++)
+		CHECK(records[i].HasTimestamp);
+	CHECK(records[2].Timestamp - records[1].Timestamp >= 3000000);
+}
+
+TEST(TimestampedChannelTests, VariableSizeReservationsAreTimestamped)
+{
+	FastSemihostingReservation reservation;
+	CHECK(ReserveVariableSizeFastSemihostingBuffer(pdcSamplingProfilerStream, 4, 100, &reservation) >= 4);
+	CopyToFastSemihostingReservation(&reservation, 0, "sample", 6);
+	CommitVariableSizeFastSemihostingBuffer(&reservation, 6);
+
+	CHECK_EQUAL(8, ReserveFastSemihostingBuffer(pdcSamplingProfilerStream, 8, &reservation));
+	CopyToFastSemihostingReservation(&reservation, 0, "complete", 8);
+	CommitFastSemihostingBuffer(&reservation);
+	Debugger.Poll();
+
+	std::vector<unsigned char> &data = Debugger.GetChannelData(pdcSamplingProfilerStream);
+	CHECK(std::string(data.begin(), data.end()) == "samplecomplete");
+
+	std::vector<TimestampedRecordDecoder::Record> &records = Debugger.GetTimestampedRecords(pdcSamplingProfilerStream);
+	CHECK_EQUAL(2, records.size());
+	CHECK_EQUAL(6, records[0].Size);
+	CHECK_EQUAL(8, records[1].Size);
+	CHECK(records[0].HasTimestamp && records[1].HasTimestamp);
+}
+
+#if FAST_SEMIHOSTING_BLOCKING_MODE == 2
+TEST(TimestampedChannelTests, OverwrittenFullTimestampsAreRestored)
+{
+	//The full timestamp is overwritten along with the oldest record, so the remaining records of its generation cannot be decoded.
+	char record[64] = "overwritten";
+	for (unsigned i = 0; i < 2 * Debugger.GetBufferSize() / sizeof(record); i++)
+		CHECK_EQUAL(sizeof(record), WriteToFastSemihostingChannel(0, record, sizeof(record), 1));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(3));
+	CHECK_EQUAL(6, WriteToFastSemihostingChannel(0, "latest", 6, 1));
+	Debugger.Poll();
+	CHECK(Debugger.GetOverwrittenByteCount() > 0);
+
+	std::vector<TimestampedRecordDecoder::Record> &records = Debugger.GetTimestampedRecords(0);
+	CHECK(records.size() > 2);
+	CHECK(!records[0].HasTimestamp);
+	CHECK(records.back().HasTimestamp);
+	CHECK_EQUAL(6, records.back().Size);
+}
+#endif
+
+TEST(TimestampedChannelTests, DecoderHandlesLateRecordsAndMissingGenerations)
+{
+	std::vector<unsigned char> data;
+	AppendSync(data, 1, 1000);
+	AppendRecord(data, 1, 5, "a");
+	AppendSync(data, 2, 2000);
+	AppendRecord(data, 1, 7, "b"); //Reserved before the generation 2 was started
+	AppendRecord(data, 2, 300, "c");
+	AppendRecord(data, 3, 1, "d"); //The record starting generation 3 was dropped
+	AppendSync(data, 0, 0xFFFFFFF0);
+	AppendSync(data, 1, 0x10);
+	AppendRecord(data, 1, 2, "e");
+
+	//Feeding the data byte by byte should not make any difference.
+	for (int pass = 0; pass < 2; pass++)
+	{
+		TimestampedRecordDecoder decoder;
+		std::vector<unsigned char> output;
+		std::vector<TimestampedRecordDecoder::Record> records;
+		if (pass)
+		{
+			for (size_t i = 0; i < data.size(); i++)
+				CHECK(decoder.Feed(&data[i], 1, output, records));
+		}
+		else
+			CHECK(decoder.Feed(data.data(), data.size(), output, records));
+
+		CHECK(std::string(output.begin(), output.end()) == "abcde");
+		CHECK_EQUAL(5, records.size());
+		CHECK_EQUAL(1005, records[0].Timestamp);
+		CHECK_EQUAL(1007, records[1].Timestamp);
+		CHECK_EQUAL(2300, records[2].Timestamp);
+		CHECK(!records[3].HasTimestamp);
+		CHECK_EQUAL(0x100000012ULL, records[4].Timestamp);
+		CHECK_EQUAL(4, records[4].Offset);
+	}
+}
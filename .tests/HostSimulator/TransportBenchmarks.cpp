@@ -0,0 +1,166 @@
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+/*
+	Sweeps the record size, the amount of interleaved channels, the probe bandwidth and the offered load for one framework configuration
+	(FAST_SEMIHOSTING_BUFFER_SIZE and FAST_SEMIHOSTING_BLOCKING_MODE are set per executable by CMakeLists.txt) and prints the results as JSON.
+	Build the RunTransportBenchmarks target to run all configurations and merge their output.
+
+	The probe is modeled via SimulatedDebugger::SetProbeModel(): each poll takes a fixed round-trip time, and the space is only
+	returned to the target after the available data has been transferred at the probe bandwidth. The writer issues the records
+	at (load * probe bandwidth), so the loads above 1 show how each blocking mode handles the overflow.
+
+	Reported values:
+		bytes_per_second - payload bytes received by the debugger per second, until all written data was read
+		latency_ns		 - percentiles of the time spent in a single WriteToFastSemihostingChannel() call
+		drop_rate		 - fraction of the written payload bytes that never reached the debugger
+*/
+
+#ifndef FAST_SEMIHOSTING_BUFFER_SIZE
+#define FAST_SEMIHOSTING_BUFFER_SIZE 4096
+#endif
+
+#ifndef FAST_SEMIHOSTING_BLOCKING_MODE
+#define FAST_SEMIHOSTING_BLOCKING_MODE 1
+#endif
+
+struct BenchmarkParameters
+{
+	unsigned RecordSize;
+	unsigned ChannelCount;
+	double ProbeBytesPerSecond;
+	unsigned ProbePollLatency; //Microseconds
+	double Load;			   //Offered data rate relative to the probe bandwidth
+};
+
+struct BenchmarkResult
+{
+	double BytesPerSecond;
+	unsigned long long LatencyPercentiles[3]; //p50, p99, p99.9
+	double DropRate;
+};
+
+static unsigned long long Percentile(std::vector<unsigned> &values, double fraction)
+{
+	size_t index = std::min(values.size() - 1, (size_t)(values.size() * fraction));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static BenchmarkResult RunBenchmark(const BenchmarkParameters &parameters, unsigned long long totalBytes)
+{
+	SimulatedDebugger &debugger = SimulatedDebugger::Instance();
+	debugger.Reset();
+	debugger.SetProbeModel(parameters.ProbePollLatency, parameters.ProbeBytesPerSecond);
+	InitializeFastSemihosting();
+
+	std::atomic<bool> done(false);
+	unsigned long long received = 0;
+	std::thread probeThread([&]() {
+		for (;;)
+		{
+			bool last = done;
+			debugger.Poll();
+			for (unsigned i = 0; i < parameters.ChannelCount; i++)
+			{
+				received += debugger.GetChannelData(i).size();
+				debugger.GetChannelData(i).clear();
+			}
+
+			if (last)
+				break;
+		}
+	});
+
+	std::vector<unsigned char> record(parameters.RecordSize, 0x55);
+	std::vector<unsigned> latencies;
+	unsigned long long recordCount = totalBytes / parameters.RecordSize;
+	latencies.reserve(recordCount);
+	double secondsPerRecord = parameters.RecordSize / (parameters.ProbeBytesPerSecond * parameters.Load);
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < recordCount; i++)
+	{
+		//Sleeping for less than ~100us is not accurate, so the writer issues small bursts of records when it is ahead of the schedule.
+		std::chrono::duration<double> ahead = std::chrono::duration<double>(i * secondsPerRecord) - (std::chrono::steady_clock::now() - start);
+		if (ahead > std::chrono::microseconds(100))
+			std::this_thread::sleep_for(ahead);
+
+		auto writeStart = std::chrono::steady_clock::now();
+		WriteToFastSemihostingChannel((unsigned char)(i % parameters.ChannelCount), record.data(), parameters.RecordSize, 1);
+		latencies.push_back((unsigned)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - writeStart).count());
+	}
+
+	FlushFastSemihostingBuffer();
+	done = true;
+	probeThread.join();
+	auto end = std::chrono::steady_clock::now();
+
+	BenchmarkResult result;
+	result.BytesPerSecond = received / std::chrono::duration<double>(end - start).count();
+	result.LatencyPercentiles[0] = Percentile(latencies, 0.5);
+	result.LatencyPercentiles[1] = Percentile(latencies, 0.99);
+	result.LatencyPercentiles[2] = Percentile(latencies, 0.999);
+	result.DropRate = 1.0 - (double)received / (recordCount * parameters.RecordSize);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long totalBytes = 256 * 1024;
+	unsigned pollLatency = 20;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strncmp(argv[i], "--total-bytes=", 14))
+			totalBytes = strtoull(argv[i] + 14, 0, 0);
+		else if (!strncmp(argv[i], "--poll-latency-us=", 18))
+			pollLatency = (unsigned)strtoul(argv[i] + 18, 0, 0);
+		else
+		{
+			fprintf(stderr, "Usage: %s [--total-bytes=<bytes per run>] [--poll-latency-us=<probe round-trip time>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	static const unsigned recordSizes[] = {8, 32, 128, 512};
+	static const unsigned channelCounts[] = {1, 4};
+	static const double bandwidths[] = {1e6, 8e6};
+	static const double loads[] = {0.5, 2};
+
+	printf("{\"buffer_size\": %u, \"blocking_mode\": %u, \"total_bytes\": %llu, \"results\": [", FAST_SEMIHOSTING_BUFFER_SIZE, FAST_SEMIHOSTING_BLOCKING_MODE, totalBytes);
+	const char *pSeparator = "\n";
+	for (size_t b = 0; b < sizeof(bandwidths) / sizeof(bandwidths[0]); b++)
+		for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++)
+			for (size_t c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+				for (size_t r = 0; r < sizeof(recordSizes) / sizeof(recordSizes[0]); r++)
+				{
+					BenchmarkParameters parameters = {recordSizes[r], channelCounts[c], bandwidths[b], pollLatency, loads[l]};
+					BenchmarkResult result = RunBenchmark(parameters, totalBytes);
+					printf("%s\t{\"record_size\": %u, \"channels\": %u, \"probe_bytes_per_second\": %.0f, \"probe_poll_latency_us\": %u, \"load\": %.2f, "
+						   "\"bytes_per_second\": %.0f, \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}, \"drop_rate\": %.4f}",
+						   pSeparator,
+						   parameters.RecordSize,
+						   parameters.ChannelCount,
+						   parameters.ProbeBytesPerSecond,
+						   parameters.ProbePollLatency,
+						   parameters.Load,
+						   result.BytesPerSecond,
+						   result.LatencyPercentiles[0],
+						   result.LatencyPercentiles[1],
+						   result.LatencyPercentiles[2],
+						   result.DropRate);
+					pSeparator = ",\n";
+					fflush(stdout);
+				}
+
+	printf("\n]}\n");
+	return 0;
+}
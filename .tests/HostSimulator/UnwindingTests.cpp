@@ -0,0 +1,249 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <AggregatedSampleDecoder.h>
+#include <FastSemihosting.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <UnwindTableBuilder.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+	This file is built with SAMPLING_PROFILER_UNWIND_TABLE_SIZE=64 and SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE=4096, so that the reported
+	stack entries can be checked via AggregatedSampleDecoder.
+*/
+
+extern "C" {
+extern SamplingProfilerUnwindEntry g_SamplingProfilerUnwindTable[];
+extern volatile int g_SamplingProfilerUnwindTableEntries;
+}
+
+//The alignment keeps the lower 32 bits of the simulated addresses (used in the unwind table) sorted.
+alignas(256) static char s_SimulatedCode[256];
+
+enum
+{
+	kLeafFunction = 0x00,
+	kSimpleFunction = 0x40, //push {r7, lr}
+	kFunctionWithLocals = 0x80, //push {r4, r7, lr}; sub sp, #8
+	kFunctionWithAlloca = 0xA0, //push {r4, r7, lr}; sub sp, #4; mov r7, sp; (alloca)
+	kOuterFunction = 0xC0, //EXIDX_CANTUNWIND
+};
+
+static unsigned CodeAddress(unsigned offset)
+{
+	return (unsigned)(uintptr_t)(s_SimulatedCode + offset);
+}
+
+static SamplingProfilerUnwindEntry Translate(std::vector<unsigned char> instructions)
+{
+	SamplingProfilerUnwindEntry entry = {0, 0, 0, 0};
+	CHECK(UnwindTableBuilder::TranslateUnwindInstructions(instructions.data(), instructions.size(), entry));
+	return entry;
+}
+
+TEST_GROUP(UnwindingTests)
+{
+	SimulatedDebugger &Debugger;
+	void *m_Stack[64];
+
+	TEST_GROUP_UnwindingTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+
+		//Everything that is not a part of the simulated frames looks like a stale return address
+		for (int i = 0; i < 64; i++)
+			m_Stack[i] = s_SimulatedCode + 0x11 + 2 * (i % 8);
+		Debugger.SetSampledMemory(m_Stack, m_Stack + 64, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+
+		g_SamplingProfilerUnwindTableEntries = 0;
+		CHECK(SysprogsProfiler_FlushAggregatedSamples());
+		Debugger.Poll();
+		Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream).clear();
+	}
+
+	~TEST_GROUP_UnwindingTests()
+	{
+		g_SamplingProfilerUnwindTableEntries = 0;
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+
+	void LoadUnwindTable(const std::vector<SamplingProfilerUnwindEntry> &table)
+	{
+		for (size_t i = 0; i < table.size(); i++)
+			g_SamplingProfilerUnwindTable[i] = table[i];
+		g_SamplingProfilerUnwindTableEntries = (int)table.size();
+	}
+
+	//Simulates the .ARM.exidx section of the functions above and converts it via UnwindTableBuilder.
+	void LoadSimulatedFunctions()
+	{
+		//The index table refers to the functions via 31-bit offsets, so it is placed next to the simulated code.
+		const unsigned exidxAddress = CodeAddress(0) + 0x10000, extabAddress = CodeAddress(0) + 0x20000;
+		struct
+		{
+			unsigned Function, Data;
+		} exidx[] = {
+			{kLeafFunction, 0x80B0B0B0},	   //No instructions
+			{kSimpleFunction, 0x808408B0},	   //pop {r7, lr}
+			{kFunctionWithLocals, 0x80018409}, //vsp += 8; pop {r4, r7, lr}
+			{kFunctionWithAlloca, extabAddress - (exidxAddress + 3 * 8 + 4)},
+			{kOuterFunction, 1},
+		};
+
+		//vsp = r7; vsp += 4; pop {r4, r7, lr} does not fit into the index table, so it is stored in the __aeabi_unwind_cpp_pr1 format
+		unsigned extab[] = {0x81019700, 0x8409B0B0};
+
+		unsigned words[2 * 5];
+		for (int i = 0; i < 5; i++)
+		{
+			unsigned entryAddress = exidxAddress + i * 8;
+			words[i * 2] = (CodeAddress(exidx[i].Function) - entryAddress) & 0x7FFFFFFF;
+			words[i * 2 + 1] = exidx[i].Data;
+		}
+
+		UnwindTableBuilder builder;
+		builder.AddMemoryRegion(exidxAddress, words, sizeof(words));
+		builder.AddMemoryRegion(extabAddress, extab, sizeof(extab));
+		builder.SetIndexTable(exidxAddress, sizeof(words));
+
+		std::vector<SamplingProfilerUnwindEntry> table;
+		unsigned unsupported;
+		CHECK(builder.Build(table, &unsupported));
+		CHECK_EQUAL(5, table.size());
+		CHECK_EQUAL(1, unsupported);
+		LoadUnwindTable(table);
+	}
+
+	//Takes a sample and returns the stack entries reported for it.
+	std::vector<AggregatedSampleDecoder::StackEntry> Sample(unsigned pcOffset, unsigned depth, void **FP, size_t *pRecordSize = NULL)
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + pcOffset, m_Stack + depth, FP, s_SimulatedCode + 0x13);
+		CHECK(SysprogsProfiler_FlushAggregatedSamples());
+		Debugger.Poll();
+
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream);
+		if (pRecordSize)
+			*pRecordSize = data.size();
+
+		AggregatedSampleDecoder decoder;
+		std::vector<AggregatedSampleDecoder::Stack> stacks;
+		CHECK(decoder.Feed(data.data(), data.size(), stacks));
+		data.clear();
+		CHECK_EQUAL(1, stacks.size());
+		return stacks.empty() ? std::vector<AggregatedSampleDecoder::StackEntry>() : stacks[0].Entries;
+	}
+};
+
+TEST(UnwindingTests, UnwindInstructionsAreTranslated)
+{
+	//push {r4, r7, lr}; sub sp, #16
+	SamplingProfilerUnwindEntry entry = Translate({0x03, 0x84, 0x09});
+	CHECK_EQUAL(7, entry.FrameSize);
+	CHECK_EQUAL(1, entry.ReturnAddressSlot);
+	CHECK_EQUAL(2, entry.SavedFPSlot);
+
+	//Leaf function without a frame
+	entry = Translate({0xB0, 0xB0, 0xB0});
+	CHECK_EQUAL(0, entry.FrameSize);
+	CHECK_EQUAL(0, entry.ReturnAddressSlot);
+	CHECK_EQUAL(0, entry.SavedFPSlot);
+
+	//push {r4-r11, lr}; vpush {d8-d9}; sub sp, #0x400 (uleb128-encoded adjustment)
+	entry = Translate({0xB2, 0x7F, 0xD1, 0xAF});
+	CHECK_EQUAL((0x204 + (0x7F << 2)) / 4 + 4 + 9, entry.FrameSize);
+	CHECK_EQUAL(1, entry.ReturnAddressSlot);
+	CHECK_EQUAL(6, entry.SavedFPSlot);
+
+	//The frame is located via R7 if the function moves SP dynamically
+	entry = Translate({0x97, 0x00, 0x84, 0x09});
+	CHECK_EQUAL(kUnwindFrameBasedOnFP | 4, entry.FrameSize);
+
+	//pop {r4, pc} returns via the restored PC
+	entry = Translate({0x88, 0x01});
+	CHECK_EQUAL(1, entry.ReturnAddressSlot);
+
+	//Unsupported layouts: 'refuse to unwind', SP based on R6, R7 used after being restored, spare instructions
+	const std::vector<unsigned char> unsupported[] = {{0x80, 0x00}, {0x96}, {0x84, 0x08, 0x97}, {0xB4}, {0x84}};
+	for (size_t i = 0; i < sizeof(unsupported) / sizeof(unsupported[0]); i++)
+		CHECK(!UnwindTableBuilder::TranslateUnwindInstructions(unsupported[i].data(), unsupported[i].size(), entry));
+}
+
+TEST(UnwindingTests, AdjacentFunctionsWithSameLayoutAreMerged)
+{
+	UnwindTableBuilder builder;
+	unsigned words[] = {0x1000, 0x80B0B0B0, 0x1000, 0x80B0B0B0, 0x1000, 0x80A8B0B0};
+	builder.AddMemoryRegion(0x4000, words, sizeof(words));
+	builder.SetIndexTable(0x4000, sizeof(words));
+
+	//The function addresses are relative to the entries: 0x5000, 0x5008, 0x5010
+	std::vector<SamplingProfilerUnwindEntry> table;
+	CHECK(builder.Build(table));
+	CHECK_EQUAL(2, table.size());
+	CHECK_EQUAL(0x5000, table[0].FunctionStart);
+	CHECK_EQUAL(0x5010, table[1].FunctionStart);
+	CHECK_EQUAL(2, table[1].FrameSize);
+}
+
+TEST(UnwindingTests, OnlyReturnAddressesAreReported)
+{
+	LoadSimulatedFunctions();
+
+	//kSimpleFunction called from kFunctionWithLocals called from kOuterFunction:
+	//	[0] saved R7	[1] return address	| [2] [3] locals	[4] saved R4	[5] saved R7	[6] return address	| kOuterFunction frame
+	m_Stack[0] = m_Stack + 5;
+	m_Stack[1] = s_SimulatedCode + kFunctionWithLocals + 0x11;
+	m_Stack[5] = m_Stack + 40;
+	m_Stack[6] = s_SimulatedCode + kOuterFunction + 0x09;
+
+	size_t unwoundSize, scannedSize;
+	std::vector<AggregatedSampleDecoder::StackEntry> entries = Sample(kSimpleFunction + 4, 0, m_Stack, &unwoundSize);
+	CHECK_EQUAL(2, entries.size());
+	CHECK_EQUAL(1, entries[0].Index);
+	CHECK_EQUAL(CodeAddress(kFunctionWithLocals + 0x11), entries[0].Value);
+	CHECK_EQUAL(6, entries[1].Index);
+	CHECK_EQUAL(CodeAddress(kOuterFunction + 0x09), entries[1].Value);
+
+	//Without the unwind table, every slot that looks like a code address or a saved FP gets reported
+	g_SamplingProfilerUnwindTableEntries = 0;
+	CHECK_EQUAL(16, Sample(kSimpleFunction + 4, 0, m_Stack, &scannedSize).size()); //SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH
+	CHECK(scannedSize > unwoundSize * 2);
+}
+
+TEST(UnwindingTests, LeafAndFPBasedFramesAreUnwound)
+{
+	LoadSimulatedFunctions();
+
+	//kLeafFunction (return address in LR) called from kFunctionWithAlloca called from kOuterFunction. The alloca() area
+	//is between SP and the frame: [0] [1] alloca	| [2] local	[3] saved R4	[4] saved R7	[5] return address
+	m_Stack[4] = m_Stack + 50;
+	m_Stack[5] = s_SimulatedCode + kOuterFunction + 0x21;
+
+	//LR points into kFunctionWithAlloca
+	SysprogsProfiler_ProcessSample(s_SimulatedCode + kLeafFunction + 2, m_Stack, m_Stack + 2, s_SimulatedCode + kFunctionWithAlloca + 0x05);
+	CHECK(SysprogsProfiler_FlushAggregatedSamples());
+	Debugger.Poll();
+
+	AggregatedSampleDecoder decoder;
+	std::vector<AggregatedSampleDecoder::Stack> stacks;
+	std::vector<unsigned char> &data = Debugger.GetChannelData(pdcAggregatedSamplingProfilerStream);
+	CHECK(decoder.Feed(data.data(), data.size(), stacks));
+	CHECK_EQUAL(1, stacks.size());
+	CHECK_EQUAL(1, stacks[0].Entries.size());
+	CHECK_EQUAL(5, stacks[0].Entries[0].Index);
+	CHECK_EQUAL(CodeAddress(kOuterFunction + 0x21), stacks[0].Entries[0].Value);
+}
+
+TEST(UnwindingTests, UnknownFunctionsAreScanned)
+{
+	LoadSimulatedFunctions();
+
+	//The unwinding stops at kOuterFunction (EXIDX_CANTUNWIND), but if it is the interrupted function, the stack is scanned as usual.
+	CHECK_EQUAL(16, Sample(kOuterFunction + 4, 0, m_Stack).size());
+
+	//Same for the code preceding the first table entry.
+	g_SamplingProfilerUnwindTable[0].FunctionStart = CodeAddress(kLeafFunction + 0x10);
+	CHECK_EQUAL(16, Sample(kLeafFunction + 4, 0, m_Stack).size());
+}
@@ -0,0 +1,66 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//This file is built with FAST_SEMIHOSTING_WAIT_STATISTICS=1 and different FAST_SEMIHOSTING_WAIT_STRATEGY values.
+
+TEST_GROUP(WaitStrategyTests)
+{
+	SimulatedDebugger &Debugger;
+
+	TEST_GROUP_WaitStrategyTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+		g_FastSemihostingWaitStatistics = FastSemihostingWaitStatistics();
+	}
+};
+
+TEST(WaitStrategyTests, BlockedWritersWaitForDebugger)
+{
+	std::vector<unsigned char> data(Debugger.GetBufferSize() * 8);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (unsigned char)(i * 13);
+
+	std::atomic<bool> done(false);
+	std::thread reader([&]() {
+		while (!done)
+		{
+			Debugger.Poll();
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	});
+
+	CHECK_EQUAL(data.size(), WriteToFastSemihostingChannel(1, data.data(), (int)data.size(), 1));
+	done = true;
+	reader.join();
+	Debugger.Poll();
+
+	CHECK(Debugger.GetChannelData(1) == data);
+	CHECK(g_FastSemihostingWaitStatistics.WaitCount > 0);
+	CHECK(g_FastSemihostingWaitStatistics.TotalWaitCycles >= g_FastSemihostingWaitStatistics.MaxWaitCycles);
+	CHECK(g_FastSemihostingWaitStatistics.MaxWaitCycles > 0);
+
+#ifdef FAST_SEMIHOSTING_DOORBELL_IRQ
+	CHECK(Debugger.GetDoorbellCount() > 0);
+#endif
+}
+
+TEST(WaitStrategyTests, DoorbellIsAnnounced)
+{
+#ifdef FAST_SEMIHOSTING_DOORBELL_IRQ
+	CHECK_EQUAL(FAST_SEMIHOSTING_DOORBELL_IRQ, Debugger.GetDoorbellIRQ());
+#else
+	CHECK_EQUAL(-1, Debugger.GetDoorbellIRQ());
+#endif
+}
+
+TEST(WaitStrategyTests, NoWaitsWhenBufferHasSpace)
+{
+	CHECK_EQUAL(5, WriteToFastSemihostingChannel(1, "hello", 5, 1));
+	CHECK_EQUAL(0, g_FastSemihostingWaitStatistics.WaitCount);
+}
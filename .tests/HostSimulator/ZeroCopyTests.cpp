@@ -0,0 +1,303 @@
+#include "HostTestFramework.h"
+#include "HostSimulator.h"
+#include <FastSemihosting.h>
+#include <SampleStreamDecoder.h>
+#include <SysprogsProfiler.h>
+#include <SysprogsProfilerInterface.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+	Built with SYSPROGS_PROFILER_ZERO_COPY = 1, so that the samples and the instrumenting profiler frame reports are encoded directly into
+	variable-size reservations. The tests decode both streams on the host side, including the records that wrap around the end of the buffer.
+*/
+
+extern "C" void SysprogsHostSimulator_ResetSamplingProfiler();
+extern "C" void SysprogsHostSimulator_ResetInstrumentingProfiler();
+extern "C" void SysprogsHostSimulator_ReportInstrumentedFrames(const uintptr_t *pFunctions, unsigned count, unsigned reportedCount, unsigned runTime, unsigned foldedTime);
+
+static char s_SimulatedCode[256];
+
+//Mirrors ReportFramesToProfiler() in InstrumentingProfiler.cpp
+struct FrameReport
+{
+	unsigned ReportedFrames;
+	std::vector<unsigned> Functions; //Top frame first
+	unsigned RunTime, FoldedTime;
+};
+
+class FrameReportDecoder
+{
+public:
+	FrameReportDecoder(const std::vector<unsigned char> &data)
+		: m_Data(data), m_Offset(0), m_FunctionBase(0)
+	{
+	}
+
+	bool AtEnd() const
+	{
+		return m_Offset == m_Data.size();
+	}
+
+	bool ReadReport(FrameReport &report)
+	{
+		unsigned newFrames, byte;
+		if (!ReadByte(&byte))
+			return false;
+
+		if (byte < 0xFE)
+		{
+			report.ReportedFrames = byte >> 4;
+			newFrames = byte & 0x0F;
+		}
+		else
+		{
+			unsigned size = (byte == 0xFE) ? 1 : 2;
+			if (!ReadInt(size, &report.ReportedFrames) || !ReadInt(size, &newFrames))
+				return false;
+		}
+
+		report.Functions.clear();
+		for (unsigned i = 0; i < newFrames; i++)
+		{
+			int delta;
+			bool isInterrupt;
+			if (!ReadIntWithFlag(true, (unsigned *)&delta, &isInterrupt))
+				return false;
+			m_FunctionBase += delta;
+			report.Functions.push_back(m_FunctionBase);
+		}
+
+		bool folded;
+		report.FoldedTime = 0;
+		if (!ReadIntWithFlag(false, &report.RunTime, &folded))
+			return false;
+		return !folded || ReadSmallUnsignedInt(&report.FoldedTime);
+	}
+
+private:
+	bool ReadByte(unsigned *pValue)
+	{
+		return ReadInt(1, pValue);
+	}
+
+	bool ReadInt(unsigned size, unsigned *pValue)
+	{
+		if (m_Data.size() - m_Offset < size)
+			return false;
+
+		*pValue = 0;
+		for (unsigned i = 0; i < size; i++)
+			*pValue |= m_Data[m_Offset++] << (i * 8);
+		return true;
+	}
+
+	//Mirrors SmallNumberCoder::WriteSmallSignedIntWithFlag() and WriteSmallUnsignedIntWithFlag()
+	bool ReadIntWithFlag(bool isSigned, unsigned *pValue, bool *pFlag)
+	{
+		if (AtEnd())
+			return false;
+
+		unsigned char first = m_Data[m_Offset];
+		if (first == 0xFF || first == 0x7F)
+		{
+			m_Offset++;
+			*pFlag = first == 0xFF;
+			return ReadInt(4, pValue);
+		}
+
+		unsigned size = (first & 1) ? 4 : 2, value;
+		if (!ReadInt(size, &value))
+			return false;
+
+		*pFlag = (value >> (size == 4 ? 2 : 1)) & 1;
+		unsigned bits = (size == 4) ? 29 : 14;
+		value >>= (size == 4) ? 3 : 2;
+		if (isSigned && (value & (1U << (bits - 1))))
+			value |= ~0U << bits;
+		*pValue = value;
+		return true;
+	}
+
+	bool ReadSmallUnsignedInt(unsigned *pValue)
+	{
+		if (AtEnd())
+			return false;
+
+		unsigned char first = m_Data[m_Offset];
+		if (first == 0xFF)
+		{
+			m_Offset++;
+			return ReadInt(4, pValue);
+		}
+
+		unsigned size = (first & 1) ? 4 : 2;
+		if (!ReadInt(size, pValue))
+			return false;
+		*pValue >>= (size == 4) ? 2 : 1;
+		return true;
+	}
+
+private:
+	const std::vector<unsigned char> &m_Data;
+	size_t m_Offset;
+	unsigned m_FunctionBase;
+};
+
+TEST_GROUP(ZeroCopyTests)
+{
+	enum
+	{
+		kStackSize = 64,
+	};
+
+	SimulatedDebugger &Debugger;
+	void *m_Stack[kStackSize];
+
+	TEST_GROUP_ZeroCopyTests()
+		: Debugger(SimulatedDebugger::Instance())
+	{
+		Reset();
+		for (int i = 0; i < kStackSize; i++)
+			m_Stack[i] = (void *)(uintptr_t)(0x1000 + i);
+		m_Stack[5] = s_SimulatedCode + 16;
+		m_Stack[20] = s_SimulatedCode + 32;
+		m_Stack[21] = &m_Stack[30]; //Saved FP
+		m_Stack[40] = s_SimulatedCode + 48;
+	}
+
+	~TEST_GROUP_ZeroCopyTests()
+	{
+		Debugger.SetSampledMemory(0, 0, 0, 0);
+	}
+
+	void Reset()
+	{
+		Debugger.Reset();
+		InitializeFastSemihosting();
+		SysprogsHostSimulator_ResetSamplingProfiler();
+		SysprogsHostSimulator_ResetInstrumentingProfiler();
+		Debugger.SetSampledMemory(m_Stack, m_Stack + kStackSize, s_SimulatedCode, s_SimulatedCode + sizeof(s_SimulatedCode));
+	}
+
+	//Makes the channel switch record preceding the next record start distanceFromEnd bytes before the end of the buffer.
+	void MoveWriteOffsetNearBufferEnd(unsigned distanceFromEnd)
+	{
+		//The initial switch to channel 1 takes 2 bytes.
+		std::vector<unsigned char> filler(Debugger.GetBufferSize() - distanceFromEnd - 2 - 2);
+		CHECK_EQUAL(filler.size(), WriteToFastSemihostingChannel(1, filler.data(), (int)filler.size(), 1));
+		Debugger.Poll();
+		Debugger.GetChannelData(1).clear();
+	}
+
+	static FrameReport MakeReport(unsigned reportedFrames, unsigned firstFunction, unsigned count, unsigned runTime, unsigned foldedTime)
+	{
+		FrameReport report = {reportedFrames, std::vector<unsigned>(), runTime, foldedTime};
+		for (unsigned i = 0; i < count; i++)
+			report.Functions.push_back(firstFunction + i * 0x40);
+		return report;
+	}
+
+	void SendReport(const FrameReport &report)
+	{
+		std::vector<uintptr_t> functions(report.Functions.begin(), report.Functions.end());
+		for (unsigned i = 0; i < report.ReportedFrames; i++)
+			functions.push_back(0x08000000 + i * 4);
+		SysprogsHostSimulator_ReportInstrumentedFrames(functions.data(), (unsigned)functions.size(), report.ReportedFrames, report.RunTime, report.FoldedTime);
+	}
+
+	void CheckReports(const std::vector<FrameReport> &expected)
+	{
+		Debugger.Poll();
+		FrameReportDecoder decoder(Debugger.GetChannelData(pdcInstrumentationProfilerNormalStream));
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			FrameReport report;
+			CHECK(decoder.ReadReport(report));
+			CHECK_EQUAL(expected[i].ReportedFrames, report.ReportedFrames);
+			CHECK(expected[i].Functions == report.Functions);
+			CHECK_EQUAL(expected[i].RunTime, report.RunTime);
+			CHECK_EQUAL(expected[i].FoldedTime, report.FoldedTime);
+		}
+		CHECK(decoder.AtEnd());
+	}
+
+	void CheckSample(const std::vector<SampleStreamDecoder::Sample> &samples)
+	{
+		CHECK_EQUAL(1, samples.size());
+		const SampleStreamDecoder::Sample &sample = samples.back();
+		CHECK_EQUAL((unsigned)(uintptr_t)m_Stack, sample.SP);
+		CHECK_EQUAL((unsigned)(uintptr_t)(s_SimulatedCode + 2), sample.PC);
+		CHECK_EQUAL(4, sample.Entries.size());
+
+		static const int slots[] = {5, 20, 21, 40};
+		for (size_t i = 0; i < sample.Entries.size() && i < 4; i++)
+		{
+			CHECK_EQUAL((unsigned)(uintptr_t)&m_Stack[slots[i]], sample.Entries[i].Address);
+			CHECK_EQUAL((unsigned)(uintptr_t)m_Stack[slots[i]], sample.Entries[i].Value);
+			CHECK(sample.Entries[i].IsSavedFP == (slots[i] == 21));
+		}
+	}
+};
+
+TEST(ZeroCopyTests, FrameReportsAreDecoded)
+{
+	//Deep reports span multiple chunks, and large values use the longer encodings.
+	std::vector<FrameReport> reports;
+	reports.push_back(MakeReport(0, 0x08001000, 1, 100, 0));
+	reports.push_back(MakeReport(1, 0x08001100, 3, 20000, 7));
+	reports.push_back(MakeReport(20, 0x08002000, 40, 0x20000000, 0x12345));
+	reports.push_back(MakeReport(100, 0x00000100, 2, 0, 0));
+
+	for (size_t i = 0; i < reports.size(); i++)
+		SendReport(reports[i]);
+	CheckReports(reports);
+}
+
+TEST(ZeroCopyTests, FrameReportsWrapAroundBufferEnd)
+{
+	for (unsigned distance = 1; distance < 40; distance++)
+	{
+		Reset();
+		MoveWriteOffsetNearBufferEnd(distance);
+
+		std::vector<FrameReport> reports;
+		reports.push_back(MakeReport(2, 0x08004000 + distance * 0x100, 12, 5000 + distance, distance));
+		SendReport(reports[0]);
+		CheckReports(reports);
+	}
+}
+
+TEST(ZeroCopyTests, SamplesAreDecoded)
+{
+	SampleStreamDecoder decoder(sizeof(void *));
+	for (int i = 0; i < 3; i++)
+	{
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+		Debugger.Poll();
+
+		std::vector<SampleStreamDecoder::Sample> samples;
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcSamplingProfilerStream);
+		CHECK(decoder.Feed(data.data(), data.size(), samples));
+		data.clear();
+		CheckSample(samples);
+	}
+}
+
+TEST(ZeroCopyTests, SamplesWrapAroundBufferEnd)
+{
+	//Covers the fixed-size entry count (patched after the stack has been walked) being split between the end and the start of the buffer.
+	for (unsigned distance = 1; distance < 40; distance++)
+	{
+		Reset();
+		MoveWriteOffsetNearBufferEnd(distance);
+		SysprogsProfiler_ProcessSample(s_SimulatedCode + 2, m_Stack, m_Stack, s_SimulatedCode + 4);
+		Debugger.Poll();
+
+		SampleStreamDecoder decoder(sizeof(void *));
+		std::vector<SampleStreamDecoder::Sample> samples;
+		std::vector<unsigned char> &data = Debugger.GetChannelData(pdcSamplingProfilerStream);
+		CHECK(decoder.Feed(data.data(), data.size(), samples));
+		CheckSample(samples);
+	}
+}
@@ -0,0 +1,28 @@
+#include "HostTestFramework.h"
+
+int RunAllTests()
+{
+	int passed = 0, failed = 0;
+	for (HostTestRegistration *pTest = HostTestRegistration::First(); pTest; pTest = pTest->pNext)
+	{
+		try
+		{
+			pTest->Function();
+			passed++;
+			printf("[PASS] %s.%s\n", pTest->Group, pTest->Name);
+		}
+		catch (const HostTestFailure &failure)
+		{
+			failed++;
+			printf("[FAIL] %s.%s\n\t%s:%d: %s\n", pTest->Group, pTest->Name, failure.File, failure.Line, failure.Message);
+		}
+	}
+
+	printf("%d tests passed, %d failed\n", passed, failed);
+	return failed ? 1 : 0;
+}
+
+int main()
+{
+	return RunAllTests();
+}
@@ -18,156 +18,1712 @@ int _write(int fd, char *pBuffer, int size);
 #define FAST_SEMIHOSTING_BUFFER_SIZE 4096
 #endif
 
+/*
+	FAST_SEMIHOSTING_BLOCKING_MODE selects what happens when the buffer is full:
+		0 - the new data is discarded.
+		1 - the writer waits until the debugger reads the buffer.
+		2 - the oldest records are overwritten (flight recorder), so the buffer always contains the latest data (e.g. for post-mortem analysis).
+			Writers never wait in this mode. Each record is prefixed with a header instead of using channel switch records (see below).
+*/
 #ifndef FAST_SEMIHOSTING_BLOCKING_MODE
 #define FAST_SEMIHOSTING_BLOCKING_MODE 1
 #endif
 
-#ifndef FAST_SEMIHOSTING_STDIO_DRIVER
-#define FAST_SEMIHOSTING_STDIO_DRIVER 1
-#endif
+#define FAST_SEMIHOSTING_WAIT_FOR_BUFFER_SPACE (FAST_SEMIHOSTING_BLOCKING_MODE == 1)
+#define FAST_SEMIHOSTING_OVERWRITE_MODE (FAST_SEMIHOSTING_BLOCKING_MODE == 2)
+
+#ifndef FAST_SEMIHOSTING_STDIO_DRIVER
+#define FAST_SEMIHOSTING_STDIO_DRIVER 1
+#endif
+
+#ifndef FAST_SEMIHOSTING_PROFILER_DRIVER
+#define FAST_SEMIHOSTING_PROFILER_DRIVER 1
+#endif
+
+/*
+	FAST_SEMIHOSTING_WAIT_STRATEGY selects how the writers wait for the debugger to read the buffer (or to process a blocking request):
+		0 - busy-wait, calling FAST_SEMIHOSTING_WAIT_HOOK() on each iteration.
+		1 - sleep via the WFE instruction until the next event or interrupt. Define FAST_SEMIHOSTING_DOORBELL_IRQ to let the debugger
+			wake up the writers as soon as it reads the buffer, otherwise they will only wake up on other interrupts (e.g. SysTick).
+		2 - call FAST_SEMIHOSTING_RTOS_YIELD() (e.g. taskYIELD()), letting other threads of the same priority run.
+		3 - busy-wait for FAST_SEMIHOSTING_WAIT_SPIN_COUNT iterations, then call FAST_SEMIHOSTING_SLEEP() (e.g. vTaskDelay(1)).
+*/
+#ifndef FAST_SEMIHOSTING_WAIT_STRATEGY
+#define FAST_SEMIHOSTING_WAIT_STRATEGY 0
+#endif
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The simulated debugger runs on the same CPU, so it should get a chance to read the data while we are waiting.
+extern "C" void SysprogsHostSimulator_Yield();
+extern "C" void SysprogsHostSimulator_WaitForEvent();
+extern "C" void SysprogsHostSimulator_Sleep();
+extern "C" unsigned SysprogsHostSimulator_GetCycleCount();
+extern "C" unsigned SysprogsHostSimulator_GetCoreID();
+#define FAST_SEMIHOSTING_WAIT_HOOK() SysprogsHostSimulator_Yield()
+#define FAST_SEMIHOSTING_GET_CORE_ID() SysprogsHostSimulator_GetCoreID()
+#define FAST_SEMIHOSTING_WAIT_FOR_EVENT() SysprogsHostSimulator_WaitForEvent()
+#define FAST_SEMIHOSTING_GET_CYCLE_COUNT() SysprogsHostSimulator_GetCycleCount()
+#ifndef FAST_SEMIHOSTING_RTOS_YIELD
+#define FAST_SEMIHOSTING_RTOS_YIELD() SysprogsHostSimulator_Yield()
+#endif
+#ifndef FAST_SEMIHOSTING_SLEEP
+#define FAST_SEMIHOSTING_SLEEP() SysprogsHostSimulator_Sleep()
+#endif
+#endif
+
+#ifndef FAST_SEMIHOSTING_WAIT_HOOK
+//Called while a blocking write is waiting for the debugger to free up the buffer space.
+#define FAST_SEMIHOSTING_WAIT_HOOK()
+#endif
+
+#ifndef FAST_SEMIHOSTING_WAIT_FOR_EVENT
+#define FAST_SEMIHOSTING_WAIT_FOR_EVENT() asm volatile("wfe" ::: "memory")
+#endif
+
+#ifndef FAST_SEMIHOSTING_WAIT_SPIN_COUNT
+#define FAST_SEMIHOSTING_WAIT_SPIN_COUNT 1000
+#endif
+
+#if FAST_SEMIHOSTING_WAIT_STRATEGY == 2 && !defined(FAST_SEMIHOSTING_RTOS_YIELD)
+#error Please define FAST_SEMIHOSTING_RTOS_YIELD() to use FAST_SEMIHOSTING_WAIT_STRATEGY=2
+#endif
+
+#if FAST_SEMIHOSTING_WAIT_STRATEGY == 3 && !defined(FAST_SEMIHOSTING_SLEEP)
+#error Please define FAST_SEMIHOSTING_SLEEP() to use FAST_SEMIHOSTING_WAIT_STRATEGY=3
+#endif
+
+/*
+	If FAST_SEMIHOSTING_DOORBELL_IRQ is defined, the debugger will set the pending bit of this interrupt after reading the buffer
+	while some writers are waiting. The interrupt should be otherwise unused and does not need to be enabled: with
+	FAST_SEMIHOSTING_WAIT_STRATEGY=1, it wakes up the WFE instruction via the SEVONPEND bit.
+*/
+
+#ifndef FAST_SEMIHOSTING_WAIT_STATISTICS
+//Accumulates the amount of CPU cycles spent waiting for the debugger in g_FastSemihostingWaitStatistics.
+#define FAST_SEMIHOSTING_WAIT_STATISTICS 0
+#endif
+
+#ifndef FAST_SEMIHOSTING_GET_CYCLE_COUNT
+//DWT->CYCCNT. The cycle counter needs to be enabled via DWT->CTRL.
+#define FAST_SEMIHOSTING_GET_CYCLE_COUNT() (*(volatile unsigned *)0xE0001004)
+#endif
+
+#ifndef FAST_SEMIHOSTING_HOLD_INTERRUPTS
+//The buffer space is claimed via the lock-free reservation protocol (see below), so masking interrupts is no longer
+//required to protect the semihosting buffer from concurrent writers, even when using an RTOS.
+#define FAST_SEMIHOSTING_HOLD_INTERRUPTS 0
+#endif
+
+#ifndef FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+//Allocates a separate ring buffer for each of the FAST_SEMIHOSTING_DEDICATED_CHANNELS, so that the high-rate profiler channels never
+//need channel switch records and cannot be starved by the printf() output. Requires a debugger supporting kInitializeFastSemihostingV3.
+//Older debuggers will ignore the V3 descriptor, in which case all channels fall back to the shared buffer.
+#define FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS 0
+#endif
+
+#ifndef FAST_SEMIHOSTING_DEDICATED_CHANNELS
+//pdcSamplingProfilerStream, pdcRealTimeAnalysisStream, pdcInstrumentationProfilerNormalStream
+#define FAST_SEMIHOSTING_DEDICATED_CHANNELS 0x41, 0x44, 0x45
+#endif
+
+#ifndef FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE
+#define FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE 2048
+#endif
+
+/*
+	FAST_SEMIHOSTING_CORE_COUNT > 1 allocates a separate set of buffers (the shared one and the dedicated channel buffers) for each core.
+	Each core only reserves space in its own buffers (selected via FAST_SEMIHOSTING_GET_CORE_ID()), so the cores never contend for the same
+	reservation state. This is required on the multi-core devices without LDREX/STREX (e.g. RP2040), where CompareAndSwap() only masks
+	the interrupts of the current core. FAST_SEMIHOSTING_BUFFER_SIZE and FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE apply to each core.
+
+	The buffers are reported to the debugger via kInitializeFastSemihostingV3, with the core number in bits 8+ of the channel field.
+	Older debuggers do not acknowledge it, in which case all cores fall back to the shared buffer of core 0 (as if this option was not set).
+	On devices without LDREX/STREX, only one core should write to the buffer in that case.
+	FlushFastSemihostingBuffer() only publishes the data of the calling core.
+*/
+#ifndef FAST_SEMIHOSTING_CORE_COUNT
+#ifdef PROFILER_RP2040
+#define FAST_SEMIHOSTING_CORE_COUNT 2
+#else
+#define FAST_SEMIHOSTING_CORE_COUNT 1
+#endif
+#endif
+
+#ifndef FAST_SEMIHOSTING_GET_CORE_ID
+#ifdef PROFILER_RP2040
+//SIO->CPUID
+#define FAST_SEMIHOSTING_GET_CORE_ID() (*(volatile unsigned *)0xD0000000)
+#else
+#define FAST_SEMIHOSTING_GET_CORE_ID() 0
+#endif
+#endif
+
+#define FAST_SEMIHOSTING_MULTIPLE_RINGS (FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS || FAST_SEMIHOSTING_CORE_COUNT > 1)
+
+#ifndef FAST_SEMIHOSTING_COMMIT_THRESHOLD
+//When non-zero, committed data is only made visible to the debugger once at least this many bytes have accumulated, reducing
+//the amount of small updates the debugger has to poll for. The data is also published when a line break is written to a text channel,
+//when a writer runs out of buffer space, or when FlushFastSemihostingBuffer() is called.
+#define FAST_SEMIHOSTING_COMMIT_THRESHOLD 0
+#endif
+
+/*
+	To limit the time the batched data can stay invisible to the debugger, define FAST_SEMIHOSTING_GET_TICK_COUNT() to return
+	a free-running counter (e.g. DWT->CYCCNT) and FAST_SEMIHOSTING_COMMIT_TIMEOUT to the maximum delay in ticks. The timeout is only
+	checked when new data is committed, so idle programs should call FlushFastSemihostingBuffer() periodically.
+*/
+/*
+	FAST_SEMIHOSTING_CHANNEL_PRIORITIES limits the share of each buffer that can be filled by the lower-priority channels,
+	so that the profiler data is not lost when the printf() output is produced faster than the debugger can read it:
+		- FAST_SEMIHOSTING_HIGH_PRIORITY_CHANNELS can use the entire buffer.
+		- Text channels (0-15) can fill the buffer up to FAST_SEMIHOSTING_LOW_PRIORITY_WATERMARK percent.
+		- All other channels can fill it up to FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK percent.
+	Writes exceeding the watermark are handled as if the buffer was full (i.e. they wait or get discarded depending on
+	FAST_SEMIHOSTING_BLOCKING_MODE). Compressed channels have the same priority as the original ones.
+*/
+#ifndef FAST_SEMIHOSTING_CHANNEL_PRIORITIES
+#define FAST_SEMIHOSTING_CHANNEL_PRIORITIES 0
+#endif
+
+#ifndef FAST_SEMIHOSTING_HIGH_PRIORITY_CHANNELS
+//pdcRealTimeAnalysisStream, pdcInstrumentationProfilerNormalStream
+#define FAST_SEMIHOSTING_HIGH_PRIORITY_CHANNELS 0x44, 0x45
+#endif
+
+#ifndef FAST_SEMIHOSTING_LOW_PRIORITY_WATERMARK
+#define FAST_SEMIHOSTING_LOW_PRIORITY_WATERMARK 50
+#endif
+
+#ifndef FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK
+#define FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK 75
+#endif
+
+#if FAST_SEMIHOSTING_LOW_PRIORITY_WATERMARK > FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK || FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK > 100
+#error Invalid fast semihosting channel watermarks
+#endif
+
+#ifndef FAST_SEMIHOSTING_DROP_STATISTICS
+//Counts the data discarded because of insufficient buffer space separately for each channel and reports the counters to the debugger.
+//FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS limits the amount of different channels that can be tracked.
+#define FAST_SEMIHOSTING_DROP_STATISTICS 0
+#endif
+
+#ifndef FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS
+#define FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS 8
+#endif
+
+#if defined(FAST_SEMIHOSTING_COMMIT_TIMEOUT) && !defined(FAST_SEMIHOSTING_GET_TICK_COUNT)
+#error FAST_SEMIHOSTING_COMMIT_TIMEOUT requires FAST_SEMIHOSTING_GET_TICK_COUNT()
+#endif
+
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD >= FAST_SEMIHOSTING_BUFFER_SIZE
+#error FAST_SEMIHOSTING_COMMIT_THRESHOLD should be smaller than FAST_SEMIHOSTING_BUFFER_SIZE
+#endif
+
+/*
+	Define FAST_SEMIHOSTING_COMPRESSED_CHANNELS as a comma-separated list of channels (e.g. 0, 1, 0x44) to compress the data written to them.
+	The compressed data for channel X is sent via channel (X | kCompressedChannelFlag) and needs to be decoded by the debugger
+	(see StreamCompressor.h and HostTools/StreamDecompressor.cpp). Each compressed channel uses a fixed amount of RAM:
+	FAST_SEMIHOSTING_COMPRESSION_WINDOW + 2 * FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE + 2 << FAST_SEMIHOSTING_COMPRESSION_HASH_BITS bytes.
+*/
+#ifdef FAST_SEMIHOSTING_COMPRESSED_CHANNELS
+
+#ifndef FAST_SEMIHOSTING_COMPRESSION_WINDOW
+#define FAST_SEMIHOSTING_COMPRESSION_WINDOW 1024
+#endif
+
+#ifndef FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE
+#define FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE 256
+#endif
+
+#ifndef FAST_SEMIHOSTING_COMPRESSION_HASH_BITS
+#define FAST_SEMIHOSTING_COMPRESSION_HASH_BITS 8
+#endif
+
+#if FAST_SEMIHOSTING_COMPRESSION_WINDOW > 32768
+#error FAST_SEMIHOSTING_COMPRESSION_WINDOW cannot exceed 32768 bytes
+#endif
+
+#if FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE * 2 > FAST_SEMIHOSTING_BUFFER_SIZE
+#error FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE is too large for FAST_SEMIHOSTING_BUFFER_SIZE
+#endif
+
+#include "StreamCompressor.h"
+
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+#error Compressed channels cannot be used with FAST_SEMIHOSTING_BLOCKING_MODE=2, as overwritten blocks would break the decompression.
+#endif
+
+#endif
+
+/*
+	Define FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS as a comma-separated list of channels (e.g. 0, 0x41, 0x44) to prefix each record written to them
+	with the value of FAST_SEMIHOSTING_GET_TIMESTAMP(). All channels use the same clock, so the debugger can correlate the printf() output
+	with the profiler data. The records for channel X are sent via channel (X | kTimestampedChannelFlag) and need to be decoded by the debugger
+	(see the format description below and HostTools/TimestampedRecordDecoder.cpp). Timestamped channels are never compressed.
+*/
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+
+#ifndef FAST_SEMIHOSTING_GET_TIMESTAMP
+#ifdef PROFILER_RP2040
+//TIMERAWL (the lower half of the 1 MHz system timer used by the instrumenting profiler)
+#define FAST_SEMIHOSTING_GET_TIMESTAMP() (*(volatile unsigned *)0x40054028)
+#else
+#define FAST_SEMIHOSTING_GET_TIMESTAMP() FAST_SEMIHOSTING_GET_CYCLE_COUNT()
+#endif
+#endif
+
+#ifndef FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL
+//Maximum distance (in timestamp ticks) between a record and the preceding full timestamp. Smaller values make the deltas shorter,
+//but require more frequent full timestamps (5 extra bytes each).
+#define FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL 0x40000
+#endif
+
+#if FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL > 0x10000000
+#error FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL cannot exceed 0x10000000
+#endif
+
+#endif
+
+struct FastSemihostingBufferHeader
+{
+	volatile unsigned ReadOffset;
+	volatile unsigned WriteOffset;
+	volatile unsigned LastKnownSwitchOffset;
+};
+
+static struct
+{
+	FastSemihostingBufferHeader Header;
+	char Data[FAST_SEMIHOSTING_BUFFER_SIZE];
+} s_FastSemihostingState;
+
+#if FAST_SEMIHOSTING_BUFFER_SIZE >= (1 << 19)
+#error FAST_SEMIHOSTING_BUFFER_SIZE is too large for the reservation state encoding
+#endif
+
+static volatile bool s_FastSemihostingInitialized;
+
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+//The simulated writers run on concurrent threads instead of interrupting each other, so the code that reserves buffer space and then writes
+//to the same buffer before committing it is treated as the interrupted writer (see HasInterruptedWriters()).
+static thread_local int s_HostThreadReservations;
+#endif
+
+typedef unsigned ChannelDescriptorType;
+
+static const int SysprogsSemihostingReasonBase = 0x50535953; //'SYSP';
+
+enum
+{
+	kInitializeFastSemihosting,
+	kControlFastSemihostingPolling,
+	kInitializeFastSemihostingV2,		//Fixes race condition with initialization vs. reset
+	kInitializeFastSemihostingV3,		//Passes a descriptor table of multiple buffers (see FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS and FAST_SEMIHOSTING_CORE_COUNT)
+	kConfigureFastSemihostingDoorbell,	//Passes the address of the waiting writer counter and the doorbell IRQ number
+	kConfigureFastSemihostingStatistics,	//Passes the address and the size of g_FastSemihostingDropStatistics
+};
+
+//Passed via R3 of the initialization calls
+enum
+{
+	kFastSemihostingFlagFramedRecords = 1,	//FAST_SEMIHOSTING_OVERWRITE_MODE: records have headers and may be overwritten
+};
+
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+static const unsigned s_FastSemihostingFlags = kFastSemihostingFlagFramedRecords;
+#else
+static const unsigned s_FastSemihostingFlags = 0;
+#endif
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The host simulator plays the role of the debugger and handles the semihosting calls directly.
+extern "C" void SysprogsHostSimulator_RunSemihostingCall(void *r0, void *r1, void *r2, void *r3);
+#define RunSemihostingCall SysprogsHostSimulator_RunSemihostingCall
+#else
+#ifdef __IAR_SYSTEMS_ICC__ 
+#pragma inline=never
+__stackless static void  RunSemihostingCall(void *r0, void *r1, void *r2, void * r3)
+#else
+static void __attribute__((noinline, naked)) RunSemihostingCall(void *r0, void *r1, void *r2, void * r3)
+#endif
+{
+	__asm("bkpt 0xab");
+	__asm("bx lr");
+}
+#endif
+
+/*
+	Lock-free reservation protocol
+
+	Writers claim disjoint slices of the buffer by atomically updating a single 32-bit reservation state word and copy their data
+	with interrupts enabled. The state word contains the following fields:
+		[31]	  A channel switch record has been reserved, but LastSwitchRecordEnd has not been updated yet.
+		[30]	  A variable-size reservation is open. Its end offset may still move back until another writer makes it final (see ReserveFastSemihostingSpace()).
+		[29:27]	  Amount of writers that have reserved space, but did not commit it yet.
+		[26:20]	  Channel of the last reserved data.
+		[19:0]	  Lower bits of the reservation offset (the full offset is reconstructed from ReadOffset).
+
+	WriteOffset and LastKnownSwitchOffset are only advanced by the writer that brings the amount of uncommitted writers to 0,
+	hence the debugger never sees a partially written record. Pending channel switches are completed by whoever encounters them
+	first, so a writer interrupted in the middle of a switch never blocks the interrupting one. Likewise, a writer that finds
+	a variable-size reservation open makes its end final instead of waiting for it, and the owner of the reservation then
+	turns the unused space into padding.
+*/
+enum
+{
+	kReservationOffsetMask = 0x000FFFFF,
+	kReservationChannelShift = 20,
+	kReservationChannelMask = 0x7F << kReservationChannelShift,
+	kReservationWriterShift = 27,
+	kReservationWriterMask = 0x07 << kReservationWriterShift,
+	kReservationSwitchPending = 0x80000000,
+	kReservationOpen = 0x40000000,
+
+	kMaxConcurrentWriters = kReservationWriterMask >> kReservationWriterShift,
+	kMaxRecordOverhead = 5, //Largest channel switch record (or record header in the overwrite mode)
+};
+
+/*
+	Each ring buffer (the shared one and the optional per-channel ones) has its own reservation state. Dedicated rings start with
+	their channel already selected in the reservation state, so they never contain channel switch records.
+*/
+struct FastSemihostingRing
+{
+	FastSemihostingBufferHeader *pHeader;
+	char *pData;
+	volatile unsigned ReservationState;
+	volatile unsigned LastSwitchRecordEnd;
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD
+	volatile unsigned char PublishRequested;
+#ifdef FAST_SEMIHOSTING_COMMIT_TIMEOUT
+	volatile unsigned LastPublishTime;
+#endif
+#endif
+};
+
+//Only the buffer of the first shared ring is known at compile time. The remaining fields are set by ResetFastSemihostingRing().
+#if !FAST_SEMIHOSTING_COMMIT_THRESHOLD
+#define FAST_SEMIHOSTING_FIRST_RING_INITIALIZER {&s_FastSemihostingState.Header, s_FastSemihostingState.Data, 0, 0}
+#elif !defined(FAST_SEMIHOSTING_COMMIT_TIMEOUT)
+#define FAST_SEMIHOSTING_FIRST_RING_INITIALIZER {&s_FastSemihostingState.Header, s_FastSemihostingState.Data, 0, 0, 0}
+#else
+#define FAST_SEMIHOSTING_FIRST_RING_INITIALIZER {&s_FastSemihostingState.Header, s_FastSemihostingState.Data, 0, 0, 0, 0}
+#endif
+
+#if FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+
+#if FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE >= (1 << 19)
+#error FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE is too large for the reservation state encoding
+#endif
+
+static const unsigned char s_DedicatedChannels[] = {FAST_SEMIHOSTING_DEDICATED_CHANNELS};
+
+enum
+{
+	kDedicatedRingCount = sizeof(s_DedicatedChannels) / sizeof(s_DedicatedChannels[0]),
+};
+
+static struct
+{
+	FastSemihostingBufferHeader Header;
+	char Data[FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE];
+} s_DedicatedChannelStates[FAST_SEMIHOSTING_CORE_COUNT][kDedicatedRingCount];
+
+#else
+enum
+{
+	kDedicatedRingCount = 0,
+};
+#endif
+
+#if FAST_SEMIHOSTING_MULTIPLE_RINGS
+
+enum
+{
+	kRingsPerCore = 1 + kDedicatedRingCount, //The shared ring of each core is followed by its dedicated rings
+	kSharedRingChannel = 0xFF,
+	kRingDescriptorCoreShift = 8,
+};
+
+#if FAST_SEMIHOSTING_CORE_COUNT > 1
+//Shared buffers of the other cores. Core 0 uses s_FastSemihostingState, so that the older debuggers can still find it.
+static struct
+{
+	FastSemihostingBufferHeader Header;
+	char Data[FAST_SEMIHOSTING_BUFFER_SIZE];
+} s_SecondaryCoreStates[FAST_SEMIHOSTING_CORE_COUNT - 1];
+#endif
+
+//Passed to the debugger via kInitializeFastSemihostingV3. The debugger sets HostAcknowledged to a non-zero value if it supports it.
+struct FastSemihostingRingDescriptor
+{
+	unsigned Channel; //kSharedRingChannel for the shared buffer, combined with (core << kRingDescriptorCoreShift)
+	FastSemihostingBufferHeader *pHeader;
+	char *pData;
+	unsigned Size;
+};
+
+static struct
+{
+	volatile unsigned HostAcknowledged;
+	unsigned RingCount;
+	FastSemihostingRingDescriptor Rings[FAST_SEMIHOSTING_CORE_COUNT * kRingsPerCore];
+} s_FastSemihostingControlBlock;
+
+static volatile bool s_MultipleRingsActive;
+static FastSemihostingRing s_Rings[FAST_SEMIHOSTING_CORE_COUNT * kRingsPerCore] = {FAST_SEMIHOSTING_FIRST_RING_INITIALIZER};
+
+static inline bool IsSharedRing(const FastSemihostingRing *pRing)
+{
+	for (int core = 0; core < FAST_SEMIHOSTING_CORE_COUNT; core++)
+		if (pRing == &s_Rings[core * kRingsPerCore])
+			return true;
+
+	return false;
+}
+
+//Ring sizes are compile-time constants, so the compiler can replace the modulo operations with masks.
+static inline unsigned GetRingSize(const FastSemihostingRing *pRing)
+{
+	return (kDedicatedRingCount == 0 || IsSharedRing(pRing)) ? FAST_SEMIHOSTING_BUFFER_SIZE : FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE;
+}
+
+static inline unsigned GetRingBufferOffset(const FastSemihostingRing *pRing, unsigned offset)
+{
+	return (kDedicatedRingCount == 0 || IsSharedRing(pRing)) ? (offset % FAST_SEMIHOSTING_BUFFER_SIZE) : (offset % FAST_SEMIHOSTING_CHANNEL_BUFFER_SIZE);
+}
+
+//Returns the rings of the current core, or the ones of core 0 if the debugger does not support multiple rings.
+static inline FastSemihostingRing *GetCoreRings()
+{
+#if FAST_SEMIHOSTING_CORE_COUNT > 1
+	if (s_MultipleRingsActive)
+	{
+		unsigned core = FAST_SEMIHOSTING_GET_CORE_ID();
+		if (core < FAST_SEMIHOSTING_CORE_COUNT)
+			return &s_Rings[core * kRingsPerCore];
+	}
+#endif
+
+	return &s_Rings[0];
+}
+
+static inline FastSemihostingRing *GetRingForChannel(unsigned char channel)
+{
+	FastSemihostingRing *pRings = GetCoreRings();
+#if FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+	if (s_MultipleRingsActive)
+	{
+		for (int i = 0; i < kDedicatedRingCount; i++)
+			if (s_DedicatedChannels[i] == channel)
+				return &pRings[i + 1];
+	}
+#else
+	(void)channel;
+#endif
+
+	return pRings;
+}
+
+#else
+enum
+{
+	kRingsPerCore = 1,
+};
+
+static FastSemihostingRing s_Rings[1] = {FAST_SEMIHOSTING_FIRST_RING_INITIALIZER};
+
+static inline bool IsSharedRing(const FastSemihostingRing *)
+{
+	return true;
+}
+
+static inline unsigned GetRingSize(const FastSemihostingRing *)
+{
+	return FAST_SEMIHOSTING_BUFFER_SIZE;
+}
+
+static inline unsigned GetRingBufferOffset(const FastSemihostingRing *, unsigned offset)
+{
+	return offset % FAST_SEMIHOSTING_BUFFER_SIZE;
+}
+
+static inline FastSemihostingRing *GetCoreRings()
+{
+	return &s_Rings[0];
+}
+
+static inline FastSemihostingRing *GetRingForChannel(unsigned char)
+{
+	return &s_Rings[0];
+}
+#endif
+
+//Returns the index of the per-core state (e.g. the timebase or the compressor) matching the rings returned by GetCoreRings().
+static inline unsigned GetCoreIndex()
+{
+	return (unsigned)(GetCoreRings() - s_Rings) / kRingsPerCore;
+}
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+static inline bool CompareAndSwap(volatile unsigned *pValue, unsigned expected, unsigned newValue)
+{
+	return __atomic_compare_exchange_n(pValue, &expected, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#elif defined(__ARM_FEATURE_LDREX) && (__ARM_FEATURE_LDREX & 4)
+static inline bool CompareAndSwap(volatile unsigned *pValue, unsigned expected, unsigned newValue)
+{
+	unsigned oldValue, failed;
+	do
+	{
+		asm volatile("ldrex %0, [%1]"
+					 : "=r"(oldValue)
+					 : "r"(pValue)
+					 : "memory");
+		if (oldValue != expected)
+		{
+			asm volatile("clrex" ::
+							 : "memory");
+			return false;
+		}
+
+		asm volatile("strex %0, %2, [%1]"
+					 : "=&r"(failed)
+					 : "r"(pValue), "r"(newValue)
+					 : "memory");
+	} while (failed);
+	return true;
+}
+
+#else
+//ARMv6-M cores (e.g. Cortex-M0) do not support LDREX/STREX, so we emulate them by masking interrupts for a few instructions.
+static inline bool CompareAndSwap(volatile unsigned *pValue, unsigned expected, unsigned newValue)
+{
+	unsigned primask;
+	asm volatile("mrs %0, primask"
+				 : "=r"(primask));
+	asm volatile("cpsid i" ::
+					 : "memory");
+	bool result = (*pValue == expected);
+	if (result)
+		*pValue = newValue;
+	if (!primask)
+		asm volatile("cpsie i" ::
+						 : "memory");
+	return result;
+}
+#endif
+
+static volatile unsigned s_WaitingWriters;
+
+#if FAST_SEMIHOSTING_WAIT_STATISTICS
+FastSemihostingWaitStatistics g_FastSemihostingWaitStatistics;
+#endif
+
+static inline void AtomicAdd(volatile unsigned *pValue, int delta)
+{
+	for (;;)
+	{
+		unsigned value = *pValue;
+		if (CompareAndSwap(pValue, value, value + delta))
+			return;
+	}
+}
+
+#if FAST_SEMIHOSTING_DROP_STATISTICS
+/*
+	The debugger reads the table passed via kConfigureFastSemihostingStatistics along with the buffer contents.
+	Slots are assigned to channels on the first drop and are never released. Once all slots are taken, drops on
+	the remaining channels are only counted in the last slot (with Channel set to kDropStatisticsOverflowChannel).
+*/
+enum
+{
+	kDropStatisticsSlotUsed = 0x100,
+	kDropStatisticsOverflowChannel = 0xFF,
+};
+
+FastSemihostingDropStatistics g_FastSemihostingDropStatistics[FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS];
+
+static void CountDroppedData(unsigned char channel, unsigned size)
+{
+	FastSemihostingDropStatistics *pSlot = &g_FastSemihostingDropStatistics[FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS - 1];
+	for (int i = 0; i < FAST_SEMIHOSTING_DROP_STATISTICS_SLOTS - 1; i++)
+	{
+		unsigned slotChannel = g_FastSemihostingDropStatistics[i].Channel;
+		if (!slotChannel && CompareAndSwap(&g_FastSemihostingDropStatistics[i].Channel, 0, kDropStatisticsSlotUsed | channel))
+			slotChannel = kDropStatisticsSlotUsed | channel;
+
+		if (slotChannel == (kDropStatisticsSlotUsed | channel))
+		{
+			pSlot = &g_FastSemihostingDropStatistics[i];
+			break;
+		}
+	}
+
+	if (pSlot->Channel != (kDropStatisticsSlotUsed | channel))
+		pSlot->Channel = kDropStatisticsSlotUsed | kDropStatisticsOverflowChannel;
+
+	AtomicAdd(&pSlot->DroppedWrites, 1);
+	AtomicAdd(&pSlot->DroppedBytes, size);
+}
+#else
+static inline void CountDroppedData(unsigned char, unsigned)
+{
+}
+#endif
+
+#if FAST_SEMIHOSTING_CHANNEL_PRIORITIES
+static const unsigned char s_HighPriorityChannels[] = {FAST_SEMIHOSTING_HIGH_PRIORITY_CHANNELS};
+
+//Returns the amount of bytes the channel may occupy in the ring, keeping the rest for the higher-priority channels.
+//Records larger than the channel's share (minSize) can still be written into an empty ring, so they never wait forever.
+static inline unsigned GetChannelSpaceLimit(const FastSemihostingRing *pRing, unsigned char channel, unsigned minSize = 0)
+{
+#ifdef FAST_SEMIHOSTING_COMPRESSED_CHANNELS
+	channel &= ~0x20; //kCompressedChannelFlag
+#endif
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	channel &= ~0x10; //kTimestampedChannelFlag
+#endif
+	for (unsigned i = 0; i < sizeof(s_HighPriorityChannels); i++)
+		if (s_HighPriorityChannels[i] == channel)
+			return GetRingSize(pRing);
+
+	unsigned limit = GetRingSize(pRing) * ((channel < 0x10) ? FAST_SEMIHOSTING_LOW_PRIORITY_WATERMARK : FAST_SEMIHOSTING_NORMAL_PRIORITY_WATERMARK) / 100;
+	if (limit < minSize + kMaxRecordOverhead)
+		limit = minSize + kMaxRecordOverhead;
+	return (limit > GetRingSize(pRing)) ? GetRingSize(pRing) : limit;
+}
+#else
+static inline unsigned GetChannelSpaceLimit(const FastSemihostingRing *pRing, unsigned char, unsigned = 0)
+{
+	return GetRingSize(pRing);
+}
+#endif
+
+//Called repeatedly while a writer is waiting for the debugger. The iteration counter should start at 0 and be passed to FinishWaitingForDebugger() afterwards.
+static void WaitForDebugger(unsigned iteration, unsigned *pWaitStart)
+{
+	if (!iteration)
+	{
+#if FAST_SEMIHOSTING_WAIT_STATISTICS
+		*pWaitStart = FAST_SEMIHOSTING_GET_CYCLE_COUNT();
+#else
+		(void)pWaitStart;
+#endif
+		//The caller will check the buffer once more after we register as a waiting writer, so the debugger cannot miss it.
+		AtomicAdd(&s_WaitingWriters, 1);
+		return;
+	}
+
+#if FAST_SEMIHOSTING_WAIT_STRATEGY == 1
+	FAST_SEMIHOSTING_WAIT_FOR_EVENT();
+#if defined(FAST_SEMIHOSTING_DOORBELL_IRQ) && !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+	//NVIC->ICPR. The doorbell interrupt is never handled, so we clear its pending bit to let it generate the next event.
+	((volatile unsigned *)0xE000E280)[FAST_SEMIHOSTING_DOORBELL_IRQ / 32] = 1U << (FAST_SEMIHOSTING_DOORBELL_IRQ % 32);
+#endif
+#elif FAST_SEMIHOSTING_WAIT_STRATEGY == 2
+	FAST_SEMIHOSTING_RTOS_YIELD();
+#elif FAST_SEMIHOSTING_WAIT_STRATEGY == 3
+	if (iteration < FAST_SEMIHOSTING_WAIT_SPIN_COUNT)
+		FAST_SEMIHOSTING_WAIT_HOOK();
+	else
+		FAST_SEMIHOSTING_SLEEP();
+#else
+	FAST_SEMIHOSTING_WAIT_HOOK();
+#endif
+}
+
+static void FinishWaitingForDebugger(unsigned iterations, unsigned waitStart)
+{
+	if (!iterations)
+		return;
+
+	AtomicAdd(&s_WaitingWriters, -1);
+#if FAST_SEMIHOSTING_WAIT_STATISTICS
+	//The statistics are updated without synchronization, so concurrent waits may occasionally be missed.
+	unsigned cycles = FAST_SEMIHOSTING_GET_CYCLE_COUNT() - waitStart;
+	g_FastSemihostingWaitStatistics.WaitCount++;
+	g_FastSemihostingWaitStatistics.TotalWaitCycles += cycles;
+	if (cycles > g_FastSemihostingWaitStatistics.MaxWaitCycles)
+		g_FastSemihostingWaitStatistics.MaxWaitCycles = cycles;
+#else
+	(void)waitStart;
+#endif
+}
+
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+/*
+	Timestamped channel format:
+	[sync token] [base: 4 bytes, little-endian]					 - optional, starts a new timebase generation
+	[record token] [payload size: 2 bytes, little-endian] [payload]
+	[record token] [payload size: 2 bytes, little-endian] [payload] ...
+
+	The tokens are LEB128-encoded. Sync tokens are (generation << 1) | 1 and record tokens are (delta << 3) | (generation << 1).
+	The timestamp of a record is the base of its generation plus the delta, so the debugger never needs to accumulate the deltas
+	of the previous records and can start decoding at any sync token (e.g. after the oldest data was overwritten in the flight
+	recorder mode). A writer that finds the delta exceeding FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL starts the next generation.
+
+	A writer may get interrupted between reading the timestamp and reserving the buffer space, so the sync token of the next generation
+	can precede a record of the previous one. The debugger should hence keep the base of the previous generation, and treat the
+	records referring to the generations it did not see (e.g. because the record starting it was dropped) as having no timestamp.
+*/
+static const unsigned char s_TimestampedChannels[] = {FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS};
+
+enum
+{
+	kTimestampedChannelFlag = 0x10,
+	kTimestampedChannelCount = sizeof(s_TimestampedChannels) / sizeof(s_TimestampedChannels[0]),
+
+	kTimestampGenerationMask = 0x03,
+	kTimestampBaseValid = 0x04,	//Cleared until the first generation is started, or after the record starting a generation was dropped
+	kTimestampStateMask = 0x07, //The base timestamp is rounded down to keep the state in a single word
+	kMaxTimestampHeaderSize = 1 + 4 + 5 + 2,
+};
+
+//Base timestamp of the current generation, combined with the generation number and kTimestampBaseValid.
+//Each core has its own generations, as the debugger decodes the rings of each core separately.
+static volatile unsigned s_TimestampStates[FAST_SEMIHOSTING_CORE_COUNT][kTimestampedChannelCount];
+#endif
+
+static void ResetFastSemihostingRing(FastSemihostingRing *pRing, unsigned char channel)
+{
+	pRing->pHeader->ReadOffset = 0;
+	pRing->pHeader->WriteOffset = 0;
+	pRing->pHeader->LastKnownSwitchOffset = 0;
+	pRing->LastSwitchRecordEnd = 0;
+	//Starting with the channel already selected ensures that the dedicated buffers never contain channel switch records.
+	pRing->ReservationState = (channel & 0x7F) << kReservationChannelShift;
+}
+
+void InitializeFastSemihosting()
+{
+	s_FastSemihostingInitialized = true;
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	s_HostThreadReservations = 0;
+#endif
+
+#if FAST_SEMIHOSTING_MULTIPLE_RINGS
+	s_FastSemihostingControlBlock.HostAcknowledged = 0;
+	s_FastSemihostingControlBlock.RingCount = FAST_SEMIHOSTING_CORE_COUNT * kRingsPerCore;
+
+	for (int core = 0; core < FAST_SEMIHOSTING_CORE_COUNT; core++)
+	{
+		FastSemihostingRing *pRings = &s_Rings[core * kRingsPerCore];
+		FastSemihostingRingDescriptor *pDescriptors = &s_FastSemihostingControlBlock.Rings[core * kRingsPerCore];
+		unsigned coreTag = core << kRingDescriptorCoreShift;
+
+#if FAST_SEMIHOSTING_CORE_COUNT > 1
+		if (core)
+		{
+			pRings[0].pHeader = &s_SecondaryCoreStates[core - 1].Header;
+			pRings[0].pData = s_SecondaryCoreStates[core - 1].Data;
+		}
+#endif
+
+		pDescriptors[0].Channel = kSharedRingChannel | coreTag;
+		pDescriptors[0].pHeader = pRings[0].pHeader;
+		pDescriptors[0].pData = pRings[0].pData;
+		pDescriptors[0].Size = FAST_SEMIHOSTING_BUFFER_SIZE;
+
+#if FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+		for (int i = 0; i < kDedicatedRingCount; i++)
+		{
+			pRings[i + 1].pHeader = &s_DedicatedChannelStates[core][i].Header;
+			pRings[i + 1].pData = s_DedicatedChannelStates[core][i].Data;
+
+			pDescriptors[i + 1].Channel = s_DedicatedChannels[i] | coreTag;
+			pDescriptors[i + 1].pHeader = &s_DedicatedChannelStates[core][i].Header;
+			pDescriptors[i + 1].pData = s_DedicatedChannelStates[core][i].Data;
+			pDescriptors[i + 1].Size = sizeof(s_DedicatedChannelStates[core][i].Data);
+		}
+#endif
+	}
+
+	RunSemihostingCall((void *)(SysprogsSemihostingReasonBase + kInitializeFastSemihostingV3),
+					   &s_FastSemihostingControlBlock,
+					   (void *)sizeof(s_FastSemihostingControlBlock),
+					   (void *)s_FastSemihostingFlags);
+
+	s_MultipleRingsActive = s_FastSemihostingControlBlock.HostAcknowledged != 0;
+	if (s_MultipleRingsActive)
+	{
+		//The shared ring of core 0 is reset below.
+		for (int i = 1; i < FAST_SEMIHOSTING_CORE_COUNT * kRingsPerCore; i++)
+		{
+#if FAST_SEMIHOSTING_DEDICATED_CHANNEL_BUFFERS
+			if (i % kRingsPerCore)
+			{
+				ResetFastSemihostingRing(&s_Rings[i], s_DedicatedChannels[i % kRingsPerCore - 1]);
+				continue;
+			}
+#endif
+			ResetFastSemihostingRing(&s_Rings[i], 0);
+		}
+	}
+	else
+#endif
+	{
+		/* The old way of reporting sizeof(Data) via the ReadOffset field causes a race condition during reset:
+		 *	1. A system reset is triggered and this function gets called.
+		 *	2. The reading thread on the VisualGDB side processes pre-reset data and updates ReadOffset.
+		 *	3. VisualGDB gets to process the semihosting call with the incorrect ReadOffset value
+		 *
+		 * Passing the size via the R2 register instead is not affected by any background memory operations.
+		*/
+		RunSemihostingCall((void *)(SysprogsSemihostingReasonBase + kInitializeFastSemihostingV2),
+						   &s_FastSemihostingState,
+						   (void *)sizeof(s_FastSemihostingState.Data),
+						   (void *)s_FastSemihostingFlags);
+	}
+
+	ResetFastSemihostingRing(&s_Rings[0], 0);
+
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	//The debugger forgets the previous generations, so the next record on each channel should start a new one.
+	for (int i = 0; i < kTimestampedChannelCount; i++)
+		for (int core = 0; core < FAST_SEMIHOSTING_CORE_COUNT; core++)
+			s_TimestampStates[core][i] = 0;
+#endif
+
+#ifdef FAST_SEMIHOSTING_DOORBELL_IRQ
+#if FAST_SEMIHOSTING_WAIT_STRATEGY == 1 && !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+	*((volatile unsigned *)0xE000ED10) |= 0x10; //SCB->SCR |= SCB_SCR_SEVONPEND_Msk
+#endif
+	RunSemihostingCall((void *)(SysprogsSemihostingReasonBase + kConfigureFastSemihostingDoorbell),
+					   (void *)&s_WaitingWriters,
+					   (void *)FAST_SEMIHOSTING_DOORBELL_IRQ,
+					   (void *)0);
+#endif
+
+#if FAST_SEMIHOSTING_DROP_STATISTICS
+	RunSemihostingCall((void *)(SysprogsSemihostingReasonBase + kConfigureFastSemihostingStatistics),
+					   g_FastSemihostingDropStatistics,
+					   (void *)sizeof(g_FastSemihostingDropStatistics),
+					   (void *)0);
+#endif
+}
+
+/*
+	Overwrite mode record format:
+	[kRecordMarker] [channel] [payload size: 2 bytes, little-endian] [payload] [kRecordMarker] ...
+
+	Writers that run out of space evict the oldest committed records by advancing LastKnownSwitchOffset (unused in this mode) past them.
+	The space is reused only after the eviction, so the debugger should read LastKnownSwitchOffset again after copying the data,
+	discard everything before it, and continue parsing from it (it always points to a record header).
+	The target treats the later of ReadOffset and LastKnownSwitchOffset as the start of the unread data. However, it also evicts the records
+	that the debugger has already read before reusing their space, as ReadOffset is not guaranteed to point to a record header.
+*/
+enum
+{
+	kRecordMarker = 0xFA,
+	kRecordHeaderSize = 4,
+	kMaxRecordSize = 0xFFFF,
+
+	kPaddingChannel = 0x7F, //Fills the unused end of variable-size reservations. The debugger should discard it (before checking the channel flags).
+};
+
+//Returns the offset of the oldest data in the ring that may not be overwritten (in the overwrite mode, the oldest record that was not evicted).
+static inline unsigned GetRingReadOffset(const FastSemihostingRing *pRing)
+{
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	return pRing->pHeader->LastKnownSwitchOffset;
+#else
+	return pRing->pHeader->ReadOffset;
+#endif
+}
+
+//Converts the lower bits of an offset stored in the reservation state into the full 32-bit offset used by the debugger.
+//If the state was read before the debugger consumed the data past it, the offset is behind ReadOffset, so the difference is sign-extended.
+static inline unsigned ExpandReservationOffset(const FastSemihostingRing *pRing, unsigned state)
+{
+	unsigned readOffset = GetRingReadOffset(pRing);
+	int delta = (int)(((state - readOffset) & kReservationOffsetMask) << 12) >> 12;
+	return readOffset + delta;
+}
+
+//Returns the amount of bytes that can be written to the specified channel, taking its priority into account.
+static int GetFastSemihostingFreeBufferSize(const FastSemihostingRing *pRing, unsigned char channel)
+{
+	unsigned readOffset = GetRingReadOffset(pRing);
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	//The records that the debugger has already read are evicted on demand, so they count as free space.
+	unsigned debuggerReadOffset = pRing->pHeader->ReadOffset;
+	if ((int)((debuggerReadOffset - readOffset) << 1) > 0)
+		readOffset = debuggerReadOffset;
+#endif
+	unsigned bytesWritten = (pRing->ReservationState - readOffset) & kReservationOffsetMask;
+	unsigned limit = GetChannelSpaceLimit(pRing, channel);
+	if (bytesWritten > limit)
+		return 0;
+
+	return limit - bytesWritten;
+}
+
+static void CopyToFastSemihostingBuffer(const FastSemihostingRing *pRing, unsigned offset, const void *pData, unsigned size)
+{
+	unsigned bufferOffset = GetRingBufferOffset(pRing, offset);
+	unsigned todo = GetRingSize(pRing) - bufferOffset;
+	if (todo > size)
+		todo = size;
+
+	memcpy(pRing->pData + bufferOffset, pData, todo);
+	if (todo < size)
+		memcpy(pRing->pData, (const char *)pData + todo, size - todo);
+}
+
+//Moves a debugger-visible offset forward, unless another writer has already moved it further.
+static void AdvanceVisibleOffset(volatile unsigned *pOffset, unsigned newValue)
+{
+	for (;;)
+	{
+		unsigned oldValue = *pOffset;
+		//Bit 31 of WriteOffset is used by RequestBlockingProcessingViaFastSemihosting() and must be preserved.
+		if ((int)((newValue - oldValue) << 1) <= 0)
+			return;
+		if (CompareAndSwap(pOffset, oldValue, (newValue & 0x7FFFFFFF) | (oldValue & 0x80000000)))
+			return;
+	}
+}
+
+//Updates LastSwitchRecordEnd for a channel switch record that has been reserved, but not yet completed.
+static void CompletePendingChannelSwitch(FastSemihostingRing *pRing, unsigned state)
+{
+	unsigned previousSwitchEnd = pRing->LastSwitchRecordEnd;
+	if (pRing->ReservationState != state)
+		return;
+
+	CompareAndSwap(&pRing->LastSwitchRecordEnd, previousSwitchEnd, ExpandReservationOffset(pRing, state));
+	CompareAndSwap(&pRing->ReservationState, state, state & ~kReservationSwitchPending);
+}
+
+//Checks whether the data committed up to writeOffset should be made visible to the debugger (see FAST_SEMIHOSTING_COMMIT_THRESHOLD).
+static inline bool IsPublishingDue(FastSemihostingRing *pRing, unsigned writeOffset)
+{
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD
+	if (pRing->PublishRequested)
+		return true;
+	if (((writeOffset - pRing->pHeader->WriteOffset) & 0x7FFFFFFF) >= FAST_SEMIHOSTING_COMMIT_THRESHOLD)
+		return true;
+#ifdef FAST_SEMIHOSTING_COMMIT_TIMEOUT
+	if ((unsigned)(FAST_SEMIHOSTING_GET_TICK_COUNT() - pRing->LastPublishTime) >= FAST_SEMIHOSTING_COMMIT_TIMEOUT)
+		return true;
+#endif
+	return false;
+#else
+	(void)pRing;
+	(void)writeOffset;
+	return true;
+#endif
+}
+
+//Makes the data visible to the debugger if the caller, that has just released its reservation by setting newState, was the last active writer.
+//lastSwitchEnd should be read before the reservation state.
+static void PublishReleasedData(FastSemihostingRing *pRing, unsigned newState, unsigned lastSwitchEnd)
+{
+	if (newState & (kReservationWriterMask | kReservationSwitchPending))
+		return;
+
+	//Everything up to the reservation offset has been written. Make it visible to the debugger.
+	unsigned writeOffset = ExpandReservationOffset(pRing, newState);
+	if (!IsPublishingDue(pRing, writeOffset))
+		return;
+
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD
+	pRing->PublishRequested = 0;
+#ifdef FAST_SEMIHOSTING_COMMIT_TIMEOUT
+	pRing->LastPublishTime = FAST_SEMIHOSTING_GET_TICK_COUNT();
+#endif
+#endif
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	(void)lastSwitchEnd; //LastKnownSwitchOffset points to the oldest record instead
+#else
+	AdvanceVisibleOffset(&pRing->pHeader->LastKnownSwitchOffset, lastSwitchEnd);
+#endif
+	AdvanceVisibleOffset(&pRing->pHeader->WriteOffset, writeOffset);
+}
+
+//Marks the data written by the caller as complete.
+static void ReleaseReservation(FastSemihostingRing *pRing)
+{
+	for (;;)
+	{
+		unsigned state = pRing->ReservationState;
+		unsigned lastSwitchEnd = pRing->LastSwitchRecordEnd;
+		unsigned newState = state - (1 << kReservationWriterShift);
+		if (CompareAndSwap(&pRing->ReservationState, state, newState))
+		{
+			PublishReleasedData(pRing, newState, lastSwitchEnd);
+			return;
+		}
+	}
+}
+
+//Marks the data written into the caller's variable-size reservation (ending at reservationEnd) as complete and returns its last unusedSize bytes
+//to the buffer. Returns false without releasing anything if another writer has already made the end of the reservation final.
+static bool ReleaseVariableSizeReservation(FastSemihostingRing *pRing, unsigned reservationEnd, unsigned unusedSize)
+{
+	for (;;)
+	{
+		unsigned state = pRing->ReservationState;
+		unsigned lastSwitchEnd = pRing->LastSwitchRecordEnd;
+
+		//A later variable-size reservation can be open at this point, but it cannot end at the same offset.
+		if (!(state & kReservationOpen) || ((state ^ reservationEnd) & kReservationOffsetMask))
+			return false;
+
+		unsigned newState = ((state - (1 << kReservationWriterShift)) & ~(kReservationOpen | kReservationOffsetMask)) | ((reservationEnd - unusedSize) & kReservationOffsetMask);
+		if (CompareAndSwap(&pRing->ReservationState, state, newState))
+		{
+			PublishReleasedData(pRing, newState, lastSwitchEnd);
+			return true;
+		}
+	}
+}
+
+//Makes all committed data visible to the debugger. If other writers are active, the last one of them will publish it.
+static void PublishCommittedData(FastSemihostingRing *pRing)
+{
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD
+	pRing->PublishRequested = 1;
+	for (;;)
+	{
+		unsigned state = pRing->ReservationState;
+		if ((state & kReservationWriterMask) == kReservationWriterMask)
+			return;
+
+		//Registering as an empty writer ensures that the reservation state does not change under our feet.
+		if (CompareAndSwap(&pRing->ReservationState, state, state + (1 << kReservationWriterShift)))
+			break;
+	}
+
+	ReleaseReservation(pRing);
+#else
+	(void)pRing;
+#endif
+}
+
+/*
+	Multi-channel data format:
+	[channel switch record] [data] [data] [data] [channel switch record] [data] ...
+
+	Channel switch record DOES NOT specify the length of the remaining data. Instead, it actually points to the previous
+	switch record and the global state object points to the last switch record. This has a HUGE advantage of having 0% overhead
+	when channel switches are rare (most of the time). One drawback of this approach is that if exactly 2GB of data are passed
+	between 2 subsequent channel switches, the client code will ignore the switch and treat it as a part of the data stream.
+	This could be fixed by adding an additional counter, but we assume that the probability of this event is extremely low.
+
+	The semihosting client code is responsible for 	reconstructing the addresses of the switch records inside the portion of data
+	it reads and in splitting the data between channels.
+*/
+
+#if !FAST_SEMIHOSTING_OVERWRITE_MODE
+//Set longForm to always use the 5-byte form, e.g. if the record has to end at a fixed offset that was reserved before the delta was known.
+static int EncodeChannelSwitchRecord(unsigned char channel, unsigned delta, unsigned char *pRecord, bool longForm = false)
+{
+	if (delta < 256 && !longForm)
+	{
+		//[delta] [1 || channel]
+		pRecord[0] = delta;
+		pRecord[1] = channel | 0x80;
+		return 2;
+	}
+	else if (delta < 0x007FFFFF && !longForm)
+	{
+		//[1 || delta] [0 || channel]
+		pRecord[0] = delta;
+		pRecord[1] = delta >> 8;
+		pRecord[2] = (delta >> 16) | 0x80;
+		pRecord[3] = channel;
+		return 4;
+	}
+	else
+	{
+		//[0 || delta] [0 || channel]
+		delta &= 0x7FFFFFFF;
+		pRecord[0] = delta;
+		pRecord[1] = delta >> 8;
+		pRecord[2] = delta >> 16;
+		pRecord[3] = delta >> 24;
+		pRecord[4] = channel;
+		return 5;
+	}
+}
+#else
+//Frees up the space occupied by the oldest record visible to the debugger (or already read by it). Returns false if there are no such records.
+//The records are always evicted starting from LastKnownSwitchOffset, as ReadOffset may point into the middle of a record.
+static bool EvictOldestRecord(FastSemihostingRing *pRing)
+{
+	unsigned oldestRecord = pRing->pHeader->LastKnownSwitchOffset;
+	unsigned writeOffset = pRing->pHeader->WriteOffset & 0x7FFFFFFF;
+	if ((int)((writeOffset - oldestRecord) << 1) <= 0)
+		return false;
+
+	unsigned char header[kRecordHeaderSize];
+	for (int i = 0; i < kRecordHeaderSize; i++)
+		header[i] = pRing->pData[GetRingBufferOffset(pRing, oldestRecord + i)];
+
+	//If another writer has already evicted this record, the header may have been overwritten, but the CAS below will fail anyway.
+	unsigned end = oldestRecord + kRecordHeaderSize + (header[2] | (header[3] << 8));
+	CompareAndSwap(&pRing->pHeader->LastKnownSwitchOffset, oldestRecord, end & 0x7FFFFFFF);
+	return true;
+}
+#endif
+
+/*
+	Each variable-size reservation is followed by a trailer, so that its unused space can be turned into padding if another writer
+	has already reserved the space after it:
+		Overwrite mode:		[record header] [used data] [record header: kPaddingChannel] [padding]
+		Shared rings:		[used data] [switch record: kPaddingChannel] [padding] [5-byte switch record: the original channel]
+	Otherwise, the unused space and the trailer are simply returned to the buffer.
+	The dedicated rings have neither record headers nor switch records, so an open variable-size reservation still blocks the other
+	writers of the same channel.
+*/
+static inline unsigned GetVariableSizeTrailerSize(const FastSemihostingRing *pRing)
+{
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	(void)pRing;
+	return kRecordHeaderSize;
+#else
+	return IsSharedRing(pRing) ? 2 * kMaxRecordOverhead : 0;
+#endif
+}
+
+//Returns true if the ring cannot be used until the open variable-size reservation is committed. The reservation may belong to the code
+//we have interrupted, so the caller should not wait for it.
+static inline bool IsBlockedByVariableSizeReservation(const FastSemihostingRing *pRing)
+{
+	return (pRing->ReservationState & kReservationOpen) && !GetVariableSizeTrailerSize(pRing);
+}
+
+//Returns true if the code we have interrupted (or preempted) holds reservations in the ring. Neither their data, nor anything written after it
+//can be published until they are committed (see PublishReleasedData()).
+static inline bool HasInterruptedWriters(const FastSemihostingRing *pRing)
+{
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	(void)pRing;
+	return s_HostThreadReservations != 0;
+#else
+	//The writers waiting for the buffer space do not hold any reservations, so all remaining ones belong to the code we have interrupted.
+	return (pRing->ReservationState & kReservationWriterMask) != 0;
+#endif
+}
+
+//Returns false if waiting for the debugger cannot free up any more space in the ring, so the caller should drop the data instead.
+static inline bool CanWaitForBufferSpace(const FastSemihostingRing *pRing)
+{
+	if (IsBlockedByVariableSizeReservation(pRing))
+		return false;
+
+	//Once the debugger has read everything that was published, the space can only be freed by the writers we have interrupted.
+	return !HasInterruptedWriters(pRing) || pRing->pHeader->ReadOffset != (pRing->pHeader->WriteOffset & 0x7FFFFFFF);
+}
+
+//Fills the space between the first usedSize bytes of a variable-size reservation and the end of its trailer with padding.
+static void WriteVariableSizeReservationPadding(const FastSemihostingReservation *pReservation, unsigned usedSize)
+{
+	FastSemihostingRing *pRing = (FastSemihostingRing *)pReservation->pRing;
+	unsigned paddingStart = pReservation->Offset + usedSize;
+	unsigned end = pReservation->Offset + pReservation->FirstSegmentSize + pReservation->SecondSegmentSize + GetVariableSizeTrailerSize(pRing);
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	unsigned paddingSize = end - paddingStart - kRecordHeaderSize;
+	unsigned char header[kRecordHeaderSize] = {kRecordMarker, kPaddingChannel, (unsigned char)paddingSize, (unsigned char)(paddingSize >> 8)};
+	CopyToFastSemihostingBuffer(pRing, paddingStart, header, sizeof(header));
+#else
+	//The end of the last record has already been used as LastSwitchRecordEnd by the other writers, so it uses the fixed-size form.
+	unsigned char record[kMaxRecordOverhead];
+	int recordSize = EncodeChannelSwitchRecord(kPaddingChannel, paddingStart - pReservation->LastSwitchRecordEnd, record);
+	CopyToFastSemihostingBuffer(pRing, paddingStart, record, recordSize);
+
+	unsigned lastRecordStart = end - kMaxRecordOverhead;
+	EncodeChannelSwitchRecord(pReservation->Channel, lastRecordStart - (paddingStart + recordSize), record, true);
+	CopyToFastSemihostingBuffer(pRing, lastRecordStart, record, kMaxRecordOverhead);
+#endif
+}
+
+//Reserves between minSize and maxSize bytes for the specified channel, inserting a channel switch record if needed.
+//Returns the amount of reserved bytes, or 0 if there is not enough space, too many concurrent writers or an open variable-size reservation
+//in a dedicated ring. Specify pLastSwitchRecordEnd to make a variable-size reservation (followed by the trailer, see GetVariableSizeTrailerSize()).
+//It receives the end of the channel switch record preceding the reservation.
+static unsigned ReserveFastSemihostingSpace(FastSemihostingRing *pRing, unsigned char channel, unsigned minSize, unsigned maxSize, unsigned *pOffset, unsigned *pLastSwitchRecordEnd = 0)
+{
+	channel &= 0x7F;
+	for (;;)
+	{
+		unsigned state = pRing->ReservationState;
+		if (state & kReservationSwitchPending)
+		{
+			CompletePendingChannelSwitch(pRing, state);
+			continue;
+		}
+
+		if ((state & kReservationWriterMask) == kReservationWriterMask)
+			return 0;
+
+		if (state & kReservationOpen)
+		{
+			if (!GetVariableSizeTrailerSize(pRing))
+				return 0;
+
+			//Instead of waiting for the open reservation to be committed, we make its end final. Its owner will then fill the unused space
+			//with padding that (outside the overwrite mode) ends with a channel switch record, hence the pending switch.
+			unsigned closedState = state & ~kReservationOpen;
+#if !FAST_SEMIHOSTING_OVERWRITE_MODE
+			closedState |= kReservationSwitchPending;
+#endif
+			CompareAndSwap(&pRing->ReservationState, state, closedState);
+			continue;
+		}
+
+		unsigned lastSwitchEnd = pRing->LastSwitchRecordEnd;
+		unsigned trailerSize = pLastSwitchRecordEnd ? GetVariableSizeTrailerSize(pRing) : 0;
+		unsigned readOffset = GetRingReadOffset(pRing);
+		unsigned start = readOffset + ((state - readOffset) & kReservationOffsetMask);
+		unsigned used = start - readOffset;
+		unsigned limit = GetChannelSpaceLimit(pRing, channel, minSize + trailerSize);
+		unsigned available = (used > limit) ? 0 : limit - used;
+		unsigned newState = state + (1 << kReservationWriterShift);
+		if (pLastSwitchRecordEnd)
+			newState |= kReservationOpen;
+
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+		if (available < kRecordHeaderSize + minSize + trailerSize)
+		{
+			PublishCommittedData(pRing);
+			if (EvictOldestRecord(pRing))
+				continue;
+			return 0; //All remaining data is still being written by other writers.
+		}
+
+		unsigned size = available - kRecordHeaderSize - trailerSize;
+		if (size > maxSize)
+			size = maxSize;
+		if (size > kMaxRecordSize)
+			size = kMaxRecordSize;
+
+		newState = (newState & ~kReservationOffsetMask) | ((start + kRecordHeaderSize + size + trailerSize) & kReservationOffsetMask);
+		if (!CompareAndSwap(&pRing->ReservationState, state, newState))
+			continue;
+
+		unsigned char header[kRecordHeaderSize] = {kRecordMarker, channel, (unsigned char)size, (unsigned char)(size >> 8)};
+		CopyToFastSemihostingBuffer(pRing, start, header, sizeof(header));
+		*pOffset = start + kRecordHeaderSize;
+		if (pLastSwitchRecordEnd)
+			*pLastSwitchRecordEnd = lastSwitchEnd;
+		return size;
+#else
+		if (((state & kReservationChannelMask) >> kReservationChannelShift) != channel)
+		{
+			//The switch record is reserved separately, so that the next writer can find out where it ends.
+			unsigned char record[5];
+			int recordSize = EncodeChannelSwitchRecord(channel, start - lastSwitchEnd, record);
+			if (available < recordSize + minSize + trailerSize)
+			{
+				PublishCommittedData(pRing); //The debugger cannot free up the space occupied by the data it does not see.
+				return 0;
+			}
+
+			newState = ((newState & ~(kReservationOpen | kReservationChannelMask | kReservationOffsetMask)) | (channel << kReservationChannelShift) | ((start + recordSize) & kReservationOffsetMask)) | kReservationSwitchPending;
+			if (!CompareAndSwap(&pRing->ReservationState, state, newState))
+				continue;
+
+			CopyToFastSemihostingBuffer(pRing, start, record, recordSize);
+			CompletePendingChannelSwitch(pRing, newState);
+			ReleaseReservation(pRing);
+			continue;
+		}
+
+		if (available < minSize + trailerSize)
+		{
+			PublishCommittedData(pRing);
+			return 0;
+		}
+
+		unsigned size = (maxSize > available - trailerSize) ? available - trailerSize : maxSize;
+		newState = (newState & ~kReservationOffsetMask) | ((start + size + trailerSize) & kReservationOffsetMask);
+		if (!CompareAndSwap(&pRing->ReservationState, state, newState))
+			continue;
+
+		*pOffset = start;
+		if (pLastSwitchRecordEnd)
+			*pLastSwitchRecordEnd = lastSwitchEnd;
+		return size;
+#endif
+	}
+}
+
+static void FillFastSemihostingReservation(FastSemihostingRing *pRing, unsigned offset, unsigned size, FastSemihostingReservation *pReservation)
+{
+	unsigned bufferOffset = GetRingBufferOffset(pRing, offset);
+	unsigned firstSegmentSize = GetRingSize(pRing) - bufferOffset;
+	if (firstSegmentSize > size)
+		firstSegmentSize = size;
+
+	pReservation->pFirstSegment = pRing->pData + bufferOffset;
+	pReservation->FirstSegmentSize = firstSegmentSize;
+	pReservation->pSecondSegment = pRing->pData;
+	pReservation->SecondSegmentSize = size - firstSegmentSize;
+	pReservation->pRing = pRing;
+	pReservation->HeaderSize = 0;
+	pReservation->Offset = offset;
+}
+
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+struct TimestampHeader
+{
+	unsigned char Data[kMaxTimestampHeaderSize];
+	unsigned Size;		  //Including the payload size field
+	unsigned StartedState; //Non-zero if this record starts a new generation
+};
+
+//Returns the timebase state for the specified channel, or NULL if the channel is not timestamped.
+static volatile unsigned *GetTimestampState(unsigned char channel)
+{
+	for (int i = 0; i < kTimestampedChannelCount; i++)
+		if (s_TimestampedChannels[i] == channel)
+			return &s_TimestampStates[GetCoreIndex()][i];
 
-#ifndef FAST_SEMIHOSTING_PROFILER_DRIVER
-#define FAST_SEMIHOSTING_PROFILER_DRIVER 1
-#endif
+	return 0;
+}
 
-#ifndef FAST_SEMIHOSTING_HOLD_INTERRUPTS
-#if defined(USE_FREERTOS) || defined(USE_RTX)
-#define FAST_SEMIHOSTING_HOLD_INTERRUPTS 1
-#else
-#define FAST_SEMIHOSTING_HOLD_INTERRUPTS 0
-#endif
+static unsigned EncodeTimestampToken(unsigned char *pBuffer, unsigned value)
+{
+	unsigned size = 0;
+	while (value >= 0x80)
+	{
+		pBuffer[size++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
 
-#endif
+	pBuffer[size++] = (unsigned char)value;
+	return size;
+}
 
-static struct
+//Encodes the tokens preceding the payload size field, starting a new generation if needed.
+static void PrepareTimestampHeader(volatile unsigned *pState, TimestampHeader *pHeader)
 {
-	volatile unsigned ReadOffset;
-	volatile unsigned WriteOffset;
-	volatile unsigned LastKnownSwitchOffset;
-	char Data[FAST_SEMIHOSTING_BUFFER_SIZE];
-} s_FastSemihostingState;
+	unsigned state, now;
+	pHeader->StartedState = 0;
+	for (;;)
+	{
+		//The timestamp is read after the state, so it is never earlier than the base of the generation.
+		state = *pState;
+		now = FAST_SEMIHOSTING_GET_TIMESTAMP();
+		if ((state & kTimestampBaseValid) && now - (state & ~kTimestampStateMask) < FAST_SEMIHOSTING_TIMESTAMP_SYNC_INTERVAL)
+			break;
 
-static volatile bool s_FastSemihostingInitialized;
-static char s_LastKnownChannel;
+		unsigned newState = (now & ~kTimestampStateMask) | kTimestampBaseValid | ((state + 1) & kTimestampGenerationMask);
+		if (CompareAndSwap(pState, state, newState))
+		{
+			state = pHeader->StartedState = newState;
+			break;
+		}
+	}
 
-typedef unsigned ChannelDescriptorType;
+	unsigned generation = state & kTimestampGenerationMask, base = state & ~kTimestampStateMask, size = 0;
+	if (pHeader->StartedState)
+	{
+		size = EncodeTimestampToken(pHeader->Data, (generation << 1) | 1);
+		for (int i = 0; i < 4; i++)
+			pHeader->Data[size++] = (unsigned char)(base >> (i * 8));
+	}
 
-static const int SysprogsSemihostingReasonBase = 0x50535953; //'SYSP';
+	size += EncodeTimestampToken(pHeader->Data + size, ((now - base) << 3) | (generation << 1));
+	pHeader->Size = size + 2;
+}
 
-enum
+//Reserves space for a record on a timestamped channel and writes its header. Returns the reserved payload size (between minSize and maxSize)
+//and stores the offset of the payload in *pOffset.
+static unsigned ReserveTimestampedRecord(volatile unsigned *pState, unsigned char channel, unsigned minSize, unsigned maxSize, unsigned *pOffset, unsigned *pHeaderSize, unsigned *pLastSwitchRecordEnd = 0)
 {
-	kInitializeFastSemihosting,
-	kControlFastSemihostingPolling,
-	kInitializeFastSemihostingV2,		//Fixes race condition with initialization vs. reset
-};
+	unsigned char transportChannel = channel | kTimestampedChannelFlag;
+	FastSemihostingRing *pRing = GetRingForChannel(transportChannel);
+	TimestampHeader header;
+	PrepareTimestampHeader(pState, &header);
 
-#ifdef __IAR_SYSTEMS_ICC__ 
-#pragma inline=never
-__stackless static void  RunSemihostingCall(void *r0, void *r1, void *r2, void * r3)
-#else
-static void __attribute__((noinline, naked)) RunSemihostingCall(void *r0, void *r1, void *r2, void * r3)
+	if (maxSize > kMaxRecordSize - header.Size)
+		maxSize = kMaxRecordSize - header.Size;
+	if (minSize > maxSize)
+		minSize = maxSize;
+
+	unsigned reserved = ReserveFastSemihostingSpace(pRing, transportChannel, header.Size + minSize, header.Size + maxSize, pOffset, pLastSwitchRecordEnd);
+	if (!reserved)
+	{
+		//The debugger will never see the new generation, so the next writer should start another one.
+		if (header.StartedState)
+			CompareAndSwap(pState, header.StartedState, header.StartedState & ~kTimestampBaseValid);
+		return 0;
+	}
+
+	reserved -= header.Size;
+	header.Data[header.Size - 2] = (unsigned char)reserved;
+	header.Data[header.Size - 1] = (unsigned char)(reserved >> 8);
+	CopyToFastSemihostingBuffer(pRing, *pOffset, header.Data, header.Size);
+	*pOffset += header.Size;
+	*pHeaderSize = header.Size;
+	return reserved;
+}
 #endif
+
+//Returns the ring that receives the uncompressed data written to the specified channel.
+static inline FastSemihostingRing *GetTransportRing(unsigned char channel)
 {
-	__asm("bkpt 0xab");
-	__asm("bx lr");
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	if (GetTimestampState(channel))
+		return GetRingForChannel(channel | kTimestampedChannelFlag);
+#endif
+	return GetRingForChannel(channel);
 }
 
-void InitializeFastSemihosting()
+//Same as ReserveFastSemihostingBuffer(), but does not count the failed attempts as dropped data, so the caller can retry them.
+static bool TryReserveFastSemihostingBuffer(unsigned char channel, unsigned size, FastSemihostingReservation *pReservation)
 {
-	s_FastSemihostingInitialized = true;
+	unsigned offset;
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	if (volatile unsigned *pTimestampState = GetTimestampState(channel))
+	{
+		unsigned headerSize;
+		if (size > kMaxRecordSize - kMaxTimestampHeaderSize || !ReserveTimestampedRecord(pTimestampState, channel, size, size, &offset, &headerSize))
+			return false;
 
-	/* The old way of reporting sizeof(Data) via the ReadOffset field causes a race condition during reset:
-	 *	1. A system reset is triggered and this function gets called.
-	 *	2. The reading thread on the VisualGDB side processes pre-reset data and updates ReadOffset.
-	 *	3. VisualGDB gets to process the semihosting call with the incorrect ReadOffset value
-	 *	
-	 * Passing the size via the R2 register instead is not affected by any background memory operations.
-	*/
-	RunSemihostingCall((void *)(SysprogsSemihostingReasonBase + kInitializeFastSemihostingV2),
-					   &s_FastSemihostingState,
-					   (void *)sizeof(s_FastSemihostingState.Data),
-					   (void *)0);
-	
-	s_FastSemihostingState.ReadOffset = 0;
-	s_FastSemihostingState.WriteOffset = 0;
+		FillFastSemihostingReservation(GetRingForChannel(channel | kTimestampedChannelFlag), offset, size, pReservation);
+		pReservation->HeaderSize = headerSize;
+		return true;
+	}
+#endif
+
+	FastSemihostingRing *pRing = GetRingForChannel(channel);
+	if (!ReserveFastSemihostingSpace(pRing, channel, size, size, &offset))
+		return false;
+
+	FillFastSemihostingReservation(pRing, offset, size, pReservation);
+	return true;
 }
 
-static int GetFastSemihostingFreeBufferSize()
+int ReserveFastSemihostingBuffer(unsigned char channel, unsigned size, FastSemihostingReservation *pReservation)
 {
-	unsigned bytesWritten = (s_FastSemihostingState.WriteOffset - s_FastSemihostingState.ReadOffset);
-	if (bytesWritten > FAST_SEMIHOSTING_BUFFER_SIZE)
+	if (!CanInvokeSemihostingCalls())
+		return 0; //No debugger connected, so there is nowhere to send the data.
+
+	if (!s_FastSemihostingInitialized)
+		InitializeFastSemihosting();
+
+	if (!size)
 		return 0;
 
-	return FAST_SEMIHOSTING_BUFFER_SIZE - bytesWritten;
+	if (!TryReserveFastSemihostingBuffer(channel, size, pReservation))
+	{
+		CountDroppedData(channel, size);
+		return 0;
+	}
+
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	s_HostThreadReservations++;
+#endif
+	return size;
 }
 
-static int WriteRawFastSemihostingData(const void *pBuffer, int size, int isChannelSwitchRecord)
+int ReserveVariableSizeFastSemihostingBuffer(unsigned char channel, unsigned minSize, unsigned maxSize, FastSemihostingReservation *pReservation)
 {
 	if (!CanInvokeSemihostingCalls())
-		return size; //No debugger connected - ignore all semihosting output.
+		return 0; //No debugger connected, so there is nowhere to send the data.
 
 	if (!s_FastSemihostingInitialized)
-	{
 		InitializeFastSemihosting();
+
+	FastSemihostingRing *pRing = GetRingForChannel(channel);
+	unsigned char transportChannel = channel;
+	unsigned offset, headerSize = 0, size, lastSwitchEnd = 0;
+	if (!maxSize)
+		return 0;
+
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	if (volatile unsigned *pTimestampState = GetTimestampState(channel))
+	{
+		transportChannel = channel | kTimestampedChannelFlag;
+		pRing = GetRingForChannel(transportChannel);
+		size = (minSize > kMaxRecordSize - kMaxTimestampHeaderSize) ? 0 : ReserveTimestampedRecord(pTimestampState, channel, minSize ? minSize : 1, maxSize, &offset, &headerSize, &lastSwitchEnd);
 	}
+	else
+#endif
+		size = ReserveFastSemihostingSpace(pRing, channel, minSize ? minSize : 1, maxSize, &offset, &lastSwitchEnd);
 
-	unsigned minRequiredSize = (isChannelSwitchRecord ? size : 1) % FAST_SEMIHOSTING_BUFFER_SIZE;
-	while ((s_FastSemihostingState.WriteOffset - s_FastSemihostingState.ReadOffset) > (FAST_SEMIHOSTING_BUFFER_SIZE - minRequiredSize))
+	if (!size)
 	{
-#if FAST_SEMIHOSTING_BLOCKING_MODE
-		continue;
-#else
+		CountDroppedData(channel, minSize ? minSize : 1);
 		return 0;
-#endif
 	}
 
-	int readOff = s_FastSemihostingState.ReadOffset % FAST_SEMIHOSTING_BUFFER_SIZE;
-	int writeOff = s_FastSemihostingState.WriteOffset % FAST_SEMIHOSTING_BUFFER_SIZE;
-	int todo;
-	if (writeOff < readOff)
-		todo = readOff - writeOff;
-	else
-		todo = sizeof(s_FastSemihostingState.Data) - writeOff;
-
-	todo = (size > todo) ? todo : size;
-	memcpy(s_FastSemihostingState.Data + writeOff, pBuffer, todo);
-	unsigned fullWriteOff = s_FastSemihostingState.WriteOffset;
-	if ((writeOff + todo) == FAST_SEMIHOSTING_BUFFER_SIZE && todo != size)
-	{
-		//We are rolling over the end of the buffer and may be able to write more data at the beginning of it.
-		//Normally we could just skip this and let the caller retry, but writing channel switch records requires all-or-nothing semantics, so
-		//we have to do it before updating WriteOffset.
-		int todo2 = readOff;
-		if (todo2 > (size - todo))
-			todo2 = size - todo;
-		memcpy(s_FastSemihostingState.Data, (char *)pBuffer + todo, todo2);
-		if (isChannelSwitchRecord)
-			s_FastSemihostingState.LastKnownSwitchOffset = fullWriteOff + todo + todo2;
-		s_FastSemihostingState.WriteOffset = fullWriteOff + todo + todo2;
-		return todo + todo2;
+	FillFastSemihostingReservation(pRing, offset, size, pReservation);
+	pReservation->HeaderSize = headerSize;
+	pReservation->Channel = transportChannel & 0x7F;
+	pReservation->LastSwitchRecordEnd = lastSwitchEnd;
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	s_HostThreadReservations++;
+#endif
+	return size;
+}
+
+void CopyToFastSemihostingReservation(const FastSemihostingReservation *pReservation, unsigned offset, const void *pData, unsigned size)
+{
+	if (offset < pReservation->FirstSegmentSize)
+	{
+		unsigned todo = pReservation->FirstSegmentSize - offset;
+		if (todo > size)
+			todo = size;
+		memcpy((char *)pReservation->pFirstSegment + offset, pData, todo);
+		pData = (const char *)pData + todo;
+		size -= todo;
+		offset = 0;
 	}
 	else
+		offset -= pReservation->FirstSegmentSize;
+
+	if (size)
+		memcpy((char *)pReservation->pSecondSegment + offset, pData, size);
+}
+
+void CommitFastSemihostingBuffer(FastSemihostingReservation *pReservation)
+{
+	ReleaseReservation((FastSemihostingRing *)pReservation->pRing);
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	s_HostThreadReservations--;
+#endif
+}
+
+void CommitVariableSizeFastSemihostingBuffer(FastSemihostingReservation *pReservation, unsigned usedSize)
+{
+	unsigned reservedSize = pReservation->FirstSegmentSize + pReservation->SecondSegmentSize;
+	FastSemihostingRing *pRing = (FastSemihostingRing *)pReservation->pRing;
+	unsigned payloadOffset = pReservation->Offset;
+	if (usedSize < reservedSize && pReservation->HeaderSize)
+	{
+		//Update the payload size at the end of the timestamp header. A cancelled reservation leaves an empty record, as the header may start a new generation.
+		unsigned char size[2] = {(unsigned char)usedSize, (unsigned char)(usedSize >> 8)};
+		CopyToFastSemihostingBuffer(pRing, payloadOffset - 2, size, sizeof(size));
+	}
+#if FAST_SEMIHOSTING_OVERWRITE_MODE
+	if (usedSize < reservedSize)
+	{
+		//Update the size in the record header preceding the reservation.
+		unsigned recordSize = usedSize + pReservation->HeaderSize;
+		unsigned char size[2] = {(unsigned char)recordSize, (unsigned char)(recordSize >> 8)};
+		CopyToFastSemihostingBuffer(pRing, payloadOffset - pReservation->HeaderSize - 2, size, sizeof(size));
+	}
+#endif
+
+	unsigned end = payloadOffset + reservedSize + GetVariableSizeTrailerSize(pRing);
+	if (!ReleaseVariableSizeReservation(pRing, end, end - payloadOffset - usedSize))
 	{
-		if (isChannelSwitchRecord)
-			s_FastSemihostingState.LastKnownSwitchOffset = fullWriteOff + todo;
-		s_FastSemihostingState.WriteOffset = fullWriteOff + todo;
-		return todo;
+		WriteVariableSizeReservationPadding(pReservation, usedSize);
+		ReleaseReservation(pRing);
 	}
+#ifdef SYSPROGS_PROFILER_HOST_SIMULATION
+	s_HostThreadReservations--;
+#endif
 }
 
-/*
-	Multi-channel data format:
-	[channel switch record] [data] [data] [data] [channel switch record] [data] ...
-	
-	Channel switch record DOES NOT specify the length of the remaining data. Instead, it actually points to the previous
-	switch record and the global state object points to the last switch record. This has a HUGE advantage of having 0% overhead
-	when channel switches are rare (most of the time). One drawback of this approach is that if exactly 2GB of data are passed
-	between 2 subsequent channel switches, the client code will ignore the switch and treat it as a part of the data stream.
-	This could be fixed by adding an additional counter, but we assume that the probability of this event is extremely low.
-	
-	The semihosting client code is responsible for 	reconstructing the addresses of the switch records inside the portion of data 
-	it reads and in splitting the data between channels.
-*/
+void FlushFastSemihostingBuffer()
+{
+	if (!FAST_SEMIHOSTING_COMMIT_THRESHOLD || !s_FastSemihostingInitialized)
+		return;
+
+	//The rings of the other cores can only be updated by their own writers (see FAST_SEMIHOSTING_CORE_COUNT).
+	FastSemihostingRing *pRings = GetCoreRings();
+	for (int i = 0; i < kRingsPerCore; i++)
+	{
+		if (pRings[i].pHeader)
+			PublishCommittedData(&pRings[i]);
+	}
+}
+
+#ifdef FAST_SEMIHOSTING_COMPRESSED_CHANNELS
+typedef StreamCompressor<FAST_SEMIHOSTING_COMPRESSION_WINDOW, FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE, FAST_SEMIHOSTING_COMPRESSION_HASH_BITS> FastSemihostingCompressor;
+
+static const unsigned char s_CompressedChannels[] = {FAST_SEMIHOSTING_COMPRESSED_CHANNELS};
+
+enum
+{
+	kCompressedChannelCount = sizeof(s_CompressedChannels) / sizeof(s_CompressedChannels[0]),
+	kCompressedChannelFlag = 0x20,
+};
+
+static struct FastSemihostingCompressionState
+{
+	volatile unsigned Busy;
+	FastSemihostingCompressor Compressor;
+	unsigned char Block[FastSemihostingCompressor::kMaxCompressedSize];
+} s_CompressionStates[FAST_SEMIHOSTING_CORE_COUNT][kCompressedChannelCount];
+
+//Returns the compressor for the specified channel, or NULL if the channel is not compressed or the compressor is used by the code we have interrupted.
+//In the latter case the data is sent uncompressed.
+static FastSemihostingCompressionState *LockCompressionState(unsigned char channel)
+{
+	for (int i = 0; i < kCompressedChannelCount; i++)
+	{
+		if (s_CompressedChannels[i] == channel)
+		{
+			FastSemihostingCompressionState *pState = &s_CompressionStates[GetCoreIndex()][i];
+			return CompareAndSwap(&pState->Busy, 0, 1) ? pState : 0;
+		}
+	}
+
+	return 0;
+}
+
+static void UnlockCompressionState(FastSemihostingCompressionState *pState)
+{
+	pState->Busy = 0;
+}
+
+//Compresses the input previously appended to the compressor and sends it as a single block.
+static bool WriteCompressedBlock(FastSemihostingCompressionState *pState, unsigned char channel, bool wait)
+{
+	unsigned char compressedChannel = channel | kCompressedChannelFlag;
+	FastSemihostingRing *pRing = GetRingForChannel(compressedChannel);
+	unsigned size = pState->Compressor.Compress(pState->Block), offset;
+
+	unsigned iteration = 0, waitStart = 0;
+	while (!ReserveFastSemihostingSpace(pRing, compressedChannel, size, size, &offset))
+	{
+		if (!wait || !CanWaitForBufferSpace(pRing))
+		{
+			//The decoder will never see this block, so the next ones should not refer to it.
+			FinishWaitingForDebugger(iteration, waitStart);
+			pState->Compressor.DiscardInput();
+			return false;
+		}
+		WaitForDebugger(iteration++, &waitStart);
+	}
+
+	FinishWaitingForDebugger(iteration, waitStart);
+
+	CopyToFastSemihostingBuffer(pRing, offset, pState->Block, size);
+	ReleaseReservation(pRing);
+	pState->Compressor.AcceptInput();
+	return true;
+}
+
+static int WriteToCompressedChannel(FastSemihostingCompressionState *pState, unsigned char channel, const void *pBuffer, int size, int writeAll)
+{
+	int done = 0;
+	do
+	{
+		unsigned todo = size - done;
+		if (todo > FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE)
+			todo = FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE;
+
+		pState->Compressor.AppendInput((const char *)pBuffer + done, todo);
+		if (!WriteCompressedBlock(pState, channel, FAST_SEMIHOSTING_WAIT_FOR_BUFFER_SPACE))
+			break;
+		done += todo;
+	} while (writeAll && done != size);
+
+	return done;
+}
+#endif
 
 int g_FastSemihostingCallActive;
 
@@ -202,51 +1758,84 @@ int WriteToFastSemihostingChannel(unsigned char channel, const void *pBuffer, in
 	if (size == 0)
 		return 0;
 
+	if (!CanInvokeSemihostingCalls())
+		return size; //No debugger connected - ignore all semihosting output.
+
+	if (!s_FastSemihostingInitialized)
+		InitializeFastSemihosting();
+
 #if FAST_SEMIHOSTING_HOLD_INTERRUPTS
 	int interruptsDisabled = __get_PRIMASK();
 	__disable_irq();
 #endif
 
 	g_FastSemihostingCallActive++;
-	channel &= 0x7F;
-	if (channel != s_LastKnownChannel)
+	FastSemihostingRing *pRing = GetRingForChannel(channel);
+	int done = 0;
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	volatile unsigned *pTimestampState = GetTimestampState(channel);
+	if (pTimestampState)
+		pRing = GetRingForChannel(channel | kTimestampedChannelFlag);
+#endif
+#ifdef FAST_SEMIHOSTING_COMPRESSED_CHANNELS
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+	FastSemihostingCompressionState *pCompression = pTimestampState ? 0 : LockCompressionState(channel);
+#else
+	FastSemihostingCompressionState *pCompression = LockCompressionState(channel);
+#endif
+	if (pCompression)
 	{
-		unsigned delta = s_FastSemihostingState.WriteOffset - s_FastSemihostingState.LastKnownSwitchOffset;
-		int done;
-		if (delta < 256)
-		{
-			unsigned short rec = delta | (channel << 8) | 0x8000; //[delta] [1 || channel]
-			done = WriteRawFastSemihostingData(&rec, sizeof(rec), 1);
-		}
-		else if (delta < 0x007FFFFF)
-		{
-			unsigned rec = (unsigned)channel << 24 | 0x800000 | delta; //[1 || delta] [0 || channel]
-			done = WriteRawFastSemihostingData(&rec, sizeof(rec), 1);
-		}
-		else
-		{
-			struct __attribute__((aligned(1), packed))
-			{
-				unsigned Delta;
-				unsigned char Channel;
-			} rec = {delta & 0x7FFFFFFF, channel}; //[0 || delta] [0 || channel]
-			done = WriteRawFastSemihostingData(&rec, sizeof(rec), 1);
-		}
+		done = WriteToCompressedChannel(pCompression, channel, pBuffer, size, writeAll);
+		UnlockCompressionState(pCompression);
+	}
+	else
+#endif
+	do
+	{
+		//Limiting the size of each reservation leaves some space for the interrupt handlers writing to the buffer while the chunk is copied.
+		//If they run out of it anyway, they give up instead of waiting for this function (see CanWaitForBufferSpace()).
+		unsigned todo = size - done;
+		if (todo > GetRingSize(pRing) / 2)
+			todo = GetRingSize(pRing) / 2;
+		if (FAST_SEMIHOSTING_OVERWRITE_MODE && todo > kMaxRecordSize)
+			todo = kMaxRecordSize;
 
-		if (!done)
+		unsigned offset, reserved, iteration = 0, waitStart = 0;
+		for (;;)
 		{
-			g_FastSemihostingCallActive--;
-			return 0;
+			//In the overwrite mode, the oldest records are evicted to make space for the entire chunk.
+#ifdef FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS
+			unsigned headerSize;
+			if (pTimestampState)
+				reserved = ReserveTimestampedRecord(pTimestampState, channel, FAST_SEMIHOSTING_OVERWRITE_MODE ? todo : 1, todo, &offset, &headerSize);
+			else
+#endif
+				reserved = ReserveFastSemihostingSpace(pRing, channel, FAST_SEMIHOSTING_OVERWRITE_MODE ? todo : 1, todo, &offset);
+			if (reserved || !FAST_SEMIHOSTING_WAIT_FOR_BUFFER_SPACE)
+				break;
+			if (!CanWaitForBufferSpace(pRing))
+				break;
+			WaitForDebugger(iteration++, &waitStart);
 		}
 
-		s_LastKnownChannel = channel;
-	}
-	int done = 0;
-	do
-	{
-		done += WriteRawFastSemihostingData((const char *)pBuffer + done, size - done, 0);
+		FinishWaitingForDebugger(iteration, waitStart);
+
+		if (!reserved)
+			break;
+
+		CopyToFastSemihostingBuffer(pRing, offset, (const char *)pBuffer + done, reserved);
+		ReleaseReservation(pRing);
+		done += reserved;
 	} while (writeAll && done != size);
 
+	if (done < size)
+		CountDroppedData(channel, size - done);
+
+#if FAST_SEMIHOSTING_COMMIT_THRESHOLD
+	if (channel < 0x10 && memchr(pBuffer, '\n', done))
+		PublishCommittedData(pRing); //Text output should appear line by line
+#endif
+
 	g_FastSemihostingCallActive--;
 #if FAST_SEMIHOSTING_HOLD_INTERRUPTS
 	if (!interruptsDisabled)
@@ -298,47 +1887,133 @@ int _write(int fd, char *pBuffer, int size)
 */
 int __attribute((weak)) SysprogsProfiler_WriteData(ProfilerDataChannel channel, const void *pHeader, unsigned headerSize, const void *pPayload, unsigned payloadSize)
 {
-	extern int g_FastSemihostingCallActive;
+	ProfilerDataSegment segments[2] = {{pHeader, headerSize}, {pPayload, payloadSize}};
+	return SysprogsProfiler_WriteDataV(channel, segments, 2);
+}
 
-#if FAST_SEMIHOSTING_HOLD_INTERRUPTS
-	int interruptsDisabled = __get_PRIMASK();
-	__disable_irq();
+//Sends the segments as a single record. If wait is set, waits for the debugger to free up the buffer space, unless it cannot happen
+//(see CanWaitForBufferSpace()). The failed attempts are only counted as dropped data once, if the record gets discarded.
+static int WriteSegmentsToFastSemihostingChannel(ProfilerDataChannel channel, const ProfilerDataSegment *pSegments, unsigned segmentCount, bool wait)
+{
+	unsigned totalSize = 0;
+	for (unsigned i = 0; i < segmentCount; i++)
+		totalSize += pSegments[i].Size;
+
+	if (!CanInvokeSemihostingCalls())
+		return totalSize;
+
+	if (!s_FastSemihostingInitialized)
+		InitializeFastSemihosting();
+
+#ifdef FAST_SEMIHOSTING_COMPRESSED_CHANNELS
+	if (FastSemihostingCompressionState *pCompression = (totalSize <= FAST_SEMIHOSTING_COMPRESSION_BLOCK_SIZE) ? LockCompressionState(channel) : 0)
+	{
+		for (unsigned i = 0; i < segmentCount; i++)
+			pCompression->Compressor.AppendInput(pSegments[i].pData, pSegments[i].Size);
+
+		bool written = WriteCompressedBlock(pCompression, channel, wait);
+		UnlockCompressionState(pCompression);
+		if (!written)
+			CountDroppedData(channel, totalSize);
+		return written ? totalSize : 0;
+	}
 #endif
 
-	int result;
-	unsigned availableSpace = GetFastSemihostingFreeBufferSize();
-	if (availableSpace < (headerSize + payloadSize))
-		result = 0;
-	else if (g_FastSemihostingCallActive)
-		result = 0;
-	else
+	if (!totalSize)
+		return 0;
+
+	//All segments are written via a single reservation, so the data from other writers never gets between them.
+	FastSemihostingReservation reservation;
+	unsigned iteration = 0, waitStart = 0;
+	while (!TryReserveFastSemihostingBuffer(channel, totalSize, &reservation))
 	{
-		int done = WriteToFastSemihostingChannel(channel, pHeader, headerSize, 1);
-		if (done != (int)headerSize)
-			asm("bkpt 255");
-		done = WriteToFastSemihostingChannel(channel, pPayload, payloadSize, 1);
-		if (done != (int)payloadSize)
-			asm("bkpt 255");
+		if (!wait || !CanWaitForBufferSpace(GetTransportRing(channel)))
+		{
+			FinishWaitingForDebugger(iteration, waitStart);
+			CountDroppedData(channel, totalSize);
+			return 0;
+		}
+		WaitForDebugger(iteration++, &waitStart);
+	}
+
+	FinishWaitingForDebugger(iteration, waitStart);
 
-		result = headerSize + payloadSize;
+	for (unsigned i = 0, offset = 0; i < segmentCount; offset += pSegments[i++].Size)
+	{
+		if (pSegments[i].Size)
+			CopyToFastSemihostingReservation(&reservation, offset, pSegments[i].pData, pSegments[i].Size);
 	}
 
-#if FAST_SEMIHOSTING_HOLD_INTERRUPTS
-	if (!interruptsDisabled)
-		__enable_irq();
-#endif
+	ReleaseReservation((FastSemihostingRing *)reservation.pRing);
+	return totalSize;
+}
 
-	return result;
+int __attribute((weak)) SysprogsProfiler_WriteDataV(ProfilerDataChannel channel, const ProfilerDataSegment *pSegments, unsigned segmentCount)
+{
+	return WriteSegmentsToFastSemihostingChannel(channel, pSegments, segmentCount, false);
+}
+
+int __attribute((weak)) SysprogsProfiler_WriteDataBlocking(ProfilerDataChannel channel, const void *pHeader, unsigned headerSize, const void *pPayload, unsigned payloadSize)
+{
+	ProfilerDataSegment segments[2] = {{pHeader, headerSize}, {pPayload, payloadSize}};
+	return WriteSegmentsToFastSemihostingChannel(channel, segments, 2, FAST_SEMIHOSTING_WAIT_FOR_BUFFER_SPACE);
 }
 
 int SysprogsProfiler_GetBufferAvailability(unsigned exp)
 {
-	return (GetFastSemihostingFreeBufferSize() << exp) / FAST_SEMIHOSTING_BUFFER_SIZE;
+	const FastSemihostingRing *pRing = GetRingForChannel(pdcSamplingProfilerStream);
+	return (GetFastSemihostingFreeBufferSize(pRing, pdcSamplingProfilerStream) << exp) / GetRingSize(pRing);
+}
+
+int SysprogsProfiler_GetReportedCoreCount()
+{
+#if FAST_SEMIHOSTING_CORE_COUNT > 1
+	if (s_MultipleRingsActive)
+		return FAST_SEMIHOSTING_CORE_COUNT;
+#endif
+	return 1;
+}
+
+#else
+#include "SysprogsProfilerInterface.h"
+
+//Custom drivers deliver the data of all cores via the same stream.
+int __attribute((weak)) SysprogsProfiler_GetReportedCoreCount()
+{
+	return 1;
+}
+
+/*
+	Custom profiler drivers only need to implement SysprogsProfiler_WriteData(). This fallback merges all segments except the last one
+	into a small header buffer, so it only supports short headers (all segments used by the framework itself fit into it).
+*/
+int __attribute((weak)) SysprogsProfiler_WriteDataV(ProfilerDataChannel channel, const ProfilerDataSegment *pSegments, unsigned segmentCount)
+{
+	if (segmentCount <= 2)
+		return SysprogsProfiler_WriteData(channel, segmentCount ? pSegments[0].pData : 0, segmentCount ? pSegments[0].Size : 0, segmentCount > 1 ? pSegments[1].pData : 0, segmentCount > 1 ? pSegments[1].Size : 0);
+
+	char header[64];
+	unsigned headerSize = 0;
+	for (unsigned i = 0; i < segmentCount - 1; i++)
+	{
+		if (pSegments[i].Size > sizeof(header) - headerSize)
+			return 0;
+		memcpy(header + headerSize, pSegments[i].pData, pSegments[i].Size);
+		headerSize += pSegments[i].Size;
+	}
+
+	return SysprogsProfiler_WriteData(channel, header, headerSize, pSegments[segmentCount - 1].pData, pSegments[segmentCount - 1].Size);
+}
+
+//The custom drivers are expected to block in SysprogsProfiler_WriteData() if they support waiting for the debugger at all.
+int __attribute((weak)) SysprogsProfiler_WriteDataBlocking(ProfilerDataChannel channel, const void *pHeader, unsigned headerSize, const void *pPayload, unsigned payloadSize)
+{
+	return SysprogsProfiler_WriteData(channel, pHeader, headerSize, pPayload, payloadSize);
 }
 
 #endif
 
-#if !defined(__IAR_SYSTEMS_ICC__) && !defined(__CC_ARM)
+#if !defined(__IAR_SYSTEMS_ICC__) && !defined(__CC_ARM) && !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
 
 void __attribute__((noinline)) SuspendFastSemihostingPolling()
 {
@@ -362,10 +2037,21 @@ void __attribute__((noinline)) ResumeFastSemihostingPolling()
 
 void RequestBlockingProcessingViaFastSemihosting()
 {
-	s_FastSemihostingState.WriteOffset |= 0x80000000;
+	FlushFastSemihostingBuffer();
 
-	while (s_FastSemihostingState.WriteOffset & 0x80000000)
+	//The request is signaled via the shared ring of the calling core, as only its own writers can update it atomically.
+	FastSemihostingBufferHeader *pHeader = GetCoreRings()->pHeader;
+	for (;;)
 	{
-		//Waiting for the host to acknowledge the call.
+		unsigned writeOffset = pHeader->WriteOffset;
+		if (CompareAndSwap(&pHeader->WriteOffset, writeOffset, writeOffset | 0x80000000))
+			break;
 	}
+
+	//Waiting for the host to acknowledge the call.
+	unsigned iteration = 0, waitStart = 0;
+	while (pHeader->WriteOffset & 0x80000000)
+		WaitForDebugger(iteration++, &waitStart);
+
+	FinishWaitingForDebugger(iteration, waitStart);
 }
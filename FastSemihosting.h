@@ -36,6 +36,88 @@ int WriteToFastSemihostingChannel(unsigned char channel, const void *pBuffer, in
 */
 void InitializeFastSemihosting();
 
+//! Describes a region of the fast semihosting buffer reserved via \ref ReserveFastSemihostingBuffer.
+/*! The region may wrap around the end of the buffer, in which case it is split into 2 segments.
+	If the region is contiguous, SecondSegmentSize is 0.
+*/
+typedef struct
+{
+	void *pFirstSegment;
+	unsigned FirstSegmentSize;
+	void *pSecondSegment;
+	unsigned SecondSegmentSize;
+	void *pRing; //!< Used internally by the framework to track the ring buffer containing the reservation.
+	unsigned HeaderSize; //!< Used internally by the framework: size of the timestamp header preceding the reservation (see FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS).
+	unsigned Offset; //!< Used internally by the framework: offset of the reserved region in the ring buffer.
+	unsigned LastSwitchRecordEnd; //!< Used internally by the framework: end of the channel switch record preceding a variable-size reservation.
+	unsigned char Channel; //!< Used internally by the framework: channel that a variable-size reservation belongs to, including the transport flags.
+} FastSemihostingReservation;
+
+//! Reserves space for a record in the fast semihosting buffer.
+/*! This function can be safely called from threads and interrupt handlers at the same time, without disabling interrupts.
+	Each caller gets a disjoint region of the buffer that should be filled (e.g. via \ref CopyToFastSemihostingReservation) and then
+	passed to \ref CommitFastSemihostingBuffer. The debugger will not see any of the reserved data until all concurrently
+	reserved regions have been committed, so the reserved region should be committed as soon as possible. The interrupt handlers
+	that run in the meantime and run out of buffer space discard their data instead of waiting for the debugger.
+	
+	\return The reserved size (equal to size) on success, 0 if the buffer does not have enough space or no debugger is connected.
+*/
+int ReserveFastSemihostingBuffer(unsigned char channel, unsigned size, FastSemihostingReservation *pReservation);
+
+//! Copies data into a region reserved via \ref ReserveFastSemihostingBuffer, handling the wrap-around.
+void CopyToFastSemihostingReservation(const FastSemihostingReservation *pReservation, unsigned offset, const void *pData, unsigned size);
+
+//! Makes the data written into a reserved region available to the debugger.
+void CommitFastSemihostingBuffer(FastSemihostingReservation *pReservation);
+
+//! Reserves space for a record whose size is not known in advance, so that it can be encoded directly into the buffer.
+/*! Reserves as much space as available, but no less than minSize and no more than maxSize bytes. The caller should
+	write the record into the reserved segments and call \ref CommitVariableSizeFastSemihostingBuffer, specifying the actual size.
+	Other writers can still use the buffer in the meantime. If they do, the unused part of the reservation is filled with padding
+	(that the debugger discards) instead of being returned to the buffer, so the reservation should still be committed soon.
+	Rings dedicated to a single channel (see FAST_SEMIHOSTING_DEDICATED_CHANNELS) cannot contain padding, so other writers of that
+	channel cannot reserve space until the reservation is committed (\ref WriteToFastSemihostingChannel will discard the data instead of waiting).
+
+	\return The reserved size on success, 0 if the buffer does not have enough space, is being used by another variable-size reservation or no debugger is connected.
+*/
+int ReserveVariableSizeFastSemihostingBuffer(unsigned char channel, unsigned minSize, unsigned maxSize, FastSemihostingReservation *pReservation);
+
+//! Makes the first usedSize bytes of a variable-size reservation available to the debugger and returns the rest to the buffer.
+/*! Passing 0 as usedSize cancels the reservation. */
+void CommitVariableSizeFastSemihostingBuffer(FastSemihostingReservation *pReservation, unsigned usedSize);
+
+//! Makes all committed data visible to the debugger.
+/*! Only needed if FAST_SEMIHOSTING_COMMIT_THRESHOLD is used to batch the updates of the buffer state. Call it periodically
+	(e.g. from the idle loop), if the program may stop producing output while some of it is still below the threshold.
+*/
+void FlushFastSemihostingBuffer();
+
+//! Describes the time spent by the writers waiting for the debugger to read the buffer.
+/*! Only collected if FAST_SEMIHOSTING_WAIT_STATISTICS is set to 1. The cycles are counted via FAST_SEMIHOSTING_GET_CYCLE_COUNT()
+	(DWT->CYCCNT by default).
+*/
+typedef struct
+{
+	unsigned WaitCount;					//!< Amount of times a writer had to wait for the debugger
+	unsigned MaxWaitCycles;				//!< Longest single wait
+	unsigned long long TotalWaitCycles; //!< Total amount of cycles spent waiting
+} FastSemihostingWaitStatistics;
+
+extern FastSemihostingWaitStatistics g_FastSemihostingWaitStatistics;
+
+//! Counts the data discarded on one channel because the buffer did not have enough space.
+/*! Only collected if FAST_SEMIHOSTING_DROP_STATISTICS is set to 1. The table is reported to the debugger during initialization,
+	so it can display the counters without stopping the target.
+*/
+typedef struct
+{
+	volatile unsigned Channel;		  //!< 0x100 | channel number, or 0 if the slot is unused. 0x1FF if the slot counts the channels that did not get their own one.
+	volatile unsigned DroppedWrites;  //!< Amount of write or reservation calls that failed, fully or partially
+	volatile unsigned DroppedBytes;	  //!< Amount of bytes that could not be written
+} FastSemihostingDropStatistics;
+
+extern FastSemihostingDropStatistics g_FastSemihostingDropStatistics[];
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,63 @@
+#include "AggregatedSampleDecoder.h"
+#include "SmallNumberCoder.h"
+
+bool AggregatedSampleDecoder::Feed(const unsigned char *pData, size_t size, std::vector<Stack> &stacks)
+{
+	m_Pending.insert(m_Pending.end(), pData, pData + size);
+
+	size_t offset = 0;
+	bool result = true;
+	while (offset < m_Pending.size())
+	{
+		size_t recordSize = m_Pending[offset];
+		if (m_Pending.size() - offset - 1 < recordSize)
+			break;
+
+		Stack stack;
+		if (DecodeRecord(&m_Pending[offset + 1], recordSize, stack))
+			stacks.push_back(stack);
+		else
+			result = false;
+		offset += recordSize + 1;
+	}
+
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + offset);
+	return result;
+}
+
+//Mirrors SendAggregatedStack() from SamplingProfiler.cpp.
+bool AggregatedSampleDecoder::DecodeRecord(const unsigned char *pRecord, size_t size, Stack &stack)
+{
+	SmallNumberDecoder decoder(pRecord, (unsigned)size, 0, 0);
+	int count, sp, fpOffset = 0, pc, lr, entryCount;
+	bool fpEqualsSP, reserved;
+	if (!decoder.ReadTinySIntWithFlag(&count, &fpEqualsSP) || !decoder.ReadTinySIntWithFlag(&sp, &reserved))
+		return false;
+	if (!fpEqualsSP && !decoder.ReadTinySIntWithFlag(&fpOffset, &reserved))
+		return false;
+	if (!decoder.ReadSmallMostlyEvenSInt(&pc) || !decoder.ReadSmallMostlyEvenSInt(&lr) || !decoder.ReadTinySIntWithFlag(&entryCount, &reserved))
+		return false;
+
+	stack.Count = (unsigned)count;
+	stack.SP = (unsigned)sp * 4;
+	stack.FP = stack.SP + (unsigned)fpOffset * 4;
+	stack.PC = (unsigned)pc;
+	stack.LR = (unsigned)lr;
+
+	//The stack entries are delta-encoded against the previous entry of the same kind (see SmallNumberCoder::WriteStackEntry()).
+	unsigned index = 0, refPoints[2] = {0, 0};
+	for (int i = 0; i < entryCount; i++)
+	{
+		int indexDelta, distance;
+		bool isSavedFP;
+		if (!decoder.ReadTinySIntWithFlag(&indexDelta, &isSavedFP) || !decoder.ReadSmallMostlyEvenSInt(&distance))
+			return false;
+
+		index += indexDelta;
+		refPoints[isSavedFP] += distance;
+		StackEntry entry = {index, refPoints[isSavedFP], isSavedFP};
+		stack.Entries.push_back(entry);
+	}
+
+	return decoder.GetOffset() == (int)size;
+}
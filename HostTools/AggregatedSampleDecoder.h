@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/*
+	Reference decoder for the pdcAggregatedSamplingProfilerStream channel (see SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE and the format
+	description in SamplingProfiler.cpp). Each record describes a stack and the amount of samples that hit it since it was last sent.
+	The same stack can be reported multiple times (e.g. after each periodic flush), so the debugger should sum up the counts.
+
+	Addresses are reported as 32-bit values, as the target sends them. Stack entry locations are reported in words relative to SP.
+*/
+class AggregatedSampleDecoder
+{
+public:
+	struct StackEntry
+	{
+		unsigned Index; //Offset from SP in words
+		unsigned Value;
+		bool IsSavedFP; //The entry points to the stack rather than to the code
+	};
+
+	struct Stack
+	{
+		unsigned Count;
+		unsigned SP, FP, PC, LR;
+		std::vector<StackEntry> Entries;
+	};
+
+	//Consumes the channel data (which may end in the middle of a record) and appends the decoded stacks to stacks.
+	//Returns false if some records are malformed.
+	bool Feed(const unsigned char *pData, size_t size, std::vector<Stack> &stacks);
+
+	//Should be called after the target reinitializes the buffer.
+	void Reset()
+	{
+		m_Pending.clear();
+	}
+
+private:
+	static bool DecodeRecord(const unsigned char *pRecord, size_t size, Stack &stack);
+
+private:
+	std::vector<unsigned char> m_Pending;
+};
@@ -0,0 +1,293 @@
+#include "DeferredLogRenderer.h"
+#include "SmallNumberCoder.h"
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	kELFHeaderSize = 0x34,
+	kProgramHeaderSize = 0x20,
+	kLoadableSegment = 1, //PT_LOAD
+};
+
+static unsigned ReadUInt32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static unsigned ReadUInt16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+void DeferredLogRenderer::AddMemoryRegion(unsigned address, const void *pData, size_t size)
+{
+	MemoryRegion region;
+	region.Address = address;
+	region.Data.assign((const char *)pData, (const char *)pData + size);
+	m_Regions.push_back(region);
+}
+
+bool DeferredLogRenderer::LoadELFFile(const char *pFileName)
+{
+	FILE *pFile = fopen(pFileName, "rb");
+	if (!pFile)
+		return false;
+
+	std::vector<unsigned char> contents;
+	unsigned char chunk[4096];
+	for (size_t done; (done = fread(chunk, 1, sizeof(chunk), pFile)) > 0;)
+		contents.insert(contents.end(), chunk, chunk + done);
+	fclose(pFile);
+
+	//Only 32-bit little-endian files are supported, as the target sends 32-bit addresses.
+	static const unsigned char magic[] = {0x7F, 'E', 'L', 'F', 1 /* ELFCLASS32 */, 1 /* ELFDATA2LSB */};
+	if (contents.size() < kELFHeaderSize || memcmp(contents.data(), magic, sizeof(magic)))
+		return false;
+
+	unsigned programHeaderOffset = ReadUInt32(&contents[0x1C]), programHeaderSize = ReadUInt16(&contents[0x2A]), programHeaderCount = ReadUInt16(&contents[0x2C]);
+	if (programHeaderSize < kProgramHeaderSize)
+		return false;
+
+	for (unsigned i = 0; i < programHeaderCount; i++)
+	{
+		unsigned long long headerOffset = programHeaderOffset + (unsigned long long)i * programHeaderSize;
+		if (headerOffset + kProgramHeaderSize > contents.size())
+			return false;
+
+		const unsigned char *pHeader = &contents[(size_t)headerOffset];
+		if (ReadUInt32(pHeader) != kLoadableSegment)
+			continue;
+
+		unsigned fileOffset = ReadUInt32(pHeader + 4), address = ReadUInt32(pHeader + 8), fileSize = ReadUInt32(pHeader + 16);
+		if ((unsigned long long)fileOffset + fileSize > contents.size())
+			return false;
+		if (fileSize)
+			AddMemoryRegion(address, &contents[fileOffset], fileSize);
+	}
+
+	return true;
+}
+
+const char *DeferredLogRenderer::ResolveFormatString(unsigned address)
+{
+	for (size_t i = 0; i < m_Regions.size(); i++)
+	{
+		const MemoryRegion &region = m_Regions[i];
+		if (address < region.Address || address - region.Address >= region.Data.size())
+			continue;
+
+		const char *pString = &region.Data[address - region.Address];
+		if (memchr(pString, 0, region.Data.size() - (address - region.Address)))
+			return pString;
+	}
+
+	return NULL;
+}
+
+bool DeferredLogRenderer::Feed(const unsigned char *pData, size_t size, std::string &output)
+{
+	m_Pending.insert(m_Pending.end(), pData, pData + size);
+
+	size_t offset = 0;
+	bool result = true;
+	while (offset < m_Pending.size())
+	{
+		size_t recordSize = m_Pending[offset];
+		if (m_Pending.size() - offset - 1 < recordSize)
+			break;
+
+		if (!RenderMessage(&m_Pending[offset + 1], recordSize, output))
+			result = false;
+		offset += recordSize + 1;
+	}
+
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + offset);
+	return result;
+}
+
+template <class _Value> static void AppendFormatted(std::string &output, const std::string &spec, _Value value)
+{
+	int size = snprintf(NULL, 0, spec.c_str(), value);
+	if (size <= 0)
+		return;
+
+	size_t offset = output.size();
+	output.resize(offset + size + 1);
+	snprintf(&output[offset], size + 1, spec.c_str(), value);
+	output.resize(offset + size);
+}
+
+static bool ReadInteger(SmallNumberDecoder &decoder, unsigned long long &value, bool &is64Bit)
+{
+	int low, high;
+	bool unused;
+	if (!decoder.ReadTinySIntWithFlag(&low, &is64Bit))
+		return false;
+
+	value = (unsigned)low;
+	if (is64Bit)
+	{
+		if (!decoder.ReadTinySIntWithFlag(&high, &unused))
+			return false;
+		value |= (unsigned long long)(unsigned)high << 32;
+	}
+
+	return true;
+}
+
+//Mirrors EncodeConversion() from SysprogsLog.cpp. Returns false if the record ends before the argument, or the conversion is not supported.
+static bool RenderConversion(SmallNumberDecoder &decoder, const char *&p, std::string &output)
+{
+	std::string spec = "%";
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+		spec += *p++;
+
+	unsigned long long value;
+	bool is64Bit;
+	if (*p == '*')
+	{
+		p++;
+		if (!ReadInteger(decoder, value, is64Bit))
+			return false;
+		spec += std::to_string((int)value);
+	}
+	else
+	{
+		while (*p >= '0' && *p <= '9')
+			spec += *p++;
+	}
+
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			p++;
+			if (!ReadInteger(decoder, value, is64Bit))
+				return false;
+			if ((int)value >= 0)
+				spec += "." + std::to_string((int)value);
+		}
+		else
+		{
+			spec += '.';
+			while (*p >= '0' && *p <= '9')
+				spec += *p++;
+		}
+	}
+
+	std::string lengthModifier;
+	if (*p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L')
+	{
+		lengthModifier += *p++;
+		if ((lengthModifier[0] == 'h' || lengthModifier[0] == 'l') && *p == lengthModifier[0])
+			lengthModifier += *p++;
+	}
+
+	//The 'h' and 'hh' modifiers are passed to snprintf() to truncate the value, the others only define the argument size (already known from the record).
+	std::string narrowModifier = (lengthModifier[0] == 'h') ? lengthModifier : std::string();
+
+	char conversion = *p++;
+	switch (conversion)
+	{
+	case '%':
+		output += '%';
+		return true;
+	case 'd':
+	case 'i':
+		if (!ReadInteger(decoder, value, is64Bit))
+			return false;
+		if (is64Bit)
+			AppendFormatted(output, spec + "ll" + conversion, (long long)value);
+		else
+			AppendFormatted(output, spec + narrowModifier + conversion, (int)(unsigned)value);
+		return true;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		if (!ReadInteger(decoder, value, is64Bit))
+			return false;
+		if (is64Bit)
+			AppendFormatted(output, spec + "ll" + conversion, value);
+		else
+			AppendFormatted(output, spec + narrowModifier + conversion, (unsigned)value);
+		return true;
+	case 'c':
+		if (!ReadInteger(decoder, value, is64Bit))
+			return false;
+		AppendFormatted(output, spec + conversion, (int)value);
+		return true;
+	case 'p':
+		if (!ReadInteger(decoder, value, is64Bit))
+			return false;
+		AppendFormatted(output, spec.insert(1, "#") + "llx", value);
+		return true;
+	case 's':
+	{
+		int length;
+		bool isNull;
+		if (!decoder.ReadTinySIntWithFlag(&length, &isNull) || length < 0)
+			return false;
+
+		std::string text(length, 0);
+		if (!decoder.ReadBytes(&text[0], length))
+			return false;
+		AppendFormatted(output, spec + conversion, isNull ? "(null)" : text.c_str());
+		return true;
+	}
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+	{
+		double floatingPointValue;
+		if (!decoder.ReadBytes(&floatingPointValue, sizeof(floatingPointValue)))
+			return false;
+		AppendFormatted(output, spec + conversion, floatingPointValue);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+bool DeferredLogRenderer::RenderMessage(const unsigned char *pRecord, size_t size, std::string &output)
+{
+	SmallNumberDecoder decoder(pRecord, (unsigned)size, 0, 0);
+	int address;
+	bool reserved;
+	if (!decoder.ReadTinySIntWithFlag(&address, &reserved))
+		return false;
+
+	const char *pFormat = ResolveFormatString((unsigned)address);
+	if (!pFormat)
+		return false;
+
+	for (const char *p = pFormat; *p;)
+	{
+		if (*p != '%')
+		{
+			output += *p++;
+			continue;
+		}
+
+		p++;
+		if (!RenderConversion(decoder, p, output))
+		{
+			//The target could not fit the remaining arguments into the record. Keep the line structure of the output intact.
+			output += "...";
+			size_t formatLength = strlen(pFormat);
+			if (pFormat[formatLength - 1] == '\n')
+				output += '\n';
+			break;
+		}
+	}
+
+	return true;
+}
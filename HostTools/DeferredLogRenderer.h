@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+	Reference renderer for the messages sent via SysprogsLog() (see SysprogsLog.h and the format description in SysprogsLog.cpp).
+	The target only sends the addresses of the format strings, so the renderer needs the contents of the memory holding them.
+	Normally, it is loaded from the ELF file via LoadELFFile(). Other debuggers can override ResolveFormatString() instead.
+
+	Feed the pdcDeferredLogStream channel data in the order it was received. Messages referring to unknown format strings are skipped.
+*/
+class DeferredLogRenderer
+{
+public:
+	virtual ~DeferredLogRenderer()
+	{
+	}
+
+	//Makes the contents of a target memory region available for resolving the format strings.
+	void AddMemoryRegion(unsigned address, const void *pData, size_t size);
+
+	//Loads all loadable segments of a 32-bit little-endian ELF file. Returns false if the file could not be read or has an unexpected format.
+	bool LoadELFFile(const char *pFileName);
+
+	//Consumes the channel data (which may end in the middle of a message) and appends the rendered messages to output.
+	//Returns false if some messages could not be rendered.
+	bool Feed(const unsigned char *pData, size_t size, std::string &output);
+
+	//Should be called after the target reinitializes the buffer.
+	void Reset()
+	{
+		m_Pending.clear();
+	}
+
+protected:
+	//Returns the null-terminated format string at the specified target address, or NULL if it is not known.
+	virtual const char *ResolveFormatString(unsigned address);
+
+private:
+	struct MemoryRegion
+	{
+		unsigned Address;
+		std::vector<char> Data;
+	};
+
+	bool RenderMessage(const unsigned char *pRecord, size_t size, std::string &output);
+
+private:
+	std::vector<unsigned char> m_Pending;
+	std::vector<MemoryRegion> m_Regions;
+};
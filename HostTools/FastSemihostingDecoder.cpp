@@ -0,0 +1,135 @@
+#include "FastSemihostingDecoder.h"
+#include <string.h>
+
+static unsigned ReadLittleEndian(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+//Returns the distance from 'from' to 'to', or a negative value if 'to' precedes it. Offsets reported by the target use 31 bits.
+static int OffsetDistance(unsigned from, unsigned to)
+{
+	return (int)((to - from) << 1) >> 1;
+}
+
+bool FastSemihostingSnapshot::FromMemoryImage(const void *pImage, size_t imageSize, FastSemihostingSnapshot &snapshot)
+{
+	const unsigned char *p = (const unsigned char *)pImage;
+	if (imageSize <= 12)
+		return false;
+
+	snapshot.ReadOffset = ReadLittleEndian(p);
+	snapshot.WriteOffset = ReadLittleEndian(p + 4);
+	snapshot.LastKnownSwitchOffset = ReadLittleEndian(p + 8);
+	snapshot.pData = p + 12;
+	snapshot.Size = (unsigned)(imageSize - 12);
+	return true;
+}
+
+bool FastSemihostingDecoder::Decode(const FastSemihostingSnapshot &snapshot, std::vector<Segment> &segments)
+{
+	unsigned readOffset = snapshot.ReadOffset & 0x7FFFFFFF;
+	unsigned writeOffset = snapshot.WriteOffset & 0x7FFFFFFF;
+	int available = OffsetDistance(readOffset, writeOffset);
+	if (available < 0 || (unsigned)available > snapshot.Size || !snapshot.Size)
+		return false;
+
+	//Walk the switch records backwards, starting from the last one. Each record ends at least 2 bytes after the previous one,
+	//so a well-formed buffer cannot contain more than available / 2 records.
+	m_Records.clear();
+	unsigned recordEnd = snapshot.LastKnownSwitchOffset;
+	if (OffsetDistance(recordEnd, writeOffset) < 0)
+		return false;
+
+	while (OffsetDistance(readOffset, recordEnd) > 0)
+	{
+		if (m_Records.size() > (unsigned)available / 2)
+			return false;
+
+		unsigned char lastByte = snapshot.pData[(recordEnd - 1) % snapshot.Size];
+		unsigned recordSize, delta;
+		if (lastByte & 0x80)
+			recordSize = 2;
+		else if (snapshot.pData[(recordEnd - 2) % snapshot.Size] & 0x80)
+			recordSize = 4;
+		else
+			recordSize = 5;
+
+		unsigned recordStart = recordEnd - recordSize;
+		if (OffsetDistance(readOffset, recordStart) < 0)
+			return false;
+
+		unsigned char bytes[4];
+		for (unsigned i = 0; i < recordSize - 1; i++)
+			bytes[i] = snapshot.pData[(recordStart + i) % snapshot.Size];
+
+		if (recordSize == 2)
+			delta = bytes[0];
+		else if (recordSize == 4)
+			delta = bytes[0] | (bytes[1] << 8) | ((bytes[2] & 0x7F) << 16);
+		else
+			delta = ReadLittleEndian(bytes);
+
+		Segment record = {(unsigned char)(lastByte & 0x7F), recordStart, recordEnd};
+		m_Records.push_back(record);
+		recordEnd = recordStart - delta;
+	}
+
+	//The state is only updated once the records have been validated, so a malformed snapshot does not produce partial output.
+	size_t firstSegment = segments.size();
+	unsigned char channel = m_CurrentChannel;
+	unsigned offset = readOffset;
+	for (size_t i = m_Records.size(); i > 0; i--)
+	{
+		const Segment &record = m_Records[i - 1];
+		if (OffsetDistance(offset, record.Start) < 0)
+		{
+			segments.resize(firstSegment); //The delta of the next record points before the end of this one
+			return false;
+		}
+
+		if (record.Start != offset)
+		{
+			Segment segment = {channel, offset, record.Start};
+			segments.push_back(segment);
+		}
+
+		channel = record.Channel;
+		offset = record.End;
+	}
+
+	if (offset != writeOffset)
+	{
+		Segment segment = {channel, offset, writeOffset};
+		segments.push_back(segment);
+	}
+
+	m_CurrentChannel = channel;
+	return true;
+}
+
+bool FastSemihostingDecoder::Decode(const FastSemihostingSnapshot &snapshot, std::vector<unsigned char> *pChannels)
+{
+	m_Segments.clear();
+	if (!Decode(snapshot, m_Segments))
+		return false;
+
+	for (size_t i = 0; i < m_Segments.size(); i++)
+		if (m_Segments[i].Channel != kPaddingChannel)
+			AppendSegment(snapshot, m_Segments[i], pChannels[m_Segments[i].Channel]);
+	return true;
+}
+
+void FastSemihostingDecoder::AppendSegment(const FastSemihostingSnapshot &snapshot, const Segment &segment, std::vector<unsigned char> &output)
+{
+	unsigned size = (segment.End - segment.Start) & 0x7FFFFFFF;
+	unsigned bufferOffset = segment.Start % snapshot.Size;
+	unsigned firstPart = snapshot.Size - bufferOffset;
+	if (firstPart > size)
+		firstPart = size;
+
+	size_t oldSize = output.size();
+	output.resize(oldSize + size);
+	memcpy(output.data() + oldSize, snapshot.pData + bufferOffset, firstPart);
+	memcpy(output.data() + oldSize + firstPart, snapshot.pData, size - firstPart);
+}
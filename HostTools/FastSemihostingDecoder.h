@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/*
+	Reference decoder for the multi-channel fast semihosting buffer format (see the channel switch record description in FastSemihosting.cpp).
+	It does not depend on the target-side code and can be used by any tool that reads the s_FastSemihostingState variable from the target memory.
+
+	The switch records do not specify the length of the data that follows them. Instead, each record ends with the new channel number
+	and begins with the distance to the end of the previous record, and LastKnownSwitchOffset points to the end of the last one:
+		[delta: 1 byte] [0x80 | channel]						  - delta < 256
+		[delta: 3 bytes, bit 23 set] [channel]					  - delta < 0x7FFFFF
+		[delta: 4 bytes, bit 31 clear] [channel]				  - all other cases
+	The records are hence walked backwards from LastKnownSwitchOffset until the read offset is reached, and then the data between them
+	is assigned to the channels in the forward order. The channel that was active at the read offset is remembered between the calls,
+	so each decoder instance should only be used with a single buffer.
+	Channel 0x7F (kPaddingChannel) fills the unused end of variable-size reservations and should be discarded.
+*/
+
+//Contents of s_FastSemihostingState (or of a ring descriptor passed via kInitializeFastSemihostingV3) captured from the target memory.
+//To get a consistent snapshot, read WriteOffset before LastKnownSwitchOffset (the target updates them in the opposite order) and
+//repeat both reads if LastKnownSwitchOffset is after WriteOffset. Only the data between ReadOffset and WriteOffset needs to be valid.
+struct FastSemihostingSnapshot
+{
+	unsigned ReadOffset;
+	unsigned WriteOffset; //Bit 31 is the blocking request flag and is ignored
+	unsigned LastKnownSwitchOffset;
+	const unsigned char *pData;
+	unsigned Size;
+
+	//Parses a raw little-endian memory image of the s_FastSemihostingState variable (the 3 header fields followed by the data).
+	static bool FromMemoryImage(const void *pImage, size_t imageSize, FastSemihostingSnapshot &snapshot);
+};
+
+class FastSemihostingDecoder
+{
+public:
+	enum
+	{
+		kChannelCount = 128,
+		kPaddingChannel = 0x7F,
+	};
+
+	//A continuous portion of the data written to one channel. Start and End are the buffer offsets (not reduced modulo the size).
+	struct Segment
+	{
+		unsigned char Channel;
+		unsigned Start, End;
+	};
+
+	FastSemihostingDecoder(unsigned char initialChannel = 0)
+		: m_CurrentChannel(initialChannel)
+	{
+	}
+
+	//Should be called after the target reinitializes the buffer.
+	void Reset(unsigned char initialChannel = 0)
+	{
+		m_CurrentChannel = initialChannel;
+	}
+
+	unsigned char GetCurrentChannel() const
+	{
+		return m_CurrentChannel;
+	}
+
+	//Splits the data between ReadOffset and WriteOffset into per-channel segments, in the order it was written.
+	//Returns false if the switch records are malformed. The caller should then set ReadOffset to WriteOffset in the target memory.
+	bool Decode(const FastSemihostingSnapshot &snapshot, std::vector<Segment> &segments);
+
+	//Appends the data between ReadOffset and WriteOffset to the per-channel streams (pChannels should point to kChannelCount vectors).
+	//The padding is discarded.
+	bool Decode(const FastSemihostingSnapshot &snapshot, std::vector<unsigned char> *pChannels);
+
+	//Copies the data of a segment returned by Decode(), handling the wrap-around.
+	static void AppendSegment(const FastSemihostingSnapshot &snapshot, const Segment &segment, std::vector<unsigned char> &output);
+
+private:
+	unsigned char m_CurrentChannel;
+	std::vector<Segment> m_Records; //Channel switch records found by the last Decode() call, in the reverse order
+	std::vector<Segment> m_Segments;
+};
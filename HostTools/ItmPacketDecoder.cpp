@@ -0,0 +1,187 @@
+#include "ItmPacketDecoder.h"
+
+void ItmPacketDecoder::Reset()
+{
+	m_SampleCounts.clear();
+	m_Statistics = Statistics();
+	m_Time = 0;
+	m_Synchronized = true;
+	m_ZeroBytes = m_SyncZeroBytes = 0;
+	m_InPacket = false;
+	m_Header = 0;
+	m_PayloadSize = m_PayloadBytes = 0;
+}
+
+int ItmPacketDecoder::GetPayloadSize(unsigned char header)
+{
+	if (header & 3)
+		return (header & 3) == 3 ? 4 : (header & 3); //Instrumentation or hardware source packet
+	if (header == 0x70)
+		return 0; //Overflow
+	if ((header & 0x0F) == 0)
+	{
+		if (header & 0x80)
+			return (header & 0x40) ? kVariableSize : kReservedHeader; //Local timestamp, format 1 (0b11xx0000)
+		return 0;													  //Local timestamp, format 2 (0b0xxx0000)
+	}
+	if ((header & 0x0B) == 0x08)
+		return (header & 0x80) ? kVariableSize : 0; //Extension
+	if (header == 0x94 || header == 0xB4)
+		return kVariableSize; //Global timestamp
+	return kReservedHeader;
+}
+
+void ItmPacketDecoder::HandleMalformedPacket()
+{
+	m_Statistics.MalformedPackets++;
+	m_Synchronized = false;
+	m_InPacket = false;
+	m_SyncZeroBytes = 0;
+}
+
+bool ItmPacketDecoder::Feed(const unsigned char *pData, size_t size, std::vector<ExceptionEvent> *pExceptionEvents)
+{
+	bool result = true;
+	for (size_t i = 0; i < size; i++)
+	{
+		unsigned char byte = pData[i];
+
+		//Valid packets never contain more than 4 consecutive zero bytes, so the synchronization packets are recognized even in the
+		//middle of a packet (e.g. if some data was lost).
+		if (byte == 0x80 && m_ZeroBytes >= kMinSyncZeroBytes)
+		{
+			m_Statistics.SyncPackets++;
+			m_Synchronized = true;
+			m_InPacket = false;
+			m_ZeroBytes = m_SyncZeroBytes = 0;
+			continue;
+		}
+
+		m_ZeroBytes = byte ? 0 : m_ZeroBytes + 1;
+		if (!m_Synchronized)
+			continue;
+
+		if (m_InPacket)
+		{
+			if (m_PayloadBytes >= (int)sizeof(m_Payload))
+			{
+				HandleMalformedPacket();
+				result = false;
+				continue;
+			}
+
+			m_Payload[m_PayloadBytes++] = byte;
+			if (m_PayloadSize == kVariableSize ? (byte & 0x80) != 0 : m_PayloadBytes < m_PayloadSize)
+				continue;
+
+			m_InPacket = false;
+			if (!HandlePacket(pExceptionEvents))
+			{
+				HandleMalformedPacket();
+				result = false;
+			}
+			continue;
+		}
+
+		if (byte == 0)
+		{
+			m_SyncZeroBytes++;
+			continue;
+		}
+
+		int payloadSize = GetPayloadSize(byte);
+		if (m_SyncZeroBytes || payloadSize == kReservedHeader)
+		{
+			//Incomplete synchronization packet or a reserved header
+			HandleMalformedPacket();
+			result = false;
+			continue;
+		}
+
+		m_Header = byte;
+		m_PayloadSize = payloadSize;
+		m_PayloadBytes = 0;
+		if (payloadSize)
+			m_InPacket = true;
+		else
+			HandlePacket(pExceptionEvents);
+	}
+
+	return result;
+}
+
+bool ItmPacketDecoder::HandlePacket(std::vector<ExceptionEvent> *pExceptionEvents)
+{
+	if (m_Header == 0x70)
+	{
+		m_Statistics.Overflows++;
+		return true;
+	}
+
+	if ((m_Header & 0x0F) == 0)
+	{
+		//Local timestamps are deltas since the previous one. Format 1 has 7 bits per payload byte, format 2 stores the value in the header.
+		if (m_Header & 0x80)
+		{
+			unsigned long long delta = 0;
+			for (int i = 0; i < m_PayloadBytes; i++)
+				delta |= (unsigned long long)(m_Payload[i] & 0x7F) << (i * 7);
+			m_Time += delta;
+		}
+		else
+			m_Time += (m_Header >> 4) & 7;
+		return true;
+	}
+
+	if (!(m_Header & 3) || !(m_Header & 4))
+		return true; //Global timestamps, extension and instrumentation packets
+
+	unsigned value = 0;
+	for (int i = 0; i < m_PayloadBytes; i++)
+		value |= (unsigned)m_Payload[i] << (i * 8);
+
+	switch (m_Header >> 3)
+	{
+	case kDiscriminatorPCSample:
+		if (m_PayloadSize == 4)
+		{
+			m_SampleCounts[value]++;
+			m_Statistics.PCSamples++;
+		}
+		else if (m_PayloadSize == 1 && value == 0)
+			m_Statistics.SleepSamples++;
+		else
+			return false;
+		break;
+	case kDiscriminatorExceptionTrace:
+	{
+		if (m_PayloadSize != 2 || !(value & 0x3000))
+			return false;
+
+		m_Statistics.ExceptionEvents++;
+		if (pExceptionEvents)
+		{
+			ExceptionEvent event = {value & 0x1FF, (ExceptionFunction)((value >> 12) & 3), m_Time};
+			pExceptionEvents->push_back(event);
+		}
+		break;
+	}
+	default:
+		break; //Event counter and data trace packets
+	}
+
+	return true;
+}
+
+void ItmPacketDecoder::TakeFlatProfile(std::vector<AggregatedSampleDecoder::Stack> &stacks)
+{
+	for (const auto &sample : m_SampleCounts)
+	{
+		AggregatedSampleDecoder::Stack stack = {};
+		stack.Count = sample.second;
+		stack.PC = sample.first;
+		stacks.push_back(stack);
+	}
+
+	m_SampleCounts.clear();
+}
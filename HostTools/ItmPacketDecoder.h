@@ -0,0 +1,96 @@
+#pragma once
+#include "AggregatedSampleDecoder.h"
+#include <map>
+#include <stddef.h>
+#include <vector>
+
+/*
+	Reference decoder for the SWO stream produced by ProfilerDriver_ITM.cpp. It parses the ITM packets (ARMv7-M Architecture Reference Manual,
+	appendix D4), counts the periodic PC samples per address and reports the exception trace events. Instrumentation (stimulus port), timestamp
+	and extension packets are skipped, except that the local timestamps are accumulated to time the exception events.
+
+	The PC samples are reported as AggregatedSampleDecoder::Stack records without stack entries, so the debugger can handle them the same way
+	as the aggregated samples from the timer-based drivers.
+
+	The data is expected to start at a packet boundary. After a malformed packet, the decoder ignores everything until the next synchronization
+	packet (ProfilerDriver_ITM.cpp enables them via DWT_CTRL.SYNCTAP).
+*/
+class ItmPacketDecoder
+{
+public:
+	enum ExceptionFunction
+	{
+		kExceptionEntered = 1,
+		kExceptionExited = 2,
+		kExceptionReturned = 3, //The core returned to the exception (or thread mode) that was interrupted by another one
+	};
+
+	struct ExceptionEvent
+	{
+		unsigned Number; //0 for thread mode, 15 for SysTick, 16+n for IRQn
+		ExceptionFunction Function;
+		unsigned long long Timestamp; //Sum of the local timestamps received so far
+	};
+
+	struct Statistics
+	{
+		unsigned long long PCSamples;
+		unsigned long long SleepSamples; //Taken while the core was sleeping (WFI/WFE)
+		unsigned long long ExceptionEvents;
+		unsigned long long Overflows; //Some packets were lost before reaching the SWO output
+		unsigned long long SyncPackets;
+		unsigned long long MalformedPackets;
+	};
+
+	ItmPacketDecoder()
+	{
+		Reset();
+	}
+
+	//Consumes the SWO data (which may end in the middle of a packet). The exception events are appended to pExceptionEvents, if specified.
+	//Returns false if some packets are malformed.
+	bool Feed(const unsigned char *pData, size_t size, std::vector<ExceptionEvent> *pExceptionEvents = nullptr);
+
+	//Appends one record per sampled address (with SP, FP and LR set to 0) and clears the counts, so that the next call only reports the new samples.
+	void TakeFlatProfile(std::vector<AggregatedSampleDecoder::Stack> &stacks);
+
+	const Statistics &GetStatistics() const
+	{
+		return m_Statistics;
+	}
+
+	void Reset();
+
+private:
+	enum
+	{
+		kVariableSize = -1,
+		kReservedHeader = -2,
+		kMinSyncZeroBytes = 5, //A synchronization packet is at least 47 zero bits followed by a one
+
+		kDiscriminatorExceptionTrace = 1,
+		kDiscriminatorPCSample = 2,
+	};
+
+	//Returns the amount of payload bytes following the header, kVariableSize for payloads terminated by a byte without the continuation bit,
+	//or kReservedHeader.
+	static int GetPayloadSize(unsigned char header);
+
+	bool HandlePacket(std::vector<ExceptionEvent> *pExceptionEvents);
+	void HandleMalformedPacket();
+
+private:
+	std::map<unsigned, unsigned> m_SampleCounts;
+	Statistics m_Statistics;
+	unsigned long long m_Time;
+
+	bool m_Synchronized;
+	unsigned m_ZeroBytes;	  //Consecutive zero bytes, including the payloads
+	unsigned m_SyncZeroBytes; //Zero bytes received instead of a header (i.e. the beginning of a synchronization packet)
+
+	bool m_InPacket;
+	unsigned char m_Header;
+	int m_PayloadSize;
+	unsigned char m_Payload[8];
+	int m_PayloadBytes;
+};
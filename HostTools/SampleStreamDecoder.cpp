@@ -0,0 +1,112 @@
+#include "SampleStreamDecoder.h"
+#include "SmallNumberCoder.h"
+
+bool SampleStreamDecoder::Feed(const unsigned char *pData, size_t size, std::vector<Sample> &samples)
+{
+	m_Pending.insert(m_Pending.end(), pData, pData + size);
+
+	size_t offset = 0;
+	bool malformed = false;
+	while (offset < m_Pending.size())
+	{
+		Sample sample;
+		size_t recordSize = DecodeRecord(&m_Pending[offset], m_Pending.size() - offset, sample, &malformed);
+		if (!recordSize)
+			break;
+
+		samples.push_back(sample);
+		offset += recordSize;
+	}
+
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + offset);
+	return !malformed;
+}
+
+//Mirrors SysprogsProfiler_ProcessSample() from SamplingProfiler.cpp: [SP delta, FP == SP] [FP - SP] [PC delta] [LR delta] [thread tag] [reused entries, new entries] [new entries...]
+size_t SampleStreamDecoder::DecodeRecord(const unsigned char *pRecord, size_t size, Sample &sample, bool *pMalformed)
+{
+	SmallNumberDecoder decoder(pRecord, (unsigned)size, 0, 0);
+	int spDelta, fpOffset = 0, pcDelta, lrDelta;
+	unsigned reusedEntries, newEntries;
+	bool fpEqualsSP;
+	if (!decoder.ReadTinySIntWithFlag(&spDelta, &fpEqualsSP))
+		return 0;
+	if (!fpEqualsSP && !decoder.ReadTinySInt(&fpOffset))
+		return 0;
+	if (!decoder.ReadSmallMostlyEvenSInt(&pcDelta) || !decoder.ReadSmallMostlyEvenSInt(&lrDelta))
+		return 0;
+
+	//Mirrors WriteThreadTag() from SamplingProfiler.cpp. The thread table is only updated once the whole record is received.
+	unsigned threadIndex = m_Last.ThreadIndex;
+	bool hasTableEntry = false;
+	ThreadTableEntry tableEntry;
+	if (decoder.GetOffset() < (int)size && pRecord[decoder.GetOffset()] == kThreadTagMarker)
+	{
+		unsigned char marker, nameLength;
+		int index, thread;
+		char name[256];
+		if (!decoder.ReadBytes(&marker, 1) || !decoder.ReadTinySIntWithFlag(&index, &hasTableEntry))
+			return 0;
+		if (hasTableEntry && (!decoder.ReadSmallMostlyEvenSInt(&thread) || !decoder.ReadBytes(&nameLength, 1) || !decoder.ReadBytes(name, nameLength)))
+			return 0;
+		if (index < 0)
+		{
+			*pMalformed = true;
+			return 0;
+		}
+
+		threadIndex = (unsigned)index;
+		if (hasTableEntry)
+		{
+			tableEntry.Thread = (unsigned)thread;
+			tableEntry.Name.assign(name, nameLength);
+		}
+	}
+
+	if (!decoder.ReadPackedUIntPair(&reusedEntries, &newEntries))
+		return 0;
+
+	if (reusedEntries > m_Last.Entries.size())
+	{
+		*pMalformed = true;
+		return 0;
+	}
+
+	sample.SP = m_Last.SP + (unsigned)spDelta * 4;
+	sample.FP = sample.SP + (unsigned)fpOffset * 4;
+	sample.PC = m_Last.PC + (unsigned)pcDelta;
+	sample.LR = m_Last.LR + (unsigned)lrDelta;
+	sample.ReusedEntries = reusedEntries;
+
+	//The stack entries are delta-encoded against the previous entry of the same kind (see SmallNumberCoder::WriteStackEntry()).
+	unsigned address = sample.SP, refPoints[2] = {m_RefPoints[0], m_RefPoints[1]};
+	for (unsigned i = 0; i < newEntries; i++)
+	{
+		int indexDelta, distance;
+		bool isSavedFP;
+		if (!decoder.ReadTinySIntWithFlag(&indexDelta, &isSavedFP) || !decoder.ReadSmallMostlyEvenSInt(&distance))
+			return 0;
+
+		address += (unsigned)indexDelta * m_SlotSize;
+		refPoints[isSavedFP] += distance;
+		StackEntry entry = {address, refPoints[isSavedFP], isSavedFP};
+		sample.Entries.push_back(entry);
+	}
+
+	sample.Entries.insert(sample.Entries.end(), m_Last.Entries.end() - reusedEntries, m_Last.Entries.end());
+
+	if (hasTableEntry)
+	{
+		if (threadIndex >= m_Threads.size())
+			m_Threads.resize(threadIndex + 1);
+		m_Threads[threadIndex] = tableEntry;
+	}
+
+	sample.ThreadIndex = threadIndex;
+	sample.Thread = threadIndex < m_Threads.size() ? m_Threads[threadIndex].Thread : 0;
+
+	m_Last = sample;
+	m_RefPoints[0] = refPoints[0];
+	m_RefPoints[1] = refPoints[1];
+	return decoder.GetOffset();
+}
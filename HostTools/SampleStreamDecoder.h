@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+	Reference decoder for the pdcSamplingProfilerStream channel. Each record is encoded against the previous one: the registers are
+	delta-encoded, and with SAMPLING_PROFILER_COMPARE_FRAMES, the record only contains the stack entries that changed since the previous
+	sample, while the rest of the stack is copied from the bottom part of the previous sample.
+
+	Addresses are reported as 32-bit values, as the target sends them. The records have no size prefix, so a record that has not been
+	fully received yet is kept until the next call to Feed().
+
+	With SAMPLING_PROFILER_THREAD_TAGS, a record can contain a thread tag (see WriteThreadTag() in SamplingProfiler.cpp). The decoder
+	keeps the thread table and assigns the last tagged thread to each sample.
+*/
+class SampleStreamDecoder
+{
+public:
+	struct StackEntry
+	{
+		unsigned Address; //Address of the stack slot
+		unsigned Value;
+		bool IsSavedFP; //The entry points to the stack rather than to the code
+	};
+
+	struct Sample
+	{
+		unsigned SP, FP, PC, LR;
+		std::vector<StackEntry> Entries; //Top of the stack first
+		unsigned ReusedEntries;			 //Amount of entries at the end of Entries copied from the previous sample
+		unsigned ThreadIndex;			 //0 if no thread has been reported, see SAMPLING_PROFILER_THREAD_TAGS
+		unsigned Thread;				 //Thread handle from the thread table entry, 0 for ThreadIndex == 0
+	};
+
+	struct ThreadTableEntry
+	{
+		unsigned Thread;
+		std::string Name;
+	};
+
+	//slotSize is sizeof(void *) on the target. Stack entry locations are encoded in slots, while SP is encoded in 4-byte words.
+	SampleStreamDecoder(unsigned slotSize = 4)
+		: m_SlotSize(slotSize)
+	{
+		Reset();
+	}
+
+	//Consumes the channel data (which may end in the middle of a record) and appends the decoded samples to samples.
+	//Returns false if some records are malformed (in this case, the rest of the stream cannot be decoded).
+	bool Feed(const unsigned char *pData, size_t size, std::vector<Sample> &samples);
+
+	//Indexed by Sample::ThreadIndex. The entries can be replaced as the target reuses the indices of the deleted threads.
+	const std::vector<ThreadTableEntry> &GetThreadTable() const
+	{
+		return m_Threads;
+	}
+
+	//Should be called after the target reinitializes the buffer.
+	void Reset()
+	{
+		m_Pending.clear();
+		m_Last = Sample();
+		m_RefPoints[0] = m_RefPoints[1] = 0;
+		m_Threads.assign(1, ThreadTableEntry());
+	}
+
+private:
+	enum
+	{
+		kThreadTagMarker = 0x0E,
+	};
+
+	//Returns the size of the record, or 0 if it is incomplete.
+	size_t DecodeRecord(const unsigned char *pRecord, size_t size, Sample &sample, bool *pMalformed);
+
+private:
+	std::vector<unsigned char> m_Pending;
+	Sample m_Last;
+	unsigned m_RefPoints[2];
+	unsigned m_SlotSize;
+	std::vector<ThreadTableEntry> m_Threads;
+};
@@ -0,0 +1,92 @@
+#include "StreamDecompressor.h"
+
+enum
+{
+	kMinMatch = 4,
+	kMaxOffset = 0xFFFF,
+};
+
+void StreamDecompressor::Reset()
+{
+	m_Pending.clear();
+	m_History.clear();
+}
+
+static bool ReadExtraLength(const unsigned char *&p, const unsigned char *pEnd, size_t &length)
+{
+	for (;;)
+	{
+		if (p >= pEnd)
+			return false;
+		unsigned char byte = *p++;
+		length += byte;
+		if (byte != 255)
+			return true;
+	}
+}
+
+bool StreamDecompressor::DecodeBlock(const unsigned char *pBlock, size_t size, std::vector<unsigned char> &output)
+{
+	const unsigned char *p = pBlock, *pEnd = pBlock + size;
+	while (p < pEnd)
+	{
+		unsigned char token = *p++;
+		size_t literalCount = token >> 4;
+		if (literalCount == 15 && !ReadExtraLength(p, pEnd, literalCount))
+			return false;
+		if (literalCount > (size_t)(pEnd - p))
+			return false;
+
+		m_History.insert(m_History.end(), p, p + literalCount);
+		output.insert(output.end(), p, p + literalCount);
+		p += literalCount;
+		if (p == pEnd)
+			break;
+
+		if (pEnd - p < 2)
+			return false;
+		size_t offset = p[0] | (p[1] << 8);
+		p += 2;
+		size_t matchLength = token & 0x0F;
+		if (matchLength == 15 && !ReadExtraLength(p, pEnd, matchLength))
+			return false;
+		matchLength += kMinMatch;
+
+		if (!offset || offset > m_History.size())
+			return false;
+
+		//The match may overlap the data it produces, so it has to be copied byte by byte.
+		size_t start = m_History.size() - offset;
+		for (size_t i = 0; i < matchLength; i++)
+		{
+			unsigned char byte = m_History[start + i];
+			m_History.push_back(byte);
+			output.push_back(byte);
+		}
+	}
+
+	if (m_History.size() > 2 * kMaxOffset)
+		m_History.erase(m_History.begin(), m_History.end() - kMaxOffset);
+	return true;
+}
+
+bool StreamDecompressor::Feed(const unsigned char *pData, size_t size, std::vector<unsigned char> &output)
+{
+	m_Pending.insert(m_Pending.end(), pData, pData + size);
+
+	size_t offset = 0;
+	bool result = true;
+	while (m_Pending.size() - offset >= 2)
+	{
+		size_t blockSize = m_Pending[offset] | (m_Pending[offset + 1] << 8);
+		if (m_Pending.size() - offset - 2 < blockSize)
+			break;
+
+		if (!DecodeBlock(&m_Pending[offset + 2], blockSize, output))
+			result = false;
+		offset += 2 + blockSize;
+	}
+
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + offset);
+	return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/*
+	Reference decoder for the compressed fast semihosting channels produced by StreamCompressor (see StreamCompressor.h for the format).
+	Data sent to channel X is compressed and transmitted via channel (X | StreamDecompressor::kCompressedChannelFlag), so the debugger
+	should keep one instance of this class per compressed channel and feed it the channel data in the order it was received.
+*/
+class StreamDecompressor
+{
+public:
+	enum
+	{
+		kCompressedChannelFlag = 0x20,
+	};
+
+	//Consumes the compressed channel data (which may end in the middle of a block) and appends the decompressed data to output.
+	//Returns false if the data is malformed.
+	bool Feed(const unsigned char *pData, size_t size, std::vector<unsigned char> &output);
+
+	void Reset();
+
+private:
+	bool DecodeBlock(const unsigned char *pBlock, size_t size, std::vector<unsigned char> &output);
+
+private:
+	std::vector<unsigned char> m_Pending;
+	std::vector<unsigned char> m_History;
+};
@@ -0,0 +1,101 @@
+#include "TimestampedRecordDecoder.h"
+
+enum
+{
+	kMaxTokenSize = 5,
+};
+
+void TimestampedRecordDecoder::Reset()
+{
+	m_Pending.clear();
+	for (int i = 0; i < kGenerationCount; i++)
+		m_BaseValid[i] = false;
+	m_HaveBase = false;
+	m_LastBase = 0;
+}
+
+void TimestampedRecordDecoder::StartGeneration(unsigned generation, unsigned base)
+{
+	if (m_HaveBase)
+		m_LastBase += (unsigned)(base - (unsigned)m_LastBase);
+	else
+		m_LastBase = base;
+	m_HaveBase = true;
+
+	//The previous generation stays valid for the records that were reserved before this sync token. The 2 following ones
+	//may still hold the bases from 4 generations ago, so the records referring to them cannot be decoded until they are restarted.
+	m_Bases[generation] = m_LastBase;
+	m_BaseValid[generation] = true;
+	m_BaseValid[(generation + 1) % kGenerationCount] = false;
+	m_BaseValid[(generation + 2) % kGenerationCount] = false;
+}
+
+//Returns the size of the token, 0 if more data is needed, or -1 if the token is malformed.
+static int ReadToken(const unsigned char *p, const unsigned char *pEnd, unsigned &value)
+{
+	value = 0;
+	for (int i = 0; i < kMaxTokenSize; i++)
+	{
+		if (p + i >= pEnd)
+			return 0;
+		value |= (unsigned)(p[i] & 0x7F) << (i * 7);
+		if (!(p[i] & 0x80))
+			return i + 1;
+	}
+
+	return -1;
+}
+
+bool TimestampedRecordDecoder::Feed(const unsigned char *pData, size_t size, std::vector<unsigned char> &output, std::vector<Record> &records)
+{
+	m_Pending.insert(m_Pending.end(), pData, pData + size);
+
+	const unsigned char *pStart = m_Pending.data(), *p = pStart, *pEnd = pStart + m_Pending.size();
+	bool result = true;
+	while (p < pEnd)
+	{
+		unsigned token;
+		int tokenSize = ReadToken(p, pEnd, token);
+		if (tokenSize < 0)
+		{
+			result = false;
+			p = pEnd;
+			break;
+		}
+		if (!tokenSize)
+			break;
+
+		unsigned generation = (token >> 1) % kGenerationCount;
+		if (token & 1)
+		{
+			if (pEnd - p < tokenSize + 4)
+				break;
+
+			const unsigned char *pBase = p + tokenSize;
+			StartGeneration(generation, pBase[0] | (pBase[1] << 8) | (pBase[2] << 16) | ((unsigned)pBase[3] << 24));
+			p += tokenSize + 4;
+			continue;
+		}
+
+		if (pEnd - p < tokenSize + 2)
+			break;
+
+		size_t payloadSize = p[tokenSize] | (p[tokenSize + 1] << 8);
+		if ((size_t)(pEnd - p) < tokenSize + 2 + payloadSize)
+			break;
+
+		Record record;
+		record.HasTimestamp = m_BaseValid[generation];
+		record.Timestamp = record.HasTimestamp ? m_Bases[generation] + (token >> 3) : 0;
+		record.Offset = output.size();
+		record.Size = payloadSize;
+		records.push_back(record);
+
+		p += tokenSize + 2;
+		output.insert(output.end(), p, p + payloadSize);
+		p += payloadSize;
+	}
+
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + (p - pStart));
+	return result;
+}
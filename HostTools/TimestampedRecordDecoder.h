@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/*
+	Reference decoder for the timestamped fast semihosting channels (see FAST_SEMIHOSTING_TIMESTAMPED_CHANNELS and the format description
+	in FastSemihosting.cpp). Records written to channel X are transmitted via channel (X | TimestampedRecordDecoder::kTimestampedChannelFlag),
+	so the debugger should keep one instance of this class per timestamped channel and feed it the channel data in the order it was received.
+
+	The target reports 32-bit timestamps. The decoder extends them to 64 bits, assuming that the full timestamps sent by the target
+	are less than 2^32 ticks apart (i.e. the channel is used at least once per counter overflow).
+*/
+class TimestampedRecordDecoder
+{
+public:
+	enum
+	{
+		kTimestampedChannelFlag = 0x10,
+	};
+
+	struct Record
+	{
+		bool HasTimestamp;			  //False if the record refers to a timebase generation that was not received (e.g. dropped or overwritten)
+		unsigned long long Timestamp; //Extended FAST_SEMIHOSTING_GET_TIMESTAMP() value
+		size_t Offset, Size;		  //Location of the payload in the output passed to Feed()
+	};
+
+	TimestampedRecordDecoder()
+	{
+		Reset();
+	}
+
+	//Consumes the channel data (which may end in the middle of a record), appends the payloads to output and their descriptions to records.
+	//Returns false if the data is malformed.
+	bool Feed(const unsigned char *pData, size_t size, std::vector<unsigned char> &output, std::vector<Record> &records);
+
+	//Should be called after the target reinitializes the buffer.
+	void Reset();
+
+private:
+	enum
+	{
+		kGenerationCount = 4,
+	};
+
+	void StartGeneration(unsigned generation, unsigned base);
+
+private:
+	std::vector<unsigned char> m_Pending;
+	unsigned long long m_Bases[kGenerationCount];
+	bool m_BaseValid[kGenerationCount];
+	bool m_HaveBase;
+	unsigned long long m_LastBase;
+};
@@ -0,0 +1,356 @@
+#include "UnwindTableBuilder.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	kELFHeaderSize = 0x34,
+	kProgramHeaderSize = 0x20,
+	kLoadableSegment = 1,			 //PT_LOAD
+	kExceptionIndexSegment = 0x70000001, //PT_ARM_EXIDX
+	kCannotUnwindMarker = 1,		 //EXIDX_CANTUNWIND
+};
+
+static unsigned ReadUInt32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static unsigned ReadUInt16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+//Decodes a 31-bit offset relative to the address of the word holding it.
+static unsigned DecodePrel31(unsigned address, unsigned value)
+{
+	return address + (unsigned)((int)(value << 1) >> 1);
+}
+
+void UnwindTableBuilder::AddMemoryRegion(unsigned address, const void *pData, size_t size)
+{
+	MemoryRegion region;
+	region.Address = address;
+	region.Data.assign((const unsigned char *)pData, (const unsigned char *)pData + size);
+	m_Regions.push_back(region);
+}
+
+bool UnwindTableBuilder::LoadELFFile(const char *pFileName)
+{
+	FILE *pFile = fopen(pFileName, "rb");
+	if (!pFile)
+		return false;
+
+	std::vector<unsigned char> contents;
+	unsigned char chunk[4096];
+	for (size_t done; (done = fread(chunk, 1, sizeof(chunk), pFile)) > 0;)
+		contents.insert(contents.end(), chunk, chunk + done);
+	fclose(pFile);
+
+	static const unsigned char magic[] = {0x7F, 'E', 'L', 'F', 1 /* ELFCLASS32 */, 1 /* ELFDATA2LSB */};
+	if (contents.size() < kELFHeaderSize || memcmp(contents.data(), magic, sizeof(magic)))
+		return false;
+
+	unsigned programHeaderOffset = ReadUInt32(&contents[0x1C]), programHeaderSize = ReadUInt16(&contents[0x2A]), programHeaderCount = ReadUInt16(&contents[0x2C]);
+	if (programHeaderSize < kProgramHeaderSize)
+		return false;
+
+	for (unsigned i = 0; i < programHeaderCount; i++)
+	{
+		unsigned long long headerOffset = programHeaderOffset + (unsigned long long)i * programHeaderSize;
+		if (headerOffset + kProgramHeaderSize > contents.size())
+			return false;
+
+		const unsigned char *pHeader = &contents[(size_t)headerOffset];
+		unsigned type = ReadUInt32(pHeader), fileOffset = ReadUInt32(pHeader + 4), address = ReadUInt32(pHeader + 8), fileSize = ReadUInt32(pHeader + 16);
+		if (type == kExceptionIndexSegment)
+			SetIndexTable(address, fileSize);
+		else if (type != kLoadableSegment)
+			continue;
+
+		if ((unsigned long long)fileOffset + fileSize > contents.size())
+			return false;
+		if (fileSize)
+			AddMemoryRegion(address, &contents[fileOffset], fileSize);
+	}
+
+	return true;
+}
+
+bool UnwindTableBuilder::ReadWord(unsigned address, unsigned *pValue) const
+{
+	for (size_t i = 0; i < m_Regions.size(); i++)
+	{
+		const MemoryRegion &region = m_Regions[i];
+		if (region.Data.size() < 4 || address < region.Address || address - region.Address > region.Data.size() - 4)
+			continue;
+
+		*pValue = ReadUInt32(&region.Data[address - region.Address]);
+		return true;
+	}
+
+	return false;
+}
+
+//Extracts the unwind instructions from the second word of an index table entry. Returns false for the personality routines that use a different format.
+bool UnwindTableBuilder::ReadUnwindInstructions(unsigned entryAddress, unsigned data, std::vector<unsigned char> &instructions) const
+{
+	instructions.clear();
+	if (data & 0x80000000)
+	{
+		//The instructions for __aeabi_unwind_cpp_pr0 are stored directly in the index table
+		if (data & 0x0F000000)
+			return false;
+
+		instructions.push_back((unsigned char)(data >> 16));
+		instructions.push_back((unsigned char)(data >> 8));
+		instructions.push_back((unsigned char)data);
+		return true;
+	}
+
+	unsigned address = DecodePrel31(entryAddress, data), word, extraWords;
+	if (!ReadWord(address, &word))
+		return false;
+
+	if (word & 0x80000000)
+	{
+		switch ((word >> 24) & 0x0F)
+		{
+		case 0: //__aeabi_unwind_cpp_pr0: 3 instructions
+			instructions.push_back((unsigned char)(word >> 16));
+			extraWords = 0;
+			break;
+		case 1: //__aeabi_unwind_cpp_pr1 and __aeabi_unwind_cpp_pr2: 2 instructions + the specified amount of words
+		case 2:
+			extraWords = (word >> 16) & 0xFF;
+			break;
+		default:
+			return false;
+		}
+	}
+	else
+	{
+		//A generic personality routine (e.g. __gxx_personality_v0) followed by the instructions in the __aeabi_unwind_cpp_pr1 format
+		address += 4;
+		if (!ReadWord(address, &word))
+			return false;
+		extraWords = word >> 24;
+		instructions.push_back((unsigned char)(word >> 16));
+	}
+
+	instructions.push_back((unsigned char)(word >> 8));
+	instructions.push_back((unsigned char)word);
+
+	for (unsigned i = 0; i < extraWords; i++)
+	{
+		if (!ReadWord(address + 4 * (i + 1), &word))
+			return false;
+		for (int shift = 24; shift >= 0; shift -= 8)
+			instructions.push_back((unsigned char)(word >> shift));
+	}
+
+	return true;
+}
+
+//Locations are tracked in bytes relative to the frame base (SP or FP) at the time the function was interrupted.
+struct UnwoundFrame
+{
+	int VSP;
+	int ReturnAddress, SavedFP; //-1 if not restored from the stack
+	bool ReturnAddressFromPC;
+	bool BasedOnFP;
+};
+
+static bool PopCoreRegisters(UnwoundFrame &frame, unsigned mask)
+{
+	if (mask & (1 << 13))
+		return false; //SP is restored from the stack
+
+	for (int reg = 0; reg < 16; reg++)
+	{
+		if (!(mask & (1 << reg)))
+			continue;
+
+		if (reg == 15)
+		{
+			frame.ReturnAddress = frame.VSP;
+			frame.ReturnAddressFromPC = true;
+		}
+		else if (reg == 14 && !frame.ReturnAddressFromPC)
+			frame.ReturnAddress = frame.VSP;
+		else if (reg == 7)
+			frame.SavedFP = frame.VSP;
+
+		frame.VSP += 4;
+	}
+
+	return true;
+}
+
+static int CountBits(unsigned value)
+{
+	int count = 0;
+	for (; value; value &= value - 1)
+		count++;
+	return count;
+}
+
+//Converts the location of a register saved at the specified offset into the distance from the caller's SP (see SamplingProfilerUnwindEntry).
+static bool TranslateSlot(const UnwoundFrame &frame, int offset, unsigned char &slot)
+{
+	if (offset == -1)
+	{
+		slot = 0;
+		return true;
+	}
+
+	int distance = (frame.VSP - offset) / 4;
+	if (distance <= 0 || distance > 0xFF)
+		return false;
+
+	slot = (unsigned char)distance;
+	return true;
+}
+
+bool UnwindTableBuilder::TranslateUnwindInstructions(const unsigned char *pInstructions, size_t size, SamplingProfilerUnwindEntry &entry)
+{
+	UnwoundFrame frame = {0, -1, -1, false, false};
+
+	for (size_t i = 0; i < size;)
+	{
+		unsigned char op = pInstructions[i++];
+		if ((op & 0xC0) == 0x00) //vsp = vsp + (xxxxxx << 2) + 4
+			frame.VSP += ((op & 0x3F) << 2) + 4;
+		else if ((op & 0xC0) == 0x40) //vsp = vsp - (xxxxxx << 2) - 4
+			frame.VSP -= ((op & 0x3F) << 2) + 4;
+		else if ((op & 0xF0) == 0x80) //Pop up to 12 integer registers under masks {r15-r12}, {r11-r4}
+		{
+			if (i >= size)
+				return false;
+			unsigned mask = (((op & 0x0F) << 8) | pInstructions[i++]) << 4;
+			if (!mask || !PopCoreRegisters(frame, mask))
+				return false; //0x80 0x00 means 'refuse to unwind'
+		}
+		else if ((op & 0xF0) == 0x90) //vsp = r[nnnn]
+		{
+			//Only R7 is tracked, and only while it still holds the value from the time the function was interrupted
+			if ((op & 0x0F) != 7 || frame.SavedFP != -1 || frame.ReturnAddress != -1)
+				return false;
+			frame.BasedOnFP = true;
+			frame.VSP = 0;
+		}
+		else if ((op & 0xF0) == 0xA0) //Pop r4-r[4+nnn], optionally r14
+		{
+			unsigned mask = ((1 << ((op & 7) + 1)) - 1) << 4;
+			if (op & 0x08)
+				mask |= 1 << 14;
+			PopCoreRegisters(frame, mask);
+		}
+		else if (op == 0xB0) //Finish
+			break;
+		else if (op == 0xB1) //Pop integer registers under mask {r3, r2, r1, r0}
+		{
+			if (i >= size || !pInstructions[i] || (pInstructions[i] & 0xF0))
+				return false;
+			PopCoreRegisters(frame, pInstructions[i++]);
+		}
+		else if (op == 0xB2) //vsp = vsp + 0x204 + (uleb128 << 2)
+		{
+			unsigned value = 0;
+			for (int shift = 0;; shift += 7)
+			{
+				if (i >= size || shift > 21)
+					return false;
+				unsigned char byte = pInstructions[i++];
+				value |= (byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					break;
+			}
+			frame.VSP += 0x204 + (value << 2);
+		}
+		else if (op == 0xB3 || op == 0xC6 || op == 0xC8 || op == 0xC9) //Pop VFP or WMMX registers specified as 'sssscccc'
+		{
+			if (i >= size)
+				return false;
+			frame.VSP += 8 * ((pInstructions[i++] & 0x0F) + 1) + (op == 0xB3 ? 4 : 0); //FSTMFDX stores an extra word
+		}
+		else if ((op & 0xF8) == 0xB8) //Pop VFP D[8]-D[8+nnn] saved by FSTMFDX
+			frame.VSP += 8 * ((op & 7) + 1) + 4;
+		else if (op >= 0xC0 && op <= 0xC5) //Pop WMMX wR[10]-wR[10+nnn]
+			frame.VSP += 8 * ((op & 7) + 1);
+		else if (op == 0xC7) //Pop WMMX wCGR registers under mask {wCGR3, wCGR2, wCGR1, wCGR0}
+		{
+			if (i >= size || !pInstructions[i] || (pInstructions[i] & 0xF0))
+				return false;
+			frame.VSP += 4 * CountBits(pInstructions[i++]);
+		}
+		else if ((op & 0xF8) == 0xD0) //Pop VFP D[8]-D[8+nnn] saved by VPUSH
+			frame.VSP += 8 * ((op & 7) + 1);
+		else
+			return false; //Spare
+	}
+
+	if (frame.VSP < 0 || (frame.VSP & 3) || frame.VSP / 4 >= (kUnwindFrameBasedOnFP - 1))
+		return false;
+
+	if (!TranslateSlot(frame, frame.ReturnAddress, entry.ReturnAddressSlot) || !TranslateSlot(frame, frame.SavedFP, entry.SavedFPSlot))
+		return false;
+
+	entry.FrameSize = (unsigned short)(frame.VSP / 4 | (frame.BasedOnFP ? kUnwindFrameBasedOnFP : 0));
+	return true;
+}
+
+static bool CompareFunctionStarts(const SamplingProfilerUnwindEntry &left, const SamplingProfilerUnwindEntry &right)
+{
+	return left.FunctionStart < right.FunctionStart;
+}
+
+bool UnwindTableBuilder::Build(std::vector<SamplingProfilerUnwindEntry> &table, unsigned *pUnsupportedFunctions)
+{
+	if (!m_IndexTableSize || (m_IndexTableSize % 8))
+		return false;
+
+	std::vector<SamplingProfilerUnwindEntry> entries;
+	std::vector<unsigned char> instructions;
+	unsigned unsupportedFunctions = 0;
+
+	for (unsigned offset = 0; offset < m_IndexTableSize; offset += 8)
+	{
+		unsigned address = m_IndexTableAddress + offset, function, data;
+		if (!ReadWord(address, &function) || !ReadWord(address + 4, &data) || (function & 0x80000000))
+			return false;
+
+		SamplingProfilerUnwindEntry entry;
+		entry.FunctionStart = DecodePrel31(address, function) & ~1U;
+		if (data == kCannotUnwindMarker || !ReadUnwindInstructions(address + 4, data, instructions) ||
+			!TranslateUnwindInstructions(instructions.data(), instructions.size(), entry))
+		{
+			entry.FrameSize = kUnwindNotPossible;
+			entry.ReturnAddressSlot = entry.SavedFPSlot = 0;
+			unsupportedFunctions++;
+		}
+
+		entries.push_back(entry);
+	}
+
+	//The linker normally sorts the index table, but the profiler relies on it, so it is checked here.
+	std::stable_sort(entries.begin(), entries.end(), CompareFunctionStarts);
+
+	table.clear();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (!table.empty())
+		{
+			const SamplingProfilerUnwindEntry &last = table.back();
+			if (last.FrameSize == entries[i].FrameSize && last.ReturnAddressSlot == entries[i].ReturnAddressSlot && last.SavedFPSlot == entries[i].SavedFPSlot)
+				continue;
+		}
+
+		table.push_back(entries[i]);
+	}
+
+	if (pUnsupportedFunctions)
+		*pUnsupportedFunctions = unsupportedFunctions;
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "SysprogsProfilerInterface.h"
+#include <stddef.h>
+#include <vector>
+
+/*
+	Converts the ARM EHABI unwind information (.ARM.exidx and .ARM.extab) into the compact table used by the sampling profiler
+	(see SAMPLING_PROFILER_UNWIND_TABLE_SIZE). The debugger writes the table into g_SamplingProfilerUnwindTable and then sets
+	g_SamplingProfilerUnwindTableEntries.
+
+	Each function gets 8 bytes describing where its caller's SP, return address and FP are located. Functions that cannot be described
+	this way (e.g. they switch SP to a register other than R7) get kUnwindNotPossible entries, so the profiler stops unwinding there.
+	Adjacent functions with the same frame layout share one entry.
+*/
+class UnwindTableBuilder
+{
+public:
+	UnwindTableBuilder()
+		: m_IndexTableAddress(0), m_IndexTableSize(0)
+	{
+	}
+
+	//Makes the contents of a target memory region available (the .ARM.exidx and .ARM.extab contents are read from it).
+	void AddMemoryRegion(unsigned address, const void *pData, size_t size);
+
+	//Specifies the location of .ARM.exidx in the target memory (LoadELFFile() finds it automatically).
+	void SetIndexTable(unsigned address, unsigned size)
+	{
+		m_IndexTableAddress = address;
+		m_IndexTableSize = size;
+	}
+
+	//Loads all loadable segments of a 32-bit little-endian ELF file and locates the PT_ARM_EXIDX segment.
+	//Returns false if the file could not be read or has an unexpected format.
+	bool LoadELFFile(const char *pFileName);
+
+	//Builds the table sorted by FunctionStart. Returns false if the index table is missing or malformed.
+	//pUnsupportedFunctions receives the amount of functions with kUnwindNotPossible entries (including the ones marked as EXIDX_CANTUNWIND).
+	bool Build(std::vector<SamplingProfilerUnwindEntry> &table, unsigned *pUnsupportedFunctions = NULL);
+
+	//Computes the frame layout from the EHABI unwind instructions of one function. Returns false if it cannot be expressed via SamplingProfilerUnwindEntry.
+	static bool TranslateUnwindInstructions(const unsigned char *pInstructions, size_t size, SamplingProfilerUnwindEntry &entry);
+
+private:
+	struct MemoryRegion
+	{
+		unsigned Address;
+		std::vector<unsigned char> Data;
+	};
+
+	bool ReadWord(unsigned address, unsigned *pValue) const;
+	bool ReadUnwindInstructions(unsigned entryAddress, unsigned data, std::vector<unsigned char> &instructions) const;
+
+private:
+	std::vector<MemoryRegion> m_Regions;
+	unsigned m_IndexTableAddress, m_IndexTableSize;
+};
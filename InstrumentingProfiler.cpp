@@ -3,11 +3,25 @@
 #include <string.h>
 #include "DebuggerChecker.h"
 
+#if SYSPROGS_PROFILER_ZERO_COPY
+#include "FastSemihosting.h"
+#endif
+
 #if !defined(__IAR_SYSTEMS_ICC__) && !defined(__CC_ARM)
 
 typedef unsigned long long ProfilerTimeType;
 
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//Only the real-time watch reporting is built for the host simulator. The function hooks rely on the Thumb calling convention
+//and the Cortex-M exception model, so they are excluded, and the resource addresses are reported as their lower 32 bits.
+#include <stdint.h>
+#include <stdlib.h>
+#define SYSPROGS_PROFILER_USE_DWT_CYCLE_COUNTER 0 //Provided by the simulator
+#define SYSPROGS_PROFILER_BREAKPOINT() abort()
+#else
 typedef unsigned uintptr_t;
+#define SYSPROGS_PROFILER_BREAKPOINT() asm("bkpt 255")
+#endif
 
 extern int g_FastSemihostingCallActive;
 
@@ -107,7 +121,7 @@ static unsigned SysprogsInstrumentingProfiler_QueryAndResetPerformanceCounter()
 			DWT_LAR = 0xC5ACCE55;
 #endif
 		
-		DWT_CTRL = 1;
+		DWT_CTRL |= 1; //Keeps the PC sampling bits set by ProfilerDriver_ITM.cpp
 		DWT_CYCCNT = 0;
 		Initialized = 1;
 	}
@@ -219,7 +233,7 @@ namespace SysprogsInstrumentingProfiler
 
 		bool IsInterrupt() const
 		{
-			return ((int)LR) < 0;
+			return ((int)(uintptr_t)LR) < 0;
 		}
 
 		bool IsReported() const
@@ -265,7 +279,7 @@ namespace SysprogsInstrumentingProfiler
 		(void)pArg;
 		//If you have stopped here, the profiler has detected an unrecoverable error.
 		//Examine the errorCode variable (r0) and pArg (r1) for more details.
-		asm("bkpt 255");
+		SYSPROGS_PROFILER_BREAKPOINT();
 	}
 
 	static ProfilerThreadRecord s_MainThreadState;
@@ -310,10 +324,86 @@ namespace SysprogsInstrumentingProfiler
 
 	unsigned FunctionFoldingThreshold;
 
+	enum
+	{
+		kFrameReportChunkSize = 32
+	};
+
+	static void WriteFrameReportChunk(SmallNumberCoder &coder)
+	{
+		while (!SysprogsProfiler_WriteData(pdcInstrumentationProfilerNormalStream,
+										   (char *)coder.GetBuffer(),
+										   0,
+										   coder.GetBuffer(),
+										   coder.GetOffset()))
+		{
+			asm("nop");
+		}
+	}
+
+#if SYSPROGS_PROFILER_ZERO_COPY
+	enum
+	{
+		kMaxFrameReportReservationAttempts = 16
+	};
+
+	//The frame reports are encoded directly into the fast semihosting buffer. If the space cannot be reserved after a few attempts
+	//(e.g. because the code we have interrupted holds a variable-size reservation in the same ring), the chunk is encoded into Data
+	//and written via the regular copy path instead.
+	struct FrameReportBuffer
+	{
+		FastSemihostingReservation Reservation;
+		bool Reserved;
+		char Data[kFrameReportChunkSize];
+	};
+
+	static SmallNumberCoder BeginFrameReportChunk(FrameReportBuffer *pBuffer)
+	{
+		FastSemihostingReservation *pReservation = &pBuffer->Reservation;
+		for (int i = 0; i < kMaxFrameReportReservationAttempts; i++)
+		{
+			if (ReserveVariableSizeFastSemihostingBuffer(pdcInstrumentationProfilerNormalStream, kFrameReportChunkSize, kFrameReportChunkSize, pReservation))
+			{
+				pBuffer->Reserved = true;
+				return SmallNumberCoder(pReservation->pFirstSegment, pReservation->FirstSegmentSize, pReservation->pSecondSegment, pReservation->SecondSegmentSize, 0, 0);
+			}
+
+			asm("nop");
+		}
+
+		pBuffer->Reserved = false;
+		return SmallNumberCoder(pBuffer->Data, sizeof(pBuffer->Data), 0, 0);
+	}
+
+	static void EndFrameReportChunk(FrameReportBuffer *pBuffer, SmallNumberCoder &coder)
+	{
+		if (pBuffer->Reserved)
+			CommitVariableSizeFastSemihostingBuffer(&pBuffer->Reservation, coder.GetOffset());
+		else
+			WriteFrameReportChunk(coder);
+	}
+#else
+	struct FrameReportBuffer
+	{
+		char Data[kFrameReportChunkSize];
+	};
+
+	static SmallNumberCoder BeginFrameReportChunk(FrameReportBuffer *pBuffer)
+	{
+		return SmallNumberCoder(pBuffer->Data, sizeof(pBuffer->Data), 0, 0);
+	}
+
+	static void EndFrameReportChunk(FrameReportBuffer *pBuffer, SmallNumberCoder &coder)
+	{
+		(void)pBuffer;
+		WriteFrameReportChunk(coder);
+	}
+#endif
+
 	void __attribute__((noinline)) ReportFramesToProfiler(const InstrumentedFrame *pTopFrame, ProfilerTimeType runTime)
 	{
-		static char buffer[32];
-		SmallNumberCoder coder(buffer, sizeof(buffer), 0, 0);
+		static FrameReportBuffer buffer;
+		SmallNumberCoder coder = BeginFrameReportChunk(&buffer);
 
 		if (s_ThreadIDReportPending)
 		{
@@ -321,7 +411,7 @@ namespace SysprogsInstrumentingProfiler
 			if (!coder.WritePackedUIntPair(0x7fff, 0))
 				RaiseError(ipeScratchBufferOverflow);
 			//TODO: report thread name if pending
-			coder.WriteSmallUnsignedInt((unsigned)s_pCurrentThreadState->pOriginalThread);
+			coder.WriteSmallUnsignedInt((unsigned)(uintptr_t)s_pCurrentThreadState->pOriginalThread);
 		}
 
 		unsigned totalFrames = 0;
@@ -351,22 +441,14 @@ namespace SysprogsInstrumentingProfiler
 				RaiseError(ipeScratchBufferOverflow);
 #if DEBUG
 			if (!pFrame || pFrame->IsReported())
-				asm("bkpt 255");
+				SYSPROGS_PROFILER_BREAKPOINT();
 #endif
 			pFrame->FlagAsReported();
 
-			if (coder.RemainingSize() < sizeof(buffer) / 2)
+			if (coder.RemainingSize() < kFrameReportChunkSize / 2)
 			{
-				while (!SysprogsProfiler_WriteData(pdcInstrumentationProfilerNormalStream,
-												   (char *)coder.GetBuffer(),
-												   0,
-												   coder.GetBuffer(),
-												   coder.GetOffset()))
-				{
-					asm("nop");
-				}
-
-				coder.SetOffset(0);
+				EndFrameReportChunk(&buffer, coder);
+				coder = BeginFrameReportChunk(&buffer);
 			}
 			pFrame = pFrame->pNextFrame;
 			unreportedFrames--;
@@ -379,16 +461,40 @@ namespace SysprogsInstrumentingProfiler
 			if (!coder.WriteSmallUnsignedInt(ProfilerTimeToUInt32(pTopFrame->FoldedTime)))
 				RaiseError(ipeScratchBufferOverflow);
 
-		while (!SysprogsProfiler_WriteData(pdcInstrumentationProfilerNormalStream,
-										   (char *)coder.GetBuffer(),
-										   0,
-										   coder.GetBuffer(),
-										   coder.GetOffset()))
+		EndFrameReportChunk(&buffer, coder);
+	}
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+	//The function hooks are not built for the host, so the tests report the frames directly, as the return hook would do when the
+	//top frame (pFunctions[0]) returns. The last reportedCount frames are treated as already reported.
+	extern "C" void SysprogsHostSimulator_ReportInstrumentedFrames(const uintptr_t *pFunctions, unsigned count, unsigned reportedCount, unsigned runTime, unsigned foldedTime)
+	{
+		InstrumentedFrame frames[128];
+		if (!count || count > __countof(frames) || reportedCount >= count)
+			RaiseError(ipeInterfaceError);
+
+		memset(frames, 0, sizeof(frames));
+		for (unsigned i = 0; i < count; i++)
 		{
-			asm("nop");
+			frames[i].FunctionAndReportFlag = pFunctions[i];
+			if (i >= count - reportedCount)
+				frames[i].FlagAsReported();
+			if (i + 1 < count)
+				frames[i].pNextFrame = &frames[i + 1];
 		}
+
+		frames[0].FoldedTime = foldedTime;
+		ReportFramesToProfiler(&frames[0], runTime);
 	}
 
+	//The frame addresses are delta-encoded, so the tests that decode the reports need to start from a known state.
+	extern "C" void SysprogsHostSimulator_ResetInstrumentingProfiler()
+	{
+		s_FrameAddressBase = 0;
+		s_ThreadIDReportPending = 0;
+	}
+#endif
+
 	struct RunTimeReportRecord
 	{
 		unsigned Type;
@@ -399,6 +505,7 @@ namespace SysprogsInstrumentingProfiler
 
 	static ProfilerTimeType LastReportedRealTimeWatchTime = 0;
 
+#if !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
 	void __attribute__((noinline)) ReportFunctionRunTimeToRealTimeWatch(const InstrumentedFrame *pTopFrame, ProfilerTimeType runTime)
 	{
 		RunTimeReportRecord rec = {.Type = rtpFunctionRuntime, .Address = pTopFrame->FunctionAndReportFlag, .StartTimeDelta = (int)(pTopFrame->StartTime - LastReportedRealTimeWatchTime), .RunTime = ProfilerTimeToUInt32(runTime)};
@@ -527,15 +634,17 @@ namespace SysprogsInstrumentingProfiler
 		pThread->pTopFrame = pNewFrame;
 	}
 	}
+#endif
 
 	void ReportThreadCreated(void *newThread, const char *pThreadName)
 	{
 		if (g_InstrumentingProfilerRTOSFlags & ipfReportThreadCreation)
 		{
 			unsigned length = strlen(pThreadName);
-			unsigned header[2] = {(length << 8) | rtpThreadCreated, (unsigned)newThread};
+			unsigned header[2] = {(length << 8) | rtpThreadCreated, (unsigned)(uintptr_t)newThread};
+			ProfilerDataSegment segments[] = {{header, sizeof(header)}, {pThreadName, length}};
 
-			while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, &header, sizeof(header), pThreadName, length))
+			while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, __countof(segments)))
 			{
 				asm("nop");
 			}
@@ -555,8 +664,9 @@ namespace SysprogsInstrumentingProfiler
 		if (g_InstrumentingProfilerRTOSFlags & ipfReportThreadTimes)
 		{
 			unsigned char type = rtpThreadSwitch;
-			int payload[2] = {GetRelativeTimestamp(), (int)newThread};
-			while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, &type, 1, payload, sizeof(payload)))
+			int payload[2] = {GetRelativeTimestamp(), (int)(uintptr_t)newThread};
+			ProfilerDataSegment segments[] = {{&type, 1}, {payload, sizeof(payload)}};
+			while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, __countof(segments)))
 			{
 				asm("nop");
 			}
@@ -565,6 +675,7 @@ namespace SysprogsInstrumentingProfiler
 
 } // namespace SysprogsInstrumentingProfiler
 
+#if !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
 #ifdef __thumb2__
 #define CLEAR_R0_BIT_0() \
 	asm("bic r0, #1");
@@ -639,12 +750,15 @@ extern "C" __attribute__((naked)) void SysprogsInstrumentingProfilerHook()
 	asm("ProfilerHook_NoInterrupt_Exit:");
 	SYSPROGS_THUMB_HOOK_EPILOGUE();
 }
+#endif
 
 namespace SysprogsStackVerifier
 {
 	void *StackLimit = 0;
 }
 
+#if !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+
 //Stack verifier enabled, timing analysis disabled
 extern "C" __attribute__((naked)) void SysprogsStackVerifierHook()
 {
@@ -666,10 +780,12 @@ extern "C" __attribute__((naked)) void SysprogsStackVerifierHook()
 	asm("pop {r1}");
 	SYSPROGS_THUMB_HOOK_EPILOGUE();
 }
+#endif
 
 volatile void *SysprogsProfiler_FunctionHookTable;
 extern volatile void *__attribute__((alias("SysprogsProfiler_FunctionHookTable"))) SysprogsProfiler_FunctionHookTableEnd;
 
+#if !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
 //Timing analysis enabled, stack verifier disabled
 extern "C" __attribute__((naked)) void SysprogsTimingRecorderHook()
 {
@@ -731,6 +847,7 @@ namespace OverheadMeasurementFunctions
 		asm("bx lr");
 	}
 } // namespace OverheadMeasurementFunctions
+#endif
 
 struct OverheadReportPacket
 {
@@ -741,6 +858,9 @@ struct OverheadReportPacket
 
 extern "C" void __attribute__((noinline)) InstrumentingProfilerInitialized(int measureOverhead = 0)
 {
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+	(void)measureOverhead;
+#else
 	if (measureOverhead)
 	{
 		asm volatile("cpsid f");
@@ -764,10 +884,18 @@ extern "C" void __attribute__((noinline)) InstrumentingProfilerInitialized(int m
 		SysprogsInstrumentingProfiler::Chronometer::ProfilerTimeOverhead = 0;
 		asm volatile("cpsie f");
 	}
+#endif
 }
 
+//Defined in SamplingProfiler.cpp, that is not linked into the projects without the sampling profiler.
+extern "C" void __attribute__((weak)) SysprogsProfiler_SamplingThreadSwitched(void *newThread, const char *pThreadName);
+extern "C" void __attribute__((weak)) SysprogsProfiler_SamplingThreadDeleted(void *thread);
+
 void SysprogsProfiler_RTOSThreadSwitched(void *newThread, const char *pThreadName, void *pStackLimit)
 {
+	if (SysprogsProfiler_SamplingThreadSwitched)
+		SysprogsProfiler_SamplingThreadSwitched(newThread, pThreadName);
+
 	if (g_InstrumentingProfilerRTOSFlags & (ipfProfileFunctionCalls | ipfVerifyFunctionStacks | ipfRecordFunctionTiming | ipfReportThreadCreation | ipfReportThreadTimes))
 	{
 		SysprogsStackVerifier::StackLimit = pStackLimit;
@@ -803,6 +931,8 @@ void SysprogsProfiler_RTOSThreadSwitched(void *newThread, const char *pThreadNam
 
 void SysprogsProfiler_RTOSThreadDeleted(void *thread)
 {
+	if (SysprogsProfiler_SamplingThreadDeleted)
+		SysprogsProfiler_SamplingThreadDeleted(thread);
 	for (int i = 0; i < (int)__countof(SysprogsInstrumentingProfiler::s_AllThreadRecords); i++)
 	{
 		if (SysprogsInstrumentingProfiler::s_AllThreadRecords[i].pOriginalThread == thread)
@@ -819,7 +949,7 @@ void SysprogsProfiler_RTOSThreadDeleted(void *thread)
 
 void SysprogsProfiler_ReportResourceTaken(void *pResource, void *pOwner, unsigned optional24BitTag)
 {
-	unsigned msg[] = {optional24BitTag << 8 | rtpResourceTaken, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource, (unsigned)pOwner};
+	unsigned msg[] = {optional24BitTag << 8 | rtpResourceTaken, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource, (unsigned)(uintptr_t)pOwner};
 	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), 0, 0))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
@@ -828,7 +958,7 @@ void SysprogsProfiler_ReportResourceTaken(void *pResource, void *pOwner, unsigne
 
 void SysprogsProfiler_ReportResourceReleased(void *pResource, void *pOwner, unsigned optional24BitTag)
 {
-	unsigned msg[] = {optional24BitTag << 8 | rtpResourceReleased, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource, (unsigned)pOwner};
+	unsigned msg[] = {optional24BitTag << 8 | rtpResourceReleased, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource, (unsigned)(uintptr_t)pOwner};
 	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), 0, 0))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
@@ -837,7 +967,7 @@ void SysprogsProfiler_ReportResourceReleased(void *pResource, void *pOwner, unsi
 
 void SysprogsProfiler_ReportIntegralValue(void *pResource, unsigned value, int reportAsSigned)
 {
-	unsigned msg[] = {(reportAsSigned ? rtpSignedValueChanged : rtpUnsignedValueChanged), (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource, value};
+	unsigned msg[] = {(reportAsSigned ? rtpSignedValueChanged : rtpUnsignedValueChanged), (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource, value};
 	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), 0, 0))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
@@ -846,8 +976,9 @@ void SysprogsProfiler_ReportIntegralValue(void *pResource, unsigned value, int r
 
 void SysprogsProfiler_ReportFPValue(void *pResource, double value)
 {
-	unsigned msg[] = {rtpFPValueChanged, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource};
-	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), &value, sizeof(value)))
+	unsigned msg[] = {rtpFPValueChanged, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource};
+	ProfilerDataSegment segments[] = {{msg, sizeof(msg)}, {&value, sizeof(value)}};
+	while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, __countof(segments)))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
 	}
@@ -856,8 +987,9 @@ void SysprogsProfiler_ReportFPValue(void *pResource, double value)
 void SysprogsProfiler_ReportGenericEvent(void *pResource, const char *pEvent)
 {
 	unsigned length = pEvent ? strlen(pEvent) : 0;
-	unsigned msg[] = {length << 8 | rtpCustomEvent, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource};
-	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), pEvent, length))
+	unsigned msg[] = {length << 8 | rtpCustomEvent, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource};
+	ProfilerDataSegment segments[] = {{msg, sizeof(msg)}, {pEvent, length}};
+	while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, __countof(segments)))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
 	}
@@ -865,8 +997,9 @@ void SysprogsProfiler_ReportGenericEvent(void *pResource, const char *pEvent)
 
 void SysprogsProfiler_ReportGenericEventEx(void *pResource, void *argument, RealTimeEventArgType argType, int argSize)
 {
-	unsigned msg[] = {(unsigned)rtpCustomEventEx | (unsigned)argType << 8, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)pResource};
-	while (!SysprogsProfiler_WriteData(pdcRealTimeAnalysisStream, msg, sizeof(msg), argument, argSize))
+	unsigned msg[] = {(unsigned)rtpCustomEventEx | (unsigned)argType << 8, (unsigned)SysprogsInstrumentingProfiler::GetRelativeTimestamp(), (unsigned)(uintptr_t)pResource};
+	ProfilerDataSegment segments[] = {{msg, sizeof(msg)}, {argument, (unsigned)argSize}};
+	while (!SysprogsProfiler_WriteDataV(pdcRealTimeAnalysisStream, segments, __countof(segments)))
 	{
 		ReportRealTimeAnalysisBufferOverflow();
 	}
@@ -901,6 +1034,7 @@ extern "C" void __attribute__((noinline)) InitializeInstrumentingProfiler()
 	}
 
 	volatile int x = 0;
+#if !defined(SYSPROGS_PROFILER_HOST_SIMULATION)
 	if (x)
 	{
 		//This code is only needed to reference the functions so that they won't be remoevd by the linker.
@@ -911,6 +1045,7 @@ extern "C" void __attribute__((noinline)) InitializeInstrumentingProfiler()
 		SysprogsInstrumentingProfiler::SysprogsInstrumentingProfilerReturnHookImpl(0);
 		SysprogsInstrumentingProfiler::ReportFunctionRunTimeToRealTimeWatch(0, 0);
 	}
+#endif
 	InitializeProfilerRTOSHooks();
 
 	g_SuppressInstrumentingProfiler = 0;
@@ -937,7 +1072,7 @@ extern "C" void ReportTicksPerSecond(unsigned ticksPerSecond)
 static __attribute__((noinline)) void ReportRealTimeAnalysisBufferOverflow()
 {
 	if (g_StopOnRealTimeReportingBufferOverflow)
-		asm("bkpt 255");
+		SYSPROGS_PROFILER_BREAKPOINT();
 
 	//Wait for the buffer to empty up
 	while (SysprogsProfiler_GetBufferAvailability(4) <= 2)
@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+	Address ranges used by the sampling profiler to tell code and stack addresses from other values when the firmware has more than one
+	code or RAM region (see SYSPROGS_PROFILER_ADDRESS_REGIONS in SamplingProfiler.cpp). The tables must be sorted by Start and must not overlap.
+*/
+typedef struct
+{
+	const void *Start;
+	const void *End; //Exclusive
+} ProfilerAddressRegion;
+
+/*
+	Returns the region containing the address, or NULL if there is none. The amount of iterations only depends on the region count, and the
+	comparison inside the loop is compiled into a conditional select, so the lookup takes the same time for code addresses and for random data.
+*/
+static inline const ProfilerAddressRegion *FindProfilerAddressRegion(const ProfilerAddressRegion *pRegions, unsigned count, const void *pAddr)
+{
+	if (!count)
+		return 0;
+
+	while (count > 1)
+	{
+		unsigned half = count / 2;
+		pRegions = (pRegions[half].Start <= pAddr) ? pRegions + half : pRegions;
+		count -= half;
+	}
+
+	return (pRegions->Start <= pAddr && pAddr < pRegions->End) ? pRegions : 0;
+}
@@ -0,0 +1,152 @@
+#include "ProfilerCompatibility.h"
+#include "SysprogsProfiler.h"
+#include "SamplingPeriodJitter.h"
+#include <stdint.h>
+
+/*
+	This driver does not use any timer interrupts. Instead, it configures the DWT unit of the Cortex-M3/M4/M7/M33 core to emit periodic
+	PC samples (and optionally exception entry/exit events) as ITM hardware source packets, which are sent via SWO without any CPU involvement.
+	The debugger captures the SWO stream and decodes it into a flat profile (see HostTools/ItmPacketDecoder.h). As the samples only contain
+	the PC value, the call stacks are not reconstructed.
+
+	The sampling period is derived from CYCCNT: each sample is taken after (POSTPRESET + 1) * 64 or (POSTPRESET + 1) * 1024 cycles, so the
+	rate is limited to SystemCoreClock / 16384 .. SystemCoreClock / 64 and is rounded to the nearest available period. The actual rate is
+	reported via g_SamplingProfilerMeanRate. SAMPLING_PROFILER_PERIOD_JITTER and g_SamplingProfilerAutoRate are not supported, as there is
+	no code running for each sample.
+
+	The SWO pin and its clock are normally configured by the debugger, as they depend on the debug probe. Use SAMPLING_PROFILER_ITM_SWO_FREQUENCY
+	to configure the TPIU from the target instead.
+*/
+
+#if defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_8M_BASE__)
+#error Cortex-M0/M0+/M23 cores do not support DWT PC sampling. Please use a timer-based sampling profiler driver instead.
+#endif
+
+//Also send exception entry/exit/return packets. This shows the exact amount of time spent in each interrupt handler, but can saturate
+//the SWO link if the interrupts are frequent.
+#ifndef SAMPLING_PROFILER_ITM_EXCEPTION_TRACE
+#define SAMPLING_PROFILER_ITM_EXCEPTION_TRACE 0
+#endif
+
+//If not 0, the TPIU is configured for the specified SWO frequency (NRZ encoding), assuming that the trace clock equals SystemCoreClock.
+#ifndef SAMPLING_PROFILER_ITM_SWO_FREQUENCY
+#define SAMPLING_PROFILER_ITM_SWO_FREQUENCY 0
+#endif
+
+//Trace bus ID reported in the ITM_TCR register. Only matters if the TPIU formatter is enabled (e.g. when using the parallel trace port).
+#ifndef SAMPLING_PROFILER_ITM_TRACE_BUS_ID
+#define SAMPLING_PROFILER_ITM_TRACE_BUS_ID 1
+#endif
+
+//The debug components have fixed addresses on all ARMv7-M and ARMv8-M mainline cores, so no device-specific headers are needed.
+#define PROFILER_DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define PROFILER_DEMCR_TRCENA (1UL << 24)
+
+#define PROFILER_DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define PROFILER_DWT_LAR (*(volatile uint32_t *)0xE0001FB0)
+#define PROFILER_DWT_LSR (*(volatile uint32_t *)0xE0001FB4)
+#define PROFILER_DWT_CTRL_CYCCNTENA (1UL << 0)
+#define PROFILER_DWT_CTRL_POSTPRESET_Pos 1
+#define PROFILER_DWT_CTRL_POSTINIT_Pos 5
+#define PROFILER_DWT_CTRL_CYCTAP (1UL << 9)
+#define PROFILER_DWT_CTRL_SYNCTAP_Pos 10
+#define PROFILER_DWT_CTRL_PCSAMPLENA (1UL << 12)
+#define PROFILER_DWT_CTRL_EXCTRCENA (1UL << 16)
+#define PROFILER_DWT_CTRL_NOCYCCNT (1UL << 25)
+#define PROFILER_DWT_CTRL_SAMPLING_MASK (0x3FEUL | PROFILER_DWT_CTRL_PCSAMPLENA | PROFILER_DWT_CTRL_EXCTRCENA | (3UL << PROFILER_DWT_CTRL_SYNCTAP_Pos))
+
+#define PROFILER_ITM_TCR (*(volatile uint32_t *)0xE0000E80)
+#define PROFILER_ITM_LAR (*(volatile uint32_t *)0xE0000FB0)
+#define PROFILER_ITM_LSR (*(volatile uint32_t *)0xE0000FB4)
+#define PROFILER_ITM_TCR_ITMENA (1UL << 0)
+#define PROFILER_ITM_TCR_SYNCENA (1UL << 2)
+#define PROFILER_ITM_TCR_DWTENA (1UL << 3)
+#define PROFILER_ITM_TCR_TRACEBUSID_Pos 16
+
+#define PROFILER_TPIU_ACPR (*(volatile uint32_t *)0xE0040010)
+#define PROFILER_TPIU_SPPR (*(volatile uint32_t *)0xE00400F0)
+#define PROFILER_TPIU_FFCR (*(volatile uint32_t *)0xE0040304)
+
+#define PROFILER_CORESIGHT_UNLOCK_KEY 0xC5ACCE55
+
+extern "C" uint32_t SystemCoreClock;
+extern "C" void SystemCoreClockUpdate(void);
+
+volatile int g_SamplingProfilerRate = 10000; //Samples/sec. Values below SystemCoreClock / 16384 are rounded up.
+volatile int g_EnableSamplingProfiler = 0;	 //Will be set via the debugger interface when starting a profiling session
+
+//The DWT_CTRL value programmed by InitializeSamplingProfiler(). Lets the debugger recognize this driver and change the sampling period
+//by writing DWT_CTRL directly while the target is running.
+volatile uint32_t g_SamplingProfilerDWTControl;
+
+//Returns the DWT_CTRL bits selecting the available sampling period closest to SystemCoreClock / g_SamplingProfilerRate.
+//Also updates g_SamplingProfilerMeanRate.
+static uint32_t ComputeSamplingPeriodBits()
+{
+	unsigned period = SystemCoreClock / g_SamplingProfilerRate;
+	unsigned tap = 64;
+	uint32_t bits = 0;
+	if (period > 16 * 64)
+	{
+		tap = 1024;
+		bits |= PROFILER_DWT_CTRL_CYCTAP;
+	}
+
+	unsigned reload = (period + tap / 2) / tap;
+	if (reload < 1)
+		reload = 1;
+	else if (reload > 16)
+		reload = 16;
+
+	g_SamplingProfilerMeanRate = SystemCoreClock / (reload * tap);
+	return bits | ((reload - 1) << PROFILER_DWT_CTRL_POSTPRESET_Pos) | ((reload - 1) << PROFILER_DWT_CTRL_POSTINIT_Pos);
+}
+
+#if SAMPLING_PROFILER_ITM_SWO_FREQUENCY
+static void InitializeSWO()
+{
+	PROFILER_TPIU_SPPR = 2; //NRZ (UART) encoding
+	PROFILER_TPIU_ACPR = SystemCoreClock / SAMPLING_PROFILER_ITM_SWO_FREQUENCY - 1;
+	PROFILER_TPIU_FFCR = 0x100; //Formatter disabled, TRIGIN enabled
+}
+#endif
+
+void InitializeSamplingProfiler()
+{
+	if (!g_EnableSamplingProfiler || g_SamplingProfilerRate == 0)
+		return;
+
+	SystemCoreClockUpdate();
+	PROFILER_DEMCR |= PROFILER_DEMCR_TRCENA;
+	if (PROFILER_DWT_LSR & 1) //Cortex-M7 requires unlocking the debug components
+		PROFILER_DWT_LAR = PROFILER_CORESIGHT_UNLOCK_KEY;
+	if (PROFILER_ITM_LSR & 1)
+		PROFILER_ITM_LAR = PROFILER_CORESIGHT_UNLOCK_KEY;
+
+	if (PROFILER_DWT_CTRL & PROFILER_DWT_CTRL_NOCYCCNT)
+		return; //The cycle counter is needed to time the samples
+
+#if SAMPLING_PROFILER_ITM_SWO_FREQUENCY
+	InitializeSWO();
+#endif
+
+	//The debugger may already be using some stimulus ports, so ITM_TER is left unchanged. The PC samples do not depend on it.
+	PROFILER_ITM_TCR |= PROFILER_ITM_TCR_ITMENA | PROFILER_ITM_TCR_SYNCENA | PROFILER_ITM_TCR_DWTENA | (SAMPLING_PROFILER_ITM_TRACE_BUS_ID << PROFILER_ITM_TCR_TRACEBUSID_Pos);
+
+	//POSTPRESET and POSTINIT should not change while the sampling is enabled, so it is disabled first. CYCCNT keeps running, as
+	//the instrumenting profiler may be using it.
+	uint32_t control = PROFILER_DWT_CTRL & ~PROFILER_DWT_CTRL_SAMPLING_MASK;
+	PROFILER_DWT_CTRL = control;
+
+	control |= ComputeSamplingPeriodBits() | PROFILER_DWT_CTRL_CYCCNTENA;
+	control |= 1UL << PROFILER_DWT_CTRL_SYNCTAP_Pos; //Periodic synchronization packets let the debugger recover from lost SWO data
+#if SAMPLING_PROFILER_ITM_EXCEPTION_TRACE
+	control |= PROFILER_DWT_CTRL_EXCTRCENA;
+#endif
+	PROFILER_DWT_CTRL = control;
+
+	control |= PROFILER_DWT_CTRL_PCSAMPLENA;
+	PROFILER_DWT_CTRL = control;
+	g_SamplingProfilerDWTControl = control;
+	g_SamplingProfilerRate = 0;
+}
@@ -2,9 +2,11 @@
 #include <fsl_hwtimer_systick.h>
 #include <fsl_hwtimer_pit.h>
 #include <fsl_pit_driver.h>
+#include <fsl_clock_manager.h>
 
 #include "SysprogsProfiler.h"
 #include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
 
 static hwtimer_t hwtimer;
 
@@ -21,16 +23,66 @@ static hwtimer_t hwtimer;
 volatile int g_SamplingProfilerRate = 100;	//Samples/sec
 volatile int g_EnableSamplingProfiler = 0;	//Will be set via the debugger interface when starting a profiling session
 
-static void UpdateProfilerTimerFrequency()
+#if SAMPLING_PROFILER_PERIOD_JITTER
+static SamplingPeriodGenerator s_PeriodGenerator;
+#endif
+
+static unsigned s_TimerClock, s_CoreClockForTimerClock;
+
+//The PIT runs from the bus clock. The clock manager updates SystemCoreClock when switching the clock configuration.
+static unsigned ComputeTimerClock()
+{
+	s_CoreClockForTimerClock = SystemCoreClock;
+	return CLOCK_SYS_GetPitFreq(0);
+}
+
+//Returns the value of the PIT load register (one less than the period). Also updates g_SamplingProfilerMeanRate and the jitter generator.
+static unsigned ComputeTimerLoadValue(unsigned timerClock)
+{
+	unsigned period = timerClock / g_SamplingProfilerRate;
+	g_SamplingProfilerMeanRate = timerClock / period;
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	//The jittered periods are written directly into the PIT load register as well.
+	SamplingPeriodGenerator_Init(&s_PeriodGenerator, period - 1, SAMPLING_PROFILER_PERIOD_JITTER, 0x2545F491);
+#endif
+	return period - 1;
+}
+
+static void InitializeProfilerTimer()
 {
 	if (g_SamplingProfilerRate == 0)
 		return;
 	SystemCoreClockUpdate();
-	
+	s_TimerClock = ComputeTimerClock();
+
+	//Lets the HWTIMER driver configure the PIT channel. The load register is then overwritten with the exact period.
 	if (kHwtimerSuccess != HWTIMER_SYS_SetPeriod(&hwtimer, 1000000 / g_SamplingProfilerRate))
 	{
 		asm("bkpt 255");
 	}
+
+	PIT_HAL_SetTimerPeriodByCount(g_pitBase[0], SAMPLING_PROFILER_TIMER_INSTANCE, ComputeTimerLoadValue(s_TimerClock));
+}
+
+/*
+	Called from the timer ISR when the rate changes (e.g. via g_SamplingProfilerAutoRate), so it only writes the PIT load register
+	instead of reprogramming the timer via the HWTIMER driver. The PIT loads the new value at the end of the current period.
+	The timer clock is only recomputed if SystemCoreClock has changed.
+*/
+static void UpdateProfilerTimerFrequency()
+{
+	if (g_SamplingProfilerRate == 0)
+		return;
+
+	if (SystemCoreClock != s_CoreClockForTimerClock)
+		s_TimerClock = ComputeTimerClock();
+
+	unsigned loadValue = ComputeTimerLoadValue(s_TimerClock);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	loadValue = SamplingPeriodGenerator_Next(&s_PeriodGenerator);
+#endif
+
+	PIT_HAL_SetTimerPeriodByCount(g_pitBase[0], SAMPLING_PROFILER_TIMER_INSTANCE, loadValue);
 }
 
 extern "C" 
@@ -41,6 +93,10 @@ extern "C"
 		if (PIT_HAL_IsIntPending(base, SAMPLING_PROFILER_TIMER_INSTANCE))
 		{
 			PIT_HAL_ClearIntFlag(base, SAMPLING_PROFILER_TIMER_INSTANCE);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+			//The PIT only reloads the new value at the end of the current period, so each sample sets the period after the next one.
+			PIT_HAL_SetTimerPeriodByCount(base, SAMPLING_PROFILER_TIMER_INSTANCE, SamplingPeriodGenerator_Next(&s_PeriodGenerator));
+#endif
 			SysprogsProfiler_ProcessSample(PC, SP, FP, LR);
 			if (g_SamplingProfilerRate != 0)
 			{
@@ -79,7 +135,7 @@ void InitializeSamplingProfiler()
 		asm("bkpt 255");
 	}
 	
-	UpdateProfilerTimerFrequency();
+	InitializeProfilerTimer();
 
 	if (kHwtimerSuccess != HWTIMER_SYS_Start(&hwtimer))
 	{
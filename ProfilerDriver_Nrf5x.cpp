@@ -12,6 +12,7 @@ extern "C" {
 
 #include "SysprogsProfiler.h"
 #include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
 
 #ifndef PROFILER_TIMER_INSTANCE
 #define PROFILER_TIMER_INSTANCE 2
@@ -26,6 +27,10 @@ extern "C" {
 volatile int g_SamplingProfilerRate = 100;	//Samples/sec
 volatile int g_EnableSamplingProfiler = 0;	//Will be set via the debugger interface when starting a profiling session
 
+#if SAMPLING_PROFILER_PERIOD_JITTER
+static SamplingPeriodGenerator s_PeriodGenerator;
+#endif
+
 static void UpdateProfilerTimerFrequency()
 {
 	if (g_SamplingProfilerRate == 0)
@@ -33,7 +38,7 @@ static void UpdateProfilerTimerFrequency()
 	SystemCoreClockUpdate();
 	int divider = SystemCoreClock / g_SamplingProfilerRate;
 	int prescaler = 0;
-	while (divider > 65535)
+	while (divider + divider / 100 * SAMPLING_PROFILER_PERIOD_JITTER > 65535)
 	{
 		prescaler++;
 		divider /= 2;
@@ -41,6 +46,11 @@ static void UpdateProfilerTimerFrequency()
 	
 	CONCAT2(NRF_TIMER, PROFILER_TIMER_INSTANCE)->CC[0] = divider;
 	CONCAT2(NRF_TIMER, PROFILER_TIMER_INSTANCE)->PRESCALER = prescaler;		  
+
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	SamplingPeriodGenerator_Init(&s_PeriodGenerator, divider, SAMPLING_PROFILER_PERIOD_JITTER, 0x2545F491);
+#endif
+	g_SamplingProfilerMeanRate = SystemCoreClock / ((unsigned)divider << prescaler);
 }
 
 extern "C" 
@@ -51,6 +61,9 @@ extern "C"
 		{
 			CONCAT2(NRF_TIMER, PROFILER_TIMER_INSTANCE)->EVENTS_COMPARE[0] = 0;	      //Clear compare register 0 event	
 			CONCAT2(NRF_TIMER, PROFILER_TIMER_INSTANCE)->TASKS_CLEAR = 1;		//Reset the timer
+#if SAMPLING_PROFILER_PERIOD_JITTER
+			CONCAT2(NRF_TIMER, PROFILER_TIMER_INSTANCE)->CC[0] = SamplingPeriodGenerator_Next(&s_PeriodGenerator);
+#endif
 			
 			SysprogsProfiler_ProcessSample(PC, SP, FP, LR);
 			if (g_SamplingProfilerRate != 0)
@@ -0,0 +1,129 @@
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+#include "pico/platform.h"
+
+#include "SysprogsProfiler.h"
+#include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
+
+/*
+	Each core is sampled by its own alarm of the 1 MHz system timer: core 0 uses SAMPLING_PROFILER_FIRST_ALARM, core 1 uses the next one.
+	The alarm interrupts are only enabled in the NVIC of the core that owns them, so each core only samples itself, and the cores never
+	touch each other's state (see SAMPLING_PROFILER_CORE_COUNT in SamplingProfiler.cpp). Call InitializeSamplingProfiler() on each
+	core that should be profiled (e.g. from main() and from the function passed to multicore_launch_core1()).
+
+	Alarm 3 is used by the default alarm pool of the Pico SDK, so the profiler uses alarms 1 and 2 by default.
+*/
+#ifndef SAMPLING_PROFILER_FIRST_ALARM
+#define SAMPLING_PROFILER_FIRST_ALARM 1
+#endif
+
+#if SAMPLING_PROFILER_FIRST_ALARM + NUM_CORES > NUM_TIMERS
+#error SAMPLING_PROFILER_FIRST_ALARM leaves no alarm for the last core
+#endif
+
+volatile int g_SamplingProfilerRate = 100; //Samples/sec
+volatile int g_EnableSamplingProfiler = 0; //Will be set via the debugger interface when starting a profiling session
+
+/*
+	Other drivers reset g_SamplingProfilerRate to 0 after applying it. Here, both cores need to see the new value, so each one
+	remembers the last applied rate instead.
+*/
+static struct
+{
+	int AppliedRate;
+	unsigned Period; //Microseconds
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	SamplingPeriodGenerator PeriodGenerator;
+#endif
+} s_CoreTimers[NUM_CORES];
+
+static inline unsigned GetAlarmForCore(unsigned core)
+{
+	return SAMPLING_PROFILER_FIRST_ALARM + core;
+}
+
+static void UpdateProfilerTimerPeriod(unsigned core)
+{
+	int rate = g_SamplingProfilerRate;
+	if (rate <= 0 || rate == s_CoreTimers[core].AppliedRate)
+		return;
+
+	unsigned period = 1000000 / rate;
+	s_CoreTimers[core].Period = period ? period : 1;
+	s_CoreTimers[core].AppliedRate = rate;
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	//Different seeds keep the cores from sampling at the same moments.
+	SamplingPeriodGenerator_Init(&s_CoreTimers[core].PeriodGenerator, s_CoreTimers[core].Period, SAMPLING_PROFILER_PERIOD_JITTER, 0x2545F491 + core);
+#endif
+	g_SamplingProfilerMeanRate = 1000000 / s_CoreTimers[core].Period;
+}
+
+static inline unsigned GetNextPeriod(unsigned core)
+{
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	return SamplingPeriodGenerator_Next(&s_CoreTimers[core].PeriodGenerator);
+#else
+	return s_CoreTimers[core].Period;
+#endif
+}
+
+extern "C" {
+void SysprogsProfiler_DoHandleTimerIRQ(void *PC, void *SP, void *FP, void *LR)
+{
+	unsigned core = get_core_num();
+	unsigned alarm = GetAlarmForCore(core);
+	timer_hw->intr = 1u << alarm;
+
+	//Scheduling the next sample before taking this one keeps the rate independent from the time spent in SysprogsProfiler_ProcessSample().
+	UpdateProfilerTimerPeriod(core);
+	timer_hw->alarm[alarm] = timer_hw->timerawl + GetNextPeriod(core);
+
+	SysprogsProfiler_ProcessSample(PC, SP, FP, LR);
+}
+
+//The interrupted code may be using either stack (e.g. FreeRTOS threads use PSP), so the stack is selected based on EXC_RETURN.
+void __attribute__((naked)) SysprogsProfiler_AlarmIRQHandler()
+{
+	asm volatile("mov r0, lr\n"
+				 "movs r1, #4\n"
+				 "tst r0, r1\n"
+				 "beq 1f\n"
+				 "mrs r3, psp\n"
+				 "b 2f\n"
+				 "1:\n"
+				 "mov r3, sp\n"
+				 "2:\n"
+				 "ldr r0, [r3, #0x18]\n"
+				 "mov r1, r3\n"
+				 "add r1, #0x20\n"
+				 "mov r2, r7\n"
+				 "ldr r3, [r3, #0x14]\n"
+				 "push {lr}\n"
+				 "bl SysprogsProfiler_DoHandleTimerIRQ\n"
+				 "pop {r2}\n"
+				 "mov lr, r2\n"
+				 "bx lr\n");
+}
+}
+
+void InitializeSamplingProfiler()
+{
+	if (!g_EnableSamplingProfiler)
+		return;
+
+	unsigned core = get_core_num();
+	unsigned alarm = GetAlarmForCore(core);
+	unsigned irq = TIMER_IRQ_0 + alarm;
+
+	hardware_alarm_claim(alarm);
+	UpdateProfilerTimerPeriod(core);
+
+	//The vector table is shared between the cores, but the NVIC is not, so the interrupt only gets enabled for the calling core.
+	irq_set_exclusive_handler(irq, SysprogsProfiler_AlarmIRQHandler);
+	irq_set_priority(irq, PICO_HIGHEST_IRQ_PRIORITY);
+	hw_set_bits(&timer_hw->inte, 1u << alarm);
+	irq_set_enabled(irq, true);
+
+	timer_hw->alarm[alarm] = timer_hw->timerawl + GetNextPeriod(core);
+}
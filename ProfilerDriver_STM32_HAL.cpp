@@ -50,6 +50,7 @@
 
 #include "SysprogsProfiler.h"
 #include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
 
 #ifndef SAMPLING_PROFILER_TIMER_INSTANCE
 #define SAMPLING_PROFILER_TIMER_INSTANCE 2
@@ -68,12 +69,15 @@ static TIM_HandleTypeDef s_SamplingProfilerTimer = {
 volatile int g_SamplingProfilerRate = 100; //Samples/sec
 volatile int g_EnableSamplingProfiler = 0; //Will be set via the debugger interface when starting a profiling session
 
-static void UpdateProfilerTimerFrequency()
-{
-	if (g_SamplingProfilerRate == 0)
-		return;
-	SystemCoreClockUpdate();
+#if SAMPLING_PROFILER_PERIOD_JITTER
+static SamplingPeriodGenerator s_PeriodGenerator;
+#endif
+
+static unsigned s_TimerClock, s_CoreClockForTimerClock; //Cached, as SystemCoreClockUpdate() is too slow to be called from the timer ISR
 
+//Computes the timer clock from SystemCoreClock and the APB divider. Does not call SystemCoreClockUpdate().
+static unsigned ComputeTimerClock()
+{
 	unsigned timerClockDividerEncoded;
 	//Somewhat dirty trick to determine whether the timer belongs to APB1 or APB2 based on the definition of __TIMxxx_CLK_DISABLE()
 #if defined(RCC_CFGR_PPRE1) && defined(RCC_CFGR_PPRE2)
@@ -103,17 +107,42 @@ static void UpdateProfilerTimerFrequency()
 	else if (timerClockDividerEncoded == RCC_HCLK_DIV16)
 		timerClock /= 8;
 
-	CONCAT3(__TIM, SAMPLING_PROFILER_TIMER_INSTANCE, _CLK_ENABLE)
-	();
+	s_CoreClockForTimerClock = SystemCoreClock;
+	return timerClock;
+}
 
+//Also updates g_SamplingProfilerMeanRate and the jitter generator.
+static unsigned ComputeTimerPeriod(unsigned timerClock, unsigned *pPrescaler)
+{
 	unsigned period = timerClock / g_SamplingProfilerRate;
 	unsigned prescaler = 1;
-	while (period > 0xFFFF)
+	//The jittered periods must fit into the 16-bit counter as well.
+	while (period + period / 100 * SAMPLING_PROFILER_PERIOD_JITTER > 0xFFFF)
 	{
 		prescaler *= 2;
 		period /= 2;
 	}
 
+	*pPrescaler = prescaler;
+	g_SamplingProfilerMeanRate = timerClock / prescaler / (period + 1);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	SamplingPeriodGenerator_Init(&s_PeriodGenerator, period, SAMPLING_PROFILER_PERIOD_JITTER, 0x2545F491);
+#endif
+	return period;
+}
+
+static void InitializeProfilerTimer()
+{
+	if (g_SamplingProfilerRate == 0)
+		return;
+	SystemCoreClockUpdate();
+	s_TimerClock = ComputeTimerClock();
+
+	CONCAT3(__TIM, SAMPLING_PROFILER_TIMER_INSTANCE, _CLK_ENABLE)
+	();
+
+	unsigned prescaler, period = ComputeTimerPeriod(s_TimerClock, &prescaler);
+
 	s_SamplingProfilerTimer.Init.Prescaler = prescaler - 1;
 	s_SamplingProfilerTimer.Init.CounterMode = TIM_COUNTERMODE_UP;
 	s_SamplingProfilerTimer.Init.Period = period;
@@ -122,6 +151,31 @@ static void UpdateProfilerTimerFrequency()
 	s_SamplingProfilerTimer.Init.RepetitionCounter = 0;
 #endif
 	HAL_TIM_Base_Init(&s_SamplingProfilerTimer);
+
+	//Older HAL versions do not have Init.AutoReloadPreload, so the preload is enabled directly. See UpdateProfilerTimerFrequency().
+	s_SamplingProfilerTimer.Instance->CR1 |= TIM_CR1_ARPE;
+}
+
+/*
+	Called from the timer ISR when the rate changes (e.g. via g_SamplingProfilerAutoRate), so it only writes the PSC and ARR registers
+	instead of reinitializing the timer. Both registers are preloaded, so the new values take effect together at the next update event
+	and cannot end up below the current counter value. The timer clock is only recomputed if SystemCoreClock has changed.
+*/
+static void UpdateProfilerTimerFrequency()
+{
+	if (g_SamplingProfilerRate == 0)
+		return;
+
+	if (SystemCoreClock != s_CoreClockForTimerClock)
+		s_TimerClock = ComputeTimerClock();
+
+	unsigned prescaler, period = ComputeTimerPeriod(s_TimerClock, &prescaler);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	period = SamplingPeriodGenerator_Next(&s_PeriodGenerator);
+#endif
+
+	__HAL_TIM_SET_PRESCALER(&s_SamplingProfilerTimer, prescaler - 1);
+	__HAL_TIM_SET_AUTORELOAD(&s_SamplingProfilerTimer, period);
 }
 
 extern "C" {
@@ -132,6 +186,10 @@ void SysprogsProfiler_DoHandleTimerIRQ(void *PC, void *SP, void *FP, void *LR)
 		if (__HAL_TIM_GET_IT_SOURCE(&s_SamplingProfilerTimer, TIM_IT_UPDATE) != RESET)
 		{
 			__HAL_TIM_CLEAR_IT(&s_SamplingProfilerTimer, TIM_IT_UPDATE);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+			//ARR is preloaded, so the new period applies to the next cycle.
+			__HAL_TIM_SET_AUTORELOAD(&s_SamplingProfilerTimer, SamplingPeriodGenerator_Next(&s_PeriodGenerator));
+#endif
 			SysprogsProfiler_ProcessSample(PC, SP, FP, LR);
 			if (g_SamplingProfilerRate != 0)
 			{
@@ -175,7 +233,7 @@ void InitializeSamplingProfiler()
 	if (!g_EnableSamplingProfiler)
 		return;
 
-	UpdateProfilerTimerFrequency();
+	InitializeProfilerTimer();
 
 	HAL_TIM_Base_Start_IT(&s_SamplingProfilerTimer);
 	HAL_NVIC_SetPriority(CONCAT3(TIM, SAMPLING_PROFILER_TIMER_INSTANCE, _IRQn), 0, 0);
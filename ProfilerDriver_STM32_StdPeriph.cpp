@@ -37,6 +37,7 @@
 #include <misc.h>
 #include "SysprogsProfiler.h"
 #include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
 
 #ifndef SAMPLING_PROFILER_TIMER_INSTANCE
 #define SAMPLING_PROFILER_TIMER_INSTANCE 2
@@ -277,14 +278,15 @@
 volatile int g_SamplingProfilerRate = 100;	//Samples/sec
 volatile int g_EnableSamplingProfiler = 0;	//Will be set via the debugger interface when starting a profiling session
 
-static void UpdateProfilerTimerFrequency()
+#if SAMPLING_PROFILER_PERIOD_JITTER
+static SamplingPeriodGenerator s_PeriodGenerator;
+#endif
+
+static unsigned s_TimerClock, s_CoreClockForTimerClock;	//Cached, as SystemCoreClockUpdate() is too slow to be called from the timer ISR
+
+//Computes the timer clock from SystemCoreClock and the APB divider. Does not call SystemCoreClockUpdate().
+static unsigned ComputeTimerClock()
 {
-	if (g_SamplingProfilerRate == 0)
-		return;
-	SystemCoreClockUpdate();
-	
-	ENABLE_SAMPLING_PROFILER_TIMER();
-	
 	unsigned timerClockDividerEncoded;
 	//Somewhat dirty trick to determine whether the timer belongs to APB1 or APB2 based on the definition of __TIMxxx_CLK_DISABLE()
 #ifdef SAMPLING_PROFILER_TIMER_APB1
@@ -305,14 +307,41 @@ static void UpdateProfilerTimerFrequency()
 	else if (timerClockDividerEncoded == RCC_CFGR_PPRE1_DIV16)
 		timerClock /= 8;
 	
+	s_CoreClockForTimerClock = SystemCoreClock;
+	return timerClock;
+}
+
+//Also updates g_SamplingProfilerMeanRate and the jitter generator.
+static unsigned ComputeTimerPeriod(unsigned timerClock, unsigned *pPrescaler)
+{
 	unsigned period = timerClock / g_SamplingProfilerRate;
 	unsigned prescaler = 1;
-	while (period > 0xFFFF)
+	//The jittered periods must fit into the 16-bit counter as well.
+	while (period + period / 100 * SAMPLING_PROFILER_PERIOD_JITTER > 0xFFFF)
 	{
 		prescaler *= 2;
 		period /= 2;
 	}
 	
+	*pPrescaler = prescaler;
+	g_SamplingProfilerMeanRate = timerClock / (prescaler + 1) / (period + 1);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	SamplingPeriodGenerator_Init(&s_PeriodGenerator, period, SAMPLING_PROFILER_PERIOD_JITTER, 0x2545F491);
+#endif
+	return period;
+}
+
+static void InitializeProfilerTimer()
+{
+	if (g_SamplingProfilerRate == 0)
+		return;
+	SystemCoreClockUpdate();
+	
+	ENABLE_SAMPLING_PROFILER_TIMER();
+	
+	s_TimerClock = ComputeTimerClock();
+	unsigned prescaler, period = ComputeTimerPeriod(s_TimerClock, &prescaler);
+	
 	TIM_TimeBaseInitTypeDef timerInitStructure; 
 	timerInitStructure.TIM_Prescaler = prescaler;
 	timerInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
@@ -320,9 +349,32 @@ static void UpdateProfilerTimerFrequency()
 	timerInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
 	timerInitStructure.TIM_RepetitionCounter = 0;
 	TIM_TimeBaseInit(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), &timerInitStructure);
+	TIM_ARRPreloadConfig(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), ENABLE);	//See UpdateProfilerTimerFrequency()
 	TIM_Cmd(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), ENABLE);
 }
 
+/*
+	Called from the timer ISR when the rate changes (e.g. via g_SamplingProfilerAutoRate), so it only writes the PSC and ARR registers
+	instead of reinitializing the timer. Both registers are preloaded, so the new values take effect together at the next update event
+	and cannot end up below the current counter value. The timer clock is only recomputed if SystemCoreClock has changed.
+*/
+static void UpdateProfilerTimerFrequency()
+{
+	if (g_SamplingProfilerRate == 0)
+		return;
+	
+	if (SystemCoreClock != s_CoreClockForTimerClock)
+		s_TimerClock = ComputeTimerClock();
+	
+	unsigned prescaler, period = ComputeTimerPeriod(s_TimerClock, &prescaler);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+	period = SamplingPeriodGenerator_Next(&s_PeriodGenerator);
+#endif
+	
+	TIM_PrescalerConfig(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), prescaler, TIM_PSCReloadMode_Update);
+	TIM_SetAutoreload(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), period);
+}
+
 extern "C" 
 {
 	void SysprogsProfiler_DoHandleTimerIRQ(void *PC, void *SP, void *FP, void *LR)
@@ -330,6 +382,10 @@ extern "C"
 		if (TIM_GetITStatus(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), TIM_IT_Update) != RESET)
 		{
 			TIM_ClearITPendingBit(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), TIM_IT_Update);
+#if SAMPLING_PROFILER_PERIOD_JITTER
+			//ARR is preloaded, so the new period applies to the next cycle.
+			TIM_SetAutoreload(CONCAT2(TIM, SAMPLING_PROFILER_TIMER_INSTANCE), SamplingPeriodGenerator_Next(&s_PeriodGenerator));
+#endif
 			SysprogsProfiler_ProcessSample(PC, SP, FP, LR);
 			if (g_SamplingProfilerRate != 0)
 			{
@@ -362,7 +418,7 @@ void InitializeSamplingProfiler()
 	if (!g_EnableSamplingProfiler)
 		return;
 	
-	UpdateProfilerTimerFrequency();
+	InitializeProfilerTimer();
 
 	NVIC_InitTypeDef nvicStructure;
 	nvicStructure.NVIC_IRQChannel = CONCAT3(TIM, SAMPLING_PROFILER_TIMER_INSTANCE, _IRQn);
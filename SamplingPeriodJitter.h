@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+/*
+	If this option is set to a non-zero value, the platform drivers reload the sampling timer with a pseudo-random period after each sample.
+	The periods are uniformly distributed within +/- SAMPLING_PROFILER_PERIOD_JITTER percent of the period matching g_SamplingProfilerRate.
+	This prevents the samples from aliasing with periodic workloads (e.g. a 1 kHz control loop sampled at 1 kHz would otherwise always get
+	interrupted at the same phase, so its ISR would get either all samples or none). The mean rate stays the same and is reported to the
+	debugger via g_SamplingProfilerMeanRate.
+*/
+#ifndef SAMPLING_PROFILER_PERIOD_JITTER
+#define SAMPLING_PROFILER_PERIOD_JITTER 0
+#endif
+
+#if SAMPLING_PROFILER_PERIOD_JITTER < 0 || SAMPLING_PROFILER_PERIOD_JITTER >= 100
+#error SAMPLING_PROFILER_PERIOD_JITTER must be between 0 and 99
+#endif
+
+//Samples/sec actually produced by the platform driver (the requested rate rounded to the timer resolution), defined in SamplingProfiler.cpp.
+extern volatile int g_SamplingProfilerMeanRate;
+
+typedef struct
+{
+	unsigned MeanPeriod; //In timer ticks
+	unsigned Spread;	 //Maximum deviation from MeanPeriod
+	unsigned State;		 //xorshift32 state, must not be 0
+} SamplingPeriodGenerator;
+
+//Can be called again when the rate changes. The random sequence is only seeded once, so the generators of different cores should get different seeds.
+static inline void SamplingPeriodGenerator_Init(SamplingPeriodGenerator *pGenerator, unsigned meanPeriod, unsigned jitterPercent, unsigned seed)
+{
+	pGenerator->MeanPeriod = meanPeriod;
+	pGenerator->Spread = (unsigned)((uint64_t)meanPeriod * jitterPercent / 100);
+	if (!pGenerator->State)
+		pGenerator->State = seed ? seed : 1;
+}
+
+//Returns a period in [MeanPeriod - Spread, MeanPeriod + Spread]. The offset is derived from the upper bits of the xorshift output via
+//a multiplication instead of a modulo, so each value is (almost exactly) equally likely and the mean period is not biased.
+static inline unsigned SamplingPeriodGenerator_Next(SamplingPeriodGenerator *pGenerator)
+{
+	unsigned x = pGenerator->State;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pGenerator->State = x;
+
+	unsigned offset = (unsigned)(((uint64_t)x * (2 * pGenerator->Spread + 1)) >> 32);
+	return pGenerator->MeanPeriod - pGenerator->Spread + offset;
+}
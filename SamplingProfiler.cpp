@@ -1,4 +1,52 @@
 #include "SysprogsProfilerInterface.h"
+#include "SamplingPeriodJitter.h"
+#include "SamplingRateController.h"
+#include <stdint.h>
+
+/*
+	Setting this to a non-zero value enables the aggregation mode: instead of sending each sample, the profiler counts the hits of each distinct
+	stack in an open-addressed hash table occupying SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE bytes (per core), and periodically sends the
+	(stack, hit count) pairs via pdcAggregatedSamplingProfilerStream. The bandwidth then depends on the amount of distinct stacks rather than
+	on the sampling rate, allowing much higher rates.
+
+	The table is never resized. Each stack can only be placed into one of SAMPLING_PROFILER_AGGREGATION_MAX_PROBES slots following its hash.
+	If all of them are taken by other stacks, the one with the least hits is sent to the debugger and replaced. Stacks deeper than
+	SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH entries are truncated. Each slot takes 24 + 8 * SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH bytes
+	(or twice as much on 64-bit hosts), so the arena should hold at least SAMPLING_PROFILER_AGGREGATION_MAX_PROBES slots.
+*/
+#ifndef SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+#define SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE 0
+#endif
+
+#ifndef SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH
+#define SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH 16
+#endif
+
+#if SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE && SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH > 22
+#error The aggregated stack record size should fit into 1 byte (see kMaxAggregatedRecordSize), limiting SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH to 22.
+#endif
+
+#ifndef SAMPLING_PROFILER_AGGREGATION_MAX_PROBES
+#define SAMPLING_PROFILER_AGGREGATION_MAX_PROBES 8
+#endif
+
+//After this amount of samples, the table is sent to the debugger, SAMPLING_PROFILER_AGGREGATION_FLUSH_BATCH slots per sample.
+#ifndef SAMPLING_PROFILER_AGGREGATION_FLUSH_INTERVAL
+#define SAMPLING_PROFILER_AGGREGATION_FLUSH_INTERVAL 4096
+#endif
+
+#ifndef SAMPLING_PROFILER_AGGREGATION_FLUSH_BATCH
+#define SAMPLING_PROFILER_AGGREGATION_FLUSH_BATCH 2
+#endif
+
+//Can be used to place the arena into a specific memory region, e.g. __attribute__((section(".scratch_x"))).
+#ifndef SAMPLING_PROFILER_AGGREGATION_ARENA_ATTRIBUTES
+#define SAMPLING_PROFILER_AGGREGATION_ARENA_ATTRIBUTES
+#endif
+
+#if SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE && SYSPROGS_PROFILER_ZERO_COPY
+#error SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE cannot be used together with SYSPROGS_PROFILER_ZERO_COPY
+#endif
 
 #ifndef SAMPLING_PROFILER_COMPARE_FRAMES
 /*
@@ -7,10 +55,84 @@
 	that 2 frames were reused. This compresses the output even more, increasing the overall performance at some extra memory costs.
 	
 	Note that the the actual frame unwinding happens on the client side and from the sampling profiler's point of view a 'frame' is
-	any entry on the stack that looks like a code address or a saved frame pointer.
+	any entry on the stack that looks like a code address or a saved frame pointer (unless SAMPLING_PROFILER_UNWIND_TABLE_SIZE is used).
+
+	By default (1), the reused frames are found by decoding the previous sample while encoding the new one. Setting this to 2 keeps the
+	previous stack as a raw array of (slot, value) pairs instead (see RawStackEntry), and compares it with the new one from the bottom
+	of the stack upwards, stopping at the first difference. This avoids the decoding and only encodes the changed frames, so deep
+	stacks (e.g. recursion) take less ISR time, at the cost of 2 * MAX_ENTRIES_PER_STACK_SNAPSHOT * 8 bytes of RAM per core.
 */
+#if SYSPROGS_PROFILER_ZERO_COPY
+#define SAMPLING_PROFILER_COMPARE_FRAMES 0 //The previous sample is not kept when encoding directly into the semihosting buffer.
+#elif SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+#define SAMPLING_PROFILER_COMPARE_FRAMES 0 //Aggregated stacks are sent independently from each other.
+#else
 #define SAMPLING_PROFILER_COMPARE_FRAMES 1
 #endif
+#endif
+
+#if SYSPROGS_PROFILER_ZERO_COPY && SAMPLING_PROFILER_COMPARE_FRAMES
+#error SAMPLING_PROFILER_COMPARE_FRAMES cannot be used together with SYSPROGS_PROFILER_ZERO_COPY
+#endif
+
+#if SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE && SAMPLING_PROFILER_COMPARE_FRAMES
+#error SAMPLING_PROFILER_COMPARE_FRAMES cannot be used together with SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+#endif
+
+/*
+	On multi-core devices (e.g. RP2040), each core is sampled by its own timer interrupt. The samples are delta-encoded against the last sample
+	of the same core, so each core keeps its own copy of the state below and the cores never need to synchronize with each other.
+	The samples of each core reach the debugger via the buffers of that core (see FAST_SEMIHOSTING_CORE_COUNT), which tells the debugger
+	where they came from. If the debugger only supports one buffer, the samples taken on the other cores are discarded.
+*/
+#ifndef SAMPLING_PROFILER_CORE_COUNT
+#ifdef PROFILER_RP2040
+#define SAMPLING_PROFILER_CORE_COUNT 2
+#else
+#define SAMPLING_PROFILER_CORE_COUNT 1
+#endif
+#endif
+
+/*
+	Setting SAMPLING_PROFILER_THREAD_TAGS to 1 lets the debugger split the samples per RTOS thread (e.g. to show a flame graph per task).
+	Each thread reported via SysprogsProfiler_RTOSThreadSwitched() (see ProfilerRTOS_FreeRTOS.c and ProfilerRTOS_RTX.c) gets a compact
+	index, and a sample only carries it (see WriteThreadTag()) if it differs from the thread of the previous sample of the same core.
+	The first sample tagged with a newly assigned index also carries its thread table entry (handle and name), so the samples taken
+	between the thread switches cost nothing extra.
+
+	Index 0 stands for the code running before the first thread switch and for the threads that did not fit into SAMPLING_PROFILER_MAX_THREADS.
+	The indices of the deleted threads are reused. Thread tags are not supported in the aggregation mode (SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE).
+*/
+#ifndef SAMPLING_PROFILER_THREAD_TAGS
+#define SAMPLING_PROFILER_THREAD_TAGS 0
+#endif
+
+#ifndef SAMPLING_PROFILER_MAX_THREADS
+#define SAMPLING_PROFILER_MAX_THREADS 31
+#endif
+
+//Longer thread names are truncated in the thread table entries.
+#ifndef SAMPLING_PROFILER_THREAD_NAME_LENGTH
+#define SAMPLING_PROFILER_THREAD_NAME_LENGTH 16
+#endif
+
+#if SAMPLING_PROFILER_THREAD_TAGS && SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+#error SAMPLING_PROFILER_THREAD_TAGS cannot be used together with SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+#endif
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+extern "C" unsigned SysprogsHostSimulator_GetCoreID();
+#define SAMPLING_PROFILER_GET_CORE_ID() SysprogsHostSimulator_GetCoreID()
+#endif
+
+#ifndef SAMPLING_PROFILER_GET_CORE_ID
+#ifdef PROFILER_RP2040
+//SIO->CPUID
+#define SAMPLING_PROFILER_GET_CORE_ID() (*(volatile unsigned *)0xD0000000)
+#else
+#define SAMPLING_PROFILER_GET_CORE_ID() 0
+#endif
+#endif
 
 struct SnapshotSummary
 {
@@ -19,7 +141,7 @@ struct SnapshotSummary
 	void *PC;
 	void *LR;
 	void *RefPointA, *RefPointB;
-#if SAMPLING_PROFILER_COMPARE_FRAMES
+#if SAMPLING_PROFILER_COMPARE_FRAMES == 1
 	void *StartRefPointA, *StartRefPointB;
 #endif
 	int StackEntryCount;
@@ -29,25 +151,161 @@ struct SnapshotSummary
 #define MAX_STACK_FRAME_SIZE 256
 #define MAX_ENTRIES_PER_STACK_SNAPSHOT 128
 
+#if SAMPLING_PROFILER_COMPARE_FRAMES == 2
+struct RawStackEntry
+{
+	void **Slot;
+	void *Value;
+};
+#endif
+
 static struct FilteredStackSnapshot
 {
 #if SAMPLING_PROFILER_COMPARE_FRAMES
-	int LastUsedReportBuffer;
+	int LastUsedReportBuffer; //With SAMPLING_PROFILER_COMPARE_FRAMES == 2, selects the last reported RawStacks[] entry
 #endif
 	int LastUsedReportBufferSize;
 	SnapshotSummary LastReportedRegisterSummary;
+#if !SYSPROGS_PROFILER_ZERO_COPY && !SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
 	char ReportBufferA[MAX_STACK_SNAPSHOT_SIZE];
-#if SAMPLING_PROFILER_COMPARE_FRAMES
+#endif
+#if SAMPLING_PROFILER_COMPARE_FRAMES == 1
 	char ReportBufferB[MAX_STACK_SNAPSHOT_SIZE];
+#elif SAMPLING_PROFILER_COMPARE_FRAMES == 2
+	RawStackEntry RawStacks[2][MAX_ENTRIES_PER_STACK_SNAPSHOT]; //Top of the stack first
+	unsigned RawStackSavedFPMasks[2][(MAX_ENTRIES_PER_STACK_SNAPSHOT + 31) / 32];
+#endif
+	SamplingRateController RateController; //See CountSampleAndUpdateAutoRate()
+#if SAMPLING_PROFILER_THREAD_TAGS
+	volatile int CurrentThreadIndex; //Set by SysprogsProfiler_SamplingThreadSwitched()
+	int LastReportedThreadIndex;
+	unsigned ReportedThreadTableEntries[(SAMPLING_PROFILER_MAX_THREADS + 1 + 31) / 32]; //Cleared when the index is assigned to another thread
+#endif
+#if SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+	int SamplesSinceFlush;
+	int SlotsLeftToFlush; //0 if no flush is in progress
+#endif
+} s_FilteredStackSnapshots[SAMPLING_PROFILER_CORE_COUNT];
+
+#if SAMPLING_PROFILER_THREAD_TAGS
+//Shared by all cores, see SysprogsProfiler_SamplingThreadSwitched().
+static struct SamplingProfilerThread
+{
+	void *Thread; //0 for free entries
+	const char *Name;
+} s_SamplingProfilerThreads[SAMPLING_PROFILER_MAX_THREADS + 1]; //Entry 0 is never used
+#endif
+
+//Returns the state of the current core, or NULL if its samples cannot be reported.
+static inline FilteredStackSnapshot *GetCurrentCoreSnapshot()
+{
+#if SAMPLING_PROFILER_CORE_COUNT > 1
+	unsigned core = SAMPLING_PROFILER_GET_CORE_ID();
+	if (core)
+	{
+		if (core >= SAMPLING_PROFILER_CORE_COUNT || (int)core >= SysprogsProfiler_GetReportedCoreCount())
+			return 0;
+		return &s_FilteredStackSnapshots[core];
+	}
+#endif
+	return &s_FilteredStackSnapshots[0];
+}
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The samples are delta-encoded against the previously reported ones, so the tests that decode the samples need to start from a known state,
+//as if the target was restarted together with the debugger (see SimulatedDebugger::Reset()).
+extern "C" void SysprogsHostSimulator_ResetSamplingProfiler()
+{
+	for (int i = 0; i < SAMPLING_PROFILER_CORE_COUNT; i++)
+		s_FilteredStackSnapshots[i] = FilteredStackSnapshot();
+#if SAMPLING_PROFILER_THREAD_TAGS
+	for (int i = 0; i <= SAMPLING_PROFILER_MAX_THREADS; i++)
+		s_SamplingProfilerThreads[i] = SamplingProfilerThread();
+#endif
+}
+#endif
+
+
+/*
+	By default, the code and the stack are expected to occupy one range each (_stext.._etext and _sdata.._estack). If the firmware has more of them
+	(e.g. ITCM/CCM RAM, functions copied to RAM, or thread stacks in external SDRAM), set SYSPROGS_PROFILER_ADDRESS_REGIONS to 1 and list the
+	regions in the linker script, sorted by address:
+
+	.sysprogs_profiler_regions :
+	{
+		. = ALIGN(4);
+		__sysprogs_profiler_code_regions_start = .;
+		LONG(_sitcm_text) LONG(_eitcm_text)
+		LONG(_stext) LONG(_etext)
+		__sysprogs_profiler_code_regions_end = .;
+		__sysprogs_profiler_stack_regions_start = .;
+		LONG(_sdata) LONG(_estack)
+		LONG(_ssdram) LONG(_esdram)
+		__sysprogs_profiler_stack_regions_end = .;
+	} > FLASH
+
+	The regions are found via a binary search (see ProfilerAddressRegions.h). The stack region is only looked up once per sample,
+	so each scanned stack slot only costs one code region lookup.
+*/
+#ifndef SYSPROGS_PROFILER_ADDRESS_REGIONS
+#define SYSPROGS_PROFILER_ADDRESS_REGIONS 0
 #endif
-} s_FilteredStackSnapshot;
 
+#include "ProfilerAddressRegions.h"
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The host simulator defines the memory regions treated as the stack and the code (see SimulatedDebugger::SetSampledMemory()).
+extern "C" void *SysprogsHostSimulator_GetEndOfStack();
+#define SYSPROGS_PROFILER_END_OF_RAM SysprogsHostSimulator_GetEndOfStack()
+#if SYSPROGS_PROFILER_ADDRESS_REGIONS
+extern "C" const ProfilerAddressRegion *SysprogsHostSimulator_GetCodeRegions(unsigned *pCount);
+extern "C" const ProfilerAddressRegion *SysprogsHostSimulator_GetStackRegions(unsigned *pCount);
+#define SYSPROGS_PROFILER_GET_CODE_REGIONS(pCount) SysprogsHostSimulator_GetCodeRegions(pCount)
+#define SYSPROGS_PROFILER_GET_STACK_REGIONS(pCount) SysprogsHostSimulator_GetStackRegions(pCount)
+#else
+#define SYSPROGS_PROFILER_USE_CUSTOM_ADDRESS_VALIDATORS 1
+#endif
+#endif
 
 #ifndef SYSPROGS_PROFILER_END_OF_RAM
 extern void *_estack;
 #define SYSPROGS_PROFILER_END_OF_RAM (&_estack)
 #endif
 
+#if SYSPROGS_PROFILER_ADDRESS_REGIONS
+#ifndef SYSPROGS_PROFILER_GET_CODE_REGIONS
+extern "C" const ProfilerAddressRegion __sysprogs_profiler_code_regions_start[], __sysprogs_profiler_code_regions_end[];
+extern "C" const ProfilerAddressRegion __sysprogs_profiler_stack_regions_start[], __sysprogs_profiler_stack_regions_end[];
+#define SYSPROGS_PROFILER_GET_CODE_REGIONS(pCount) (*(pCount) = __sysprogs_profiler_code_regions_end - __sysprogs_profiler_code_regions_start, __sysprogs_profiler_code_regions_start)
+#define SYSPROGS_PROFILER_GET_STACK_REGIONS(pCount) (*(pCount) = __sysprogs_profiler_stack_regions_end - __sysprogs_profiler_stack_regions_start, __sysprogs_profiler_stack_regions_start)
+#endif
+
+static inline int IsValidCodeAddress(void *pAddr)
+{
+	unsigned count;
+	const ProfilerAddressRegion *pRegions = SYSPROGS_PROFILER_GET_CODE_REGIONS(&count);
+	return FindProfilerAddressRegion(pRegions, count, pAddr) != 0;
+}
+
+static inline const ProfilerAddressRegion *FindStackRegion(void **pStackSlot)
+{
+	unsigned count;
+	const ProfilerAddressRegion *pRegions = SYSPROGS_PROFILER_GET_STACK_REGIONS(&count);
+	return FindProfilerAddressRegion(pRegions, count, pStackSlot);
+}
+
+static inline int IsValidStackAddress(void **pStackSlot)
+{
+	return FindStackRegion(pStackSlot) != 0;
+}
+
+//Returns the end of the stack region containing SP, or SP itself if it does not point to the stack.
+static inline void **GetEndOfStackRegion(void **SP)
+{
+	const ProfilerAddressRegion *pRegion = FindStackRegion(SP);
+	return pRegion ? (void **)pRegion->End : SP;
+}
+#else
 #if defined(SYSPROGS_PROFILER_USE_CUSTOM_ADDRESS_VALIDATORS) && SYSPROGS_PROFILER_USE_CUSTOM_ADDRESS_VALIDATORS
 extern "C" {
 int IsValidCodeAddress(void *pAddr);
@@ -79,56 +337,757 @@ static inline int IsValidStackAddress(void **pStackSlot)
 }
 #endif
 
-static bool IsPotentialSavedFPSlot(void **pStackSlot)
+static inline void **GetEndOfStackRegion(void **SP)
+{
+	return IsValidStackAddress(SP) ? (void **)(SYSPROGS_PROFILER_END_OF_RAM) : SP;
+}
+#endif
+
+//pStackSlot is expected to be within the stack region ending at pEndOfStack.
+static inline bool IsPotentialSavedFPSlot(void **pStackSlot, void **pEndOfStack)
 {
-	if (!IsValidStackAddress(pStackSlot))
-		return false;
 	void **potentialFP = (void **)pStackSlot[0];
-	if (potentialFP >= (void *)(SYSPROGS_PROFILER_END_OF_RAM) || potentialFP <= pStackSlot)
+	return potentialFP > pStackSlot && potentialFP < pEndOfStack;
+}
+
+/*
+	By default, each sample reports every stack slot that looks like a return address or a saved FP, and the debugger reconstructs the call
+	stack from them. This scans up to MAX_STACK_FRAME_SIZE bytes past each entry and reports many false frames (e.g. stale return addresses
+	or function pointers in local variables).
+
+	Setting SAMPLING_PROFILER_UNWIND_TABLE_SIZE to a non-zero value reserves room for an unwind table with that many entries (8 bytes each).
+	Once the debugger fills the table and sets g_SamplingProfilerUnwindTableEntries, the profiler follows the actual frames and reports only
+	the slots holding the return addresses. The wire format stays the same, so the samples are decoded as before.
+	The table describes the frames after the function prologues, so the samples taken in a prologue or an epilogue may end early.
+	If the interrupted function is not covered by the table (e.g. it is written in assembly), the stack is scanned as usual.
+*/
+#ifndef SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+#define SAMPLING_PROFILER_UNWIND_TABLE_SIZE 0
+#endif
+
+#if SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+extern "C" {
+SamplingProfilerUnwindEntry g_SamplingProfilerUnwindTable[SAMPLING_PROFILER_UNWIND_TABLE_SIZE];
+volatile int g_SamplingProfilerUnwindTableEntries; //Set by the debugger once it fills the table
+}
+
+//Returns the entry covering the specified address, or NULL if the address precedes the first entry.
+static inline const SamplingProfilerUnwindEntry *FindUnwindEntry(unsigned address, int entryCount)
+{
+	int first = 0, last = entryCount;
+	while (first < last)
+	{
+		int middle = (first + last) / 2;
+		if (g_SamplingProfilerUnwindTable[middle].FunctionStart <= address)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return first ? &g_SamplingProfilerUnwindTable[first - 1] : 0;
+}
+#endif
+
+//Enumerates the stack slots reported with each sample (see SAMPLING_PROFILER_UNWIND_TABLE_SIZE).
+struct StackWalker
+{
+	void **SP, **EndOfStack;
+	void **NextSlot, **LastReportedSlot;
+#if SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+	bool Unwinding;
+	bool FirstFrame;
+	void *PC, *FP, *LR;
+#endif
+};
+
+static inline void StartStackWalk(StackWalker *pWalker, void *PC, void *SP, void *FP, void *LR)
+{
+	pWalker->SP = pWalker->NextSlot = pWalker->LastReportedSlot = (void **)SP;
+	pWalker->EndOfStack = GetEndOfStackRegion((void **)SP);
+#if SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+	pWalker->Unwinding = g_SamplingProfilerUnwindTableEntries > 0;
+	pWalker->FirstFrame = true;
+	pWalker->PC = PC;
+	pWalker->FP = FP;
+	pWalker->LR = LR;
+#else
+	(void)PC;
+	(void)FP;
+	(void)LR;
+#endif
+}
+
+#if SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+static bool UnwindToNextReturnAddress(StackWalker *pWalker, void ***pSlot)
+{
+	int entryCount = g_SamplingProfilerUnwindTableEntries;
+	if (entryCount > SAMPLING_PROFILER_UNWIND_TABLE_SIZE)
 		return false;
 
-	return true;
+	for (;;)
+	{
+		//Return addresses point past the call instruction, so they are looked up via the call instruction itself (the call may be the last one in the function).
+		unsigned address = (unsigned)(uintptr_t)pWalker->PC & ~1U;
+		if (!pWalker->FirstFrame)
+			address -= 2;
+
+		const SamplingProfilerUnwindEntry *pEntry = FindUnwindEntry(address, entryCount);
+		if (!pEntry || pEntry->FrameSize == kUnwindNotPossible || (!pEntry->ReturnAddressSlot && !pWalker->FirstFrame))
+			return false;
+
+		void **base = (void **)((pEntry->FrameSize & kUnwindFrameBasedOnFP) ? pWalker->FP : pWalker->SP);
+		void **callerSP = base + (pEntry->FrameSize & ~kUnwindFrameBasedOnFP);
+		if (callerSP < pWalker->SP || (callerSP == pWalker->SP && !pWalker->FirstFrame))
+			return false;
+
+		void **returnAddressSlot = pEntry->ReturnAddressSlot ? callerSP - pEntry->ReturnAddressSlot : 0;
+		void **savedFPSlot = pEntry->SavedFPSlot ? callerSP - pEntry->SavedFPSlot : 0;
+		if ((returnAddressSlot && !IsValidStackAddress(returnAddressSlot)) || (savedFPSlot && !IsValidStackAddress(savedFPSlot)))
+			return false;
+
+		void *returnAddress = returnAddressSlot ? *returnAddressSlot : pWalker->LR;
+		if (!IsValidCodeAddress(returnAddress))
+			return false;
+
+		pWalker->FirstFrame = false;
+		pWalker->SP = callerSP;
+		pWalker->PC = returnAddress;
+		if (savedFPSlot)
+			pWalker->FP = *savedFPSlot;
+
+		//The return address of a leaf function is still in LR, which is already a part of the sample.
+		if (returnAddressSlot)
+		{
+			*pSlot = returnAddressSlot;
+			return true;
+		}
+	}
+}
+#endif
+
+//Returns the next stack slot to report. pIsSavedFP is set if the slot looks like a saved FP rather than a return address.
+static inline bool GetNextStackEntry(StackWalker *pWalker, void ***pSlot, bool *pIsSavedFP)
+{
+#if SAMPLING_PROFILER_UNWIND_TABLE_SIZE
+	if (pWalker->Unwinding)
+	{
+		*pIsSavedFP = false;
+		if (UnwindToNextReturnAddress(pWalker, pSlot))
+			return true;
+
+		//Nothing is known about the interrupted function, so the stack is scanned instead.
+		if (!pWalker->FirstFrame)
+			return false;
+		pWalker->Unwinding = false;
+	}
+#endif
+
+	//Every slot below EndOfStack is known to be a valid stack address, so only the slot contents need to be checked.
+	for (void **thisSP = pWalker->NextSlot; thisSP < pWalker->EndOfStack && ((char *)thisSP - (char *)pWalker->LastReportedSlot) < MAX_STACK_FRAME_SIZE; thisSP++)
+	{
+		if (IsPotentialSavedFPSlot(thisSP, pWalker->EndOfStack))
+			*pIsSavedFP = true;
+		else if (IsValidCodeAddress(*thisSP))
+			*pIsSavedFP = false;
+		else
+			continue;
+
+		pWalker->NextSlot = thisSP + 1;
+		pWalker->LastReportedSlot = *pSlot = thisSP;
+		return true;
+	}
+
+	return false;
 }
 
+//The drop ratio is reported per this amount of samples. It is also the update interval if the sampling rate is unknown.
 #define SAMPLES_PER_AUTORATE_CYCLE 1024
-#define SAMPLING_PROFILER_COMM_BUFFER_USAGE_EXP 4
 
 volatile int g_PauseSamplingProfiler;
 volatile int g_SamplingProfilerDroppedPacketRatio; // x SAMPLES_PER_AUTORATE_CYCLE = 1024
+volatile int g_SamplingProfilerBufferUsage;		   // x SAMPLES_PER_AUTORATE_CYCLE = 1024, average during the last update period
 extern volatile int g_SamplingProfilerRate;
-volatile int g_SamplingProfilerAutoRate; //0 if disabled, set to non-0 to set the initial autorate
+volatile int g_SamplingProfilerAutoRate; //0 if disabled, set to non-0 to set the initial autorate. Contains the current rate afterwards.
+volatile int g_SamplingProfilerMeanRate; //Set by the platform driver, see SamplingPeriodJitter.h
+volatile int g_SamplingProfilerPeriodJitter = SAMPLING_PROFILER_PERIOD_JITTER; //Lets the debugger know whether the periods are randomized
+volatile int g_SamplingProfilerThreadTags = SAMPLING_PROFILER_THREAD_TAGS;	 //Lets the debugger know whether the samples can contain thread tags
 
 #include "SmallNumberCoder.h"
 
+//Must be called once per sample after trying to send it. Adjusts the sampling rate based on the buffer usage and the amount of dropped
+//samples (see SamplingRateController.h). Each core runs its own controller, as it uses its own buffers.
+static void CountSampleAndUpdateAutoRate(FilteredStackSnapshot *pSnapshot, bool delivered)
+{
+	SamplingRateController *pController = &pSnapshot->RateController;
+	if (delivered)
+		SamplingRateController_CountSample(pController, SysprogsProfiler_GetBufferAvailability(kSamplingRateControllerAvailabilityExp));
+	else
+		SamplingRateController_CountDroppedSample(pController);
+
+	int rate = g_SamplingProfilerAutoRate ? g_SamplingProfilerAutoRate : g_SamplingProfilerMeanRate;
+	if (pController->Samples < (rate ? SamplingRateController_GetSamplesPerUpdate(pController, rate) : SAMPLES_PER_AUTORATE_CYCLE))
+		return;
+
+	g_SamplingProfilerDroppedPacketRatio = pController->Dropped * SAMPLES_PER_AUTORATE_CYCLE / pController->Samples;
+	int occupancy = SamplingRateController_GetOccupancy(pController);
+	g_SamplingProfilerBufferUsage = occupancy < 0 ? -1 : occupancy * SAMPLES_PER_AUTORATE_CYCLE / kSamplingRateControllerFullBuffer;
+
+	int newRate = SamplingRateController_Update(pController, rate);
+	if (g_SamplingProfilerAutoRate && newRate != rate)
+	{
+		g_SamplingProfilerAutoRate = newRate;
+		g_SamplingProfilerRate = newRate;
+	}
+}
+
+#if SAMPLING_PROFILER_THREAD_TAGS
+
+enum
+{
+	kThreadTagMarker = 0x0E, //Never produced by SmallNumberCoder::WritePackedUIntPair()
+	kMaxThreadTagSize = 1 + 5 + 5 + 1 + SAMPLING_PROFILER_THREAD_NAME_LENGTH,
+};
+
+//Called from the RTOS context switch code, which can be interrupted by the sampling ISR. Each entry is filled before its index gets used.
+extern "C" void SysprogsProfiler_SamplingThreadSwitched(void *newThread, const char *pThreadName)
+{
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return;
+
+	int freeIndex = 0;
+	for (int i = 1; i <= SAMPLING_PROFILER_MAX_THREADS && newThread; i++)
+	{
+		if (s_SamplingProfilerThreads[i].Thread == newThread)
+		{
+			pSnapshot->CurrentThreadIndex = i;
+			return;
+		}
+		if (!freeIndex && !s_SamplingProfilerThreads[i].Thread)
+			freeIndex = i;
+	}
+
+	if (freeIndex)
+	{
+		s_SamplingProfilerThreads[freeIndex].Name = pThreadName;
+		s_SamplingProfilerThreads[freeIndex].Thread = newThread;
+		for (int i = 0; i < SAMPLING_PROFILER_CORE_COUNT; i++)
+			s_FilteredStackSnapshots[i].ReportedThreadTableEntries[freeIndex / 32] &= ~(1U << (freeIndex % 32));
+	}
+
+	pSnapshot->CurrentThreadIndex = freeIndex;
+}
+
+extern "C" void SysprogsProfiler_SamplingThreadDeleted(void *thread)
+{
+	for (int i = 1; i <= SAMPLING_PROFILER_MAX_THREADS; i++)
+	{
+		if (s_SamplingProfilerThreads[i].Thread == thread)
+			s_SamplingProfilerThreads[i].Thread = 0;
+	}
+}
+
+/*
+	If the thread changed since the last reported sample of this core, the stack entry count of the sample is preceded by a thread tag:
+		[kThreadTagMarker: 1 byte]
+		[thread index]				WriteTinySIntWithFlag(), the flag is set if the thread table entry follows
+		[thread handle]				WriteSmallMostLikelyEvenSInt()
+		[name length: 1 byte]		Up to SAMPLING_PROFILER_THREAD_NAME_LENGTH
+		[name]
+	The thread table entry is only sent once per index and core, unless the index is assigned to another thread.
+	Returns false if the tag does not fit into the buffer. *pThreadIndex receives the value for ThreadTagDelivered().
+*/
+static inline bool WriteThreadTag(FilteredStackSnapshot *pSnapshot, SmallNumberCoder &coder, int *pThreadIndex)
+{
+	int index = *pThreadIndex = pSnapshot->CurrentThreadIndex;
+	bool sendTableEntry = index && !(pSnapshot->ReportedThreadTableEntries[index / 32] & (1U << (index % 32)));
+	if (index == pSnapshot->LastReportedThreadIndex && !sendTableEntry)
+		return true;
+
+	unsigned char marker = kThreadTagMarker;
+	if (!coder.WriteBytes(&marker, 1) || !coder.WriteTinySIntWithFlag(index, sendTableEntry))
+		return false;
+	if (!sendTableEntry)
+		return true;
+
+	const SamplingProfilerThread &thread = s_SamplingProfilerThreads[index];
+	unsigned char nameLength = 0;
+	while (thread.Name && nameLength < SAMPLING_PROFILER_THREAD_NAME_LENGTH && thread.Name[nameLength])
+		nameLength++;
+
+	return coder.WriteSmallMostLikelyEvenSInt((int)(uintptr_t)thread.Thread) && coder.WriteBytes(&nameLength, 1) && coder.WriteBytes(thread.Name, nameLength);
+}
+
+static inline void ThreadTagDelivered(FilteredStackSnapshot *pSnapshot, int threadIndex)
+{
+	pSnapshot->LastReportedThreadIndex = threadIndex;
+	pSnapshot->ReportedThreadTableEntries[threadIndex / 32] |= 1U << (threadIndex % 32);
+}
+
+#else
+
+extern "C" void __attribute__((weak)) SysprogsProfiler_SamplingThreadSwitched(void *newThread, const char *pThreadName)
+{
+	(void)newThread;
+	(void)pThreadName;
+}
+
+extern "C" void __attribute__((weak)) SysprogsProfiler_SamplingThreadDeleted(void *thread)
+{
+	(void)thread;
+}
+
+#endif
+
+#if SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
+
+/*
+	Each pdcAggregatedSamplingProfilerStream record describes one stack and does not depend on the previous records:
+		[size: 1 byte]				Amount of bytes following this field
+		[hit count]					WriteTinySIntWithFlag(), the flag is set if FP == SP
+		[SP / 4]					WriteTinySIntWithFlag(), the flag is reserved (0)
+		[(FP - SP) / 4]				WriteTinySIntWithFlag(), only present if FP != SP
+		[PC], [LR]					WriteSmallMostLikelyEvenSInt()
+		[stack entry count]			WriteTinySIntWithFlag(), the flag is reserved (0)
+		[stack entries...]			WriteStackEntry(), starting with SP and both reference points set to 0
+*/
+
+struct AggregatedStackEntry
+{
+	void *Value;
+	unsigned short Index; //Offset from SP in words
+	unsigned short IsSavedFP;
+};
+
+struct AggregatedStack
+{
+	unsigned Hash;
+	unsigned Count; //0 for free slots
+	void *SP, *FP, *PC, *LR;
+	int EntryCount;
+	AggregatedStackEntry Entries[SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH];
+};
+
+enum
+{
+	kAggregatedStackSlots = SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE / sizeof(AggregatedStack),
+	kMaxAggregatedRecordSize = 1 + 5 * 4 + 5 * 2 + SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH * (5 + 5),
+};
+
+static_assert(kAggregatedStackSlots >= SAMPLING_PROFILER_AGGREGATION_MAX_PROBES, "SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE should hold at least SAMPLING_PROFILER_AGGREGATION_MAX_PROBES slots");
+
+static AggregatedStack s_AggregatedStacks[SAMPLING_PROFILER_CORE_COUNT][kAggregatedStackSlots] SAMPLING_PROFILER_AGGREGATION_ARENA_ATTRIBUTES;
+
+static inline unsigned HashWord(unsigned hash, const void *value)
+{
+	return (hash ^ (unsigned)(uintptr_t)value) * 0x01000193; //FNV-1a, one word at a time
+}
+
+static inline bool StacksMatch(const AggregatedStack &stack, const AggregatedStack &sample)
+{
+	if (stack.Hash != sample.Hash || stack.SP != sample.SP || stack.FP != sample.FP || stack.PC != sample.PC || stack.LR != sample.LR || stack.EntryCount != sample.EntryCount)
+		return false;
+
+	for (int i = 0; i < sample.EntryCount; i++)
+	{
+		if (stack.Entries[i].Value != sample.Entries[i].Value || stack.Entries[i].Index != sample.Entries[i].Index)
+			return false;
+	}
+
+	return true;
+}
+
+//Sends the stack to the debugger and frees the slot. Returns false if the buffer is full, leaving the slot unchanged.
+static bool SendAggregatedStack(AggregatedStack &stack)
+{
+	char record[kMaxAggregatedRecordSize];
+	SmallNumberCoder coder(record + 1, sizeof(record) - 1, 0, 0);
+
+	bool ok = coder.WriteTinySIntWithFlag(stack.Count, stack.FP == stack.SP);
+	ok = ok && coder.WriteTinySIntWithFlag((int)((uintptr_t)stack.SP / 4), false);
+	if (stack.FP != stack.SP)
+		ok = ok && coder.WriteTinySIntWithFlag((int)(((char *)stack.FP - (char *)stack.SP) / 4), false);
+	ok = ok && coder.WriteSmallMostLikelyEvenSInt((int)(uintptr_t)stack.PC);
+	ok = ok && coder.WriteSmallMostLikelyEvenSInt((int)(uintptr_t)stack.LR);
+	ok = ok && coder.WriteTinySIntWithFlag(stack.EntryCount, false);
+
+	for (int i = 0, lastIndex = 0; ok && i < stack.EntryCount; lastIndex = stack.Entries[i++].Index)
+		ok = coder.WriteStackEntry(stack.Entries[i].Index - lastIndex, stack.Entries[i].Value, stack.Entries[i].IsSavedFP != 0);
+
+	record[0] = (char)coder.GetOffset();
+	if (!ok || !SysprogsProfiler_WriteData(pdcAggregatedSamplingProfilerStream, record, coder.GetOffset() + 1, 0, 0))
+		return false;
+
+	stack.Count = 0;
+	return true;
+}
+
+//Sends up to maxSlots used slots of the table, continuing the flush started by the previous calls. Returns true once the whole table has been sent.
+static bool ContinueFlushingAggregatedStacks(FilteredStackSnapshot *pSnapshot, AggregatedStack *pTable, int maxSlots)
+{
+	while (pSnapshot->SlotsLeftToFlush)
+	{
+		AggregatedStack &stack = pTable[kAggregatedStackSlots - pSnapshot->SlotsLeftToFlush];
+		if (stack.Count)
+		{
+			if (!maxSlots-- || !SendAggregatedStack(stack))
+				return false; //The buffer is full, or the batch is done. The next sample will continue.
+		}
+
+		pSnapshot->SlotsLeftToFlush--;
+	}
+
+	return true;
+}
+
+extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, void *LR)
+{
+	if (g_PauseSamplingProfiler)
+		return;
+
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return;
+
+	AggregatedStack *pTable = s_AggregatedStacks[pSnapshot - s_FilteredStackSnapshots];
+
+	//1. Collect the stack entries and compute the hash. The sample lives on the stack of the ISR, so nothing gets allocated here.
+	AggregatedStack sample;
+	sample.SP = SP;
+	sample.FP = FP;
+	sample.PC = PC;
+	sample.LR = LR;
+	sample.EntryCount = 0;
+
+	unsigned hash = HashWord(HashWord(HashWord(HashWord(0x811C9DC5, SP), FP), PC), LR);
+	StackWalker walker;
+	StartStackWalk(&walker, PC, SP, FP, LR);
+	void **thisSP;
+	bool isSavedFP;
+	while (GetNextStackEntry(&walker, &thisSP, &isSavedFP))
+	{
+		AggregatedStackEntry &entry = sample.Entries[sample.EntryCount];
+		entry.Value = *thisSP;
+		entry.Index = (unsigned short)(thisSP - (void **)SP);
+		entry.IsSavedFP = isSavedFP;
+		hash = HashWord(HashWord(hash, entry.Value), (void *)(uintptr_t)entry.Index);
+
+		if (++sample.EntryCount >= SAMPLING_PROFILER_AGGREGATION_MAX_DEPTH)
+			break;
+	}
+
+	sample.Hash = hash;
+
+	//2. Find the matching slot, or a free one. All probed slots are checked, as the slots freed by the flushing do not end the probe sequence.
+	AggregatedStack *pMatchingSlot = 0, *pFreeSlot = 0, *pLeastUsedSlot = 0;
+	for (int i = 0; i < SAMPLING_PROFILER_AGGREGATION_MAX_PROBES; i++)
+	{
+		AggregatedStack &slot = pTable[(hash + i) % kAggregatedStackSlots];
+		if (!slot.Count)
+		{
+			if (!pFreeSlot)
+				pFreeSlot = &slot;
+		}
+		else if (StacksMatch(slot, sample))
+		{
+			pMatchingSlot = &slot;
+			break;
+		}
+		else if (!pLeastUsedSlot || slot.Count < pLeastUsedSlot->Count)
+			pLeastUsedSlot = &slot;
+	}
+
+	if (pMatchingSlot)
+		pMatchingSlot->Count++;
+	else
+	{
+		//3. Bounded eviction: the least used stack among the probed slots is sent to make room for the new one.
+		if (!pFreeSlot)
+		{
+			if (!SendAggregatedStack(*pLeastUsedSlot))
+			{
+				CountSampleAndUpdateAutoRate(pSnapshot, false);
+				return;
+			}
+			pFreeSlot = pLeastUsedSlot;
+		}
+
+		*pFreeSlot = sample;
+		pFreeSlot->Count = 1;
+	}
+
+	//4. Periodically send the whole table, a few slots per sample, so that the ISR run time stays bounded.
+	if (!pSnapshot->SlotsLeftToFlush && ++pSnapshot->SamplesSinceFlush >= SAMPLING_PROFILER_AGGREGATION_FLUSH_INTERVAL)
+	{
+		pSnapshot->SamplesSinceFlush = 0;
+		pSnapshot->SlotsLeftToFlush = kAggregatedStackSlots;
+	}
+
+	if (pSnapshot->SlotsLeftToFlush)
+		ContinueFlushingAggregatedStacks(pSnapshot, pTable, SAMPLING_PROFILER_AGGREGATION_FLUSH_BATCH);
+
+	CountSampleAndUpdateAutoRate(pSnapshot, true);
+}
+
+extern "C" int SysprogsProfiler_FlushAggregatedSamples()
+{
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return 1;
+
+	pSnapshot->SlotsLeftToFlush = kAggregatedStackSlots;
+	pSnapshot->SamplesSinceFlush = 0;
+	return ContinueFlushingAggregatedStacks(pSnapshot, s_AggregatedStacks[pSnapshot - s_FilteredStackSnapshots], kAggregatedStackSlots);
+}
+
+#elif SYSPROGS_PROFILER_ZERO_COPY
+#include "FastSemihosting.h"
+
+enum
+{
+	//SP/FP deltas, PC/LR deltas and the fixed-size entry count
+#if SAMPLING_PROFILER_THREAD_TAGS
+	kMaxSampleHeaderSize = 5 + 4 + 5 + 5 + kMaxThreadTagSize + 3,
+#else
+	kMaxSampleHeaderSize = 5 + 4 + 5 + 5 + 3,
+#endif
+};
+
+/*
+	Encodes the sample directly into the fast semihosting buffer. As the header precedes the stack entries, the entry count
+	is written as a fixed-size placeholder and is overwritten once the stack has been scanned.
+*/
 extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, void *LR)
 {
-	static int s_PacketsDropped, s_PacketsInCycle, s_AvailabilitySum;
 	if (g_PauseSamplingProfiler)
 		return;
 
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return;
+
+	FastSemihostingReservation reservation;
+	if (!ReserveVariableSizeFastSemihostingBuffer(pdcSamplingProfilerStream, kMaxSampleHeaderSize, kMaxSampleHeaderSize + MAX_STACK_SNAPSHOT_SIZE, &reservation))
+	{
+		CountSampleAndUpdateAutoRate(pSnapshot, false);
+		return;
+	}
+
+	SmallNumberCoder coder(reservation.pFirstSegment,
+						   reservation.FirstSegmentSize,
+						   reservation.pSecondSegment,
+						   reservation.SecondSegmentSize,
+						   pSnapshot->LastReportedRegisterSummary.RefPointA,
+						   pSnapshot->LastReportedRegisterSummary.RefPointB);
+
+	//1. Compress register values
+	bool ok = coder.WriteTinySIntWithFlag((((char *)SP - (char *)pSnapshot->LastReportedRegisterSummary.SP) / 4), FP == SP);
+	if (ok && FP != SP)
+		ok = coder.WriteTinySInt((((char *)FP - (char *)SP) / 4));
+
+	ok = ok && coder.WriteSmallMostLikelyEvenSInt(((char *)PC - (char *)pSnapshot->LastReportedRegisterSummary.PC));
+	ok = ok && coder.WriteSmallMostLikelyEvenSInt(((char *)LR - (char *)pSnapshot->LastReportedRegisterSummary.LR));
+
+#if SAMPLING_PROFILER_THREAD_TAGS
+	int threadIndex = 0;
+	ok = ok && WriteThreadTag(pSnapshot, coder, &threadIndex);
+#endif
+
+	//2. Reserve space for the stack entry count
+	int entryCountOffset = coder.GetOffset();
+	ok = ok && coder.WriteFixedSizeUIntPair(0, 0);
+
+	//3. Compress stack entries
+	void **lastSavedEntry = (void **)SP, **thisSP;
+	unsigned entries = 0;
+	bool writeRefPointB;
+	StackWalker walker;
+	StartStackWalk(&walker, PC, SP, FP, LR);
+	while (ok && GetNextStackEntry(&walker, &thisSP, &writeRefPointB))
+	{
+		int indexDelta = thisSP - lastSavedEntry;
+		lastSavedEntry = thisSP;
+
+		ok = coder.WriteStackEntry(indexDelta, *thisSP, writeRefPointB);
+		if (++entries >= MAX_ENTRIES_PER_STACK_SNAPSHOT)
+			break;
+	}
+
+	if (!ok)
+	{
+		//The reservation was too small for the sample, so it is dropped just like when no space could be reserved at all.
+		CommitVariableSizeFastSemihostingBuffer(&reservation, 0);
+		CountSampleAndUpdateAutoRate(pSnapshot, false);
+		return;
+	}
+
+	int endOfSample = coder.GetOffset();
+	coder.SetOffset(entryCountOffset);
+	coder.WriteFixedSizeUIntPair(0, entries);
+
+	CommitVariableSizeFastSemihostingBuffer(&reservation, endOfSample);
+	CountSampleAndUpdateAutoRate(pSnapshot, true);
+#if SAMPLING_PROFILER_THREAD_TAGS
+	ThreadTagDelivered(pSnapshot, threadIndex);
+#endif
+
+	pSnapshot->LastReportedRegisterSummary.FP = FP;
+	pSnapshot->LastReportedRegisterSummary.SP = SP;
+	pSnapshot->LastReportedRegisterSummary.PC = PC;
+	pSnapshot->LastReportedRegisterSummary.LR = LR;
+	coder.ExportState(&pSnapshot->LastReportedRegisterSummary.RefPointA, &pSnapshot->LastReportedRegisterSummary.RefPointB);
+	pSnapshot->LastReportedRegisterSummary.StackEntryCount = entries;
+}
+
+#elif SAMPLING_PROFILER_COMPARE_FRAMES == 2
+
+/*
+	Produces the same stream as the regular mode below, but the reused frames are found by comparing the raw stack entries
+	of the new sample with the ones of the last reported sample, starting from the bottom of the stack.
+*/
+extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, void *LR)
+{
+	if (g_PauseSamplingProfiler)
+		return;
+
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return;
+
+	//1. Collect stack entries
+	int current = !pSnapshot->LastUsedReportBuffer;
+	RawStackEntry *pStack = pSnapshot->RawStacks[current];
+	unsigned *pSavedFPMask = pSnapshot->RawStackSavedFPMasks[current];
+	int entries = 0;
+	void **thisSP;
+	bool isSavedFP;
+	StackWalker walker;
+	StartStackWalk(&walker, PC, SP, FP, LR);
+
+	for (int i = 0; i < (MAX_ENTRIES_PER_STACK_SNAPSHOT + 31) / 32; i++)
+		pSavedFPMask[i] = 0;
+
+	while (entries < MAX_ENTRIES_PER_STACK_SNAPSHOT && GetNextStackEntry(&walker, &thisSP, &isSavedFP))
+	{
+		pStack[entries].Slot = thisSP;
+		pStack[entries].Value = *thisSP;
+		if (isSavedFP)
+			pSavedFPMask[entries / 32] |= 1U << (entries % 32);
+		entries++;
+	}
+
+	//2. Find the frames shared with the last reported sample. The debugger reuses the last matchingEntries entries of that sample.
+	const RawStackEntry *pLastStack = pSnapshot->RawStacks[!current];
+	int lastEntries = pSnapshot->LastReportedRegisterSummary.StackEntryCount;
+	int matchingEntries = 0;
+	while (matchingEntries < entries && matchingEntries < lastEntries)
+	{
+		const RawStackEntry &entry = pStack[entries - 1 - matchingEntries], &lastEntry = pLastStack[lastEntries - 1 - matchingEntries];
+		if (entry.Slot != lastEntry.Slot || entry.Value != lastEntry.Value)
+			break;
+		matchingEntries++;
+	}
+
+	//3. Compress the changed stack entries
+	SmallNumberCoder coder(pSnapshot->ReportBufferA,
+						   MAX_STACK_SNAPSHOT_SIZE,
+						   pSnapshot->LastReportedRegisterSummary.RefPointA,
+						   pSnapshot->LastReportedRegisterSummary.RefPointB);
+
 	void **lastSavedEntry = (void **)SP;
+	for (int i = 0; i < entries - matchingEntries; i++)
+	{
+		if (!coder.WriteStackEntry(pStack[i].Slot - lastSavedEntry, pStack[i].Value, (pSavedFPMask[i / 32] >> (i % 32)) & 1))
+			return;
+		lastSavedEntry = pStack[i].Slot;
+	}
+
+	int endOfStackEntries = coder.GetOffset();
+
+	//4. Compress register values
+	if (!coder.WriteTinySIntWithFlag((((char *)SP - (char *)pSnapshot->LastReportedRegisterSummary.SP) / 4), FP == SP))
+		return;
+	if (FP != SP)
+	{
+		if (!coder.WriteTinySInt((((char *)FP - (char *)SP) / 4)))
+			return;
+	}
+
+	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)PC - (char *)pSnapshot->LastReportedRegisterSummary.PC)))
+		return;
+	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)LR - (char *)pSnapshot->LastReportedRegisterSummary.LR)))
+		return;
+
+	//5. Write stack entry count
+#if SAMPLING_PROFILER_THREAD_TAGS
+	int threadIndex;
+	if (!WriteThreadTag(pSnapshot, coder, &threadIndex))
+		return;
+#endif
+	if (!coder.WritePackedUIntPair(matchingEntries, entries - matchingEntries))
+		return;
+
+	if (!SysprogsProfiler_WriteData(pdcSamplingProfilerStream,
+									(char *)coder.GetBuffer() + endOfStackEntries,
+									coder.GetOffset() - endOfStackEntries,
+									coder.GetBuffer(),
+									endOfStackEntries))
+	{
+		CountSampleAndUpdateAutoRate(pSnapshot, false);
+		return;
+	}
+
+	CountSampleAndUpdateAutoRate(pSnapshot, true);
+#if SAMPLING_PROFILER_THREAD_TAGS
+	ThreadTagDelivered(pSnapshot, threadIndex);
+#endif
+
+	pSnapshot->LastReportedRegisterSummary.FP = FP;
+	pSnapshot->LastReportedRegisterSummary.SP = SP;
+	pSnapshot->LastReportedRegisterSummary.PC = PC;
+	pSnapshot->LastReportedRegisterSummary.LR = LR;
+	coder.ExportState(&pSnapshot->LastReportedRegisterSummary.RefPointA, &pSnapshot->LastReportedRegisterSummary.RefPointB);
+	pSnapshot->LastReportedRegisterSummary.StackEntryCount = entries;
+	pSnapshot->LastUsedReportBuffer = current;
+}
+
+#else
+
+extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, void *LR)
+{
+	if (g_PauseSamplingProfiler)
+		return;
+
+	FilteredStackSnapshot *pSnapshot = GetCurrentCoreSnapshot();
+	if (!pSnapshot)
+		return;
+
+	void **lastSavedEntry = (void **)SP, **thisSP;
 	unsigned entries = 0;
+	bool writeRefPointB;
+	StackWalker walker;
+	StartStackWalk(&walker, PC, SP, FP, LR);
 
 #if SAMPLING_PROFILER_COMPARE_FRAMES
-	void *pCodeBuffer = s_FilteredStackSnapshot.LastUsedReportBuffer ? s_FilteredStackSnapshot.ReportBufferA : s_FilteredStackSnapshot.ReportBufferB;
+	void *pCodeBuffer = pSnapshot->LastUsedReportBuffer ? pSnapshot->ReportBufferA : pSnapshot->ReportBufferB;
 #else
-	void *pCodeBuffer = s_FilteredStackSnapshot.ReportBufferA;
+	void *pCodeBuffer = pSnapshot->ReportBufferA;
 #endif
 
 	SmallNumberCoder coder(pCodeBuffer,
 						   MAX_STACK_SNAPSHOT_SIZE,
-						   s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointA,
-						   s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointB);
+						   pSnapshot->LastReportedRegisterSummary.RefPointA,
+						   pSnapshot->LastReportedRegisterSummary.RefPointB);
 
 #if SAMPLING_PROFILER_COMPARE_FRAMES
-	void *startA = s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointA;
-	void *startB = s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointB;
+	void *startA = pSnapshot->LastReportedRegisterSummary.RefPointA;
+	void *startB = pSnapshot->LastReportedRegisterSummary.RefPointB;
 
-	SmallNumberDecoder decoder(s_FilteredStackSnapshot.LastUsedReportBuffer ? s_FilteredStackSnapshot.ReportBufferB : s_FilteredStackSnapshot.ReportBufferA,
+	SmallNumberDecoder decoder(pSnapshot->LastUsedReportBuffer ? pSnapshot->ReportBufferB : pSnapshot->ReportBufferA,
 							   MAX_STACK_SNAPSHOT_SIZE,
-							   s_FilteredStackSnapshot.LastReportedRegisterSummary.StartRefPointA,
-							   s_FilteredStackSnapshot.LastReportedRegisterSummary.StartRefPointB);
-	void **readBase = (void **)s_FilteredStackSnapshot.LastReportedRegisterSummary.SP;
+							   pSnapshot->LastReportedRegisterSummary.StartRefPointA,
+							   pSnapshot->LastReportedRegisterSummary.StartRefPointB);
+	void **readBase = (void **)pSnapshot->LastReportedRegisterSummary.SP;
 	int firstMatchingEntry = -1, firstMatchingEntryOffset = -1;
 	int readEntries = 0;
 
@@ -136,25 +1095,17 @@ extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, voi
 #endif
 
 	//1. Compress stack entries
-	for (void **thisSP = (void **)SP; SP < (void *)(SYSPROGS_PROFILER_END_OF_RAM) && ((char *)thisSP - (char *)lastSavedEntry) < MAX_STACK_FRAME_SIZE; thisSP++)
+	while (GetNextStackEntry(&walker, &thisSP, &writeRefPointB))
 	{
 #if SAMPLING_PROFILER_COMPARE_FRAMES
 		int entryStartOffset = coder.GetOffset();
 #endif
-		bool writeRefPointB;
-		if (IsPotentialSavedFPSlot(thisSP))
-			writeRefPointB = true;
-		else if (IsValidStackAddress(thisSP) && IsValidCodeAddress(*thisSP))
-			writeRefPointB = false;
-		else
-			continue;
-
 		int indexDelta = thisSP - lastSavedEntry;
 		lastSavedEntry = thisSP;
 
 #if SAMPLING_PROFILER_COMPARE_FRAMES
 		void *readValue;
-		while (readEntries < s_FilteredStackSnapshot.LastReportedRegisterSummary.StackEntryCount && decoder.ReadStackEntry(&readBase, &readValue))
+		while (readEntries < pSnapshot->LastReportedRegisterSummary.StackEntryCount && decoder.ReadStackEntry(&readBase, &readValue))
 		{
 			readEntries++;
 			if (readBase < thisSP)
@@ -201,7 +1152,7 @@ extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, voi
 #endif
 
 	//2. Compress register values
-	if (!coder.WriteTinySIntWithFlag((((char *)SP - (char *)s_FilteredStackSnapshot.LastReportedRegisterSummary.SP) / 4), FP == SP))
+	if (!coder.WriteTinySIntWithFlag((((char *)SP - (char *)pSnapshot->LastReportedRegisterSummary.SP) / 4), FP == SP))
 		return;
 	if (FP != SP)
 	{
@@ -209,67 +1160,47 @@ extern "C" void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, voi
 			return;
 	}
 
-	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)PC - (char *)s_FilteredStackSnapshot.LastReportedRegisterSummary.PC)))
+	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)PC - (char *)pSnapshot->LastReportedRegisterSummary.PC)))
 		return;
-	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)LR - (char *)s_FilteredStackSnapshot.LastReportedRegisterSummary.LR)))
+	if (!coder.WriteSmallMostLikelyEvenSInt(((char *)LR - (char *)pSnapshot->LastReportedRegisterSummary.LR)))
 		return;
 
 	//3. Write stack entry count
+#if SAMPLING_PROFILER_THREAD_TAGS
+	int threadIndex;
+	if (!WriteThreadTag(pSnapshot, coder, &threadIndex))
+		return;
+#endif
 	if (!coder.WritePackedUIntPair(matchingEntries, entries))
 		return;
 
-	if (++s_PacketsInCycle >= SAMPLES_PER_AUTORATE_CYCLE)
-	{
-		g_SamplingProfilerDroppedPacketRatio = s_PacketsDropped;
-
-		if (g_SamplingProfilerAutoRate)
-		{
-			int newRate = 0;
-			if (g_SamplingProfilerDroppedPacketRatio)
-				newRate = g_SamplingProfilerAutoRate * (SAMPLES_PER_AUTORATE_CYCLE - g_SamplingProfilerDroppedPacketRatio) / SAMPLES_PER_AUTORATE_CYCLE;
-			else if ((s_AvailabilitySum / SAMPLES_PER_AUTORATE_CYCLE) > (1 << SAMPLING_PROFILER_COMM_BUFFER_USAGE_EXP) * 1 / 4)
-			{
-				if ((s_AvailabilitySum / SAMPLES_PER_AUTORATE_CYCLE) > (1 << SAMPLING_PROFILER_COMM_BUFFER_USAGE_EXP) * 7 / 8)
-					newRate = g_SamplingProfilerAutoRate * 4;
-				else if ((s_AvailabilitySum / SAMPLES_PER_AUTORATE_CYCLE) > (1 << SAMPLING_PROFILER_COMM_BUFFER_USAGE_EXP) * 3 / 4)
-					newRate = g_SamplingProfilerAutoRate * 2;
-				else
-					newRate = g_SamplingProfilerAutoRate + 200;
-			}
-
-			if (newRate > 100 && newRate < 100000)
-			{
-				g_SamplingProfilerAutoRate = newRate;
-				g_SamplingProfilerRate = newRate;
-			}
-		}
-		s_PacketsDropped = 0;
-		s_PacketsInCycle = 0;
-		s_AvailabilitySum = 0;
-	}
-
 	if (!SysprogsProfiler_WriteData(pdcSamplingProfilerStream,
 									(char *)coder.GetBuffer() + headerStartOffset,
 									coder.GetOffset() - headerStartOffset,
 									coder.GetBuffer(),
 									endOfStackEntries))
 	{
-		s_PacketsDropped++;
+		CountSampleAndUpdateAutoRate(pSnapshot, false);
 		return;
 	}
 
-	s_AvailabilitySum += SysprogsProfiler_GetBufferAvailability(SAMPLING_PROFILER_COMM_BUFFER_USAGE_EXP);
+	CountSampleAndUpdateAutoRate(pSnapshot, true);
+#if SAMPLING_PROFILER_THREAD_TAGS
+	ThreadTagDelivered(pSnapshot, threadIndex);
+#endif
 
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.FP = FP;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.SP = SP;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.PC = PC;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.LR = LR;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointA = refAAtEndOfMismatchingEntries;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.RefPointB = refBAtEndOfMismatchingEntries;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.StackEntryCount = entries + matchingEntries;
+	pSnapshot->LastReportedRegisterSummary.FP = FP;
+	pSnapshot->LastReportedRegisterSummary.SP = SP;
+	pSnapshot->LastReportedRegisterSummary.PC = PC;
+	pSnapshot->LastReportedRegisterSummary.LR = LR;
+	pSnapshot->LastReportedRegisterSummary.RefPointA = refAAtEndOfMismatchingEntries;
+	pSnapshot->LastReportedRegisterSummary.RefPointB = refBAtEndOfMismatchingEntries;
+	pSnapshot->LastReportedRegisterSummary.StackEntryCount = entries + matchingEntries;
 #if SAMPLING_PROFILER_COMPARE_FRAMES
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.StartRefPointA = startA;
-	s_FilteredStackSnapshot.LastReportedRegisterSummary.StartRefPointB = startB;
-	s_FilteredStackSnapshot.LastUsedReportBuffer = !s_FilteredStackSnapshot.LastUsedReportBuffer;
+	pSnapshot->LastReportedRegisterSummary.StartRefPointA = startA;
+	pSnapshot->LastReportedRegisterSummary.StartRefPointB = startB;
+	pSnapshot->LastUsedReportBuffer = !pSnapshot->LastUsedReportBuffer;
+#endif
+}
+
 #endif
-}
\ No newline at end of file
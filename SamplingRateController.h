@@ -0,0 +1,183 @@
+#pragma once
+
+/*
+	Automatic sampling rate selection (enabled by setting g_SamplingProfilerAutoRate to the initial rate). The controller runs
+	SAMPLING_PROFILER_AUTORATE_UPDATES_PER_SECOND times per second (the amount of samples per update is derived from the current rate,
+	so no time source is needed) and tries to keep the usage of the communication buffer at SAMPLING_PROFILER_AUTORATE_TARGET_OCCUPANCY
+	percent. The buffer integrates the difference between the sampling rate and the rate at which the debugger reads it, so the controller:
+		1. Measures the buffer share taken by one sample (the drop of the free space between two samples not separated by a debugger read).
+		2. Computes the least-squares slope of the buffer usage during the period (derivative term) and estimates the amount of samples
+		   read by the debugger from it. The estimate also acts as the integral term, as it directly follows the debugger bandwidth.
+		3. Plans to deliver that amount plus the amount that would move the buffer usage halfway towards the target (proportional term).
+	If the buffer stays almost empty, the rate is scaled by up to 2x instead, as the debugger bandwidth could be much higher than the rate.
+	A period never takes more samples than one buffer can hold, so the buffer cannot overflow unnoticed between the updates.
+	Each update changes the rate by 1/4x to 2x, so going from the minimum to the maximum rate takes log2(MAX_RATE / MIN_RATE) updates.
+	If the transport does not report the buffer usage, the rate is only reduced when samples get dropped.
+*/
+#ifndef SAMPLING_PROFILER_AUTORATE_TARGET_OCCUPANCY
+#define SAMPLING_PROFILER_AUTORATE_TARGET_OCCUPANCY 50
+#endif
+
+#ifndef SAMPLING_PROFILER_AUTORATE_UPDATES_PER_SECOND
+#define SAMPLING_PROFILER_AUTORATE_UPDATES_PER_SECOND 8
+#endif
+
+//Lower values make the measured buffer usage too noisy. Higher values slow down the controller at low rates.
+#ifndef SAMPLING_PROFILER_AUTORATE_MIN_SAMPLES_PER_UPDATE
+#define SAMPLING_PROFILER_AUTORATE_MIN_SAMPLES_PER_UPDATE 16
+#endif
+
+#ifndef SAMPLING_PROFILER_AUTORATE_MIN_RATE
+#define SAMPLING_PROFILER_AUTORATE_MIN_RATE 100
+#endif
+
+#ifndef SAMPLING_PROFILER_AUTORATE_MAX_RATE
+#define SAMPLING_PROFILER_AUTORATE_MAX_RATE 100000
+#endif
+
+enum
+{
+	kSamplingRateControllerAvailabilityExp = 12, //Passed to SysprogsProfiler_GetBufferAvailability()
+	kSamplingRateControllerFullBuffer = 1 << kSamplingRateControllerAvailabilityExp,
+	kSamplingRateControllerMaxSamplesPerUpdate = 4096,
+};
+
+typedef struct
+{
+	//Statistics of the current period
+	int Samples, Dropped;
+	int AvailabilitySum, AvailabilityCount;
+	long long WeightedAvailabilitySum;		  //Sum of (index * availability), used to compute the trend of the buffer usage
+	int UsageIncreaseSum, UsageIncreaseCount; //Buffer space taken by the samples that were not preceded by a debugger read
+
+	int LastAvailability; //-1 if the last sample was dropped
+	int SamplesPerBuffer; //Measured during the previous period, 0 if unknown
+} SamplingRateController;
+
+static inline void SamplingRateController_Reset(SamplingRateController *pController)
+{
+	pController->Samples = pController->Dropped = 0;
+	pController->AvailabilitySum = pController->AvailabilityCount = 0;
+	pController->WeightedAvailabilitySum = 0;
+	pController->UsageIncreaseSum = pController->UsageIncreaseCount = 0;
+	pController->LastAvailability = -1;
+	pController->SamplesPerBuffer = 0;
+}
+
+//Returns the amount of samples after which SamplingRateController_Update() should be called. If the debugger reads the buffer
+//much faster than the update rate, the updates happen more often, so that the buffer cannot overflow between them.
+static inline int SamplingRateController_GetSamplesPerUpdate(const SamplingRateController *pController, int rate)
+{
+	int samples = rate / SAMPLING_PROFILER_AUTORATE_UPDATES_PER_SECOND;
+	if (pController->SamplesPerBuffer && samples > pController->SamplesPerBuffer)
+		samples = pController->SamplesPerBuffer;
+	if (samples < SAMPLING_PROFILER_AUTORATE_MIN_SAMPLES_PER_UPDATE)
+		return SAMPLING_PROFILER_AUTORATE_MIN_SAMPLES_PER_UPDATE;
+	if (samples > kSamplingRateControllerMaxSamplesPerUpdate)
+		return kSamplingRateControllerMaxSamplesPerUpdate;
+	return samples;
+}
+
+//availability is the value returned by SysprogsProfiler_GetBufferAvailability(kSamplingRateControllerAvailabilityExp) after sending the sample.
+static inline void SamplingRateController_CountSample(SamplingRateController *pController, int availability)
+{
+	pController->Samples++;
+	if (availability < 0 || availability > kSamplingRateControllerFullBuffer)
+	{
+		pController->LastAvailability = -1;
+		return; //The transport does not support SysprogsProfiler_GetBufferAvailability()
+	}
+
+	pController->WeightedAvailabilitySum += (long long)pController->AvailabilityCount * availability;
+	pController->AvailabilitySum += availability;
+	pController->AvailabilityCount++;
+	if (pController->LastAvailability > availability)
+	{
+		pController->UsageIncreaseSum += pController->LastAvailability - availability;
+		pController->UsageIncreaseCount++;
+	}
+	pController->LastAvailability = availability;
+}
+
+static inline void SamplingRateController_CountDroppedSample(SamplingRateController *pController)
+{
+	pController->Samples++;
+	pController->Dropped++;
+	pController->LastAvailability = -1;
+}
+
+//Returns the average buffer usage during the current period (x kSamplingRateControllerFullBuffer), or -1 if it is unknown.
+static inline int SamplingRateController_GetOccupancy(const SamplingRateController *pController)
+{
+	if (!pController->AvailabilityCount)
+		return -1;
+	return kSamplingRateControllerFullBuffer - pController->AvailabilitySum / pController->AvailabilityCount;
+}
+
+//Returns the rate for the next period and starts a new one.
+static inline int SamplingRateController_Update(SamplingRateController *pController, int rate)
+{
+	const int unit = kSamplingRateControllerFullBuffer;
+	const int target = SAMPLING_PROFILER_AUTORATE_TARGET_OCCUPANCY * unit / 100;
+	int samples = pController->Samples, delivered = samples - pController->Dropped;
+	int occupancy = SamplingRateController_GetOccupancy(pController);
+	int factor = unit; //New rate / old rate, x unit
+
+	if (occupancy < 0)
+	{
+		//Nothing is known about the buffer, so only the dropped samples can be taken into account.
+		if (pController->Dropped)
+			factor = delivered * unit / samples * 7 / 8;
+	}
+	else if (!pController->UsageIncreaseSum)
+	{
+		//Without the buffer share of one sample, the usage cannot be converted to a rate, so the rate is scaled by up to 2x.
+		factor = unit + 2 * (target - occupancy);
+	}
+	else
+	{
+		//Least-squares slope of the buffer usage per sample, as slopeNumerator / slopeDenominator.
+		long long n = pController->AvailabilityCount;
+		long long slopeNumerator = 0, slopeDenominator = 1;
+		if (n > 1)
+		{
+			slopeNumerator = -12 * (2 * pController->WeightedAvailabilitySum - (n - 1) * pController->AvailabilitySum);
+			slopeDenominator = 2 * n * (n * n - 1);
+		}
+
+		//The debugger read (share of one sample - slope) per delivered sample. The share is UsageIncreaseSum / UsageIncreaseCount.
+		long long slopeInShares = slopeNumerator * pController->UsageIncreaseCount / slopeDenominator; //x UsageIncreaseSum
+		long long readFactor = (long long)unit * delivered * (pController->UsageIncreaseSum - slopeInShares) / ((long long)samples * pController->UsageIncreaseSum);
+
+		//The buffer usage at the end of the period should move halfway towards the target during the next one.
+		long long usageAtEnd = occupancy + slopeNumerator * n / (2 * slopeDenominator);
+		long long error = target - usageAtEnd;
+		long long correctionFactor = (long long)unit * error * pController->UsageIncreaseCount / (2LL * pController->UsageIncreaseSum * samples);
+
+		factor = (int)(readFactor + correctionFactor);
+
+		//If the buffer stays almost empty, the debugger reads everything, so its bandwidth could be much higher than the current rate.
+		//Growing the rate by the buffer share would take too long then.
+		int proportionalFactor = unit + 2 * (target - occupancy);
+		if (usageAtEnd < target / 4 && slopeNumerator <= 0 && !pController->Dropped && factor < proportionalFactor)
+			factor = proportionalFactor;
+	}
+
+	if (factor > 2 * unit)
+		factor = 2 * unit;
+	else if (factor < unit / 4)
+		factor = unit / 4;
+
+	int newRate = (int)((long long)rate * factor / unit);
+	if (newRate < SAMPLING_PROFILER_AUTORATE_MIN_RATE)
+		newRate = SAMPLING_PROFILER_AUTORATE_MIN_RATE;
+	else if (newRate > SAMPLING_PROFILER_AUTORATE_MAX_RATE)
+		newRate = SAMPLING_PROFILER_AUTORATE_MAX_RATE;
+
+	int lastAvailability = pController->LastAvailability;
+	int samplesPerBuffer = pController->UsageIncreaseSum ? (int)((long long)pController->UsageIncreaseCount * unit / pController->UsageIncreaseSum) : 0;
+	SamplingRateController_Reset(pController);
+	pController->LastAvailability = lastAvailability;
+	pController->SamplesPerBuffer = samplesPerBuffer;
+	return newRate;
+}
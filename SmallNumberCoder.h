@@ -7,6 +7,11 @@ private:
 	int m_BufferSize;
 	int m_Offset;
 
+	//The buffer can consist of 2 segments (e.g. when encoding directly into a circular buffer).
+	//m_pBuffer points to the first segment; the bytes past m_FirstSegmentSize are stored in m_pSecondSegment.
+	int m_FirstSegmentSize;
+	char *m_pSecondSegment;
+
 	void *m_RefPointA, *m_RefPointB;
 
 private:
@@ -22,11 +27,26 @@ private:
 		return (value & mask) == 0;
 	}
 
-	inline bool WriteSmallInteger(int value, int byteCount)
+	bool WriteSmallIntegerAcrossSegments(int value, int byteCount)
 	{
 		if (byteCount > (m_BufferSize - m_Offset))
 			return false;
 
+		for (int i = 0; i < byteCount; i++, m_Offset++)
+		{
+			if (m_Offset < m_FirstSegmentSize)
+				m_pBuffer[m_Offset] = ((char *)&value)[i];
+			else
+				m_pSecondSegment[m_Offset - m_FirstSegmentSize] = ((char *)&value)[i];
+		}
+		return true;
+	}
+
+	inline bool WriteSmallInteger(int value, int byteCount)
+	{
+		if (byteCount > (m_FirstSegmentSize - m_Offset))
+			return WriteSmallIntegerAcrossSegments(value, byteCount);
+
 #if defined(ARM_MATH_CM3) || defined(ARM_MATH_CM4)
 		switch (byteCount)
 		{
@@ -53,7 +73,13 @@ private:
 
 public:
 	SmallNumberCoder(void *pBuffer, unsigned size, void *pRefPointA, void *pRefPointB)
-		: m_pBuffer((char *)pBuffer), m_BufferSize(size), m_Offset(0), m_RefPointA(pRefPointA), m_RefPointB(pRefPointB)
+		: m_pBuffer((char *)pBuffer), m_BufferSize(size), m_Offset(0), m_FirstSegmentSize(size), m_pSecondSegment(0), m_RefPointA(pRefPointA), m_RefPointB(pRefPointB)
+	{
+	}
+
+	SmallNumberCoder(void *pFirstSegment, unsigned firstSegmentSize, void *pSecondSegment, unsigned secondSegmentSize, void *pRefPointA, void *pRefPointB)
+		: m_pBuffer((char *)pFirstSegment), m_BufferSize(firstSegmentSize + secondSegmentSize), m_Offset(0), m_FirstSegmentSize(firstSegmentSize),
+		  m_pSecondSegment((char *)pSecondSegment), m_RefPointA(pRefPointA), m_RefPointB(pRefPointB)
 	{
 	}
 
@@ -220,17 +246,27 @@ public:
 		}
 	}
 
+	//Always uses the 3-byte form of WritePackedUIntPair(), so that the values can be overwritten later via SetOffset().
+	inline bool WriteFixedSizeUIntPair(unsigned char largerInt, unsigned char smallerInt)
+	{
+		if (!WriteSmallInteger(0xFE, 1))
+			return false;
+		if (!WriteSmallInteger(largerInt, 1))
+			return false;
+		return WriteSmallInteger(smallerInt, 1);
+	}
+
 	inline bool WriteStackEntry(int indexDelta, void *value, bool useRefPointB)
 	{
 		int dist;
 		if (useRefPointB)
 		{
-			dist = (int)value - (int)m_RefPointB;
+			dist = (int)((char *)value - (char *)m_RefPointB);
 			m_RefPointB = value;
 		}
 		else
 		{
-			dist = (int)value - (int)m_RefPointA;
+			dist = (int)((char *)value - (char *)m_RefPointA);
 			m_RefPointA = value;
 		}
 
@@ -239,6 +275,22 @@ public:
 		return WriteSmallMostLikelyEvenSInt(dist);
 	}
 
+	//Copies the raw bytes (e.g. string contents or floating-point values) into the buffer.
+	inline bool WriteBytes(const void *pData, int size)
+	{
+		if (size > (m_BufferSize - m_Offset))
+			return false;
+
+		for (int i = 0; i < size; i++, m_Offset++)
+		{
+			if (m_Offset < m_FirstSegmentSize)
+				m_pBuffer[m_Offset] = ((const char *)pData)[i];
+			else
+				m_pSecondSegment[m_Offset - m_FirstSegmentSize] = ((const char *)pData)[i];
+		}
+		return true;
+	}
+
 	int GetOffset()
 	{
 		return m_Offset;
@@ -358,6 +410,66 @@ public:
 		}
 	}
 
+	inline bool ReadTinySInt(int *pValue)
+	{
+		if ((m_Offset + 1) > m_BufferSize)
+			return false;
+
+		unsigned char b = (unsigned char)m_pBuffer[m_Offset];
+
+		if ((b & 0x01) == 0)
+		{
+			*pValue = SignExtend(b >> 1, 7);
+			m_Offset += 1;
+		}
+		else if ((b & 0x03) == 1)
+		{
+			if ((m_Offset + 2) > m_BufferSize)
+				return false;
+			*pValue = SignExtend(PeekInt16() >> 2, 14);
+			m_Offset += 2;
+		}
+		else
+		{
+			if ((m_Offset + 4) > m_BufferSize)
+				return false;
+			*pValue = SignExtend(PeekInt32() >> 2, 30);
+			m_Offset += 4;
+		}
+		return true;
+	}
+
+	inline bool ReadPackedUIntPair(unsigned *pLargerInt, unsigned *pSmallerInt)
+	{
+		if ((m_Offset + 1) > m_BufferSize)
+			return false;
+
+		unsigned char b = (unsigned char)m_pBuffer[m_Offset];
+		if (b < 0xFE)
+		{
+			*pLargerInt = b >> 4;
+			*pSmallerInt = b & 0x0F;
+			m_Offset += 1;
+		}
+		else if (b == 0xFE)
+		{
+			if ((m_Offset + 3) > m_BufferSize)
+				return false;
+			*pLargerInt = (unsigned char)m_pBuffer[m_Offset + 1];
+			*pSmallerInt = (unsigned char)m_pBuffer[m_Offset + 2];
+			m_Offset += 3;
+		}
+		else
+		{
+			if ((m_Offset + 5) > m_BufferSize)
+				return false;
+			*pLargerInt = PeekInt16(1);
+			*pSmallerInt = PeekInt16(3);
+			m_Offset += 5;
+		}
+		return true;
+	}
+
 	bool ReadSmallMostlyEvenSInt(int *pValue)
 	{
 		if ((m_Offset + 1) > m_BufferSize)
@@ -386,8 +498,7 @@ public:
 		{
 			if ((m_Offset + 5) > m_BufferSize)
 				return false;
-			int dw = PeekInt32(1);
-			permutatedValue = dw >> 2;
+			permutatedValue = PeekInt32(1); //The 5-byte form stores the value as is
 			m_Offset += 5;
 		}
 
@@ -396,6 +507,22 @@ public:
 		return true;
 	}
 
+	inline bool ReadBytes(void *pData, int size)
+	{
+		if ((m_Offset + size) > m_BufferSize)
+			return false;
+
+		for (int i = 0; i < size; i++)
+			((char *)pData)[i] = m_pBuffer[m_Offset + i];
+		m_Offset += size;
+		return true;
+	}
+
+	int GetOffset()
+	{
+		return m_Offset;
+	}
+
 	inline bool ReadStackEntry(void ***pInOutStackAddr, void **pValue)
 	{
 		int dist;
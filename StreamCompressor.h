@@ -0,0 +1,151 @@
+#pragma once
+#include <string.h>
+
+/*
+	Small-window LZ77 compressor used by the compressed fast semihosting channels (see FAST_SEMIHOSTING_COMPRESSED_CHANNELS).
+	The RAM usage is fixed: _Window + _MaxBlock bytes of history and 2 << _HashBits bytes of the match lookup table.
+
+	Each block produced by Compress() has the following format:
+		[compressed size, excluding this field: 2 bytes, little-endian] [sequence] [sequence] ...
+
+	Each sequence is encoded in the same way as in LZ4:
+		[token: literal count (4 bits) || match length - 4 (4 bits)] [extra literal count] [literals] [offset: 2 bytes, little-endian] [extra match length]
+
+	Counts of 15 in the token are continued by the extra bytes (255 means "add 255 and read another byte"). The last sequence of a block
+	may end right after the literals. Offsets count back from the current position in the decompressed stream of the same channel and
+	can refer to the data from the previous blocks, hence the decoder must process all blocks of a channel in order.
+	See HostTools/StreamDecompressor.cpp for the reference decoder.
+*/
+template <unsigned _Window, unsigned _MaxBlock, unsigned _HashBits = 8> class StreamCompressor
+{
+public:
+	enum
+	{
+		kMinMatch = 4,
+		//Matches never take more space than the literals they replace, so the worst case is a single literal-only sequence.
+		kMaxCompressedSize = 2 + 1 + (_MaxBlock / 255 + 1) + _MaxBlock,
+	};
+
+private:
+	unsigned char m_Buffer[_Window + _MaxBlock];
+	unsigned m_HistorySize, m_InputSize;
+	unsigned m_BasePosition; //Position of m_Buffer[0] in the uncompressed stream
+	unsigned short m_HashTable[1 << _HashBits];
+
+	static inline unsigned Hash(const unsigned char *p)
+	{
+		unsigned value = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+		return (value * 2654435761U) >> (32 - _HashBits);
+	}
+
+	static inline unsigned char *WriteExtraLength(unsigned char *p, unsigned length)
+	{
+		while (length >= 255)
+		{
+			*p++ = 255;
+			length -= 255;
+		}
+		*p++ = length;
+		return p;
+	}
+
+	static unsigned char *WriteSequence(unsigned char *p, const unsigned char *pLiterals, unsigned literalCount, unsigned offset, unsigned matchLength)
+	{
+		unsigned matchCode = matchLength ? matchLength - kMinMatch : 0;
+		*p++ = ((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15);
+		if (literalCount >= 15)
+			p = WriteExtraLength(p, literalCount - 15);
+		memcpy(p, pLiterals, literalCount);
+		p += literalCount;
+
+		if (matchLength)
+		{
+			*p++ = offset;
+			*p++ = offset >> 8;
+			if (matchCode >= 15)
+				p = WriteExtraLength(p, matchCode - 15);
+		}
+		return p;
+	}
+
+public:
+	//Resets the compressor to the initial state. Zero-initialized static instances do not need to be reset explicitly.
+	void Reset()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	//Appends data to the next block. Returns false if the block would exceed _MaxBlock bytes.
+	bool AppendInput(const void *pData, unsigned size)
+	{
+		if (size > _MaxBlock - m_InputSize)
+			return false;
+		memcpy(m_Buffer + m_HistorySize + m_InputSize, pData, size);
+		m_InputSize += size;
+		return true;
+	}
+
+	unsigned GetInputSize() const
+	{
+		return m_InputSize;
+	}
+
+	//Compresses the appended input into pOutput (at least kMaxCompressedSize bytes) and returns the size of the block.
+	//The input remains pending until AcceptInput() or DiscardInput() is called.
+	unsigned Compress(unsigned char *pOutput)
+	{
+		const unsigned char *pBuffer = m_Buffer;
+		unsigned end = m_HistorySize + m_InputSize, anchor = m_HistorySize;
+		unsigned char *p = pOutput + 2;
+
+		for (unsigned i = anchor; i + kMinMatch <= end;)
+		{
+			unsigned short *pEntry = &m_HashTable[Hash(pBuffer + i)];
+			unsigned distance = (unsigned short)(m_BasePosition + i - *pEntry);
+			*pEntry = (unsigned short)(m_BasePosition + i);
+
+			//The table may contain stale or aliased entries, so the candidate is always verified.
+			if (!distance || distance > i || distance > _Window || memcmp(pBuffer + i, pBuffer + i - distance, kMinMatch))
+			{
+				i++;
+				continue;
+			}
+
+			unsigned length = kMinMatch;
+			while (i + length < end && pBuffer[i + length] == pBuffer[i + length - distance])
+				length++;
+
+			p = WriteSequence(p, pBuffer + anchor, i - anchor, distance, length);
+			i += length;
+			anchor = i;
+		}
+
+		if (anchor < end || end == m_HistorySize)
+			p = WriteSequence(p, pBuffer + anchor, end - anchor, 0, 0);
+
+		unsigned size = (unsigned)(p - pOutput - 2);
+		pOutput[0] = size;
+		pOutput[1] = size >> 8;
+		return size + 2;
+	}
+
+	//Must be called once the block returned by Compress() has been delivered to the decoder, so that further blocks can refer to it.
+	void AcceptInput()
+	{
+		m_HistorySize += m_InputSize;
+		m_InputSize = 0;
+		if (m_HistorySize > _Window)
+		{
+			unsigned excess = m_HistorySize - _Window;
+			memmove(m_Buffer, m_Buffer + excess, _Window);
+			m_BasePosition += excess;
+			m_HistorySize = _Window;
+		}
+	}
+
+	//Drops the pending input if the compressed block could not be delivered. The next block will not refer to it.
+	void DiscardInput()
+	{
+		m_InputSize = 0;
+	}
+};
@@ -0,0 +1,221 @@
+#include "SysprogsLog.h"
+#include "SmallNumberCoder.h"
+#include "SysprogsProfilerInterface.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Each SysprogsLog() call produces one record in the pdcDeferredLogStream channel:
+		[size: 1 byte]			Amount of bytes following this field
+		[format address]		WriteTinySIntWithFlag(), the flag is reserved (0)
+		[arguments...]			One entry per '*' width/precision and per conversion, in the order they appear in the format string
+
+	The arguments are encoded as follows:
+		Integers, characters and pointers: WriteTinySIntWithFlag(low 32 bits, is64Bit), followed by WriteTinySIntWithFlag(high 32 bits) for 64-bit values.
+		Strings: WriteTinySIntWithFlag(length, isNull), followed by the characters (no null terminator).
+		Floating-point values: 8 bytes of the 'double' representation.
+
+	If the next argument does not fit into the record, the record ends before it, and the host renders the rest of the message as "...".
+	The same happens after an unsupported conversion, as the size of its argument is not known.
+*/
+
+//Maximum size of a single record, including the size field. Larger records need more stack space, but can hold longer strings.
+#ifndef SYSPROGS_LOG_MAX_RECORD_SIZE
+#define SYSPROGS_LOG_MAX_RECORD_SIZE 64
+#endif
+
+#if SYSPROGS_LOG_MAX_RECORD_SIZE > 256
+#error The record size should fit into 1 byte.
+#endif
+
+//Longer strings passed via %s are truncated. The precision specified in the format string (e.g. %.10s) is also taken into account.
+#ifndef SYSPROGS_LOG_MAX_STRING_LENGTH
+#define SYSPROGS_LOG_MAX_STRING_LENGTH 32
+#endif
+
+/*
+	If this option is enabled, SysprogsLog() waits for the debugger to read the buffer when it is full, like printf() does in the
+	fast semihosting blocking mode 1 (see SysprogsProfiler_WriteDataBlocking()). Otherwise, the messages that do not fit into the buffer
+	are discarded.
+*/
+#ifndef SYSPROGS_LOG_WAIT_FOR_BUFFER_SPACE
+#if !defined(FAST_SEMIHOSTING_BLOCKING_MODE) || FAST_SEMIHOSTING_BLOCKING_MODE == 1
+#define SYSPROGS_LOG_WAIT_FOR_BUFFER_SPACE 1
+#else
+#define SYSPROGS_LOG_WAIT_FOR_BUFFER_SPACE 0
+#endif
+#endif
+
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The simulated debugger runs in the same 64-bit process, so the format strings are passed to it as 32-bit tokens.
+extern "C" unsigned SysprogsHostSimulator_MapAddress(const volatile void *p);
+#define SYSPROGS_LOG_FORMAT_ADDRESS(p) SysprogsHostSimulator_MapAddress(p)
+#else
+#define SYSPROGS_LOG_FORMAT_ADDRESS(p) ((unsigned)(p))
+#endif
+
+static inline bool WriteInteger(SmallNumberCoder &coder, unsigned long long value, bool is64Bit)
+{
+	if (!coder.WriteTinySIntWithFlag((int)value, is64Bit))
+		return false;
+	return !is64Bit || coder.WriteTinySIntWithFlag((int)(value >> 32), false);
+}
+
+static inline bool WriteString(SmallNumberCoder &coder, const char *pString, int precision)
+{
+	if (!pString)
+		return coder.WriteTinySIntWithFlag(0, true);
+
+	unsigned limit = SYSPROGS_LOG_MAX_STRING_LENGTH, length = 0, room = coder.RemainingSize();
+	if (precision >= 0 && (unsigned)precision < limit)
+		limit = precision;
+
+	//Long strings at the end of the message are truncated to the remaining space (the length takes at most 2 bytes).
+	if (room < 2)
+		return false;
+	if (limit > room - 2)
+		limit = room - 2;
+
+	while (length < limit && pString[length])
+		length++;
+
+	return coder.WriteTinySIntWithFlag(length, false) && coder.WriteBytes(pString, length);
+}
+
+//Returns false if the argument did not fit into the record, or the conversion is not supported.
+static bool EncodeConversion(SmallNumberCoder &coder, const char *&p, va_list &args)
+{
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+		p++;
+
+	if (*p == '*')
+	{
+		p++;
+		if (!WriteInteger(coder, (unsigned)va_arg(args, int), false))
+			return false;
+	}
+	else
+	{
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	int precision = -1;
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			p++;
+			precision = va_arg(args, int);
+			if (!WriteInteger(coder, (unsigned)precision, false))
+				return false;
+		}
+		else
+		{
+			for (precision = 0; *p >= '0' && *p <= '9'; p++)
+				precision = precision * 10 + *p - '0';
+		}
+	}
+
+	char length = 0;
+	if (*p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L')
+	{
+		length = *p++;
+		if ((length == 'h' || length == 'l') && *p == length)
+		{
+			p++;
+			length = (length == 'l') ? 'q' : 'H';
+		}
+	}
+
+	switch (*p++)
+	{
+	case '%':
+		return true;
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		//Only the size of the argument matters here. The host applies the signedness and the 'h'/'hh' truncation.
+		switch (length)
+		{
+		case 'l':
+			return WriteInteger(coder, va_arg(args, unsigned long), sizeof(long) > 4);
+		case 'q':
+			return WriteInteger(coder, va_arg(args, unsigned long long), true);
+		case 'j':
+			return WriteInteger(coder, va_arg(args, uintmax_t), sizeof(uintmax_t) > 4);
+		case 'z':
+			return WriteInteger(coder, va_arg(args, size_t), sizeof(size_t) > 4);
+		case 't':
+			return WriteInteger(coder, va_arg(args, ptrdiff_t), sizeof(ptrdiff_t) > 4);
+		default:
+			return WriteInteger(coder, va_arg(args, unsigned), false);
+		}
+	case 'c':
+		return length != 'l' && WriteInteger(coder, (unsigned)va_arg(args, int), false);
+	case 'p':
+		return WriteInteger(coder, (uintptr_t)va_arg(args, void *), sizeof(void *) > 4);
+	case 's':
+		return length != 'l' && WriteString(coder, va_arg(args, const char *), precision);
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+	{
+		double value = (length == 'L') ? (double)va_arg(args, long double) : va_arg(args, double);
+		return coder.WriteBytes(&value, sizeof(value));
+	}
+	default:
+		return false;
+	}
+}
+
+void SysprogsLogV(const char *pFormat, va_list originalArgs)
+{
+	char record[SYSPROGS_LOG_MAX_RECORD_SIZE];
+	SmallNumberCoder coder(record + 1, sizeof(record) - 1, 0, 0);
+	if (!coder.WriteTinySIntWithFlag((int)SYSPROGS_LOG_FORMAT_ADDRESS(pFormat), false))
+		return;
+
+	//va_list may be an array type, so it is copied into a local variable before being passed by reference.
+	va_list args;
+	va_copy(args, originalArgs);
+
+	for (const char *p = pFormat; *p;)
+	{
+		if (*p++ != '%')
+			continue;
+
+		int offset = coder.GetOffset();
+		if (!EncodeConversion(coder, p, args))
+		{
+			//Discard the partially written argument. The host will stop rendering the message at this point.
+			coder.SetOffset(offset);
+			break;
+		}
+	}
+
+	va_end(args);
+
+	record[0] = (char)coder.GetOffset();
+	if (SYSPROGS_LOG_WAIT_FOR_BUFFER_SPACE)
+		SysprogsProfiler_WriteDataBlocking(pdcDeferredLogStream, record, coder.GetOffset() + 1, 0, 0);
+	else
+		SysprogsProfiler_WriteData(pdcDeferredLogStream, record, coder.GetOffset() + 1, 0, 0);
+}
+
+void SysprogsLog(const char *pFormat, ...)
+{
+	va_list args;
+	va_start(args, pFormat);
+	SysprogsLogV(pFormat, args);
+	va_end(args);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdarg.h>
+
+/*!	\file SysprogsLog.h Provides a printf()-like logging API that formats the messages on the host
+
+	\ref SysprogsLog() accepts the same arguments as printf(), but instead of formatting the message on the target,
+	it sends the address of the format string along with the binary-encoded arguments via the pdcDeferredLogStream profiler channel.
+	The debugger reads the format string from the ELF file and renders the message on the host (see HostTools/DeferredLogRenderer.h).
+	This avoids running vfprintf() on the target and typically reduces the amount of transmitted data several times.
+
+	\code
+		SysprogsLog("ADC channel %d: %u mV (%s)\n", channel, millivolts, pStateName);
+	\endcode
+
+	The format string must remain at the same address and must not change after the call (e.g. a string literal stored in FLASH),
+	as the debugger reads it from the ELF file rather than from the target memory. The arguments for the %s conversions are copied
+	into the message (up to SYSPROGS_LOG_MAX_STRING_LENGTH characters), so they can point to temporary buffers.
+	The %n conversion and the wide strings (%ls) are not supported. The rest of the message after an unsupported conversion is not rendered.
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//! Sends a printf()-like message to the debugger, leaving the formatting to the host.
+void SysprogsLog(const char *pFormat, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 1, 2)))
+#endif
+	;
+
+//! Same as \ref SysprogsLog, but takes the arguments as a va_list.
+void SysprogsLogV(const char *pFormat, va_list args);
+
+#ifdef __cplusplus
+}
+#endif
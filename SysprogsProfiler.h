@@ -11,6 +11,8 @@
 	
 	The platform driver configures one of the hardware timers to trigger periodic interrupts
 	and calls the SysprogsProfiler_ProcessSample() function from the ISR.
+	Alternatively, ProfilerDriver_ITM.cpp lets the DWT unit of Cortex-M3/M4/M7 cores send the PC samples via SWO,
+	without any interrupts (only the PC is sampled in this mode, not the call stack).
 	
 	The interface driver sends arbitrary packets of data to the profiler client running on
 	your development machine. The profiler framework includes a universal driver that uses the
@@ -24,6 +26,7 @@ extern "C" {
 //! Should be called from your <b>main()</b> function after initializing the system clock.
 /*! \remarks If this function is not implemented, you are missing a profiler driver for your platform.
 	See the STM32 driver for an implementation example. 
+	On multi-core devices (e.g. RP2040), call it on each core that should be profiled.
 */
 void InitializeSamplingProfiler();
 
@@ -33,6 +36,14 @@ void InitializeSamplingProfiler();
    stack from those and count it in the final report. */
 void SysprogsProfiler_ProcessSample(void *PC, void *SP, void *FP, void *LR);
 
+//! Sends the stacks counted so far by the current core to the debugger.
+/*! Only available if the sampling profiler aggregates the samples (see SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE in SamplingProfiler.cpp).
+	The table is also sent periodically from the sampling ISR, so this only needs to be called to get the exact counts at a specific point.
+	It should not run concurrently with the sampling ISR of the same core (e.g. set g_PauseSamplingProfiler before calling it from a thread).
+	\return 1 if all stacks have been sent, 0 if the buffer got full (call it again once the debugger reads the buffer).
+*/
+int SysprogsProfiler_FlushAggregatedSamples();
+
 //! Should be called from your <b>main()</b> function before using the instrumenting profiler.
 void InitializeInstrumentingProfiler();
 
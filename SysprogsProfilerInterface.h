@@ -1,5 +1,14 @@
 #pragma once
 
+#ifndef SYSPROGS_PROFILER_ZERO_COPY
+/*
+	If this option is enabled, the profilers will encode their data directly into the fast semihosting buffer instead of encoding it
+	into a temporary buffer and calling SysprogsProfiler_WriteData(). This saves one copy per sample/report, but requires the fast semihosting
+	profiler driver, and the sampling profiler will not be able to compare frames with the previous sample (SAMPLING_PROFILER_COMPARE_FRAMES).
+*/
+#define SYSPROGS_PROFILER_ZERO_COPY 0
+#endif
+
 typedef enum
 {
 	pdcSamplingProfilerStream = 0x41,
@@ -8,6 +17,8 @@ typedef enum
 	pdcRealTimeAnalysisStream = 0x44,
 	pdcInstrumentationProfilerNormalStream = 0x45,
 	pdcResourceManagementStream = 0x46,
+	pdcDeferredLogStream = 0x47, //Messages sent via SysprogsLog(), see SysprogsLog.h
+	pdcAggregatedSamplingProfilerStream = 0x48, //(stack, hit count) pairs, see SAMPLING_PROFILER_AGGREGATION_ARENA_SIZE
 } ProfilerDataChannel;
 
 typedef enum
@@ -17,11 +28,42 @@ typedef enum
 	rtaFloatingPoint
 } RealTimeEventArgType;
 
+typedef struct
+{
+	const void *pData;
+	unsigned Size;
+} ProfilerDataSegment;
+
+/*
+	Entry of the unwind table used by the sampling profiler (see SAMPLING_PROFILER_UNWIND_TABLE_SIZE). The table is derived from .ARM.exidx
+	on the host side (see HostTools/UnwindTableBuilder.h) and describes the frame layout of each function after its prologue.
+	The entries are sorted by FunctionStart, and each entry covers the code up to the next one.
+*/
+typedef struct
+{
+	unsigned FunctionStart;			 //Thumb bit cleared
+	unsigned short FrameSize;		 //Distance from SP (or FP, see kUnwindFrameBasedOnFP) to the caller's SP in words, or kUnwindNotPossible
+	unsigned char ReturnAddressSlot; //Distance from the caller's SP to the saved return address in words, 0 if it is still in LR
+	unsigned char SavedFPSlot;		 //Distance from the caller's SP to the saved caller's FP (R7) in words, 0 if FP is not changed
+} SamplingProfilerUnwindEntry;
+
+enum
+{
+	kUnwindFrameBasedOnFP = 0x8000, //Set in FrameSize if the function moves SP dynamically, so the frame is located via FP
+	kUnwindNotPossible = 0xFFFF,
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 int SysprogsProfiler_WriteData(ProfilerDataChannel channel, const void *pHeader, unsigned headerSize, const void *pPayload, unsigned payloadSize);
+//Sends an arbitrary amount of segments as a single record with the same all-or-nothing semantics as SysprogsProfiler_WriteData().
+int SysprogsProfiler_WriteDataV(ProfilerDataChannel channel, const ProfilerDataSegment *pSegments, unsigned segmentCount);
+//Same as SysprogsProfiler_WriteData(), but waits for the debugger to free up the buffer space in the fast semihosting blocking mode 1 (see
+//FAST_SEMIHOSTING_WAIT_STRATEGY). Returns 0 if the data was discarded anyway, e.g. because the space is held by the code the caller has interrupted.
+int SysprogsProfiler_WriteDataBlocking(ProfilerDataChannel channel, const void *pHeader, unsigned headerSize, const void *pPayload, unsigned payloadSize);
 int SysprogsProfiler_GetBufferAvailability(unsigned exp); //Returns (1 << exp) if the buffer is fully available, 0 if fully used, -1 if not supported
+int SysprogsProfiler_GetReportedCoreCount(); //Returns the amount of cores whose data reaches the debugger via separate buffers (1 if all cores share one)
 
 //! Returns the amount of profiler clock ticks passed since the last call to this function.
 unsigned SysprogsInstrumentingProfiler_QueryAndResetPerformanceCounter();
@@ -29,6 +71,10 @@ unsigned SysprogsInstrumentingProfiler_QueryAndResetPerformanceCounter();
 void SysprogsProfiler_RTOSThreadSwitched(void *newThread, const char *pThreadName, void *pStackLimit);
 void SysprogsProfiler_RTOSThreadDeleted(void *thread);
 
+//Called by the 2 functions above if SamplingProfiler.cpp is linked. It implements them if SAMPLING_PROFILER_THREAD_TAGS is enabled, otherwise they do nothing.
+void SysprogsProfiler_SamplingThreadSwitched(void *newThread, const char *pThreadName);
+void SysprogsProfiler_SamplingThreadDeleted(void *thread);
+
 void SysprogsProfiler_ReportResourceTaken(void *pResource, void *pOwner, unsigned optional24BitTag);
 void SysprogsProfiler_ReportResourceReleased(void *pResource, void *pOwner, unsigned optional24BitTag);
 
@@ -4,6 +4,17 @@
 #include "SysprogsProfilerInterface.h"
 #include <string.h>
 
+#if defined(SYSPROGS_PROFILER_HOST_SIMULATION)
+//The simulated debugger runs in the same 64-bit process, so the pointers are passed to it as 32-bit tokens.
+extern "C" unsigned SysprogsHostSimulator_MapAddress(const volatile void *p);
+#define TRM_TARGET_ADDRESS(p) SysprogsHostSimulator_MapAddress(p)
+#else
+#define TRM_TARGET_ADDRESS(p) ((unsigned)(p))
+#endif
+
+//Handles are assigned by the host and always fit into 32 bits.
+#define TRM_HANDLE_VALUE(h) ((unsigned)(uintptr_t)(h))
+
 static volatile bool s_BlockingFastSemihostingInitialized;
 
 enum NonBlockingResourceRequest
@@ -47,7 +58,7 @@ static void RunBlockingFastSemihostingCall(BlockingResourceRequest request, unsi
 {
 	if (!s_BlockingFastSemihostingInitialized)
 	{
-		unsigned request[3] = {nbrrInitialize, (unsigned)&s_BlockingFastSemihostingInitialized, (unsigned)&s_FastSemihostingStateExtension};
+		unsigned request[3] = {nbrrInitialize, TRM_TARGET_ADDRESS(&s_BlockingFastSemihostingInitialized), TRM_TARGET_ADDRESS(&s_FastSemihostingStateExtension)};
 
 		SysprogsProfiler_WriteData(pdcResourceManagementStream, request, sizeof(request), 0, 0);
 
@@ -72,65 +83,65 @@ uint64_t TRMGetHostSystemTime()
 
 TRMFileHandle TRMCreateFile(const char *pFileName, SemihostingFileMode mode)
 {
-	RunBlockingFastSemihostingCall(brrCreateFile, (unsigned)pFileName, strlen(pFileName), mode);
-	return (TRMFileHandle)s_FastSemihostingStateExtension.Arguments[0];
+	RunBlockingFastSemihostingCall(brrCreateFile, TRM_TARGET_ADDRESS(pFileName), strlen(pFileName), mode);
+	return (TRMFileHandle)(uintptr_t)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 void TRMCloseFile(TRMFileHandle hFile)
 {
-	RunBlockingFastSemihostingCall(brrCloseFile, (unsigned)hFile);
+	RunBlockingFastSemihostingCall(brrCloseFile, TRM_HANDLE_VALUE(hFile));
 }
 
 ssize_t TRMReadFile(TRMFileHandle hFile, void *pBuffer, size_t size)
 {
-	RunBlockingFastSemihostingCall(brrReadFile, (unsigned)hFile, (unsigned)pBuffer, size);
-	return s_FastSemihostingStateExtension.Arguments[0];
+	RunBlockingFastSemihostingCall(brrReadFile, TRM_HANDLE_VALUE(hFile), TRM_TARGET_ADDRESS(pBuffer), size);
+	return (int)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 ssize_t TRMWriteFile(TRMFileHandle hFile, const void *pBuffer, size_t size)
 {
-	RunBlockingFastSemihostingCall(brrWriteFile, (unsigned)hFile, (unsigned)pBuffer, size);
-	return s_FastSemihostingStateExtension.Arguments[0];
+	RunBlockingFastSemihostingCall(brrWriteFile, TRM_HANDLE_VALUE(hFile), TRM_TARGET_ADDRESS(pBuffer), size);
+	return (int)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 ssize_t TRMReadStdin(void *pBuffer, size_t size, int blocking)
 {
-	RunBlockingFastSemihostingCall(brrReadStdin, blocking, (unsigned)pBuffer, size);
-	return s_FastSemihostingStateExtension.Arguments[0];
+	RunBlockingFastSemihostingCall(brrReadStdin, blocking, TRM_TARGET_ADDRESS(pBuffer), size);
+	return (int)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 uint64_t TRMGetFileSize(TRMFileHandle hFile)
 {
-	RunBlockingFastSemihostingCall(brrGetFileSize, (unsigned)hFile);
+	RunBlockingFastSemihostingCall(brrGetFileSize, TRM_HANDLE_VALUE(hFile));
 	return ((uint64_t)s_FastSemihostingStateExtension.Arguments[1] << 32) | s_FastSemihostingStateExtension.Arguments[0];
 }
 
 uint64_t TRMSeekFile(TRMFileHandle hFile, int mode /* SEEK_SET/SEEK_CUR/SEEK_END*/, int64_t distance)
 {
-	RunBlockingFastSemihostingCall(brrSeekFile, (unsigned)hFile, mode, (unsigned)&distance);
+	RunBlockingFastSemihostingCall(brrSeekFile, TRM_HANDLE_VALUE(hFile), mode, TRM_TARGET_ADDRESS(&distance));
 	return ((uint64_t)s_FastSemihostingStateExtension.Arguments[1] << 32) | s_FastSemihostingStateExtension.Arguments[0];
 }
 
 void TRMTruncateFile(TRMFileHandle hFile)
 {
-	RunBlockingFastSemihostingCall(brrTruncateFile, (unsigned)hFile);
+	RunBlockingFastSemihostingCall(brrTruncateFile, TRM_HANDLE_VALUE(hFile));
 }
 
 TRMErrorCode TRMDeleteFile(const char *pFileName)
 {
-	RunBlockingFastSemihostingCall(brrDeleteFile, (unsigned)pFileName, strlen(pFileName));
+	RunBlockingFastSemihostingCall(brrDeleteFile, TRM_TARGET_ADDRESS(pFileName), strlen(pFileName));
 	return (TRMErrorCode)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 TRMErrorCode TRMCreateDirectory(const char *pDirName)
 {
-	RunBlockingFastSemihostingCall(brrCreateDirectory, (unsigned)pDirName, strlen(pDirName));
+	RunBlockingFastSemihostingCall(brrCreateDirectory, TRM_TARGET_ADDRESS(pDirName), strlen(pDirName));
 	return (TRMErrorCode)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 TRMErrorCode TRMDeleteDirectory(const char *pDirName, int recursively)
 {
-	RunBlockingFastSemihostingCall(brrDeleteDirectory, (unsigned)pDirName, strlen(pDirName), recursively);
+	RunBlockingFastSemihostingCall(brrDeleteDirectory, TRM_TARGET_ADDRESS(pDirName), strlen(pDirName), recursively);
 	return (TRMErrorCode)s_FastSemihostingStateExtension.Arguments[0];
 }
 
@@ -143,7 +154,7 @@ struct ReadBurstWorkArea
 
 TRMReadBurstHandle TRMBeginReadBurst(TRMFileHandle hFile, void *pWorkArea, size_t workAreaSize)
 {
-	int frontPadding = (unsigned)pWorkArea % sizeof(void *);
+	int frontPadding = (uintptr_t)pWorkArea % sizeof(void *);
 	if (frontPadding)
 		frontPadding = sizeof(void *) - frontPadding;
 
@@ -155,7 +166,7 @@ TRMReadBurstHandle TRMBeginReadBurst(TRMFileHandle hFile, void *pWorkArea, size_
 	pWorkAreaStructure->WriteOffsetWithFlags = 0;
 	pWorkAreaStructure->BufferSize = workAreaSize - frontPadding - sizeof(ReadBurstWorkArea);
 
-	RunBlockingFastSemihostingCall(brrBeginCachedRead, (unsigned)hFile, (unsigned)pWorkAreaStructure);
+	RunBlockingFastSemihostingCall(brrBeginCachedRead, TRM_HANDLE_VALUE(hFile), TRM_TARGET_ADDRESS(pWorkAreaStructure));
 	if (s_FastSemihostingStateExtension.Arguments[0])
 		return 0; //Unknown error on the host side.
 	else
@@ -164,7 +175,7 @@ TRMReadBurstHandle TRMBeginReadBurst(TRMFileHandle hFile, void *pWorkArea, size_
 
 TRMErrorCode TRMEndReadBurst(TRMReadBurstHandle hBurst)
 {
-	RunBlockingFastSemihostingCall(brrEndCachedRead, (unsigned)hBurst);
+	RunBlockingFastSemihostingCall(brrEndCachedRead, TRM_TARGET_ADDRESS(hBurst));
 	return (TRMErrorCode)s_FastSemihostingStateExtension.Arguments[0];
 }
 
@@ -273,19 +284,25 @@ ssize_t TRMReadFileCached(TRMReadBurstHandle hBurst, void *pBuffer, size_t size,
 
 TRMWriteBurstHandle TRMBeginWriteBurst(TRMFileHandle hFile)
 {
-	RunBlockingFastSemihostingCall(brrBeginCachedWrite, (unsigned)hFile);
-	return (TRMWriteBurstHandle)s_FastSemihostingStateExtension.Arguments[0];
+	RunBlockingFastSemihostingCall(brrBeginCachedWrite, TRM_HANDLE_VALUE(hFile));
+	return (TRMWriteBurstHandle)(uintptr_t)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 TRMErrorCode TRMEndWriteBurst(TRMWriteBurstHandle hBurst)
 {
-	RunBlockingFastSemihostingCall(brrEndCachedWrite, (unsigned)hBurst);
+	RunBlockingFastSemihostingCall(brrEndCachedWrite, TRM_HANDLE_VALUE(hBurst));
 	return (TRMErrorCode)s_FastSemihostingStateExtension.Arguments[0];
 }
 
 ssize_t TRMWriteFileCached(TRMWriteBurstHandle hBurst, const void *pData, size_t size)
 {
-	unsigned request[3] = {nbrrProcessWriteBurstData, (unsigned)hBurst, size};
+	unsigned request[3] = {nbrrProcessWriteBurstData, TRM_HANDLE_VALUE(hBurst), (unsigned)size};
+
+	//Try sending the request and the data as one record first. If it does not fit into the buffer now, fall back to blocking writes.
+	ProfilerDataSegment segments[] = {{request, sizeof(request)}, {pData, (unsigned)size}};
+	if (SysprogsProfiler_WriteDataV(pdcResourceManagementStream, segments, 2))
+		return size;
+
 	if (WriteToFastSemihostingChannel(pdcResourceManagementStream, &request, sizeof(request), 1) != sizeof(request))
 		return 0;
 